@@ -0,0 +1,53 @@
+#include <cerrno>
+#include <atomic>
+#include <unistd.h>
+
+#include "atomic_file.h"
+
+namespace pn {
+
+namespace {
+
+std::atomic<uint32_t> temporary_counter(0);
+
+//Exclusive, so a file left by a crashed process that had the same pid is never written into
+FILE* open_temporary(const std::string& path, std::string& temporary) {
+    for(uint32_t attempt = 0; attempt < 100; ++attempt) {
+        temporary = path + "." + std::to_string(getpid()) + "-" + std::to_string(temporary_counter++) + ".tmp";
+
+        FILE* file = fopen(temporary.c_str(), "wbx");
+        if(file || errno != EEXIST) {
+            return file;
+        }
+    }
+    return nullptr;
+}
+
+}
+
+bool write_file_atomically(const std::string& path, const std::vector<uint8_t>& data) {
+    return write_file_atomically(path, [&](FILE* file) {
+        return fwrite(data.data(), 1, data.size(), file) == data.size();
+    });
+}
+
+bool write_file_atomically(const std::string& path, const std::function<bool (FILE*)>& write) {
+    std::string temporary;
+    FILE* file = open_temporary(path, temporary);
+    if(!file) {
+        return false;
+    }
+
+    bool written = write(file);
+    written = (fflush(file) == 0) && written;
+    written = (fsync(fileno(file)) == 0) && written; //The rename mustn't reach the disk before the data
+    written = (fclose(file) == 0) && written;
+
+    if(!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+}
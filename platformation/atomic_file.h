@@ -0,0 +1,30 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace pn {
+
+/*
+    Writes a file in full or not at all. The data goes to a temporary file
+    beside it, named for this process and this call so that threads and
+    other editors writing the same path never share one. It's flushed to
+    the disk and checked closed before being renamed over the original, so
+    a crash leaves either the old file or the new one, and anything that
+    had the old one open or mapped keeps its contents.
+
+    Returns false, with no temporary file left behind, if any step fails.
+    Callers decide whether that's worth a warning or an exception.
+*/
+bool write_file_atomically(const std::string& path, const std::vector<uint8_t>& data);
+
+//For data in several pieces, write returns false if any of it couldn't be written
+bool write_file_atomically(const std::string& path, const std::function<bool (FILE*)>& write);
+
+}
+
+#endif // ATOMIC_FILE_H
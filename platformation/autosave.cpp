@@ -0,0 +1,449 @@
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "kazbase/os/path.h"
+#include "kazbase/string.h"
+
+#include "autosave.h"
+#include "mapped_file.h"
+#include "layer.h"
+#include "level_file.h"
+#include "binary_io.h"
+#include "atomic_file.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+void compress_block(const std::vector<uint8_t>& raw, std::vector<uint8_t>& out) {
+    uLongf length = compressBound(raw.size());
+    out.resize(length);
+
+    //Fastest level, the data is mostly runs and the point is to stay out of the way
+    if(compress2(out.data(), &length, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+        throw LevelFileError("Unable to compress autosave data");
+    }
+    out.resize(length);
+}
+
+void decompress_block(const uint8_t* data, uint32_t length, std::vector<uint8_t>& raw) {
+    uLongf raw_length = raw.size();
+    if(uncompress(raw.data(), &raw_length, data, length) != Z_OK || raw_length != raw.size()) {
+        throw LevelFileError("Autosave chunk data is corrupt");
+    }
+}
+
+//Reads the next block, returning false for an empty one
+bool read_block(BinaryReader& reader, const std::vector<uint8_t>& data, std::vector<uint8_t>& raw) {
+    uint32_t length = reader.u32();
+    if(!length) {
+        return false;
+    }
+
+    size_t at = reader.position();
+    reader.seek(at + length);
+    decompress_block(data.data() + at, length, raw);
+    return true;
+}
+
+}
+
+LevelSnapshot::ptr LevelSnapshot::take(Level& level, const LevelSnapshot::ptr& previous) {
+    PN_PROFILE_SCOPE("LevelSnapshot::take");
+
+    LevelSnapshot::ptr snapshot(new LevelSnapshot());
+    snapshot->name = level.name();
+    snapshot->width = level.horizontal_tile_count();
+    snapshot->height = level.vertical_tile_count();
+
+    Palette& palette = level.palette();
+    snapshot->palette.reserve(palette.size());
+    for(uint32_t i = 0; i < palette.size(); ++i) {
+        snapshot->palette.push_back(palette.path_for_id(i));
+    }
+
+    std::vector<uint32_t> changed;
+
+    snapshot->layers.resize(level.layer_count());
+    for(uint32_t l = 0; l < level.layer_count(); ++l) {
+        Layer& layer = level.layer_at(l);
+        LayerCells& cells = snapshot->layers[l];
+
+        cells.source = &layer;
+        cells.name = layer.name();
+        cells.width = layer.width();
+        cells.height = layer.height();
+        cells.origin_x = layer.origin_x();
+        cells.origin_y = layer.origin_y();
+        cells.chunks_across = layer.chunks_across();
+        cells.chunks_down = layer.chunks_down();
+
+        //Layers can be added, removed or reordered between snapshots
+        const SnapshotPages<ChunkCells>* previous_chunks = nullptr;
+        for(uint32_t p = 0; previous && p < previous->layers.size(); ++p) {
+            if(previous->layers[p].source == &layer) {
+                previous_chunks = &previous->layers[p].chunks;
+            }
+        }
+
+        bool all = layer.take_cell_changes(changed);
+        cells.chunks.update(previous_chunks, all, changed, cells.chunks_across * cells.chunks_down, [&](uint32_t chunk_idx) {
+            return layer.chunk(chunk_idx % cells.chunks_across, chunk_idx / cells.chunks_across).cells;
+        });
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    MetadataCells& flags = snapshot->metadata;
+    flags.origin_x = metadata.origin_x();
+    flags.origin_y = metadata.origin_y();
+    flags.chunks_across = metadata.chunks_across();
+    flags.chunks_down = metadata.chunks_down();
+
+    bool all = metadata.take_flag_changes(changed);
+    flags.chunks.update(previous ? &previous->metadata.chunks : nullptr, all, changed, flags.chunks_across * flags.chunks_down, [&](uint32_t chunk_idx) {
+        return metadata.chunk(chunk_idx % flags.chunks_across, chunk_idx / flags.chunks_across);
+    });
+
+    return snapshot;
+}
+
+Autosaver::Autosaver(const std::string& path):
+    path_(path),
+    busy_(false),
+    stop_(false) {
+
+    thread_ = std::thread(&Autosaver::run, this);
+}
+
+Autosaver::~Autosaver() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+}
+
+void Autosaver::save(Level& level) {
+    last_snapshot_ = LevelSnapshot::take(level, last_snapshot_);
+    save(last_snapshot_);
+}
+
+void Autosaver::save(LevelSnapshot::ptr snapshot) {
+    {
+        //If the last save is still going, this replaces any snapshot waiting behind it
+        std::lock_guard<std::mutex> guard(lock_);
+        pending_ = snapshot;
+    }
+    condition_.notify_all();
+}
+
+void Autosaver::wait() {
+    std::unique_lock<std::mutex> guard(lock_);
+    condition_.wait(guard, [=]() { return !pending_ && !busy_; });
+}
+
+AutosaveResult Autosaver::last_result() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return result_;
+}
+
+void Autosaver::run() {
+    std::unique_lock<std::mutex> guard(lock_);
+
+    while(true) {
+        condition_.wait(guard, [=]() { return pending_ || stop_; });
+        if(!pending_) {
+            return;
+        }
+
+        LevelSnapshot::ptr snapshot = pending_;
+        pending_.reset();
+        busy_ = true;
+        guard.unlock();
+
+        AutosaveResult result;
+        try {
+            write_snapshot(*snapshot, result);
+        } catch(LevelFileError& e) {
+            result.ok = false;
+            result.error = e.what();
+        }
+
+        //Released outside the lock, it can be a lot of chunks
+        snapshot.reset();
+
+        guard.lock();
+        result.saves = result_.saves + 1;
+        result_ = result;
+        busy_ = false;
+        condition_.notify_all();
+    }
+}
+
+const std::vector<uint8_t>& Autosaver::encoded(const std::tr1::shared_ptr<const void>& data,
+    std::function<void (std::vector<uint8_t>&)> raw_cells, ChunkCache& cache, AutosaveResult& result) {
+
+    //Chunks are copy on write, so the same pointer means the same cells as last time
+    ChunkCache::iterator it = cache.find(data.get());
+    if(it != cache.end()) {
+        result.chunks_reused++;
+        return it->second.block;
+    }
+
+    it = cache_.find(data.get());
+    if(it != cache_.end()) {
+        result.chunks_reused++;
+        return (cache[data.get()] = it->second).block;
+    }
+
+    EncodedChunk& entry = cache[data.get()];
+    entry.data = data;
+
+    std::vector<uint8_t> raw;
+    raw_cells(raw);
+    compress_block(raw, entry.block);
+
+    result.chunks_encoded++;
+    return entry.block;
+}
+
+void Autosaver::write_snapshot(const LevelSnapshot& snapshot, AutosaveResult& result) {
+    PN_PROFILE_SCOPE("Autosaver::write_snapshot");
+
+    auto start = std::chrono::steady_clock::now();
+
+    //Anything not used by this save is dropped from the cache, releasing those chunks
+    ChunkCache cache;
+
+    std::vector<uint8_t> file;
+    BinaryWriter writer(file);
+
+    writer.magic("PNAS");
+    writer.u32(AUTOSAVE_FILE_VERSION);
+    writer.string(snapshot.name);
+    writer.u32(snapshot.width);
+    writer.u32(snapshot.height);
+
+    writer.u32(snapshot.palette.size());
+    for(const std::string& path: snapshot.palette) {
+        writer.string(path);
+    }
+
+    writer.u32(snapshot.layers.size());
+    for(const LevelSnapshot::LayerCells& layer: snapshot.layers) {
+        writer.string(layer.name);
+        writer.u32(layer.width);
+        writer.u32(layer.height);
+        writer.u32(layer.origin_x);
+        writer.u32(layer.origin_y);
+        writer.u32(layer.chunks_across);
+        writer.u32(layer.chunks_down);
+
+        for(uint32_t c = 0; c < layer.chunks.size(); ++c) {
+            const ChunkCells::ptr& cells = layer.chunks[c];
+            if(cells == ChunkCells::blank()) {
+                writer.u32(0);
+                continue;
+            }
+
+            const std::vector<uint8_t>& block = encoded(cells, [&](std::vector<uint8_t>& raw) {
+                BinaryWriter cell_writer(raw);
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    cell_writer.i32(cells->tiles[i]);
+                }
+            }, cache, result);
+
+            writer.u32(block.size());
+            writer.bytes(block.data(), block.size());
+        }
+    }
+
+    const LevelSnapshot::MetadataCells& metadata = snapshot.metadata;
+    writer.u32(metadata.origin_x);
+    writer.u32(metadata.origin_y);
+    writer.u32(metadata.chunks_across);
+    writer.u32(metadata.chunks_down);
+
+    for(uint32_t c = 0; c < metadata.chunks.size(); ++c) {
+        const MetadataChunk::ptr& chunk = metadata.chunks[c];
+        bool empty = true;
+        for(uint32_t i = 0; empty && i < MAX_METADATA_FLAGS; ++i) {
+            empty = chunk->flags[i].none();
+        }
+
+        if(empty) {
+            writer.u32(0);
+            continue;
+        }
+
+        const std::vector<uint8_t>& block = encoded(chunk, [&](std::vector<uint8_t>& raw) {
+            raw.resize(CHUNK_AREA);
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                raw[i] = chunk->flags_at(i);
+            }
+        }, cache, result);
+
+        writer.u32(block.size());
+        writer.bytes(block.data(), block.size());
+    }
+
+    cache_.swap(cache);
+
+    //Edits that were undone, or a save with nothing new, leave the file alone
+    if(file != last_file_) {
+        if(!write_file_atomically(path_, file)) {
+            throw LevelFileError("Unable to write " + path_);
+        }
+        last_file_.swap(file);
+    }
+
+    result.bytes = last_file_.size();
+    result.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+Level::ptr load_autosave(const std::string& path) {
+    PN_PROFILE_SCOPE("load_autosave");
+
+    std::ifstream filein(path.c_str(), std::ios::binary);
+    if(!filein) {
+        throw LevelFileError("Unable to open " + path);
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(filein)), std::istreambuf_iterator<char>());
+    BinaryReader reader(data.data(), data.size());
+
+    try {
+        if(!reader.magic("PNAS")) {
+            throw LevelFileError("Not a Platformation autosave");
+        }
+
+        if(reader.u32() > AUTOSAVE_FILE_VERSION) {
+            throw LevelFileError("Autosave is from a newer version of Platformation");
+        }
+
+        std::string name = reader.string();
+        uint32_t width = reader.u32();
+        uint32_t height = reader.u32();
+        if(!width || !height || width > (1 << 16) || height > (1 << 16)) {
+            throw LevelFileError("Autosave dimensions are out of range");
+        }
+
+        Level::ptr level(new Level(width, height));
+        level->set_name(name);
+
+        uint32_t palette_count = reader.u32();
+        for(uint32_t i = 0; i < palette_count; ++i) {
+            level->palette().id_for_path(reader.string());
+        }
+
+        std::vector<uint8_t> raw(CHUNK_AREA * sizeof(int32_t));
+
+        uint32_t layer_count = reader.u32();
+        for(uint32_t l = 0; l < layer_count; ++l) {
+            if(l >= level->layer_count()) {
+                level->add_layer();
+            }
+
+            Layer& layer = level->layer_at(l);
+            layer.set_name(reader.string());
+
+            reader.u32(); //Width and height match the level's
+            reader.u32();
+            uint32_t origin_x = reader.u32();
+            uint32_t origin_y = reader.u32();
+            uint32_t chunks_across = reader.u32();
+            uint32_t chunks_down = reader.u32();
+
+            for(uint32_t c = 0; c < chunks_across * chunks_down; ++c) {
+                if(!read_block(reader, data, raw)) {
+                    continue;
+                }
+
+                BinaryReader cells(raw.data(), raw.size());
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    int32_t tile = cells.i32();
+                    uint32_t x = ((c % chunks_across) * CHUNK_SIZE) + (i % CHUNK_SIZE) - origin_x;
+                    uint32_t y = ((c / chunks_across) * CHUNK_SIZE) + (i / CHUNK_SIZE) - origin_y;
+                    if(tile >= 0 && x < width && y < height) {
+                        layer.set_tile(x, y, tile);
+                    }
+                }
+            }
+        }
+
+        MetadataLayer& metadata = level->metadata();
+        uint32_t origin_x = reader.u32();
+        uint32_t origin_y = reader.u32();
+        uint32_t chunks_across = reader.u32();
+        uint32_t chunks_down = reader.u32();
+
+        raw.resize(CHUNK_AREA);
+        for(uint32_t c = 0; c < chunks_across * chunks_down; ++c) {
+            if(!read_block(reader, data, raw)) {
+                continue;
+            }
+
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                uint32_t x = ((c % chunks_across) * CHUNK_SIZE) + (i % CHUNK_SIZE) - origin_x;
+                uint32_t y = ((c / chunks_across) * CHUNK_SIZE) + (i / CHUNK_SIZE) - origin_y;
+                if(raw[i] && x < width && y < height) {
+                    metadata.set_flags(x, y, raw[i]);
+                }
+            }
+        }
+
+        return level;
+    } catch(std::out_of_range& e) {
+        throw LevelFileError("Autosave is truncated");
+    }
+}
+
+std::string autosave_path(const std::string& directory) {
+    return os::path::join(directory, std::to_string(getpid()) + ".pnas");
+}
+
+std::string claim_orphaned_autosave(const std::string& directory) {
+    if(!os::path::exists(directory)) {
+        return std::string();
+    }
+
+    std::string claimed = autosave_path(directory);
+
+    std::vector<std::pair<uint64_t, std::string> > orphans;
+    for(std::string file: os::path::list_dir(directory)) {
+        if(!str::ends_with(file, ".pnas")) {
+            continue;
+        }
+
+        pid_t pid = pid_t(strtol(file.c_str(), nullptr, 10));
+        std::string path = os::path::join(directory, file);
+
+        //A file with our own pid was left by an earlier process that had it
+        bool running = pid > 0 && pid != getpid() && (kill(pid, 0) == 0 || errno == EPERM);
+        uint64_t size, modified;
+        if(!running && file_signature(path, size, modified)) {
+            orphans.push_back(std::make_pair(modified, path));
+        }
+    }
+
+    //Newest first. Losing the race for one just moves on to the next
+    std::sort(orphans.rbegin(), orphans.rend());
+    for(const std::pair<uint64_t, std::string>& orphan: orphans) {
+        if(orphan.second == claimed || rename(orphan.second.c_str(), claimed.c_str()) == 0) {
+            return claimed;
+        }
+    }
+    return std::string();
+}
+
+}
@@ -0,0 +1,224 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <tr1/memory>
+
+#include "level.h"
+#include "chunk.h"
+#include "metadata_layer.h"
+
+namespace pn {
+
+class Layer;
+
+const uint32_t AUTOSAVE_FILE_VERSION = 1;
+
+const uint32_t SNAPSHOT_PAGE_SIZE = 64; //Chunk pointers per page
+
+/*
+    A chunk grid's pointers split into fixed size pages, so a snapshot can
+    share every page that nothing has touched with the snapshot before it.
+*/
+template<typename T>
+class SnapshotPages {
+public:
+    typedef std::tr1::shared_ptr<T> chunk_ptr;
+
+    SnapshotPages():
+        size_(0) {}
+
+    uint32_t size() const { return size_; }
+
+    const chunk_ptr& operator[](uint32_t chunk_idx) const {
+        return (*pages_[chunk_idx / SNAPSHOT_PAGE_SIZE])[chunk_idx % SNAPSHOT_PAGE_SIZE];
+    }
+
+    //Calls lookup(chunk_idx) for the changed chunks, or for all of them without a usable previous snapshot
+    template<typename Lookup>
+    void update(const SnapshotPages* previous, bool all, const std::vector<uint32_t>& changed, uint32_t size, Lookup lookup) {
+        size_ = size;
+
+        if(all || !previous || previous->size_ != size) {
+            pages_.clear();
+            for(uint32_t first = 0; first < size; first += SNAPSHOT_PAGE_SIZE) {
+                std::tr1::shared_ptr<Page> page(new Page());
+                for(uint32_t i = first; i < std::min(size, first + SNAPSHOT_PAGE_SIZE); ++i) {
+                    page->push_back(lookup(i));
+                }
+                pages_.push_back(page);
+            }
+            return;
+        }
+
+        pages_ = previous->pages_;
+
+        for(uint32_t chunk_idx: changed) {
+            std::tr1::shared_ptr<Page>& page = pages_[chunk_idx / SNAPSHOT_PAGE_SIZE];
+            if(page == previous->pages_[chunk_idx / SNAPSHOT_PAGE_SIZE]) {
+                page.reset(new Page(*page));
+            }
+            (*page)[chunk_idx % SNAPSHOT_PAGE_SIZE] = lookup(chunk_idx);
+        }
+    }
+
+private:
+    typedef std::vector<chunk_ptr> Page;
+
+    uint32_t size_;
+    std::vector<std::tr1::shared_ptr<Page> > pages_;
+};
+
+/*
+    A frozen copy of a level for saving off the main thread. Chunks are
+    shared copy on write with the level, so the next edit to a chunk clones
+    it rather than changing the snapshot. Given the previous snapshot,
+    only the chunks changed since then are looked at, which keeps taking
+    one well under a millisecond however big the level is.
+*/
+struct LevelSnapshot {
+    typedef std::tr1::shared_ptr<LevelSnapshot> ptr;
+
+    struct LayerCells {
+        const Layer* source; //Only for matching layers up with the previous snapshot
+        std::string name;
+        uint32_t width;
+        uint32_t height;
+        uint32_t origin_x;
+        uint32_t origin_y;
+        uint32_t chunks_across;
+        uint32_t chunks_down;
+        SnapshotPages<ChunkCells> chunks;
+    };
+
+    struct MetadataCells {
+        uint32_t origin_x;
+        uint32_t origin_y;
+        uint32_t chunks_across;
+        uint32_t chunks_down;
+        SnapshotPages<MetadataChunk> chunks;
+    };
+
+    /*
+        Takes the level's changed chunk lists, so previous must be the last
+        snapshot taken of this level (or null for a full one).
+    */
+    static LevelSnapshot::ptr take(Level& level, const LevelSnapshot::ptr& previous=LevelSnapshot::ptr());
+
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    std::vector<std::string> palette;
+    std::vector<LayerCells> layers;
+    MetadataCells metadata;
+};
+
+struct AutosaveResult {
+    AutosaveResult():
+        saves(0),
+        ok(true),
+        chunks_encoded(0),
+        chunks_reused(0),
+        bytes(0),
+        elapsed_ms(0) {}
+
+    uint32_t saves; //Bumped after every attempt, so callers can spot a new result
+    bool ok;
+    std::string error;
+    uint32_t chunks_encoded;
+    uint32_t chunks_reused;
+    uint64_t bytes;
+    double elapsed_ms;
+};
+
+/*
+    Writes snapshots to a file on a background thread. Each chunk is
+    compressed on its own and kept, so a save only compresses the chunks
+    whose data changed since the last one (spotted by the shared pointer
+    having changed) and skips the write entirely if nothing did. Files
+    are written to a temporary name and renamed over the old one, so a
+    crash mid save leaves the previous autosave intact.
+
+    Layout (little endian): "PNAS", u32 version, string name, u32 width,
+    u32 height, u32 palette count + strings, u32 layer count, per layer
+    string name + u32 width, height, origin x/y, chunks across/down and a
+    block per chunk, then the metadata's u32 origin x/y, chunks across/down
+    and blocks. A block is u32 length + zlib data of the chunk's cells
+    (i32 tiles or u8 flags), and an empty block is a blank chunk.
+*/
+class Autosaver {
+public:
+    Autosaver(const std::string& path);
+    ~Autosaver(); //Finishes any save in progress
+
+    std::string path() const { return path_; }
+
+    //Takes the snapshot on the calling thread and returns straight away
+    void save(Level& level);
+    void save(LevelSnapshot::ptr snapshot);
+
+    //Blocks until queued saves are written
+    void wait();
+
+    AutosaveResult last_result();
+
+private:
+    struct EncodedChunk {
+        std::tr1::shared_ptr<const void> data; //Holds the chunk so its address can't be reused
+        std::vector<uint8_t> block;
+    };
+
+    typedef std::map<const void*, EncodedChunk> ChunkCache;
+
+    std::string path_;
+    LevelSnapshot::ptr last_snapshot_; //Only touched by the thread calling save()
+
+    std::thread thread_;
+    std::mutex lock_;
+    std::condition_variable condition_;
+    LevelSnapshot::ptr pending_;
+    bool busy_;
+    bool stop_;
+    AutosaveResult result_;
+
+    //Only touched by the save thread
+    ChunkCache cache_;
+    std::vector<uint8_t> last_file_;
+
+    void run();
+    void write_snapshot(const LevelSnapshot& snapshot, AutosaveResult& result);
+
+    //Compresses what raw_cells() fills in, unless the last save already did for this data
+    const std::vector<uint8_t>& encoded(const std::tr1::shared_ptr<const void>& data,
+        std::function<void (std::vector<uint8_t>&)> raw_cells, ChunkCache& cache, AutosaveResult& result);
+};
+
+//Throws LevelFileError if the autosave can't be read
+Level::ptr load_autosave(const std::string& path);
+
+/*
+    Every editor autosaves to its own file in the autosave directory, named
+    for its process id, so editors running side by side never write over
+    each other's autosave.
+*/
+std::string autosave_path(const std::string& directory);
+
+/*
+    Finds the newest autosave left behind by an editor that's no longer
+    running and renames it to this editor's autosave_path(), so two editors
+    starting together can't both recover it. Returns the new path, or an
+    empty string if there's nothing to recover.
+*/
+std::string claim_orphaned_autosave(const std::string& directory);
+
+}
+
+#endif // AUTOSAVE_H
@@ -0,0 +1,253 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "kazbase/json/json.h"
+#include "kazbase/file_utils.h"
+#include "kazbase/os/path.h"
+#include "kazbase/logging/logging.h"
+
+#include "autotile.h"
+#include "layer.h"
+#include "palette.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+const uint32_t CHUNK_KEY_SHIFT = 16;
+
+uint32_t chunk_key(uint32_t x, uint32_t y) {
+    return ((y / CHUNK_SIZE) << CHUNK_KEY_SHIFT) | (x / CHUNK_SIZE);
+}
+
+}
+
+int32_t Autotiler::add_terrain(const Terrain& terrain) {
+    int32_t idx = terrains_.size();
+    terrains_.push_back(terrain);
+
+    std::vector<int32_t> tiles(terrain.tile_for_mask);
+    tiles.push_back(terrain.default_tile);
+
+    for(int32_t tile: tiles) {
+        if(tile < 0) {
+            continue;
+        }
+
+        if(uint32_t(tile) >= terrain_for_tile_.size()) {
+            terrain_for_tile_.resize(tile + 1, -1);
+        }
+        terrain_for_tile_[tile] = idx;
+    }
+
+    return idx;
+}
+
+void Autotiler::clear() {
+    terrains_.clear();
+    terrain_for_tile_.clear();
+}
+
+bool Autotiler::load_rules(const std::string& path, Palette& palette, const std::string& tile_directory) {
+    if(!os::path::exists(path)) {
+        return false;
+    }
+
+    json::JSON j = json::loads(file_utils::read_contents(path));
+    if(!j.has_key("terrains")) {
+        L_INFO("No terrains defined in " + path);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < j["terrains"].length(); ++i) {
+        json::Node& node = j["terrains"][i];
+
+        Terrain terrain;
+        terrain.name = node["name"].get();
+        if(node.has_key("neighbours")) {
+            terrain.neighbours = (atoi(node["neighbours"].get().c_str()) == 8) ? 8 : 4;
+        }
+
+        if(node.has_key("default")) {
+            terrain.default_tile = palette.id_for_path(os::path::join(tile_directory, node["default"].get()));
+        }
+
+        if(node.has_key("rules")) {
+            for(uint32_t r = 0; r < node["rules"].length(); ++r) {
+                json::Node& rule = node["rules"][r];
+                uint32_t mask = uint32_t(atoi(rule["mask"].get().c_str()));
+                if(mask >= NEIGHBOUR_MASK_COUNT) {
+                    L_INFO("Ignoring out of range autotile mask in " + path);
+                    continue;
+                }
+
+                terrain.tile_for_mask[mask] = palette.id_for_path(os::path::join(tile_directory, rule["tile"].get()));
+            }
+        }
+
+        L_DEBUG("Loaded autotile terrain: " + terrain.name);
+        add_terrain(terrain);
+    }
+
+    return true;
+}
+
+int32_t Autotiler::terrain_of(int32_t tile_image_id) const {
+    if(tile_image_id < 0 || uint32_t(tile_image_id) >= terrain_for_tile_.size()) {
+        return -1;
+    }
+    return terrain_for_tile_[tile_image_id];
+}
+
+uint32_t Autotiler::neighbour_mask(Layer& layer, uint32_t x, uint32_t y, int32_t terrain) const {
+    const int32_t offsets[8][2] = {
+        {0, 1}, {1, 0}, {0, -1}, {-1, 0},
+        {1, 1}, {1, -1}, {-1, -1}, {-1, 1}
+    };
+
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < 8; ++i) {
+        int32_t nx = int32_t(x) + offsets[i][0];
+        int32_t ny = int32_t(y) + offsets[i][1];
+
+        if(nx < 0 || ny < 0 || nx >= int32_t(layer.width()) || ny >= int32_t(layer.height())) {
+            continue;
+        }
+
+        if(terrain_of(layer.tile_image_at(nx, ny)) == terrain) {
+            mask |= (1 << i);
+        }
+    }
+
+    //Drop the corners that aren't backed by both of their edges
+    const uint32_t corner_edges[4] = {
+        NEIGHBOUR_N | NEIGHBOUR_E, NEIGHBOUR_S | NEIGHBOUR_E,
+        NEIGHBOUR_S | NEIGHBOUR_W, NEIGHBOUR_N | NEIGHBOUR_W
+    };
+
+    for(uint32_t i = 0; i < 4; ++i) {
+        if((mask & corner_edges[i]) != corner_edges[i]) {
+            mask &= ~(NEIGHBOUR_NE << i);
+        }
+    }
+
+    return mask;
+}
+
+int32_t Autotiler::resolve(int32_t terrain, uint32_t mask) const {
+    const Terrain& t = terrains_.at(terrain);
+    if(t.neighbours == 4) {
+        mask &= EDGE_NEIGHBOUR_MASK;
+    }
+
+    int32_t tile = t.tile_for_mask[mask];
+    if(tile < 0) {
+        //Tilesets often only draw the edge cases, fall back to those
+        tile = t.tile_for_mask[mask & EDGE_NEIGHBOUR_MASK];
+    }
+
+    return (tile < 0) ? t.default_tile : tile;
+}
+
+AutotileBatch::AutotileBatch(const Autotiler& autotiler, Layer& layer):
+    autotiler_(autotiler),
+    layer_(layer) {
+
+}
+
+void AutotileBatch::mark_dirty(uint32_t x, uint32_t y) {
+    dirty_[chunk_key(x, y)].set(((y % CHUNK_SIZE) * CHUNK_SIZE) + (x % CHUNK_SIZE));
+}
+
+void AutotileBatch::mark_neighbours_dirty(uint32_t x, uint32_t y) {
+    uint32_t min_x = (x > 0) ? x - 1 : 0;
+    uint32_t min_y = (y > 0) ? y - 1 : 0;
+    uint32_t max_x = std::min(x + 1, layer_.width() - 1);
+    uint32_t max_y = std::min(y + 1, layer_.height() - 1);
+
+    for(uint32_t ny = min_y; ny <= max_y; ++ny) {
+        for(uint32_t nx = min_x; nx <= max_x; ++nx) {
+            mark_dirty(nx, ny);
+        }
+    }
+}
+
+void AutotileBatch::paint(uint32_t x, uint32_t y, int32_t terrain) {
+    if(x >= layer_.width() || y >= layer_.height()) {
+        return;
+    }
+
+    int32_t tile = (terrain < 0) ? -1 : autotiler_.terrain(terrain).default_tile;
+    layer_.set_tile(x, y, tile);
+    mark_neighbours_dirty(x, y);
+}
+
+void AutotileBatch::fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t terrain) {
+    uint32_t end_x = std::min(x + width, layer_.width());
+    uint32_t end_y = std::min(y + height, layer_.height());
+    if(x >= end_x || y >= end_y) {
+        return;
+    }
+
+    int32_t tile = (terrain < 0) ? -1 : autotiler_.terrain(terrain).default_tile;
+
+    for(uint32_t cy = y; cy < end_y; ++cy) {
+        for(uint32_t cx = x; cx < end_x; ++cx) {
+            layer_.set_tile(cx, cy, tile);
+            mark_dirty(cx, cy);
+        }
+    }
+
+    //Only the border of the filled area can change cells outside of it
+    for(uint32_t cx = x; cx < end_x; ++cx) {
+        mark_neighbours_dirty(cx, y);
+        mark_neighbours_dirty(cx, end_y - 1);
+    }
+
+    for(uint32_t cy = y; cy < end_y; ++cy) {
+        mark_neighbours_dirty(x, cy);
+        mark_neighbours_dirty(end_x - 1, cy);
+    }
+}
+
+uint32_t AutotileBatch::commit() {
+    PN_PROFILE_SCOPE("AutotileBatch::commit");
+
+    uint32_t evaluated = 0;
+
+    typedef std::pair<const uint32_t, std::bitset<CHUNK_AREA> > DirtyChunk;
+    for(DirtyChunk& chunk: dirty_) {
+        uint32_t base_x = (chunk.first & ((1 << CHUNK_KEY_SHIFT) - 1)) * CHUNK_SIZE;
+        uint32_t base_y = (chunk.first >> CHUNK_KEY_SHIFT) * CHUNK_SIZE;
+
+        for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+            if(!chunk.second.test(i)) {
+                continue;
+            }
+
+            uint32_t x = base_x + (i % CHUNK_SIZE);
+            uint32_t y = base_y + (i / CHUNK_SIZE);
+            if(x >= layer_.width() || y >= layer_.height()) {
+                continue;
+            }
+
+            ++evaluated;
+
+            int32_t terrain = autotiler_.terrain_of(layer_.tile_image_at(x, y));
+            if(terrain < 0) {
+                continue;
+            }
+
+            uint32_t mask = autotiler_.neighbour_mask(layer_, x, y, terrain);
+            layer_.set_tile(x, y, autotiler_.resolve(terrain, mask));
+        }
+    }
+
+    dirty_.clear();
+    layer_.flush_render();
+
+    return evaluated;
+}
+
+}
@@ -0,0 +1,100 @@
+#ifndef AUTOTILE_H
+#define AUTOTILE_H
+
+#include <string>
+#include <vector>
+#include <bitset>
+#include <tr1/unordered_map>
+
+#include "chunk.h"
+
+namespace pn {
+
+class Layer;
+class Palette;
+
+/*
+    Bits of the neighbour mask, north is +y. Diagonals only count when both
+    edges next to them are the same terrain, otherwise a 256 entry table
+    would need rules for corners that can never be seen.
+*/
+enum NeighbourBit {
+    NEIGHBOUR_N = 1,
+    NEIGHBOUR_E = 2,
+    NEIGHBOUR_S = 4,
+    NEIGHBOUR_W = 8,
+    NEIGHBOUR_NE = 16,
+    NEIGHBOUR_SE = 32,
+    NEIGHBOUR_SW = 64,
+    NEIGHBOUR_NW = 128
+};
+
+const uint32_t EDGE_NEIGHBOUR_MASK = 15;
+const uint32_t NEIGHBOUR_MASK_COUNT = 256;
+
+struct Terrain {
+    Terrain():
+        neighbours(4),
+        default_tile(-1),
+        tile_for_mask(NEIGHBOUR_MASK_COUNT, -1) {}
+
+    std::string name;
+    uint32_t neighbours; //4 or 8
+    int32_t default_tile;
+    std::vector<int32_t> tile_for_mask;
+};
+
+class Autotiler {
+public:
+    int32_t add_terrain(const Terrain& terrain);
+
+    /*
+        Reads an autotile.json from a tile directory, tile filenames are
+        relative to that directory and are added to the palette.
+    */
+    bool load_rules(const std::string& path, Palette& palette, const std::string& tile_directory);
+    void clear();
+
+    uint32_t terrain_count() const { return terrains_.size(); }
+    const Terrain& terrain(uint32_t idx) const { return terrains_.at(idx); }
+
+    //Which terrain a placed tile belongs to, or -1 if it isn't autotiled
+    int32_t terrain_of(int32_t tile_image_id) const;
+
+    uint32_t neighbour_mask(Layer& layer, uint32_t x, uint32_t y, int32_t terrain) const;
+    int32_t resolve(int32_t terrain, uint32_t mask) const;
+
+private:
+    std::vector<Terrain> terrains_;
+    std::vector<int32_t> terrain_for_tile_; //Indexed by palette id
+};
+
+/*
+    Collects edits and recomputes the affected cells in one pass on commit().
+    Cells touched by several edits (or next to several) are evaluated once,
+    and each chunk's meshes are updated once at the end.
+*/
+class AutotileBatch {
+public:
+    AutotileBatch(const Autotiler& autotiler, Layer& layer);
+
+    //terrain -1 erases
+    void paint(uint32_t x, uint32_t y, int32_t terrain);
+    void fill(uint32_t x, uint32_t y, uint32_t width, uint32_t height, int32_t terrain);
+
+    uint32_t commit();
+
+private:
+    const Autotiler& autotiler_;
+    Layer& layer_;
+
+    //Keyed by the chunk coordinates of the cell in layer space
+    std::tr1::unordered_map<uint32_t, std::bitset<CHUNK_AREA> > dirty_;
+
+    void mark_dirty(uint32_t x, uint32_t y);
+    void mark_neighbours_dirty(uint32_t x, uint32_t y);
+};
+
+}
+
+#endif // AUTOTILE_H
@@ -0,0 +1,162 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+namespace pn {
+
+/*
+    Appends little endian values to a byte buffer. Fields are written one
+    at a time rather than as structs so files don't depend on the
+    compiler's padding.
+*/
+class BinaryWriter {
+public:
+    BinaryWriter(std::vector<uint8_t>& buffer):
+        buffer_(buffer) {}
+
+    void u8(uint8_t value) { buffer_.push_back(value); }
+
+    void u16(uint16_t value) {
+        u8(value & 0xFF);
+        u8(value >> 8);
+    }
+
+    void u32(uint32_t value) {
+        for(uint32_t i = 0; i < 4; ++i) {
+            u8((value >> (i * 8)) & 0xFF);
+        }
+    }
+
+    void u64(uint64_t value) {
+        u32(uint32_t(value & 0xFFFFFFFF));
+        u32(uint32_t(value >> 32));
+    }
+
+    void i32(int32_t value) { u32(uint32_t(value)); }
+
+    void f32(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        u32(bits);
+    }
+
+    void string(const std::string& value) {
+        u32(value.size());
+        bytes(value.data(), value.size());
+    }
+
+    void bytes(const void* data, size_t length) {
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        buffer_.insert(buffer_.end(), begin, begin + length);
+    }
+
+    void magic(const char* four_cc) { bytes(four_cc, 4); }
+
+    //Space for a value that isn't known yet, fill it in with patch_u64()
+    size_t reserve_u64() {
+        size_t at = buffer_.size();
+        u64(0);
+        return at;
+    }
+
+    void patch_u64(size_t at, uint64_t value) {
+        for(uint32_t i = 0; i < 8; ++i) {
+            buffer_[at + i] = (value >> (i * 8)) & 0xFF;
+        }
+    }
+
+    size_t position() const { return buffer_.size(); }
+
+private:
+    std::vector<uint8_t>& buffer_;
+};
+
+/*
+    Reads back what BinaryWriter wrote. Running off the end of the data
+    throws, so callers can read a whole header without checking each field.
+*/
+class BinaryReader {
+public:
+    BinaryReader(const uint8_t* data, size_t length):
+        data_(data),
+        length_(length),
+        position_(0) {}
+
+    uint8_t u8() {
+        require(1);
+        return data_[position_++];
+    }
+
+    uint16_t u16() {
+        uint16_t low = u8();
+        return low | (uint16_t(u8()) << 8);
+    }
+
+    uint32_t u32() {
+        require(4);
+        uint32_t value = 0;
+        for(uint32_t i = 0; i < 4; ++i) {
+            value |= uint32_t(data_[position_++]) << (i * 8);
+        }
+        return value;
+    }
+
+    uint64_t u64() {
+        uint64_t low = u32();
+        return low | (uint64_t(u32()) << 32);
+    }
+
+    int32_t i32() { return int32_t(u32()); }
+
+    float f32() {
+        uint32_t bits = u32();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    std::string string() {
+        uint32_t length = u32();
+        require(length);
+        std::string value(reinterpret_cast<const char*>(data_ + position_), length);
+        position_ += length;
+        return value;
+    }
+
+    bool magic(const char* four_cc) {
+        require(4);
+        bool matches = memcmp(data_ + position_, four_cc, 4) == 0;
+        position_ += 4;
+        return matches;
+    }
+
+    void seek(size_t position) {
+        if(position > length_) {
+            throw std::out_of_range("Seek past the end of the data");
+        }
+        position_ = position;
+    }
+
+    size_t position() const { return position_; }
+    size_t remaining() const { return length_ - position_; }
+
+private:
+    const uint8_t* data_;
+    size_t length_;
+    size_t position_;
+
+    void require(size_t count) const {
+        if(count > length_ - position_) {
+            throw std::out_of_range("Unexpected end of data");
+        }
+    }
+};
+
+}
+
+#endif // BINARY_IO_H
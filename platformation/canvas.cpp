@@ -1,16 +1,156 @@
+#include <cstdio>
+
 #include "canvas.h"
+#include "trace.h"
+#include "memory_accounting.h"
 
 namespace pn {
 
+namespace {
+
+const uint64_t OVERLAY_UPDATE_INTERVAL_NS = 250000000ull;
+
+//Sample names must outlive the samples, so per-pass names are fixed literals
+const char* PASS_SAMPLE_NAMES[] = {
+    "render pass 0", "render pass 1", "render pass 2", "render pass 3",
+    "render pass 4", "render pass 5", "render pass 6", "render pass 7"
+};
+const int32_t MAX_NAMED_PASSES = sizeof(PASS_SAMPLE_NAMES) / sizeof(const char*);
+
+}
+
 Canvas::Canvas(BaseObjectType *cobject, const Glib::RefPtr<Gtk::Builder>& builder):
     GtkGLWidget(cobject),
-    ortho_height_(15.0) {
-
+    tile_textures_(*this),
+    ortho_width_(0),
+    profiler_label_(nullptr),
+    profiler_overlay_visible_(false),
+    created_ns_(profiler::now_ns()),
+    last_frame_start_ns_(0),
+    last_overlay_update_ns_(0),
+    pass_start_ns_(0),
+    current_pass_(-1) {
+
+    builder->get_widget("profiler_overlay_label", profiler_label_);
 }
 
 void Canvas::do_render() {
+    PN_PROFILE_SCOPE("Canvas::do_render");
+
+    if(profiler::enabled()) {
+        uint64_t now = profiler::now_ns();
+        if(last_frame_start_ns_) {
+            profiler::record("frame", last_frame_start_ns_, now - last_frame_start_ns_);
+        }
+        last_frame_start_ns_ = now;
+    }
+
+    //Everything scrolled and zoomed since the last frame moves the camera once
+    uint32_t changes = view_.advance(profiler::now_ns());
+    if(changes & VIEW_ZOOMED) {
+        ortho_width_ = scene().active_camera().set_orthographic_projection_from_height(
+            view_.ortho_height(), double(width()) / double(height())
+        );
+    }
+    if(changes & VIEW_MOVED) {
+        scene().active_camera().move_to(view_.camera_x(), view_.camera_y(), 0.0);
+    }
+
+    signal_frame_started_((profiler::now_ns() - created_ns_) / 1000000ull);
+
     //scene().active_camera().move_to((ortho_width() / 2.0), 0, 0);
     update();
+
+    finish_render_pass();
+    current_pass_ = -1;
+
+    if(profiler::enabled()) {
+        collect_profiler_samples();
+    }
+}
+
+void Canvas::render_pass_started_cb(kglt::Pass& pass) {
+    if(!profiler::enabled()) {
+        return;
+    }
+
+    finish_render_pass();
+    ++current_pass_;
+    pass_start_ns_ = profiler::now_ns();
+}
+
+void Canvas::finish_render_pass() {
+    if(current_pass_ < 0 || !profiler::enabled()) {
+        return;
+    }
+
+    const char* name = (current_pass_ < MAX_NAMED_PASSES) ? PASS_SAMPLE_NAMES[current_pass_] : "render pass 8+";
+    profiler::record(name, pass_start_ns_, profiler::now_ns() - pass_start_ns_);
+}
+
+void Canvas::set_profiler_overlay_visible(bool value) {
+    if(value == profiler_overlay_visible_) {
+        return;
+    }
+
+    profiler_overlay_visible_ = value;
+    if(value) {
+        profiler::acquire();
+    } else {
+        profiler::release();
+    }
+
+    frame_stats_.clear();
+    last_frame_start_ns_ = 0;
+
+    if(!profiler_label_) {
+        return;
+    }
+
+    if(value) {
+        profiler_label_->show();
+    } else {
+        profiler_label_->hide();
+    }
+}
+
+void Canvas::collect_profiler_samples() {
+    //Samples are drained once per frame and shared between the overlay and the trace recorder
+    drained_samples_.clear();
+    profiler::drain(drained_samples_);
+
+    if(trace::recording()) {
+        trace::add_samples(drained_samples_);
+        if(trace::expired()) {
+            std::string path = trace::stop();
+            signal_trace_written_(path);
+        }
+    }
+
+    if(profiler_overlay_visible_) {
+        update_profiler_overlay();
+    }
+}
+
+void Canvas::update_profiler_overlay() {
+    frame_stats_.add_samples(drained_samples_);
+
+    //Relaying out the label every frame would show up in the very numbers we are displaying
+    uint64_t now = profiler::now_ns();
+    if(profiler_label_ && now - last_overlay_update_ns_ > OVERLAY_UPDATE_INTERVAL_NS) {
+        memory::Usage meshes = memory::usage(memory::SUBSYSTEM_RENDER_MESHES);
+        memory::Usage textures = memory::usage(memory::SUBSYSTEM_GPU_TEXTURES);
+
+        //kglt keeps no draw call statistics, every visible mesh is drawn once per pass
+        char counts[256];
+        snprintf(counts, sizeof(counts), "meshes %lld  draw calls (est.) %lld\ntextures %lld  texture memory %s",
+            (long long) meshes.count, (long long) (meshes.count * scene().pass_count()),
+            (long long) textures.count, memory::format_bytes(textures.bytes).c_str()
+        );
+
+        profiler_label_->set_text(frame_stats_.summary() + counts);
+        last_overlay_update_ns_ = now;
+    }
 }
 
 void Canvas::do_init() {
@@ -18,7 +158,7 @@ void Canvas::do_init() {
 
     selection_ = kglt::SelectionRenderer::create();
 
-    add_events(Gdk::SCROLL_MASK);
+    add_events(Gdk::SCROLL_MASK | Gdk::SMOOTH_SCROLL_MASK | Gdk::POINTER_MOTION_MASK);
 
     scene().remove_all_passes();
     scene().add_pass(selection_);
@@ -28,10 +168,18 @@ void Canvas::do_init() {
         sigc::mem_fun(this, &Canvas::scroll_event_callback)
     );
 
+    signal_motion_notify_event().connect(
+        sigc::mem_fun(this, &Canvas::motion_notify_callback)
+    );
+
     signal_button_press_event().connect(
         sigc::mem_fun(this, &Canvas::mouse_button_pressed_cb)
     );
 
+    scene().signal_render_pass_started().connect(
+        sigc::mem_fun(this, &Canvas::render_pass_started_cb)
+    );
+
     scene().render_options.texture_enabled = true;
     scene().pass(1).viewport().set_background_colour(kglt::Colour(0.2078, 0.494, 0.78, 0.5));
 }
@@ -39,17 +187,50 @@ void Canvas::do_init() {
 void Canvas::do_resize(int width, int height) {
     set_width(get_allocation().get_width());
     set_height(get_allocation().get_height());
+    view_.set_viewport(width, height);
 
     if(scene().pass_count() < 2) {
         return;
     }
 
     scene().pass(0).viewport().set_size(width, height);
-    ortho_width_ = scene().active_camera().set_orthographic_projection_from_height(ortho_height_, double(width) / double(height));
+    ortho_width_ = scene().active_camera().set_orthographic_projection_from_height(view_.ortho_height(), double(width) / double(height));
     scene().pass(1).viewport().set_size(width, height);
     //scene().pass(1).renderer().set_orthographic_projection_from_height(15.0, double(width) / double(height));
 }
 
+bool Canvas::scroll_event_callback(GdkEventScroll* scroll_event) {
+    double steps_x = 0, steps_y = 0;
+    switch(scroll_event->direction) {
+        case GDK_SCROLL_UP: steps_y = -1; break;
+        case GDK_SCROLL_DOWN: steps_y = 1; break;
+        case GDK_SCROLL_LEFT: steps_x = -1; break;
+        case GDK_SCROLL_RIGHT: steps_x = 1; break;
+        case GDK_SCROLL_SMOOTH: //Touchpads, fractions of a step at a time
+            steps_x = scroll_event->delta_x;
+            steps_y = scroll_event->delta_y;
+        break;
+        default:
+            return false;
+    }
+
+    //Only gathered here, do_render applies it all at once
+    GdkModifierType modifiers = gtk_accelerator_get_default_mod_mask();
+    if((scroll_event->state & modifiers) == GDK_CONTROL_MASK) {
+        view_.zoomed(-steps_y);
+    } else if((scroll_event->state & modifiers) == GDK_SHIFT_MASK && !steps_x) {
+        view_.scrolled(steps_y, 0);
+    } else {
+        view_.scrolled(steps_x, steps_y);
+    }
+    return true;
+}
+
+bool Canvas::motion_notify_callback(GdkEventMotion* motion_event) {
+    view_.pointer_moved(motion_event->x, motion_event->y);
+    return false;
+}
+
 bool Canvas::mouse_button_pressed_cb(GdkEventButton* event) {
     kglt::MeshID selected = selection_->selected_mesh();
     if(selected) {
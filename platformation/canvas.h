@@ -7,6 +7,11 @@
 #include "kglt/window_base.h"
 #include "kglt/kglt.h"
 
+#include "profiler.h"
+#include "entity_registry.h"
+#include "tile_textures.h"
+#include "view_input.h"
+
 namespace pn {
 
 class Canvas : public GtkGLWidget, public kglt::WindowBase {
@@ -29,45 +34,53 @@ public:
     double ortho_width() const { return ortho_width_; }
 
     bool mouse_button_pressed_cb(GdkEventButton* event);
+    bool scroll_event_callback(GdkEventScroll* scroll_event);
+    bool motion_notify_callback(GdkEventMotion* motion_event);
 
     sigc::signal<void, kglt::MeshID>& signal_mesh_selected() { return signal_mesh_selected_; }
 
+    EntityRegistry& entities() { return entities_; }
+    ViewInput& view() { return view_; }
+    TileTextures& tile_textures() { return tile_textures_; }
 
-    bool scroll_event_callback(GdkEventScroll* scroll_event) {
-        L_DEBUG("Scroll event received");
-
-        GdkModifierType modifiers = gtk_accelerator_get_default_mod_mask();
-
-        if((scroll_event->state & modifiers) == GDK_CONTROL_MASK) {
-            if(scroll_event->direction == GDK_SCROLL_UP || scroll_event->direction == GDK_SCROLL_DOWN) {
-                if(scroll_event->direction == GDK_SCROLL_UP) {
-                    ortho_height_ -= 0.2;
-                } else {
-                    ortho_height_ += 0.2;
-                }
-                ortho_width_ = scene().active_camera().set_orthographic_projection_from_height(
-                    ortho_height_, double(width()) / double(height())
-                );                
-                return true;
-            }
-        }
+    void set_profiler_overlay_visible(bool value);
+    bool profiler_overlay_visible() const { return profiler_overlay_visible_; }
 
-        return false;
-    }
+    sigc::signal<void, std::string>& signal_trace_written() { return signal_trace_written_; }
 
+    //Before each frame is drawn, with the time in milliseconds since the canvas was created
+    sigc::signal<void, uint64_t>& signal_frame_started() { return signal_frame_started_; }
 
 private:
     void do_init();
     void do_resize(int width, int height);
     void do_render();
 
+    void render_pass_started_cb(kglt::Pass& pass);
+    void finish_render_pass();
+    void collect_profiler_samples();
+    void update_profiler_overlay();
+
     kglt::SelectionRenderer::ptr selection_;
+    EntityRegistry entities_;
+    TileTextures tile_textures_; //Destroyed before the scene its textures are in
 
+    ViewInput view_; //Scrolling and zooming, applied to the camera once per frame
     double ortho_width_;
-    double ortho_height_;
 
     sigc::signal<void, kglt::MeshID> signal_mesh_selected_;
-
+    sigc::signal<void, std::string> signal_trace_written_;
+    sigc::signal<void, uint64_t> signal_frame_started_;
+
+    Gtk::Label* profiler_label_;
+    bool profiler_overlay_visible_;
+    profiler::FrameStats frame_stats_;
+    std::vector<profiler::Sample> drained_samples_;
+    uint64_t created_ns_;
+    uint64_t last_frame_start_ns_;
+    uint64_t last_overlay_update_ns_;
+    uint64_t pass_start_ns_;
+    int32_t current_pass_;
 };
 
 }
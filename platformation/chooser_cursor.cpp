@@ -0,0 +1,103 @@
+#include <cassert>
+#include <algorithm>
+
+#include "chooser_cursor.h"
+
+namespace pn {
+
+ChooserCursor::ChooserCursor(uint32_t radius):
+    radius_(radius),
+    current_(0),
+    count_(0),
+    reported_count_(0),
+    reported_first_(0),
+    reported_end_(0) {
+
+}
+
+bool ChooserCursor::next() {
+    if(!count_ || current_ >= count_ - 1) {
+        return false;
+    }
+    current_++;
+    return true;
+}
+
+bool ChooserCursor::previous() {
+    if(current_ < 1) {
+        return false;
+    }
+    current_--;
+    return true;
+}
+
+void ChooserCursor::set(uint32_t index) {
+    assert(index < count_);
+    current_ = index;
+}
+
+void ChooserCursor::appended(uint32_t entries) {
+    count_ += entries;
+}
+
+void ChooserCursor::reset(uint32_t count) {
+    count_ = count;
+    if(current_ >= count_) {
+        current_ = count_ ? count_ - 1 : 0;
+    }
+
+    reported_count_ = 0;
+    reported_first_ = reported_end_ = 0;
+}
+
+uint32_t ChooserCursor::first_visible() const {
+    return (current_ > radius_) ? current_ - radius_ : 0;
+}
+
+uint32_t ChooserCursor::end_visible() const {
+    return std::min(count_, current_ + radius_ + 1);
+}
+
+bool ChooserCursor::visible(uint32_t index) const {
+    return index >= first_visible() && index < end_visible();
+}
+
+void ChooserCursor::take_changes(std::vector<uint32_t>& shown, std::vector<uint32_t>& hidden) {
+    shown.clear();
+    hidden.clear();
+
+    uint32_t first = first_visible();
+    uint32_t end = end_visible();
+
+    //Entries already reported only change if they cross an edge of the window
+    uint32_t old_count = reported_count_;
+    uint32_t old_first = std::min(reported_first_, old_count);
+    uint32_t old_end = std::min(reported_end_, old_count);
+
+    for(uint32_t i = old_first; i < old_end; ++i) {
+        if(i < first || i >= end) {
+            hidden.push_back(i);
+        }
+    }
+
+    for(uint32_t i = first; i < std::min(end, old_count); ++i) {
+        if(i < old_first || i >= old_end) {
+            shown.push_back(i);
+        }
+    }
+
+    //Anything new is reported whichever side of the window it's on
+    for(uint32_t i = old_count; i < count_; ++i) {
+        if(i >= first && i < end) {
+            shown.push_back(i);
+        } else {
+            hidden.push_back(i);
+        }
+    }
+
+    reported_count_ = count_;
+    reported_first_ = first;
+    reported_end_ = end;
+}
+
+}
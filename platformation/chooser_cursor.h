@@ -0,0 +1,61 @@
+#ifndef CHOOSER_CURSOR_H
+#define CHOOSER_CURSOR_H
+
+#include <cstdint>
+#include <vector>
+
+namespace pn {
+
+const uint32_t TILE_CHOOSER_VISIBLE_RADIUS = 5; //Entries either side of the selected one that are shown
+
+/*
+    Which tile chooser entry is selected and which entries are close enough
+    to it to be shown. Rather than the chooser revisiting every entry each
+    time the selection moves, the cursor hands back just the entries whose
+    visibility changed, so stepping through thousands of tiles touches
+    the few at the edges of the visible window and loading a directory
+    touches each new entry once.
+*/
+class ChooserCursor {
+public:
+    ChooserCursor(uint32_t radius=TILE_CHOOSER_VISIBLE_RADIUS);
+
+    uint32_t current() const { return current_; }
+    uint32_t count() const { return count_; }
+
+    //False (with nothing changed) at either end
+    bool next();
+    bool previous();
+    void set(uint32_t index);
+
+    //New entries at the end
+    void appended(uint32_t entries=1);
+
+    //Entries were removed or reordered, everything is reported again on the next take
+    void reset(uint32_t count);
+
+    bool visible(uint32_t index) const;
+
+    /*
+        Entries to show and hide since the last call. New entries are
+        always reported one way or the other.
+    */
+    void take_changes(std::vector<uint32_t>& shown, std::vector<uint32_t>& hidden);
+
+private:
+    uint32_t radius_;
+    uint32_t current_;
+    uint32_t count_;
+
+    //What the last take reported, [first, end) of the first reported_count_ entries
+    uint32_t reported_count_;
+    uint32_t reported_first_;
+    uint32_t reported_end_;
+
+    uint32_t first_visible() const;
+    uint32_t end_visible() const;
+};
+
+}
+
+#endif // CHOOSER_CURSOR_H
@@ -0,0 +1,47 @@
+#include "chunk.h"
+#include "memory_accounting.h"
+
+#include <algorithm>
+
+namespace pn {
+
+ChunkCells::ChunkCells() {
+    std::fill(tiles, tiles + CHUNK_AREA, -1);
+    memory::allocated(memory::SUBSYSTEM_TILE_DATA, sizeof(ChunkCells));
+}
+
+ChunkCells::ChunkCells(const ChunkCells& other) {
+    std::copy(other.tiles, other.tiles + CHUNK_AREA, tiles);
+    memory::allocated(memory::SUBSYSTEM_TILE_DATA, sizeof(ChunkCells));
+}
+
+ChunkCells::~ChunkCells() {
+    memory::released(memory::SUBSYSTEM_TILE_DATA, sizeof(ChunkCells));
+}
+
+const ChunkCells::ptr& ChunkCells::blank() {
+    static ChunkCells::ptr cells(new ChunkCells());
+    return cells;
+}
+
+Chunk::Chunk():
+    cells(ChunkCells::blank()),
+    grid_x(0),
+    grid_y(0),
+    render_dirty(false) {
+
+    memory::allocated(memory::SUBSYSTEM_TILE_DATA, sizeof(Chunk));
+}
+
+Chunk::~Chunk() {
+    memory::released(memory::SUBSYSTEM_TILE_DATA, sizeof(Chunk));
+}
+
+int32_t* Chunk::writable_tiles() {
+    if(!cells.unique()) {
+        cells.reset(new ChunkCells(*cells));
+    }
+    return cells->tiles;
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef CHUNK_H
+#define CHUNK_H
+
+#include <cstdint>
+#include <vector>
+#include <tr1/memory>
+
+namespace pn {
+
+const uint32_t CHUNK_SIZE = 16;
+const uint32_t CHUNK_AREA = CHUNK_SIZE * CHUNK_SIZE;
+
+//Whatever the attached LayerView keeps per chunk, defined by the view (see level_renderer.h)
+struct ChunkRender;
+
+/*
+    The tile ids of one chunk, -1 for an empty cell. Chunks, clipboard
+    regions and save snapshots share these and copy them on write, so
+    copying a chunk aligned area only copies pointers.
+*/
+struct ChunkCells {
+    typedef std::tr1::shared_ptr<ChunkCells> ptr;
+
+    ChunkCells();
+    ChunkCells(const ChunkCells& other);
+    ~ChunkCells();
+
+    int32_t tiles[CHUNK_AREA];
+
+    //Every new chunk starts out sharing this, so blank areas cost nothing until painted
+    static const ptr& blank();
+
+private:
+    ChunkCells& operator=(const ChunkCells&);
+};
+
+/*
+    Remembers which chunks of a grid have had their cells changed since the
+    changes were last taken, so incremental snapshots only revisit those.
+    A new or reshaped grid counts as entirely changed.
+*/
+class ChunkChanges {
+public:
+    ChunkChanges():
+        all_(true) {}
+
+    void mark(uint32_t chunk_idx) {
+        if(!all_ && !marked_[chunk_idx]) {
+            marked_[chunk_idx] = true;
+            changed_.push_back(chunk_idx);
+        }
+    }
+
+    void mark_all(uint32_t chunk_count) {
+        all_ = true;
+        changed_.clear();
+        marked_.assign(chunk_count, false);
+    }
+
+    //Hands over the changed chunk indices and starts afresh, returns true if the whole grid changed
+    bool take(std::vector<uint32_t>& changed) {
+        bool all = all_;
+        for(uint32_t chunk_idx: changed_) {
+            marked_[chunk_idx] = false;
+        }
+
+        changed.swap(changed_);
+        changed_.clear();
+        all_ = false;
+        return all;
+    }
+
+private:
+    bool all_;
+    std::vector<bool> marked_;
+    std::vector<uint32_t> changed_;
+};
+
+/*
+    A fixed size square block of a layer. Layers store their cells as a grid
+    of chunks so that resizing only ever moves chunk pointers around, and
+    rendering is organised so that a chunk can be rebuilt on its own.
+    Render state is only allocated once a view draws the chunk, so levels
+    loaded without one (the command line tool, thumbnails, merges) don't
+    carry it.
+*/
+struct Chunk {
+    typedef std::tr1::shared_ptr<Chunk> ptr;
+
+    Chunk();
+    ~Chunk();
+
+    int32_t tile_image(uint32_t local_index) const { return cells->tiles[local_index]; }
+
+    //Takes a private copy of the cells first if anything else still shares them
+    int32_t* writable_tiles();
+
+    ChunkCells::ptr cells;
+    std::tr1::shared_ptr<ChunkRender> render; //Null while no view has drawn the chunk
+
+    uint32_t grid_x; //Position in the owning layer's chunk grid
+    uint32_t grid_y;
+
+    bool render_dirty; //Queued for the view's next flush
+
+private:
+    Chunk(const Chunk&);
+    Chunk& operator=(const Chunk&);
+};
+
+}
+
+#endif // CHUNK_H
@@ -0,0 +1,516 @@
+#include <iostream>
+#include <sstream>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <csignal>
+#include <boost/lexical_cast.hpp>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/os/core.h"
+#include "kazbase/os/path.h"
+#include "kazbase/string.h"
+
+#include "level.h"
+#include "layer.h"
+#include "level_file.h"
+#include "atomic_file.h"
+#include "level_validation.h"
+#include "runtime_export.h"
+#include "level_diff.h"
+#include "compositor.h"
+#include "parallel.h"
+#include "pixel_ops.h"
+
+/*
+    Headless batch tool, links the level code without GTK or GL so it can
+    run on build servers:
+
+        platformation-cli <command> [options] level...
+        platformation-cli diff [options] before after
+        platformation-cli merge [options] base ours theirs
+
+    Exits with 1 if any file fails (including validation errors), 2 on
+    bad usage and 130 if interrupted. diff exits with 1 if the levels
+    differ and merge with 1 if there were conflicts, like diff(1) and
+    git merge-file, so they can be used as git drivers.
+*/
+
+using namespace pn;
+
+namespace {
+
+struct Options {
+    Options():
+        jobs(0),
+        format(LEVEL_FORMAT_BINARY),
+        resolution(RESOLVE_OURS),
+        thumbnail_size(0),
+        pixel_path(pn::pixel_path()) {}
+
+    std::string command;
+    uint32_t jobs;
+    LevelFormat format;
+    std::string output_directory;
+    ExportOptions export_options;
+    std::string output; //Only for merge
+    ConflictResolution resolution;
+    RenderOptions render_options;
+    uint32_t thumbnail_size; //0 renders full size
+    PixelPath pixel_path; //Fastest pixel kernels to use
+    std::vector<std::string> files;
+};
+
+struct FileResult {
+    FileResult():
+        ok(true) {}
+
+    bool ok;
+    std::ostringstream report;
+};
+
+std::mutex output_lock;
+
+//Set by Ctrl+C, running validations stop at the next chunk and nothing new is started
+std::atomic<bool> interrupted(false);
+
+void interrupt_handler(int) {
+    interrupted = true;
+}
+
+void print_usage() {
+    std::cerr << "Usage: platformation-cli <command> [options] level..." << std::endl
+              << "       platformation-cli diff before after" << std::endl
+              << "       platformation-cli merge --output=PATH [--prefer=SIDE] base ours theirs" << std::endl
+              << std::endl
+              << "Commands:" << std::endl
+              << "  validate    check levels for errors and warnings" << std::endl
+              << "  convert     rewrite levels in another format (--to)" << std::endl
+              << "  export      write a runtime pack (.pnrt) for each level" << std::endl
+              << "  stats       print size, layer and metadata counts" << std::endl
+              << "  render      draw each level to a PNG without a GPU" << std::endl
+              << "  diff        list the cells that differ between two levels" << std::endl
+              << "  merge       three way merge of two levels with their common base (--output)" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --jobs=N            files to process at once, 0 for one per core (default)" << std::endl
+              << "  --to=json|binary    output format for convert (default binary)" << std::endl
+              << "  --output-dir=DIR    where to write output, defaults to next to the input" << std::endl
+              << "  --atlas-columns=N   atlas width in tiles for export (default 16)" << std::endl
+              << "  --tile-pixels=N     pixels per cell edge for render (default 16)" << std::endl
+              << "  --thumbnail=N       render a thumbnail at most N pixels square instead" << std::endl
+              << "  --output=PATH       where merge writes the merged level" << std::endl
+              << "  --prefer=SIDE       ours or theirs, which side wins merge conflicts (default ours)" << std::endl
+              << "  --pixel-path=PATH   scalar, sse2 or avx2, the fastest pixel kernels to use (default best available)" << std::endl;
+}
+
+std::string option_value(const std::string& arg, const std::string& name) {
+    return arg.substr(name.length());
+}
+
+bool parse_arguments(int argc, char* argv[], Options& options) {
+    if(argc < 2) {
+        return false;
+    }
+
+    options.command = argv[1];
+    if(options.command != "validate" && options.command != "convert" &&
+       options.command != "export" && options.command != "stats" && options.command != "render" &&
+       options.command != "diff" && options.command != "merge") {
+        std::cerr << "Unknown command: " << options.command << std::endl;
+        return false;
+    }
+
+    try {
+        for(int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if(str::starts_with(arg, "--jobs=")) {
+                options.jobs = boost::lexical_cast<uint32_t>(option_value(arg, "--jobs="));
+            } else if(str::starts_with(arg, "--to=")) {
+                std::string format = option_value(arg, "--to=");
+                if(format == "json") {
+                    options.format = LEVEL_FORMAT_JSON;
+                } else if(format == "binary") {
+                    options.format = LEVEL_FORMAT_BINARY;
+                } else {
+                    std::cerr << "Unknown format: " << format << std::endl;
+                    return false;
+                }
+            } else if(str::starts_with(arg, "--output-dir=")) {
+                options.output_directory = option_value(arg, "--output-dir=");
+            } else if(str::starts_with(arg, "--atlas-columns=")) {
+                options.export_options.atlas_columns = boost::lexical_cast<uint32_t>(option_value(arg, "--atlas-columns="));
+            } else if(str::starts_with(arg, "--tile-pixels=")) {
+                options.render_options.tile_pixels = boost::lexical_cast<uint32_t>(option_value(arg, "--tile-pixels="));
+            } else if(str::starts_with(arg, "--thumbnail=")) {
+                options.thumbnail_size = boost::lexical_cast<uint32_t>(option_value(arg, "--thumbnail="));
+            } else if(str::starts_with(arg, "--output=")) {
+                options.output = option_value(arg, "--output=");
+            } else if(str::starts_with(arg, "--prefer=")) {
+                std::string side = option_value(arg, "--prefer=");
+                if(side == "ours") {
+                    options.resolution = RESOLVE_OURS;
+                } else if(side == "theirs") {
+                    options.resolution = RESOLVE_THEIRS;
+                } else {
+                    std::cerr << "Unknown side: " << side << std::endl;
+                    return false;
+                }
+            } else if(str::starts_with(arg, "--pixel-path=")) {
+                std::string path = option_value(arg, "--pixel-path=");
+                if(path == "scalar") {
+                    options.pixel_path = PIXEL_PATH_SCALAR;
+                } else if(path == "sse2") {
+                    options.pixel_path = PIXEL_PATH_SSE2;
+                } else if(path == "avx2") {
+                    options.pixel_path = PIXEL_PATH_AVX2;
+                } else {
+                    std::cerr << "Unknown pixel path: " << path << std::endl;
+                    return false;
+                }
+            } else if(str::starts_with(arg, "--")) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                return false;
+            } else {
+                options.files.push_back(arg);
+            }
+        }
+    } catch(boost::bad_lexical_cast& e) {
+        std::cerr << "Expected a number in option value" << std::endl;
+        return false;
+    }
+
+    if(options.command == "diff") {
+        return options.files.size() == 2;
+    } else if(options.command == "merge") {
+        return options.files.size() == 3 && !options.output.empty();
+    }
+
+    return !options.files.empty();
+}
+
+std::string directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos) ? std::string() : path.substr(0, slash);
+}
+
+//Input path with its extension swapped, placed in the output directory if there is one
+std::string output_path(const Options& options, const std::string& input, const std::string& extension) {
+    size_t slash = input.rfind('/');
+    std::string filename = (slash == std::string::npos) ? input : input.substr(slash + 1);
+
+    size_t dot = filename.rfind('.');
+    if(dot != std::string::npos && dot > 0) {
+        filename = filename.substr(0, dot);
+    }
+    filename += extension;
+
+    std::string directory = options.output_directory.empty() ? directory_of(input) : options.output_directory;
+    return directory.empty() ? filename : os::path::join(directory, filename);
+}
+
+void run_validate(const Options&, const std::string& path, Level& level, FileResult& result) {
+    ValidationOptions validation;
+    validation.base_directory = directory_of(path);
+    validation.cancel = &interrupted;
+
+    //Issues are printed as they're found, compiler style so editors can jump to them
+    ValidationSummary summary = validate_level(level, validation, [&](const ValidationIssue& issue) {
+        std::ostringstream line;
+        line << path;
+        if(issue.x >= 0 || issue.y >= 0) {
+            line << ":" << issue.x << ":" << issue.y;
+        }
+        line << ": " << ((issue.severity == VALIDATION_ERROR) ? "error: " : "warning: ") << issue.message
+             << " [" << validation_check_name(issue.check);
+        if(issue.layer >= 0) {
+            line << ", layer " << issue.layer;
+        }
+        line << "]";
+
+        std::lock_guard<std::mutex> lock(output_lock);
+        std::cout << line.str() << std::endl;
+    });
+
+    result.report << "    " << summary.errors << " errors, " << summary.warnings << " warnings, "
+                  << summary.chunks << " chunks checked" << std::endl;
+
+    if(summary.cancelled) {
+        result.report << "    error: cancelled" << std::endl;
+    }
+
+    result.ok = !summary.errors && !summary.cancelled;
+}
+
+void run_convert(const Options& options, const std::string& path, Level& level, FileResult& result) {
+    std::string destination = output_path(options, path, (options.format == LEVEL_FORMAT_JSON) ? ".json" : ".pnl");
+
+    std::vector<uint8_t> data;
+    write_level(level, options.format, data);
+
+    if(!write_file_atomically(destination, data)) {
+        throw LevelFileError("Unable to write " + destination);
+    }
+
+    result.report << "    wrote " << destination << " (" << data.size() << " bytes)" << std::endl;
+}
+
+void run_export(const Options& options, const std::string& path, Level& level, FileResult& result) {
+    std::string destination = output_path(options, path, ".pnrt");
+
+    ExportOptions export_options = options.export_options;
+    if(options.files.size() > 1) {
+        //Files are already spread over the cores, don't oversubscribe them
+        export_options.threads = 1;
+    }
+
+    ExportStats stats;
+    if(!export_runtime_pack(level, destination, export_options, &stats)) {
+        result.report << "    error: unable to write " << destination << std::endl;
+        result.ok = false;
+        return;
+    }
+
+    result.report << "    wrote " << destination << " (" << stats.chunk_count << " chunks, "
+                  << stats.quad_count << " quads, " << stats.collision_rect_count << " collision rects, "
+                  << stats.byte_count << " bytes)" << std::endl;
+}
+
+void run_render(const Options& options, const std::string& path, Level& level, FileResult& result) {
+    std::string destination = output_path(options, path, ".png");
+
+    RenderOptions render_options = options.render_options;
+    render_options.base_directory = directory_of(path);
+    if(options.files.size() > 1) {
+        render_options.threads = 1;
+    }
+
+    RenderStats stats;
+    bool written = false;
+    if(options.thumbnail_size) {
+        Image thumbnail;
+        render_thumbnail(level, options.thumbnail_size, render_options, thumbnail, &stats);
+        written = write_png(thumbnail, destination, render_options.threads);
+    } else {
+        written = export_level_png(level, destination, render_options, &stats);
+    }
+
+    if(!written) {
+        result.report << "    error: unable to write " << destination << std::endl;
+        result.ok = false;
+        return;
+    }
+
+    result.report << "    wrote " << destination << " (" << stats.width << "x" << stats.height << ")" << std::endl;
+    if(stats.missing_tiles) {
+        result.report << "    warning: " << stats.missing_tiles << " tile images could not be read" << std::endl;
+    }
+}
+
+void run_stats(const Options&, const std::string&, Level& level, FileResult& result) {
+    result.report << "    name: " << level.name() << std::endl
+                  << "    size: " << level.horizontal_tile_count() << "x" << level.vertical_tile_count() << std::endl
+                  << "    palette: " << level.palette().size() << " tiles" << std::endl;
+
+    for(uint32_t l = 0; l < level.layer_count(); ++l) {
+        Layer& layer = level.layer_at(l);
+
+        uint32_t filled = 0;
+        for(uint32_t y = 0; y < layer.height(); ++y) {
+            for(uint32_t x = 0; x < layer.width(); ++x) {
+                filled += (layer.tile_image_at(x, y) >= 0) ? 1 : 0;
+            }
+        }
+
+        result.report << "    layer " << l << " '" << layer.name() << "': " << filled << " tiles" << std::endl;
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    for(uint32_t flag_bit = 0; flag_bit < MAX_METADATA_FLAGS; ++flag_bit) {
+        uint32_t count = metadata.count(flag_bit);
+        if(count) {
+            std::vector<CellRect> rects;
+            metadata.rectangles(flag_bit, rects);
+            result.report << "    " << metadata_flag_name(flag_bit) << ": " << count << " cells, "
+                          << rects.size() << " rects" << std::endl;
+        }
+    }
+}
+
+std::string layer_label(Level& level, uint32_t layer) {
+    if(layer == METADATA_LAYER_INDEX) {
+        return "metadata";
+    }
+
+    std::ostringstream label;
+    label << "layer " << layer;
+    if(layer < level.layer_count()) {
+        label << " '" << level.layer_at(layer).name() << "'";
+    }
+    return label.str();
+}
+
+std::string cell_label(const std::vector<std::string>& palette, uint32_t layer, int32_t value) {
+    if(layer == METADATA_LAYER_INDEX) {
+        return boost::lexical_cast<std::string>(value);
+    }
+    return (value >= 0 && uint32_t(value) < palette.size()) ? palette[value] : "(empty)";
+}
+
+int run_diff(const Options& options) {
+    Level::ptr before = load_level(options.files[0]);
+    Level::ptr after = load_level(options.files[1]);
+
+    auto start = std::chrono::steady_clock::now();
+    LevelDiff diff = diff_levels(*before, *after);
+    double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    //Differences come block by block, so each chunk's run is contiguous
+    uint32_t i = 0;
+    while(i < diff.differences.size()) {
+        uint32_t layer = diff.differences[i].layer;
+        uint32_t first = i;
+        uint32_t chunks = 0;
+
+        std::ostringstream chunk_lines;
+        while(i < diff.differences.size() && diff.differences[i].layer == layer) {
+            const CellDifference& difference = diff.differences[i];
+            uint32_t cx = difference.x / CHUNK_SIZE, cy = difference.y / CHUNK_SIZE;
+
+            uint32_t count = 0;
+            while(i < diff.differences.size() && diff.differences[i].layer == layer &&
+                  diff.differences[i].x / CHUNK_SIZE == cx && diff.differences[i].y / CHUNK_SIZE == cy) {
+                ++count;
+                ++i;
+            }
+
+            chunk_lines << "    chunk " << cx << "," << cy << ": " << count << " cells, first at "
+                        << difference.x << "," << difference.y << " ("
+                        << cell_label(diff.palette, layer, difference.before) << " -> "
+                        << cell_label(diff.palette, layer, difference.after) << ")" << std::endl;
+            ++chunks;
+        }
+
+        std::cout << layer_label(*after, layer) << ": " << (i - first) << " cells in " << chunks << " chunks" << std::endl
+                  << chunk_lines.str();
+    }
+
+    std::cout << diff.differences.size() << " cells differ, " << diff.blocks_compared << " of "
+              << (diff.blocks_compared + diff.blocks_skipped) << " chunks compared in " << elapsed << " ms" << std::endl;
+
+    return diff.identical() ? 0 : 1;
+}
+
+int run_merge(const Options& options) {
+    Level::ptr base = load_level(options.files[0]);
+    Level::ptr ours = load_level(options.files[1]);
+    Level::ptr theirs = load_level(options.files[2]);
+
+    LevelMerge merge = merge_levels(*base, *ours, *theirs, options.resolution);
+
+    //Compiler style, so editors can jump to them
+    const Palette& palette = merge.level->palette();
+    for(const MergeConflict& conflict: merge.conflicts) {
+        std::cout << options.output << ":" << conflict.x << ":" << conflict.y << ": conflict: "
+                  << layer_label(*merge.level, conflict.layer) << " was "
+                  << ((conflict.base >= 0) ? palette.path_for_id(conflict.base) : "(empty)") << ", ours "
+                  << ((conflict.ours >= 0) ? palette.path_for_id(conflict.ours) : "(empty)") << ", theirs "
+                  << ((conflict.theirs >= 0) ? palette.path_for_id(conflict.theirs) : "(empty)") << std::endl;
+    }
+
+    save_level(*merge.level, options.output);
+
+    std::cout << "wrote " << options.output << ": " << merge.conflicts.size() << " conflicts ("
+              << ((options.resolution == RESOLVE_OURS) ? "ours" : "theirs") << " kept), "
+              << merge.blocks_merged << " chunks merged cell by cell" << std::endl;
+
+    return merge.conflicts.empty() ? 0 : 1;
+}
+
+void process_file(const Options& options, const std::string& path, FileResult& result) {
+    try {
+        Level::ptr level = load_level(path);
+
+        if(options.command == "validate") {
+            run_validate(options, path, *level, result);
+        } else if(options.command == "convert") {
+            run_convert(options, path, *level, result);
+        } else if(options.command == "export") {
+            run_export(options, path, *level, result);
+        } else if(options.command == "render") {
+            run_render(options, path, *level, result);
+        } else {
+            run_stats(options, path, *level, result);
+        }
+    } catch(std::exception& e) {
+        result.report << "    error: " << e.what() << std::endl;
+        result.ok = false;
+    }
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    //Only problems go to the terminal, the per file report is the output
+    logging::get_logger("/")->add_handler(logging::Handler::ptr(new logging::StdIOHandler()));
+    logging::get_logger("/")->set_level(logging::LOG_LEVEL_WARN);
+
+    Options options;
+    if(!parse_arguments(argc, argv, options)) {
+        print_usage();
+        return 2;
+    }
+
+    set_pixel_path(options.pixel_path);
+    if(options.command == "diff" || options.command == "merge") {
+        try {
+            return (options.command == "diff") ? run_diff(options) : run_merge(options);
+        } catch(std::exception& e) {
+            std::cerr << "error: " << e.what() << std::endl;
+            return 2;
+        }
+    }
+
+    auto now = []() { return std::chrono::steady_clock::now(); };
+    auto ms_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto batch_start = now();
+    std::atomic<uint32_t> failures(0);
+
+    if(!options.output_directory.empty() && !os::path::exists(options.output_directory)) {
+        os::make_dirs(options.output_directory);
+    }
+
+    signal(SIGINT, interrupt_handler);
+
+    parallel_for(options.files.size(), options.jobs, [&](uint32_t i) {
+        if(interrupted) {
+            return;
+        }
+
+        auto file_start = now();
+
+        FileResult result;
+        process_file(options, options.files[i], result);
+        double elapsed = ms_since(file_start);
+
+        if(!result.ok) {
+            failures++;
+        }
+
+        //Each file's report is printed in one go so parallel output doesn't interleave
+        std::lock_guard<std::mutex> lock(output_lock);
+        std::cout << (result.ok ? "ok     " : "FAILED ") << options.files[i] << " (" << elapsed << " ms)" << std::endl
+                  << result.report.str();
+    });
+
+    std::cout << options.files.size() << " files, " << failures << " failed in " << ms_since(batch_start) << " ms" << std::endl;
+
+    if(interrupted) {
+        std::cout << "Interrupted" << std::endl;
+        return 130;
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,600 @@
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <zlib.h>
+#include <png.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "kazbase/os/path.h"
+#include "kazbase/logging/logging.h"
+
+#include "compositor.h"
+#include "atomic_file.h"
+#include "level.h"
+#include "layer.h"
+#include "palette.h"
+#include "parallel.h"
+#include "pixel_ops.h"
+#include "profiler.h"
+#include "tileset_manager.h"
+
+namespace pn {
+
+/*
+    Pixels are handled as little endian uint32s, so R is the low byte and
+    A the high one.
+*/
+
+namespace {
+
+const uint32_t BLOCK_CELLS = 16; //Cells along each edge of a block composited as one job
+const uint32_t BAND_CELL_ROWS = 16; //Cell rows per band of an exported PNG
+const uint32_t PNG_DEFLATE_LEVEL = 1;
+const int PNG_DEFLATE_STRATEGY = Z_DEFAULT_STRATEGY;
+
+const uint32_t ALPHA_MASK = 0xFF000000;
+
+inline uint32_t div255(uint32_t value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+inline uint32_t blend_pixel(uint32_t destination, uint32_t source) {
+    uint32_t inverse = 255 - (source >> 24);
+
+    uint32_t result = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t channel = ((source >> shift) & 0xFF) + div255(((destination >> shift) & 0xFF) * inverse);
+        result |= std::min(channel, 255u) << shift;
+    }
+    return result;
+}
+
+void fill_pixels(uint32_t* out, uint32_t count, uint32_t value) {
+    std::fill(out, out + count, value);
+}
+
+/*
+    Draws cells [x, x + width) by [y, y + height) of the layers (back to
+    front) into out, whose first row is the top pixel row of cell row
+    y + height - 1.
+*/
+void composite_cells(const std::vector<Layer*>& layers, const TileImages& tiles, uint32_t background,
+                     uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t* out, size_t stride) {
+
+    const uint32_t tp = tiles.tile_pixels();
+
+    for(uint32_t row = 0; row < height * tp; ++row) {
+        fill_pixels(out + (row * stride), width * tp, background);
+    }
+
+    for(Layer* layer: layers) {
+        uint32_t right = std::min(x + width, layer->width());
+        uint32_t top = std::min(y + height, layer->height());
+
+        for(uint32_t cy = y; cy < top; ++cy) {
+            uint32_t* cell_row = out + (size_t(y + height - 1 - cy) * tp * stride);
+
+            for(uint32_t cx = x; cx < right; ++cx) {
+                int32_t tile = layer->tile_image_at(cx, cy);
+                TileImages::Coverage coverage = tiles.coverage(tile);
+                if(coverage == TileImages::COVERAGE_EMPTY) {
+                    continue;
+                }
+
+                const uint32_t* source = tiles.pixels(tile);
+                uint32_t* destination = cell_row + ((cx - x) * tp);
+
+                if(coverage == TileImages::COVERAGE_OPAQUE) {
+                    for(uint32_t r = 0; r < tp; ++r) {
+                        memcpy(destination + (r * stride), source + (r * tp), tp * sizeof(uint32_t));
+                    }
+                } else {
+                    for(uint32_t r = 0; r < tp; ++r) {
+                        blend_row(destination + (r * stride), source + (r * tp), tp);
+                    }
+                }
+            }
+        }
+    }
+}
+
+//The editor draws layer 0 in front, see LayerRenderer::layer_geometry_changed()
+std::vector<Layer*> back_to_front(Level& level) {
+    std::vector<Layer*> layers;
+    for(uint32_t i = level.layer_count(); i > 0; --i) {
+        layers.push_back(&level.layer_at(i - 1));
+    }
+    return layers;
+}
+
+double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+    PNGs are written by hand rather than through libpng so that bands can
+    be deflated on separate threads. Each band is a raw deflate block run
+    ending on a byte boundary (Z_SYNC_FLUSH), so the bands' output can be
+    stitched into a single zlib stream, with the checksum combined from
+    each band's with adler32_combine().
+*/
+struct EncodedBand {
+    EncodedBand():
+        adler(0),
+        raw_length(0) {}
+
+    std::vector<uint8_t> deflated;
+    uLong adler;
+    uLong raw_length;
+};
+
+//out[i] = bytes[i] - left[i], 16 at a time with SSE2
+void subtract_bytes(uint8_t* out, const uint8_t* bytes, const uint8_t* left, size_t count) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    for(; i + 16 <= count; i += 16) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_sub_epi8(current, previous));
+    }
+#endif
+
+    for(; i < count; ++i) {
+        out[i] = uint8_t(bytes[i] - left[i]);
+    }
+}
+
+void encode_rows(const uint32_t* pixels, uint32_t width, uint32_t rows, size_t stride, bool last, EncodedBand& out) {
+    size_t row_bytes = size_t(width) * 4;
+    std::vector<uint8_t> raw((row_bytes + 1) * rows);
+
+    //A blank pixel in front of the row is the left neighbour of the first
+    std::vector<uint32_t> straight(width + 1, 0);
+
+    for(uint32_t r = 0; r < rows; ++r) {
+        unpremultiply_row(pixels + (r * stride), &straight[1], width);
+
+        //Sub filtering (each byte minus the one a pixel to the left) suits rows of repeating tiles
+        uint8_t* filtered = &raw[(row_bytes + 1) * r];
+        *filtered++ = 1;
+        subtract_bytes(filtered, reinterpret_cast<const uint8_t*>(&straight[1]), reinterpret_cast<const uint8_t*>(&straight[0]), row_bytes);
+    }
+
+    out.raw_length = raw.size();
+    out.adler = adler32(adler32(0, nullptr, 0), raw.data(), raw.size());
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, PNG_DEFLATE_LEVEL, Z_DEFLATED, -15, 8, PNG_DEFLATE_STRATEGY);
+
+    out.deflated.resize(deflateBound(&stream, raw.size()) + 16);
+    stream.next_in = raw.data();
+    stream.avail_in = raw.size();
+    stream.next_out = out.deflated.data();
+    stream.avail_out = out.deflated.size();
+
+    deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+    out.deflated.resize(stream.total_out);
+    deflateEnd(&stream);
+}
+
+void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+}
+
+bool write_chunk(FILE* file, const char* type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> header;
+    put_u32(header, data.size());
+    header.insert(header.end(), type, type + 4);
+
+    uLong crc = crc32(0, nullptr, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(type), 4);
+    crc = crc32(crc, data.data(), data.size());
+
+    std::vector<uint8_t> footer;
+    put_u32(footer, crc);
+
+    return fwrite(header.data(), 1, header.size(), file) == header.size() &&
+        fwrite(data.data(), 1, data.size(), file) == data.size() &&
+        fwrite(footer.data(), 1, footer.size(), file) == footer.size();
+}
+
+//Streams into a file opened by write_file_atomically(), so a failed or interrupted write never replaces the old image
+class PngWriter {
+public:
+    PngWriter(FILE* file, uint32_t width, uint32_t height):
+        file_(file),
+        adler_(adler32(0, nullptr, 0)) {
+
+        const uint8_t signature[] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+        ok_ = fwrite(signature, 1, sizeof(signature), file_) == sizeof(signature);
+
+        std::vector<uint8_t> header;
+        put_u32(header, width);
+        put_u32(header, height);
+        header.push_back(8); //Bit depth
+        header.push_back(6); //RGBA
+        header.push_back(0);
+        header.push_back(0);
+        header.push_back(0); //Not interlaced
+        ok_ = ok_ && write_chunk(file_, "IHDR", header);
+
+        //zlib header for a 32K window with the fastest compression
+        std::vector<uint8_t> stream_header = { 0x78, 0x01 };
+        ok_ = ok_ && write_chunk(file_, "IDAT", stream_header);
+    }
+
+    void add(const EncodedBand& band) {
+        adler_ = adler32_combine(adler_, band.adler, band.raw_length);
+        if(!band.deflated.empty()) {
+            ok_ = ok_ && write_chunk(file_, "IDAT", band.deflated);
+        }
+    }
+
+    bool finish() {
+        std::vector<uint8_t> checksum;
+        put_u32(checksum, adler_);
+        ok_ = ok_ && write_chunk(file_, "IDAT", checksum);
+        ok_ = ok_ && write_chunk(file_, "IEND", std::vector<uint8_t>());
+        return ok_;
+    }
+
+private:
+    FILE* file_;
+    uLong adler_;
+    bool ok_;
+};
+
+}
+
+void blend_row(uint32_t* destination, const uint32_t* source, uint32_t count) {
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32(int32_t(ALPHA_MASK));
+    const __m128i lane_255 = _mm_set1_epi16(255);
+    const __m128i lane_128 = _mm_set1_epi16(128);
+
+    for(; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i alpha = _mm_and_si128(s, alpha_mask);
+
+        int opaque = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, alpha_mask));
+        if(opaque == 0xFFFF) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), s);
+            continue;
+        }
+
+        int clear = _mm_movemask_epi8(_mm_cmpeq_epi32(alpha, zero));
+        if(clear == 0xFFFF) {
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(destination + i));
+
+        //255 - alpha in both 16 bit halves of each pixel, then spread over that pixel's four 16 bit channels
+        __m128i inverse = _mm_srli_epi32(alpha, 24);
+        inverse = _mm_or_si128(inverse, _mm_slli_epi32(inverse, 16));
+        inverse = _mm_sub_epi16(lane_255, inverse);
+        __m128i inverse_low = _mm_unpacklo_epi32(inverse, inverse);
+        __m128i inverse_high = _mm_unpackhi_epi32(inverse, inverse);
+
+        //d * (255 - alpha) / 255, rounded, on 16 bit lanes
+        __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inverse_low), lane_128);
+        __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inverse_high), lane_128);
+        low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+        high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+
+        __m128i result = _mm_adds_epu8(s, _mm_packus_epi16(low, high));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), result);
+    }
+#endif
+
+    for(; i < count; ++i) {
+        uint32_t alpha = source[i] >> 24;
+        if(alpha == 255) {
+            destination[i] = source[i];
+        } else if(alpha) {
+            destination[i] = blend_pixel(destination[i], source[i]);
+        }
+    }
+}
+
+bool read_png(const std::string& path, Image& out) {
+    png_image image;
+    memset(&image, 0, sizeof(image));
+    image.version = PNG_IMAGE_VERSION;
+
+    if(!png_image_begin_read_from_file(&image, path.c_str())) {
+        L_WARN("Unable to read " + path + ": " + image.message);
+        return false;
+    }
+
+    //Opaque files come out as packed RGB, a quarter less for libpng to write, and skip premultiplying
+    bool has_alpha = image.format & PNG_FORMAT_FLAG_ALPHA;
+    image.format = has_alpha ? PNG_FORMAT_RGBA : PNG_FORMAT_RGB;
+    out.resize(image.width, image.height);
+
+    std::vector<uint8_t> rgb;
+    void* buffer = out.pixels.data();
+    if(!has_alpha) {
+        rgb.resize(PNG_IMAGE_SIZE(image));
+        buffer = rgb.data();
+    }
+
+    if(!png_image_finish_read(&image, nullptr, buffer, 0, nullptr)) {
+        L_WARN("Unable to decode " + path + ": " + image.message);
+        png_image_free(&image);
+        return false;
+    }
+
+    if(has_alpha) {
+        premultiply_row(out.pixels.data(), out.pixels.data(), out.pixels.size());
+    } else {
+        for(uint32_t y = 0; y < out.height; ++y) {
+            rgb_to_rgba_row(&rgb[size_t(y) * out.width * 3], out.row(y), out.width);
+        }
+    }
+    return true;
+}
+
+bool write_png(const Image& image, const std::string& path, uint32_t threads) {
+    if(!image.width || !image.height) {
+        L_ERROR("Unable to write an empty image to " + path);
+        return false;
+    }
+
+    const uint32_t rows_per_band = 64;
+    uint32_t bands = (image.height + rows_per_band - 1) / rows_per_band;
+
+    std::vector<EncodedBand> encoded(bands);
+    parallel_for(bands, threads, [&](uint32_t band) {
+        uint32_t first = band * rows_per_band;
+        uint32_t rows = std::min(rows_per_band, image.height - first);
+        encode_rows(image.pixels.data() + (size_t(first) * image.width), image.width, rows, image.width, band + 1 == bands, encoded[band]);
+    });
+
+    bool written = write_file_atomically(path, [&](FILE* file) {
+        PngWriter writer(file, image.width, image.height);
+        for(EncodedBand& band: encoded) {
+            writer.add(band);
+        }
+        return writer.finish();
+    });
+
+    if(!written) {
+        L_ERROR("Unable to write " + path);
+        return false;
+    }
+    return true;
+}
+
+void TileImages::scale(const Image& source, uint32_t tile_pixels, uint32_t* out) {
+    for(uint32_t dy = 0; dy < tile_pixels; ++dy) {
+        uint32_t y0 = (dy * source.height) / tile_pixels;
+        uint32_t y1 = std::max(y0 + 1, ((dy + 1) * source.height) / tile_pixels);
+
+        for(uint32_t dx = 0; dx < tile_pixels; ++dx) {
+            uint32_t x0 = (dx * source.width) / tile_pixels;
+            uint32_t x1 = std::max(x0 + 1, ((dx + 1) * source.width) / tile_pixels);
+
+            uint32_t totals[4] = { 0, 0, 0, 0 };
+            for(uint32_t sy = y0; sy < y1; ++sy) {
+                const uint32_t* row = source.row(sy);
+                for(uint32_t sx = x0; sx < x1; ++sx) {
+                    for(uint32_t c = 0; c < 4; ++c) {
+                        totals[c] += (row[sx] >> (c * 8)) & 0xFF;
+                    }
+                }
+            }
+
+            uint32_t count = (y1 - y0) * (x1 - x0);
+            uint32_t pixel = 0;
+            for(uint32_t c = 0; c < 4; ++c) {
+                pixel |= ((totals[c] + (count / 2)) / count) << (c * 8);
+            }
+            out[(dy * tile_pixels) + dx] = pixel;
+        }
+    }
+}
+
+void TileImages::load(const Palette& palette, const std::string& base_directory, uint32_t tile_pixels, uint32_t threads) {
+    PN_PROFILE_SCOPE("TileImages::load");
+
+    tile_pixels_ = std::max(tile_pixels, 1u);
+    uint32_t area = tile_pixels_ * tile_pixels_;
+
+    coverage_.assign(palette.size(), COVERAGE_EMPTY);
+    pixels_.assign(palette.size(), nullptr);
+    sources_.assign(palette.size(), TileImage::ptr());
+
+    //Images are shared with everything else using them, so usually there's nothing to decode or scale here
+    std::atomic<uint32_t> missing(0);
+    parallel_for(palette.size(), threads, [&](uint32_t id) {
+        std::string path = palette.path_for_id(id);
+        if(!base_directory.empty() && !path.empty() && path[0] != '/') {
+            path = os::path::join(base_directory, path);
+        }
+
+        TileImage::ptr source = TilesetManager::instance().acquire(path);
+        if(!source->valid()) {
+            missing++;
+            return;
+        }
+
+        const uint32_t* scaled = source->scaled(tile_pixels_).data();
+        sources_[id] = source;
+        pixels_[id] = scaled;
+
+        bool opaque = true, empty = true;
+        for(uint32_t i = 0; i < area; ++i) {
+            opaque = opaque && (scaled[i] >> 24) == 255;
+            empty = empty && !(scaled[i] >> 24);
+        }
+        coverage_[id] = empty ? COVERAGE_EMPTY : (opaque ? COVERAGE_OPAQUE : COVERAGE_BLENDED);
+    });
+
+    missing_ = missing;
+}
+
+void render_level(Level& level, const RenderOptions& options, Image& out, RenderStats* stats) {
+    PN_PROFILE_SCOPE("render_level");
+    auto start = std::chrono::steady_clock::now();
+
+    TileImages tiles;
+    tiles.load(level.palette(), options.base_directory, options.tile_pixels, options.threads);
+
+    uint32_t tp = tiles.tile_pixels();
+    uint32_t width = level.horizontal_tile_count();
+    uint32_t height = level.vertical_tile_count();
+    out.resize(width * tp, height * tp);
+
+    std::vector<Layer*> layers = back_to_front(level);
+
+    uint32_t blocks_across = (width + BLOCK_CELLS - 1) / BLOCK_CELLS;
+    uint32_t blocks_down = (height + BLOCK_CELLS - 1) / BLOCK_CELLS;
+
+    //Blocks cover separate pixels, so they need no locking
+    parallel_for(blocks_across * blocks_down, options.threads, [&](uint32_t block) {
+        uint32_t x = (block % blocks_across) * BLOCK_CELLS;
+        uint32_t y = (block / blocks_across) * BLOCK_CELLS;
+        uint32_t block_width = std::min(BLOCK_CELLS, width - x);
+        uint32_t block_height = std::min(BLOCK_CELLS, height - y);
+
+        uint32_t* origin = out.row((height - y - block_height) * tp) + (x * tp);
+        composite_cells(layers, tiles, options.background, x, y, block_width, block_height, origin, out.width);
+    });
+
+    if(stats) {
+        stats->width = out.width;
+        stats->height = out.height;
+        stats->missing_tiles = tiles.missing();
+        stats->elapsed_ms = ms_since(start);
+    }
+}
+
+void render_thumbnail(Level& level, uint32_t max_size, const RenderOptions& options, Image& out, RenderStats* stats) {
+    auto start = std::chrono::steady_clock::now();
+
+    uint32_t cells = std::max(std::max(level.horizontal_tile_count(), level.vertical_tile_count()), 1u);
+    max_size = std::max(max_size, 1u);
+
+    RenderOptions scaled = options;
+    if(cells <= max_size) {
+        scaled.tile_pixels = max_size / cells;
+        render_level(level, scaled, out, stats);
+        return;
+    }
+
+    //A pixel per cell (each tile's average colour) then averaged down again
+    scaled.tile_pixels = 1;
+    Image full;
+    render_level(level, scaled, full, stats);
+
+    uint32_t factor = (cells + max_size - 1) / max_size;
+    out.resize((full.width + factor - 1) / factor, (full.height + factor - 1) / factor);
+
+    parallel_for(out.height, options.threads, [&](uint32_t y) {
+        for(uint32_t x = 0; x < out.width; ++x) {
+            uint32_t totals[4] = { 0, 0, 0, 0 };
+            uint32_t count = 0;
+
+            for(uint32_t sy = y * factor; sy < std::min((y + 1) * factor, full.height); ++sy) {
+                const uint32_t* row = full.row(sy);
+                for(uint32_t sx = x * factor; sx < std::min((x + 1) * factor, full.width); ++sx) {
+                    for(uint32_t c = 0; c < 4; ++c) {
+                        totals[c] += (row[sx] >> (c * 8)) & 0xFF;
+                    }
+                    ++count;
+                }
+            }
+
+            uint32_t pixel = 0;
+            for(uint32_t c = 0; c < 4; ++c) {
+                pixel |= ((totals[c] + (count / 2)) / count) << (c * 8);
+            }
+            out.row(y)[x] = pixel;
+        }
+    });
+
+    if(stats) {
+        stats->width = out.width;
+        stats->height = out.height;
+        stats->elapsed_ms = ms_since(start);
+    }
+}
+
+bool export_level_png(Level& level, const std::string& path, const RenderOptions& options, RenderStats* stats) {
+    PN_PROFILE_SCOPE("export_level_png");
+    auto start = std::chrono::steady_clock::now();
+
+    TileImages tiles;
+    tiles.load(level.palette(), options.base_directory, options.tile_pixels, options.threads);
+
+    uint32_t tp = tiles.tile_pixels();
+    uint32_t width = level.horizontal_tile_count();
+    uint32_t height = level.vertical_tile_count();
+    if(!width || !height) {
+        L_ERROR("Unable to export an empty level to " + path);
+        return false;
+    }
+
+    std::vector<Layer*> layers = back_to_front(level);
+
+    uint32_t threads = options.threads ? options.threads : std::max(std::thread::hardware_concurrency(), 1u);
+    uint32_t bands = (height + BAND_CELL_ROWS - 1) / BAND_CELL_ROWS;
+
+    bool written = write_file_atomically(path, [&](FILE* file) {
+        PngWriter writer(file, width * tp, height * tp);
+
+        //Bands go top down, and only a couple per thread are held at once. Their buffers are reused, fresh pages are slow
+        uint32_t window = threads * 2;
+        std::vector<std::vector<uint32_t> > band_pixels(std::min(window, bands));
+
+        for(uint32_t first = 0; first < bands; first += window) {
+            uint32_t count = std::min(window, bands - first);
+            std::vector<EncodedBand> encoded(count);
+
+            parallel_for(count, threads, [&](uint32_t i) {
+                uint32_t band = first + i;
+                uint32_t top = height - (band * BAND_CELL_ROWS);
+                uint32_t rows = std::min(BAND_CELL_ROWS, top);
+
+                std::vector<uint32_t>& pixels = band_pixels[i];
+                pixels.resize(size_t(width) * tp * BAND_CELL_ROWS * tp);
+                composite_cells(layers, tiles, options.background, 0, top - rows, width, rows, pixels.data(), width * tp);
+                encode_rows(pixels.data(), width * tp, rows * tp, width * tp, band + 1 == bands, encoded[i]);
+            });
+
+            for(EncodedBand& band: encoded) {
+                writer.add(band);
+            }
+        }
+        return writer.finish();
+    });
+
+    if(!written) {
+        L_ERROR("Unable to write " + path);
+        return false;
+    }
+
+    if(stats) {
+        stats->width = width * tp;
+        stats->height = height * tp;
+        stats->missing_tiles = tiles.missing();
+        stats->elapsed_ms = ms_since(start);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,138 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+
+namespace pn {
+
+class Level;
+class Palette;
+class TileImage;
+
+/*
+    RGBA, 8 bits a channel in that byte order, premultiplied by alpha so
+    drawing one pixel over another is a multiply and an add. Rows run from
+    the top of the image down.
+*/
+struct Image {
+    Image():
+        width(0),
+        height(0) {}
+
+    void resize(uint32_t new_width, uint32_t new_height) {
+        width = new_width;
+        height = new_height;
+        pixels.assign(size_t(width) * height, 0);
+    }
+
+    uint32_t* row(uint32_t y) { return &pixels[size_t(y) * width]; }
+    const uint32_t* row(uint32_t y) const { return &pixels[size_t(y) * width]; }
+
+    uint32_t width;
+    uint32_t height;
+    std::vector<uint32_t> pixels;
+};
+
+//Both return false (and log why) if the file can't be read or written. Writes replace the file atomically
+bool read_png(const std::string& path, Image& out);
+bool write_png(const Image& image, const std::string& path, uint32_t threads=0); //threads deflate the image in bands, 0 uses every core
+
+/*
+    Draws source over destination, both premultiplied. Four pixels at a
+    time with SSE2, and runs of four fully opaque or fully clear source
+    pixels are copied or skipped without any arithmetic.
+*/
+void blend_row(uint32_t* destination, const uint32_t* source, uint32_t count);
+
+/*
+    The palette's images scaled to tile_pixels square, box filtered when
+    shrinking, and shared through the TilesetManager. Each tile also knows
+    whether it's entirely opaque or empty, so compositing can copy or skip
+    it outright rather than blend.
+*/
+class TileImages {
+public:
+    enum Coverage {
+        COVERAGE_EMPTY,
+        COVERAGE_OPAQUE,
+        COVERAGE_BLENDED
+    };
+
+    TileImages():
+        tile_pixels_(0),
+        missing_(0) {}
+
+    //Relative palette paths are looked up in base_directory, missing or unreadable images draw nothing
+    void load(const Palette& palette, const std::string& base_directory, uint32_t tile_pixels, uint32_t threads=0);
+
+    uint32_t tile_pixels() const { return tile_pixels_; }
+    uint32_t missing() const { return missing_; }
+
+    Coverage coverage(int32_t tile_image_id) const {
+        return (tile_image_id >= 0 && uint32_t(tile_image_id) < coverage_.size()) ? coverage_[tile_image_id] : COVERAGE_EMPTY;
+    }
+
+    //Only for ids whose coverage isn't empty
+    const uint32_t* pixels(int32_t tile_image_id) const {
+        return pixels_[tile_image_id];
+    }
+
+    //Box filters source into a tile_pixels square
+    static void scale(const Image& source, uint32_t tile_pixels, uint32_t* out);
+
+private:
+    uint32_t tile_pixels_;
+    uint32_t missing_;
+    std::vector<Coverage> coverage_;
+    std::vector<const uint32_t*> pixels_; //Owned by sources_
+    std::vector<std::tr1::shared_ptr<TileImage> > sources_;
+};
+
+struct RenderOptions {
+    RenderOptions():
+        tile_pixels(16),
+        background(0),
+        threads(0) {}
+
+    std::string base_directory; //For relative tile paths
+    uint32_t tile_pixels; //Output pixels per cell edge
+    uint32_t background; //Premultiplied RGBA under every layer, transparent by default
+    uint32_t threads; //0 uses every core
+};
+
+struct RenderStats {
+    RenderStats():
+        width(0),
+        height(0),
+        missing_tiles(0),
+        elapsed_ms(0) {}
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t missing_tiles; //Palette entries whose image couldn't be read
+    double elapsed_ms;
+};
+
+/*
+    Draws the level without a GPU: every layer from the back (highest z
+    index) to the front, composited block by block across threads. The
+    image is (width * tile_pixels) by (height * tile_pixels).
+*/
+void render_level(Level& level, const RenderOptions& options, Image& out, RenderStats* stats=nullptr);
+
+//Scales the level down to fit max_size square, averaging cells when the level is larger than that
+void render_thumbnail(Level& level, uint32_t max_size, const RenderOptions& options, Image& out, RenderStats* stats=nullptr);
+
+/*
+    Renders and writes a PNG a band of cell rows at a time. Bands are
+    composited and compressed on every core and only a couple per thread
+    are held at once, so memory use doesn't grow with the level.
+*/
+bool export_level_png(Level& level, const std::string& path, const RenderOptions& options=RenderOptions(), RenderStats* stats=nullptr);
+
+}
+
+#endif // COMPOSITOR_H
@@ -0,0 +1,206 @@
+#include <cstdio>
+#include <cstring>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/os/path.h"
+
+#include "editor_state.h"
+#include "tile_pixel_cache.h"
+#include "mapped_file.h"
+#include "binary_io.h"
+#include "atomic_file.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bits_double(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}
+
+bool EditorState::operator==(const EditorState& other) const {
+    return tile_directories == other.tile_directories && selected_tile == other.selected_tile &&
+        camera_x == other.camera_x && camera_y == other.camera_y && ortho_height == other.ortho_height &&
+        active_layer == other.active_layer && level_path == other.level_path;
+}
+
+void write_editor_state(const EditorState& state, std::vector<uint8_t>& out) {
+    BinaryWriter writer(out);
+    writer.magic("PNES");
+    writer.u32(EDITOR_STATE_VERSION);
+
+    writer.u32(state.tile_directories.size());
+    for(const std::string& directory: state.tile_directories) {
+        writer.string(directory);
+    }
+    writer.string(state.selected_tile);
+    writer.u64(double_bits(state.camera_x));
+    writer.u64(double_bits(state.camera_y));
+    writer.u64(double_bits(state.ortho_height));
+    writer.u32(state.active_layer);
+    writer.string(state.level_path);
+}
+
+bool read_editor_state(const uint8_t* data, size_t length, EditorState& out) {
+    try {
+        BinaryReader reader(data, length);
+        if(!reader.magic("PNES") || reader.u32() != EDITOR_STATE_VERSION) {
+            L_WARN("Ignoring editor state from another version");
+            return false;
+        }
+
+        EditorState state;
+        uint32_t directory_count = reader.u32();
+        for(uint32_t i = 0; i < directory_count; ++i) {
+            state.tile_directories.push_back(reader.string());
+        }
+        state.selected_tile = reader.string();
+        state.camera_x = bits_double(reader.u64());
+        state.camera_y = bits_double(reader.u64());
+        state.ortho_height = bits_double(reader.u64());
+        state.active_layer = reader.u32();
+        state.level_path = reader.string();
+
+        out = state;
+        return true;
+    } catch(std::out_of_range& e) {
+        L_WARN("Editor state is truncated");
+        return false;
+    }
+}
+
+bool load_editor_state(const std::string& path, EditorState& out) {
+    if(!os::path::exists(path)) {
+        return false;
+    }
+
+    MappedFile::ptr file = MappedFile::open(path);
+    return file && read_editor_state(file->data(), file->size(), out);
+}
+
+EditorStateWriter::EditorStateWriter(const std::string& path, const std::string& pixel_cache_path, uint32_t debounce_ms, uint32_t max_delay_ms):
+    path_(path),
+    pixel_cache_path_(pixel_cache_path),
+    debounce_(debounce_ms),
+    max_delay_(max_delay_ms),
+    state_pending_(false),
+    tiles_pending_(false),
+    busy_(false),
+    flushing_(false),
+    stop_(false),
+    written_any_(false) {
+
+    thread_ = std::thread(&EditorStateWriter::run, this);
+}
+
+EditorStateWriter::~EditorStateWriter() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+}
+
+void EditorStateWriter::changed() {
+    clock::time_point now = clock::now();
+    if(!state_pending_ && !tiles_pending_) {
+        first_change_ = now;
+    }
+    last_change_ = now;
+}
+
+void EditorStateWriter::save(const EditorState& state) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        changed();
+        state_pending_ = true;
+        pending_state_ = state;
+    }
+    condition_.notify_all();
+}
+
+void EditorStateWriter::cache_tiles(const std::vector<std::string>& tile_paths) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        changed();
+        tiles_pending_ = true;
+        pending_tiles_ = tile_paths;
+    }
+    condition_.notify_all();
+}
+
+void EditorStateWriter::flush() {
+    std::unique_lock<std::mutex> guard(lock_);
+    flushing_ = true;
+    condition_.notify_all();
+    condition_.wait(guard, [=]() { return !state_pending_ && !tiles_pending_ && !busy_; });
+    flushing_ = false;
+}
+
+void EditorStateWriter::run() {
+    std::unique_lock<std::mutex> guard(lock_);
+
+    while(true) {
+        condition_.wait(guard, [=]() { return state_pending_ || tiles_pending_ || stop_; });
+        if(!state_pending_ && !tiles_pending_) {
+            return;
+        }
+
+        //Each change pushes the write back, up to the maximum delay
+        while(!stop_ && !flushing_) {
+            clock::time_point due = std::min(last_change_ + debounce_, first_change_ + max_delay_);
+            if(clock::now() >= due) {
+                break;
+            }
+            condition_.wait_until(guard, due);
+        }
+
+        bool write_state = state_pending_;
+        EditorState state = pending_state_;
+        bool write_tiles = tiles_pending_;
+        std::vector<std::string> tiles;
+        tiles.swap(pending_tiles_);
+        state_pending_ = tiles_pending_ = false;
+        busy_ = true;
+        guard.unlock();
+
+        if(write_state && (!written_any_ || state != written_state_)) {
+            PN_PROFILE_SCOPE("EditorStateWriter::write_state");
+
+            std::vector<uint8_t> data;
+            write_editor_state(state, data);
+            if(write_file_atomically(path_, data)) {
+                written_any_ = true;
+                written_state_ = state;
+            } else {
+                L_WARN("Unable to write the editor state: " + path_);
+            }
+        }
+
+        if(write_tiles) {
+            //Only rewritten when there's something new to go in it, it can be a lot of pixels
+            TilePixelCache::ptr cache = TilePixelCache::open(pixel_cache_path_);
+            if(!cache || !cache->covers(tiles)) {
+                TilePixelCache::write(pixel_cache_path_, tiles);
+            }
+        }
+
+        guard.lock();
+        busy_ = false;
+        condition_.notify_all();
+    }
+}
+
+}
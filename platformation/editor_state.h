@@ -0,0 +1,113 @@
+#ifndef EDITOR_STATE_H
+#define EDITOR_STATE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "view_input.h"
+
+namespace pn {
+
+const uint32_t EDITOR_STATE_VERSION = 1;
+const uint32_t EDITOR_STATE_DEBOUNCE_MS = 500; //Quiet time after the last change before it's written
+const uint32_t EDITOR_STATE_MAX_DELAY_MS = 5000; //Written at least this often while changes keep coming
+
+/*
+    Where the editor was left, so the next start picks up from there:
+    the tile directories, the tile picked in the chooser, the camera, the
+    active layer and the level file that was open.
+
+    Layout (little endian): "PNES", u32 version, u32 directory count +
+    strings, string selected tile, f64 camera x, camera y and ortho height
+    (as u64 bits), u32 active layer, string level path.
+*/
+struct EditorState {
+    EditorState():
+        camera_x(0),
+        camera_y(0),
+        ortho_height(DEFAULT_ORTHO_HEIGHT),
+        active_layer(0) {}
+
+    std::vector<std::string> tile_directories;
+    std::string selected_tile; //Path of the chooser's selected tile, empty for none
+    double camera_x;
+    double camera_y;
+    double ortho_height;
+    uint32_t active_layer;
+    std::string level_path; //Empty unless the level was opened from a file
+
+    bool operator==(const EditorState& other) const;
+    bool operator!=(const EditorState& other) const { return !(*this == other); }
+};
+
+void write_editor_state(const EditorState& state, std::vector<uint8_t>& out);
+
+//False (and logged) if the data isn't an editor state this version can read
+bool read_editor_state(const uint8_t* data, size_t length, EditorState& out);
+
+//False if there's no state file or it can't be read
+bool load_editor_state(const std::string& path, EditorState& out);
+
+/*
+    Writes the editor state on a background thread, a while after the last
+    change, so a burst of changes (scrolling across a level) is one small
+    write rather than one per frame. States equal to the last one written
+    are skipped.
+
+    Also keeps the tile pixel cache up to date with the tiles it's given,
+    rewriting it only when some of them aren't cached yet.
+*/
+class EditorStateWriter {
+public:
+    EditorStateWriter(const std::string& path, const std::string& pixel_cache_path,
+        uint32_t debounce_ms=EDITOR_STATE_DEBOUNCE_MS, uint32_t max_delay_ms=EDITOR_STATE_MAX_DELAY_MS);
+
+    ~EditorStateWriter(); //Writes anything still waiting
+
+    std::string path() const { return path_; }
+    std::string pixel_cache_path() const { return pixel_cache_path_; }
+
+    //Returns straight away, the latest state wins
+    void save(const EditorState& state);
+    void cache_tiles(const std::vector<std::string>& tile_paths);
+
+    //Writes whatever is waiting now rather than after the debounce, and blocks until it's done
+    void flush();
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    std::string path_;
+    std::string pixel_cache_path_;
+    std::chrono::milliseconds debounce_;
+    std::chrono::milliseconds max_delay_;
+
+    std::thread thread_;
+    std::mutex lock_;
+    std::condition_variable condition_;
+    bool state_pending_;
+    EditorState pending_state_;
+    bool tiles_pending_;
+    std::vector<std::string> pending_tiles_;
+    clock::time_point first_change_;
+    clock::time_point last_change_;
+    bool busy_;
+    bool flushing_;
+    bool stop_;
+
+    //Only touched by the writer thread
+    bool written_any_;
+    EditorState written_state_;
+
+    void run();
+    void changed();
+};
+
+}
+
+#endif // EDITOR_STATE_H
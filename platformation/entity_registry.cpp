@@ -0,0 +1,56 @@
+#include "entity_registry.h"
+#include "level_renderer.h"
+
+namespace pn {
+
+EntityRegistry::EntityRegistry() {
+    //Handle 0 is never given out, so a zero tile index always means "nothing"
+    chunks_.push_back(ChunkRef());
+}
+
+void EntityRegistry::set(kglt::MeshID mesh_id, UserDataType type, uint32_t index) {
+    if(mesh_id >= entities_.size()) {
+        entities_.resize(mesh_id + 1);
+    }
+    entities_[mesh_id] = Entity(type, index);
+}
+
+void EntityRegistry::clear(kglt::MeshID mesh_id) {
+    if(mesh_id < entities_.size()) {
+        entities_[mesh_id] = Entity();
+    }
+}
+
+uint32_t EntityRegistry::register_chunk(Layer* layer, Chunk* chunk) {
+    uint32_t handle;
+    if(free_chunk_handles_.empty()) {
+        handle = chunks_.size();
+        chunks_.push_back(ChunkRef());
+    } else {
+        handle = free_chunk_handles_.back();
+        free_chunk_handles_.pop_back();
+    }
+
+    chunks_[handle].layer = layer;
+    chunks_[handle].chunk = chunk;
+    return handle;
+}
+
+void EntityRegistry::unregister_chunk(uint32_t handle) {
+    if(!handle || handle >= chunks_.size()) {
+        return;
+    }
+
+    chunks_[handle] = ChunkRef();
+    free_chunk_handles_.push_back(handle);
+}
+
+TileInstance* EntityRegistry::tile(uint32_t tile_index) const {
+    ChunkRef ref = chunk(chunk_handle(tile_index));
+    if(!ref.chunk || !ref.chunk->render) {
+        return nullptr;
+    }
+    return &ref.chunk->render->tiles[local_index(tile_index)];
+}
+
+}
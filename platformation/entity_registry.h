@@ -0,0 +1,89 @@
+#ifndef ENTITY_REGISTRY_H
+#define ENTITY_REGISTRY_H
+
+#include <vector>
+#include <cstdint>
+#include <tr1/memory>
+
+#include <kglt/kglt.h>
+
+#include "user_data_types.h"
+#include "chunk.h"
+
+namespace pn {
+
+class Layer;
+struct TileInstance;
+
+struct Entity {
+    Entity():
+        type(USER_DATA_TYPE_NONE),
+        index(0) {}
+
+    Entity(UserDataType type, uint32_t index):
+        type(type),
+        index(index) {}
+
+    UserDataType type;
+    uint32_t index; //Meaning depends on the type, see below
+};
+
+struct ChunkRef {
+    ChunkRef():
+        layer(nullptr),
+        chunk(nullptr) {}
+
+    Layer* layer;
+    Chunk* chunk;
+};
+
+/*
+    Maps render handles (mesh IDs) to what they represent, so that picking
+    can be resolved with a couple of array lookups instead of user data
+    casts.
+
+    For USER_DATA_TYPE_TILE_CHOOSER the index is the chooser entry. For
+    USER_DATA_TYPE_TILE_INSTANCE it is a chunk handle plus the cell within
+    that chunk; chunk handles stay valid while chunks are moved around or
+    rebuilt, unlike pointers into the tile storage.
+*/
+class EntityRegistry {
+public:
+    typedef std::tr1::shared_ptr<EntityRegistry> ptr;
+
+    EntityRegistry();
+
+    void set(kglt::MeshID mesh_id, UserDataType type, uint32_t index);
+    void clear(kglt::MeshID mesh_id);
+
+    Entity lookup(kglt::MeshID mesh_id) const {
+        return (mesh_id < entities_.size()) ? entities_[mesh_id] : Entity();
+    }
+
+    uint32_t register_chunk(Layer* layer, Chunk* chunk);
+    void unregister_chunk(uint32_t handle);
+
+    ChunkRef chunk(uint32_t handle) const {
+        return (handle < chunks_.size()) ? chunks_[handle] : ChunkRef();
+    }
+
+    //Returns null if the chunk has since been released
+    TileInstance* tile(uint32_t tile_index) const;
+
+    static uint32_t tile_index(uint32_t chunk_handle, uint32_t local_index) {
+        return (chunk_handle * CHUNK_AREA) + local_index;
+    }
+
+    static uint32_t chunk_handle(uint32_t tile_index) { return tile_index / CHUNK_AREA; }
+    static uint32_t local_index(uint32_t tile_index) { return tile_index % CHUNK_AREA; }
+
+private:
+    std::vector<Entity> entities_;
+
+    std::vector<ChunkRef> chunks_;
+    std::vector<uint32_t> free_chunk_handles_;
+};
+
+}
+
+#endif // ENTITY_REGISTRY_H
@@ -1,5 +1,6 @@
 #include "gtk_gl_widget.h"
 #include "kazbase/logging/logging.h"
+#include "../profiler.h"
 #include <gdkmm.h>
 #include <gdk/gdkx.h>
 
@@ -58,6 +59,7 @@ bool GtkGLWidget::make_current() {
 }
 
 bool GtkGLWidget::on_area_idle() {
+    PN_PROFILE_SCOPE("GtkGLWidget::on_area_idle");
     //queue_draw();
     if(make_current()) {
         do_render();
@@ -76,6 +78,7 @@ void GtkGLWidget::on_area_realize() {
 
 bool GtkGLWidget::on_area_draw(const ::Cairo::RefPtr< ::Cairo::Context>& cr) {
     //if(event->count > 0) return true;
+    PN_PROFILE_SCOPE("GtkGLWidget::on_area_draw");
 
     if(make_current()) {
         do_render();
@@ -0,0 +1,15 @@
+#ifndef PN_I18N_H
+#define PN_I18N_H
+
+/*
+    For code that is shared with the command line tool, which doesn't link
+    glib. Matches the definition in glib/gi18n.h so the two can meet in one
+    translation unit.
+*/
+#include <libintl.h>
+
+#ifndef _
+#define _(String) gettext (String)
+#endif
+
+#endif // PN_I18N_H
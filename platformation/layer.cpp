@@ -1,57 +1,383 @@
-#include <glibmm/i18n.h>
+#include <cassert>
+#include <algorithm>
+
+#include "i18n.h"
 #include "layer.h"
 #include "level.h"
-#include "user_data_types.h"
+#include "profiler.h"
+#include "selection.h"
 
 namespace pn {
 
+static int32_t floor_div(int32_t value, int32_t divisor) {
+    return (value >= 0) ? (value / divisor) : -((-value + divisor - 1) / divisor);
+}
+
 Layer::Layer(Level& parent):
     parent_(parent),
+    view_(nullptr),
     name_(_("Untitled")),
-    mesh_container_(0) {
+    zindex_(0),
+    parallax_(1.0f),
+    width_(0),
+    height_(0),
+    origin_x_(0),
+    origin_y_(0),
+    chunks_across_(0),
+    chunks_down_(0) {
 
     resize(parent.horizontal_tile_count(), parent.vertical_tile_count());
 }
 
+Layer::~Layer() {
+
+}
+
+void Layer::set_zindex(int32_t zindex) {
+    zindex_ = zindex;
+
+    if(view_) {
+        view_->layer_geometry_changed();
+    }
+}
+
+Chunk& Layer::chunk_containing(uint32_t x, uint32_t y, uint32_t& local_index) const {
+    assert(x < width_ && y < height_);
+
+    uint32_t grid_x = x + origin_x_;
+    uint32_t grid_y = y + origin_y_;
+    local_index = ((grid_y % CHUNK_SIZE) * CHUNK_SIZE) + (grid_x % CHUNK_SIZE);
+    return *chunks_[((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE)];
+}
+
+int32_t Layer::tile_image_at(uint32_t x, uint32_t y) const {
+    uint32_t local_index;
+    Chunk& chunk = chunk_containing(x, y, local_index);
+    return chunk.tile_image(local_index);
+}
+
+bool Layer::cell_position(const Chunk& chunk, uint32_t local_index, uint32_t& x, uint32_t& y) const {
+    uint32_t grid_x = (chunk.grid_x * CHUNK_SIZE) + (local_index % CHUNK_SIZE);
+    uint32_t grid_y = (chunk.grid_y * CHUNK_SIZE) + (local_index / CHUNK_SIZE);
+
+    if(!in_bounds(grid_x, grid_y)) {
+        return false;
+    }
+
+    x = grid_x - origin_x_;
+    y = grid_y - origin_y_;
+    return true;
+}
+
+void Layer::set_tile(uint32_t x, uint32_t y, int32_t tile_image_id) {
+    uint32_t grid_x = x + origin_x_;
+    uint32_t grid_y = y + origin_y_;
+    assert(x < width_ && y < height_);
+
+    const Chunk::ptr& chunk = chunks_[((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE)];
+    uint32_t local_index = ((grid_y % CHUNK_SIZE) * CHUNK_SIZE) + (grid_x % CHUNK_SIZE);
+    if(chunk->tile_image(local_index) == tile_image_id) {
+        return;
+    }
+
+    chunk->writable_tiles()[local_index] = tile_image_id;
+    mark_render_dirty(chunk);
+}
+
+ChunkCells::ptr Layer::copy_block(int32_t x, int32_t y) const {
+    int32_t grid_x = x + int32_t(origin_x_);
+    int32_t grid_y = y + int32_t(origin_y_);
+
+    if(grid_x >= 0 && grid_y >= 0 && !(grid_x % CHUNK_SIZE) && !(grid_y % CHUNK_SIZE) &&
+       uint32_t(grid_x) < chunks_across_ * CHUNK_SIZE && uint32_t(grid_y) < chunks_down_ * CHUNK_SIZE) {
+        //Cells outside the layer are always blank in the chunks too, so the whole chunk can be shared
+        return chunks_[((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE)]->cells;
+    }
+
+    ChunkCells::ptr block(new ChunkCells());
+    for(uint32_t ly = 0; ly < CHUNK_SIZE; ++ly) {
+        for(uint32_t lx = 0; lx < CHUNK_SIZE; ++lx) {
+            int32_t cx = x + int32_t(lx);
+            int32_t cy = y + int32_t(ly);
+            if(cx >= 0 && cy >= 0 && uint32_t(cx) < width_ && uint32_t(cy) < height_) {
+                block->tiles[(ly * CHUNK_SIZE) + lx] = tile_image_at(cx, cy);
+            }
+        }
+    }
+    return block;
+}
+
+void Layer::paste_block(int32_t x, int32_t y, uint32_t width, uint32_t height, const ChunkCells::ptr& cells,
+                        const std::vector<int32_t>* remap, bool skip_empty) {
+    int32_t grid_x = x + int32_t(origin_x_);
+    int32_t grid_y = y + int32_t(origin_y_);
+
+    bool whole_chunk = width >= CHUNK_SIZE && height >= CHUNK_SIZE && grid_x >= 0 && grid_y >= 0 &&
+        !(grid_x % CHUNK_SIZE) && !(grid_y % CHUNK_SIZE) &&
+        in_bounds(grid_x, grid_y) && in_bounds(grid_x + CHUNK_SIZE - 1, grid_y + CHUNK_SIZE - 1);
+
+    if(whole_chunk && !remap && !skip_empty) {
+        const Chunk::ptr& chunk = chunks_[((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE)];
+        if(chunk->cells != cells) {
+            chunk->cells = cells;
+            mark_render_dirty(chunk);
+        }
+        return;
+    }
+
+    for(uint32_t ly = 0; ly < std::min(height, CHUNK_SIZE); ++ly) {
+        for(uint32_t lx = 0; lx < std::min(width, CHUNK_SIZE); ++lx) {
+            int32_t cx = x + int32_t(lx);
+            int32_t cy = y + int32_t(ly);
+            if(cx < 0 || cy < 0 || uint32_t(cx) >= width_ || uint32_t(cy) >= height_) {
+                continue;
+            }
+
+            int32_t tile = cells->tiles[(ly * CHUNK_SIZE) + lx];
+            if(tile < 0 && skip_empty) {
+                continue;
+            }
+
+            if(tile >= 0 && remap) {
+                tile = (uint32_t(tile) < remap->size()) ? (*remap)[tile] : -1;
+            }
+
+            set_tile(cx, cy, tile);
+        }
+    }
+}
+
+void Layer::fill(const CellRect& area, int32_t tile_image_id) {
+    PN_PROFILE_SCOPE("Layer::fill");
+
+    uint32_t end_x = std::min(area.x + area.width, width_);
+    uint32_t end_y = std::min(area.y + area.height, height_);
+    if(area.x >= end_x || area.y >= end_y) {
+        return;
+    }
+
+    for(uint32_t cy = (area.y + origin_y_) / CHUNK_SIZE; cy <= (end_y - 1 + origin_y_) / CHUNK_SIZE; ++cy) {
+        for(uint32_t cx = (area.x + origin_x_) / CHUNK_SIZE; cx <= (end_x - 1 + origin_x_) / CHUNK_SIZE; ++cx) {
+            const Chunk::ptr& chunk = chunks_[(cy * chunks_across_) + cx];
+
+            //The part of the area inside this chunk, in layer cells
+            uint32_t first_x = std::max(area.x, (cx * CHUNK_SIZE > origin_x_) ? cx * CHUNK_SIZE - origin_x_ : 0);
+            uint32_t first_y = std::max(area.y, (cy * CHUNK_SIZE > origin_y_) ? cy * CHUNK_SIZE - origin_y_ : 0);
+            uint32_t last_x = std::min(end_x, (cx + 1) * CHUNK_SIZE - origin_x_);
+            uint32_t last_y = std::min(end_y, (cy + 1) * CHUNK_SIZE - origin_y_);
+
+            if(tile_image_id < 0 && (last_x - first_x) == CHUNK_SIZE && (last_y - first_y) == CHUNK_SIZE) {
+                if(chunk->cells != ChunkCells::blank()) {
+                    chunk->cells = ChunkCells::blank();
+                    mark_render_dirty(chunk);
+                }
+                continue;
+            }
+
+            //Straight into the chunk's cells, copied at most once and marked dirty once
+            int32_t* tiles = nullptr;
+            for(uint32_t y = first_y; y < last_y; ++y) {
+                uint32_t row = ((y + origin_y_) % CHUNK_SIZE) * CHUNK_SIZE;
+                for(uint32_t x = first_x; x < last_x; ++x) {
+                    uint32_t local_index = row + ((x + origin_x_) % CHUNK_SIZE);
+                    if(chunk->tile_image(local_index) == tile_image_id) {
+                        continue;
+                    }
+
+                    if(!tiles) {
+                        tiles = chunk->writable_tiles();
+                    }
+                    tiles[local_index] = tile_image_id;
+                }
+            }
+
+            if(tiles) {
+                mark_render_dirty(chunk);
+            }
+        }
+    }
+}
+
+void Layer::fill(const Selection& selection, int32_t tile_image_id) {
+    PN_PROFILE_SCOPE("Layer::fill");
+    assert(selection.fits(*this));
+
+    for(uint32_t chunk_idx = 0; chunk_idx < chunks_.size(); ++chunk_idx) {
+        if(selection.chunk_empty(chunk_idx)) {
+            continue;
+        }
+
+        const Chunk::ptr& chunk = chunks_[chunk_idx];
+        if(tile_image_id < 0 && selection.chunk_full(chunk_idx)) {
+            if(chunk->cells != ChunkCells::blank()) {
+                chunk->cells = ChunkCells::blank();
+                mark_render_dirty(chunk);
+            }
+            continue;
+        }
+
+        //Only take a copy of the cells if something actually changes
+        const uint64_t* words = selection.chunk_words(chunk_idx);
+        int32_t* tiles = nullptr;
+        for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+            uint64_t bits = words[w];
+            while(bits) {
+                uint32_t local_index = (w * 64) + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                if(chunk->tile_image(local_index) == tile_image_id) {
+                    continue;
+                }
+
+                if(!tiles) {
+                    tiles = chunk->writable_tiles();
+                }
+                tiles[local_index] = tile_image_id;
+            }
+        }
+
+        if(tiles) {
+            mark_render_dirty(chunk);
+        }
+    }
+}
+
+void Layer::mark_render_dirty(const Chunk::ptr& chunk) {
+    //Every change to a chunk's cells comes through here
+    cell_changes_.mark((chunk->grid_y * chunks_across_) + chunk->grid_x);
+
+    if(!view_ || chunk->render_dirty) {
+        return;
+    }
+
+    chunk->render_dirty = true;
+    render_dirty_chunks_.push_back(chunk);
+}
+
+void Layer::flush_render() {
+    PN_PROFILE_SCOPE("Layer::flush_render");
+
+    for(Chunk::ptr& chunk: render_dirty_chunks_) {
+        chunk->render_dirty = false;
+
+        //Chunks dropped by a resize since they were marked only live on in this list
+        if(view_ && !chunk.unique()) {
+            view_->chunk_tiles_changed(*chunk);
+        }
+    }
+
+    render_dirty_chunks_.clear();
+}
+
+bool Layer::in_bounds(uint32_t grid_x, uint32_t grid_y) const {
+    return grid_x >= origin_x_ && grid_x < origin_x_ + width_ &&
+           grid_y >= origin_y_ && grid_y < origin_y_ + height_;
+}
+
 void Layer::resize(uint32_t new_width, uint32_t new_height) {
-    //FIXME: Should preserve existing tiles
-    tiles_.resize(new_width * new_height, TileInstance());
+    extend(0, 0, int32_t(new_width) - int32_t(width_), int32_t(new_height) - int32_t(height_));
 }
 
-void Layer::add_to_scene(kglt::Scene& scene) {
-    mesh_container_ = scene.new_mesh();
-    scene.mesh(mesh_container_).move_to(-(float(parent_.horizontal_tile_count()) / 2.0f), 0.0f, 0.0f);
+void Layer::extend(int32_t left, int32_t bottom, int32_t right, int32_t top) {
+    PN_PROFILE_SCOPE("Layer::extend");
+
+    int32_t new_width = int32_t(width_) + left + right;
+    int32_t new_height = int32_t(height_) + bottom + top;
+    assert(new_width > 0 && new_height > 0);
+
+    /*
+        Work out where cell (0, 0) ends up in the old chunk grid. If it moves
+        off the grid (or a whole chunk into it) then chunk columns/rows are
+        added or dropped, so that cells never have to be copied.
+    */
+    int32_t new_origin_x = int32_t(origin_x_) - left;
+    int32_t new_origin_y = int32_t(origin_y_) - bottom;
 
-    for(uint32_t z = 0; z < parent_.vertical_tile_count(); ++z) {
-        for(uint32_t x = 0; x < parent_.horizontal_tile_count(); ++x) {
-            TileInstance& instance = tiles_[(z * parent_.horizontal_tile_count()) + x];
-            kglt::MeshID new_mesh = scene.new_mesh();
-            instance.mesh_id = new_mesh;
-            instance.border_mesh_id = scene.new_mesh();
+    int32_t first_chunk_x = floor_div(new_origin_x, CHUNK_SIZE);
+    int32_t first_chunk_y = floor_div(new_origin_y, CHUNK_SIZE);
+    new_origin_x -= first_chunk_x * int32_t(CHUNK_SIZE);
+    new_origin_y -= first_chunk_y * int32_t(CHUNK_SIZE);
 
-            //Generate a mesh for the tile
-            kglt::Mesh& mesh = scene.mesh(new_mesh);
-            kglt::procedural::mesh::rectangle(mesh, 1.0, 1.0, 0.5, 0.5);
-            mesh.set_user_data(&instance); //Set the extra data on the mesh to point to this tile instance
-            mesh.set_diffuse_colour(kglt::Colour(0, 0, 0, 0));
+    uint32_t new_across = (new_origin_x + new_width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t new_down = (new_origin_y + new_height + CHUNK_SIZE - 1) / CHUNK_SIZE;
 
-            //Generate a mesh for the border
-            kglt::Mesh& border_mesh = scene.mesh(instance.border_mesh_id);
-            kglt::procedural::mesh::rectangle_outline(border_mesh, 1.0, 1.0, 0.5, 0.5);
+    std::vector<Chunk::ptr> new_chunks(new_across * new_down);
+    std::vector<bool> needs_refresh(new_across * new_down, false);
 
-            border_mesh.set_parent(&mesh);
-            //border_mesh.set_visible(false);
+    for(uint32_t cy = 0; cy < new_down; ++cy) {
+        for(uint32_t cx = 0; cx < new_across; ++cx) {
+            int32_t old_cx = int32_t(cx) + first_chunk_x;
+            int32_t old_cy = int32_t(cy) + first_chunk_y;
+            uint32_t idx = (cy * new_across) + cx;
 
-            mesh.move_to(float(x), float(z) - (float(parent_.vertical_tile_count()) / 2.0), -1.0 - (0.1 * (float) zindex()));
-            border_mesh.move_to(0, 0, 0.01); //Move the border mesh slightly forward
+            if(old_cx >= 0 && old_cy >= 0 && old_cx < int32_t(chunks_across_) && old_cy < int32_t(chunks_down_)) {
+                uint32_t old_idx = (old_cy * chunks_across_) + old_cx;
+                new_chunks[idx].swap(chunks_[old_idx]);
+                new_chunks[idx]->grid_x = cx;
+                new_chunks[idx]->grid_y = cy;
 
-            mesh.set_parent(&scene.mesh(mesh_container_));
+                //Chunks that were on the old border may have gained or lost cells
+                bool old_border = (old_cx == 0 || old_cy == 0 || old_cx == int32_t(chunks_across_) - 1 || old_cy == int32_t(chunks_down_) - 1);
+                bool new_border = (cx == 0 || cy == 0 || cx == new_across - 1 || cy == new_down - 1);
+                needs_refresh[idx] = old_border || new_border;
+            } else {
+                new_chunks[idx].reset(new Chunk());
+                new_chunks[idx]->grid_x = cx;
+                new_chunks[idx]->grid_y = cy;
+                needs_refresh[idx] = true;
+            }
+        }
+    }
+
+    //Anything left behind has fallen off the edge of the layer
+    for(Chunk::ptr& dropped: chunks_) {
+        if(dropped && view_) {
+            view_->chunk_dropped(*dropped);
+        }
+    }
+
+    chunks_.swap(new_chunks);
+    chunks_across_ = new_across;
+    chunks_down_ = new_down;
+    origin_x_ = new_origin_x;
+    origin_y_ = new_origin_y;
+    width_ = new_width;
+    height_ = new_height;
+    cell_changes_.mark_all(chunks_.size());
+
+    if(view_) {
+        view_->layer_geometry_changed();
+    }
+
+    for(uint32_t cy = 0; cy < chunks_down_; ++cy) {
+        for(uint32_t cx = 0; cx < chunks_across_; ++cx) {
+            Chunk& chunk = *chunks_[(cy * chunks_across_) + cx];
+            if(needs_refresh[(cy * chunks_across_) + cx]) {
+                clip_chunk(chunk);
+                if(view_) {
+                    view_->chunk_changed(chunk);
+                }
+            } else if(view_ && (first_chunk_x || first_chunk_y)) {
+                //Interior chunks keep their contents but their grid position may have shifted
+                view_->chunk_moved(chunk);
+            }
         }
     }
 }
 
-void Layer::remove_from_scene(kglt::Scene& scene) {
+void Layer::clip_chunk(Chunk& chunk) {
+    if(chunk.cells == ChunkCells::blank()) {
+        return;
+    }
 
+    //Cells outside the layer are always blank, so growing again doesn't resurrect them
+    for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+        uint32_t grid_x = (chunk.grid_x * CHUNK_SIZE) + (i % CHUNK_SIZE);
+        uint32_t grid_y = (chunk.grid_y * CHUNK_SIZE) + (i / CHUNK_SIZE);
+        if(!in_bounds(grid_x, grid_y) && chunk.tile_image(i) >= 0) {
+            chunk.writable_tiles()[i] = -1;
+        }
+    }
 }
 
 }
@@ -2,24 +2,41 @@
 #define LAYER_H
 
 #include <string>
+#include <vector>
 #include <tr1/memory>
 
-#include <kglt/kglt.h>
+#include "chunk.h"
+#include "rect_merge.h"
 
 namespace pn {
 
 class Level;
 class Layer;
+class Selection;
+
+/*
+    Whatever draws a layer. The layer owns the cells and tells its view
+    when chunks come, go, move or need their tiles redrawn; the view keeps
+    its own state in Chunk::render.
+*/
+class LayerView {
+public:
+    virtual ~LayerView() {}
+
+    //Size, origin or z-index changed
+    virtual void layer_geometry_changed() = 0;
+
+    //A new chunk, or one whose cells were clipped or uncovered by a resize
+    virtual void chunk_changed(Chunk& chunk) = 0;
 
-struct TileInstance {
-    TileInstance():
-        tile_image_id(-1) {
+    //An untouched chunk whose grid position shifted
+    virtual void chunk_moved(Chunk& chunk) = 0;
 
-    }
+    //About to be destroyed, release everything attached to it
+    virtual void chunk_dropped(Chunk& chunk) = 0;
 
-    int32_t tile_image_id;
-    kglt::MeshID mesh_id;
-    kglt::MeshID border_mesh_id;
+    //Tile images changed somewhere in the chunk since the last flush
+    virtual void chunk_tiles_changed(Chunk& chunk) = 0;
 };
 
 class Layer {
@@ -27,25 +44,107 @@ public:
     typedef std::tr1::shared_ptr<Layer> ptr;
 
     Layer(Level& parent);
+    ~Layer();
+
     std::string name() const { return name_; }
+    void set_name(const std::string& name) { name_ = name; }
+
+    Level& level() { return parent_; }
 
-    void add_to_scene(kglt::Scene& scene);
-    void remove_from_scene(kglt::Scene& scene);
+    void set_view(LayerView* view) { view_ = view; }
+    LayerView* view() const { return view_; }
 
-    void set_zindex(int32_t zindex) { zindex_ = zindex; }
+    void set_zindex(int32_t zindex);
     int32_t zindex() const { return zindex_; }
 
+    //How far the layer scrolls per tile the camera moves in the parallax preview, 0 stays put on screen
+    void set_parallax(float parallax) { parallax_ = parallax; }
+    float parallax() const { return parallax_; }
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    int32_t tile_image_at(uint32_t x, uint32_t y) const;
+
+    /*
+        Changes the tile at a cell. The view isn't told until
+        flush_render() so that bulk edits touch each chunk once.
+    */
+    void set_tile(uint32_t x, uint32_t y, int32_t tile_image_id);
+    void flush_render();
+
+    /*
+        The CHUNK_SIZE square of cells whose top left is (x, y), with cells
+        outside the layer empty. If that square is exactly one of this
+        layer's chunks its cells are shared rather than copied.
+    */
+    ChunkCells::ptr copy_block(int32_t x, int32_t y) const;
+
+    /*
+        Writes the top left width x height cells of a block with its top
+        left at (x, y), clipped to the layer. Tile ids are translated
+        through remap if there is one, and empty cells are skipped if
+        skip_empty is set. A whole block that lands exactly on a chunk and
+        replaces every cell is shared instead of copied.
+    */
+    void paste_block(int32_t x, int32_t y, uint32_t width, uint32_t height, const ChunkCells::ptr& cells,
+                     const std::vector<int32_t>* remap=nullptr, bool skip_empty=false);
+
+    //Sets every cell in the area (clipped to the layer), whole chunks cleared to -1 go back to sharing the blank block
+    void fill(const CellRect& area, int32_t tile_image_id);
+
+    //Sets every selected cell, the selection must have been made for this layer
+    void fill(const Selection& selection, int32_t tile_image_id);
+
+    //Finds the layer coordinates of a cell within one of this layer's chunks
+    bool cell_position(const Chunk& chunk, uint32_t local_index, uint32_t& x, uint32_t& y) const;
+
+    //The chunk grid, for views. Grid cell (x + origin_x, y + origin_y) is layer cell (x, y)
+    uint32_t origin_x() const { return origin_x_; }
+    uint32_t origin_y() const { return origin_y_; }
+    uint32_t chunks_across() const { return chunks_across_; }
+    uint32_t chunks_down() const { return chunks_down_; }
+    Chunk& chunk(uint32_t chunk_x, uint32_t chunk_y) { return *chunks_[(chunk_y * chunks_across_) + chunk_x]; }
+    const Chunk& chunk(uint32_t chunk_x, uint32_t chunk_y) const { return *chunks_[(chunk_y * chunks_across_) + chunk_x]; }
+    bool in_bounds(uint32_t grid_x, uint32_t grid_y) const;
+
+    /*
+        Grows (positive) or shrinks (negative) the layer by the given number
+        of cells at each edge, keeping existing tiles where they are relative
+        to each other. Only chunk pointers are moved, and only chunks along
+        the old and new borders have their render state touched.
+    */
+    void extend(int32_t left, int32_t bottom, int32_t right, int32_t top);
     void resize(uint32_t new_width, uint32_t new_height);
 
+    //For snapshots, see ChunkChanges
+    bool take_cell_changes(std::vector<uint32_t>& chunk_indices) { return cell_changes_.take(chunk_indices); }
+
 private:
     Level& parent_;
+    LayerView* view_;
 
     std::string name_;
     int32_t zindex_;
+    float parallax_;
+
+    uint32_t width_;
+    uint32_t height_;
+
+    //Offset of cell (0, 0) within the chunk grid, always less than CHUNK_SIZE
+    uint32_t origin_x_;
+    uint32_t origin_y_;
+
+    uint32_t chunks_across_;
+    uint32_t chunks_down_;
+    std::vector<Chunk::ptr> chunks_;
 
-    std::vector<TileInstance> tiles_;
+    std::vector<Chunk::ptr> render_dirty_chunks_;
+    ChunkChanges cell_changes_;
 
-    kglt::MeshID mesh_container_;
+    Chunk& chunk_containing(uint32_t x, uint32_t y, uint32_t& local_index) const;
+    void mark_render_dirty(const Chunk::ptr& chunk);
+    void clip_chunk(Chunk& chunk);
 };
 
 }
@@ -1,16 +1,17 @@
 #include "level.h"
 #include "layer.h"
 
-#include <glibmm/i18n.h>
+#include "i18n.h"
+#include "kazbase/logging/logging.h"
 
 namespace pn {
 
-Level::Level(kglt::Scene& scene):
-    scene_(scene),
+Level::Level(uint32_t width, uint32_t height):
     name_(_("Untitled")),
     active_layer_(0),
-    horizontal_tile_count_(40),
-    vertical_tile_count_(10) {
+    horizontal_tile_count_(width),
+    vertical_tile_count_(height),
+    metadata_(width, height) {
 
     add_layer();
 }
@@ -23,6 +24,36 @@ uint32_t Level::vertical_tile_count() const {
     return vertical_tile_count_;
 }
 
+void Level::extend(int32_t left, int32_t bottom, int32_t right, int32_t top) {
+    int32_t new_width = int32_t(horizontal_tile_count_) + left + right;
+    int32_t new_height = int32_t(vertical_tile_count_) + bottom + top;
+
+    if(new_width < 1 || new_height < 1) {
+        L_WARN("Ignoring a resize that would leave the level empty");
+        return;
+    }
+
+    horizontal_tile_count_ = new_width;
+    vertical_tile_count_ = new_height;
+
+    for(std::tr1::shared_ptr<Layer>& layer: layers_) {
+        layer->extend(left, bottom, right, top);
+    }
+    metadata_.extend(left, bottom, right, top);
+
+    signal_size_changed_();
+}
+
+void Level::resize(uint32_t width, uint32_t height) {
+    extend(0, 0, int32_t(width) - int32_t(horizontal_tile_count_), int32_t(height) - int32_t(vertical_tile_count_));
+}
+
+void Level::flush_render() {
+    for(std::tr1::shared_ptr<Layer>& layer: layers_) {
+        layer->flush_render();
+    }
+}
+
 uint32_t Level::layer_count() const {
     return layers_.size();
 }
@@ -36,13 +67,13 @@ void Level::add_layer() {
 
     //Set the zindex
     layer_at(layer_count() - 1).set_zindex(layer_count());
-    layer_at(layer_count() - 1).add_to_scene(scene_);
 
+    signal_layer_added_(layer_at(layer_count() - 1));
     signal_layers_changed_();
 }
 
 void Level::remove_layer(uint32_t idx) {        
-    layer_at(idx).remove_from_scene(scene_);
+    signal_layer_removing_(layer_at(idx));
     layers_.erase(layers_.begin() + idx);
 
     //Rebuild the zindex
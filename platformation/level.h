@@ -8,17 +8,25 @@
 
 #include <tr1/memory>
 
-#include <kglt/kglt.h>
+#include "palette.h"
+#include "metadata_layer.h"
 
 namespace pn {
 
 class Layer;
 
+const uint32_t DEFAULT_LEVEL_WIDTH = 40;
+const uint32_t DEFAULT_LEVEL_HEIGHT = 10;
+
 class Level {
 public:
     typedef std::tr1::shared_ptr<Level> ptr;
 
-    Level(kglt::Scene& scene);
+    /*
+        Levels are pure data and never touch the scene; the editor draws one
+        by attaching a LevelRenderer. The command line tool doesn't.
+    */
+    Level(uint32_t width=DEFAULT_LEVEL_WIDTH, uint32_t height=DEFAULT_LEVEL_HEIGHT);
 
     void set_active_layer(uint32_t active) { active_layer_ = active; }
     uint32_t active_layer() const { return active_layer_; }
@@ -34,12 +42,31 @@ public:
         return signal_layers_changed_;
     }
 
+    sigc::signal<void>& signal_size_changed() {
+        return signal_size_changed_;
+    }
+
+    sigc::signal<void, Layer&>& signal_layer_added() { return signal_layer_added_; }
+    sigc::signal<void, Layer&>& signal_layer_removing() { return signal_layer_removing_; }
+
     uint32_t horizontal_tile_count() const;
     uint32_t vertical_tile_count() const;
 
-private:
-    kglt::Scene& scene_;
+    /*
+        Grows (or with negative values, shrinks) every layer at the given
+        edges. Existing tiles are preserved.
+    */
+    void extend(int32_t left, int32_t bottom, int32_t right, int32_t top);
+    void resize(uint32_t width, uint32_t height);
 
+    Palette& palette() { return palette_; }
+
+    //Collision and trigger flags, always the same size as the visual layers
+    MetadataLayer& metadata() { return metadata_; }
+
+    void flush_render();
+
+private:
     std::string name_;
     uint32_t active_layer_;
     std::vector<std::tr1::shared_ptr<Layer> > layers_;
@@ -47,7 +74,13 @@ private:
     uint32_t horizontal_tile_count_;
     uint32_t vertical_tile_count_;
 
+    Palette palette_;
+    MetadataLayer metadata_;
+
     sigc::signal<void> signal_layers_changed_;
+    sigc::signal<void> signal_size_changed_;
+    sigc::signal<void, Layer&> signal_layer_added_;
+    sigc::signal<void, Layer&> signal_layer_removing_;
 
 };
 
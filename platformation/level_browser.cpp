@@ -0,0 +1,222 @@
+#include <chrono>
+#include <algorithm>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/os/path.h"
+#include "kazbase/string.h"
+
+#include "level_browser.h"
+#include "parallel.h"
+
+namespace pn {
+
+namespace {
+
+std::string directory_of(const std::string& path) {
+    size_t slash = path.rfind('/');
+    return (slash == std::string::npos) ? std::string() : path.substr(0, slash);
+}
+
+bool is_level_file(const std::string& name) {
+    std::string lowered(name);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+    return str::ends_with(lowered, ".pnl") || str::ends_with(lowered, ".json");
+}
+
+void find_levels_under(const std::string& directory, std::vector<std::string>& out) {
+    for(std::string name: os::path::list_dir(directory)) {
+        if(str::starts_with(name, ".")) {
+            continue;
+        }
+
+        std::string path = os::path::join(directory, name);
+        if(os::path::is_dir(path)) {
+            find_levels_under(path, out);
+        } else if(is_level_file(name)) {
+            out.push_back(path);
+        }
+    }
+}
+
+}
+
+LevelBrowser::LevelBrowser(ThumbnailCache& cache, const std::string& directory, uint32_t threads):
+    cache_(cache),
+    directory_(directory),
+    threads_(threads),
+    cancel_(false),
+    done_(false),
+    elapsed_ms_(0) {
+
+    std::vector<std::string> paths = find_levels(directory);
+    entries_.resize(paths.size());
+    files_.resize(paths.size());
+    for(uint32_t i = 0; i < paths.size(); ++i) {
+        entries_[i].path = paths[i];
+    }
+
+    thread_ = std::thread(&LevelBrowser::run, this);
+}
+
+LevelBrowser::~LevelBrowser() {
+    cancel_ = true;
+    thread_.join();
+}
+
+std::vector<std::string> LevelBrowser::find_levels(const std::string& directory) {
+    std::vector<std::string> result;
+    if(os::path::is_dir(directory)) {
+        find_levels_under(directory, result);
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+bool LevelBrowser::take_finished(std::vector<uint32_t>& indices) {
+    std::lock_guard<std::mutex> guard(lock_);
+    indices.clear();
+    indices.swap(finished_);
+    return !done_ || !indices.empty();
+}
+
+Level::ptr LevelBrowser::open(uint32_t idx) const {
+    const std::string& path = entries_.at(idx).path;
+
+    MappedFile::ptr file;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        file = files_[idx];
+    }
+
+    //Saved over since it was mapped, the mapping still has the old contents
+    if(!file || !file->current()) {
+        return load_level(path);
+    }
+    return read_level(file->data(), file->size(), level_format_for_path(path));
+}
+
+void LevelBrowser::publish(uint32_t idx) {
+    std::lock_guard<std::mutex> guard(lock_);
+    finished_.push_back(idx);
+}
+
+bool LevelBrowser::lookup(uint32_t idx) {
+    LevelEntry& entry = entries_[idx];
+
+    MappedFile::ptr file = MappedFile::open(entry.path);
+    if(!file) {
+        entry.state = LEVEL_ENTRY_FAILED;
+        entry.error = "Unable to open " + entry.path;
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        files_[idx] = file;
+    }
+
+    LevelFormat format = level_format_for_path(entry.path);
+    entry.hash = ThumbnailCache::content_hash(file->data(), file->size());
+    entry.has_summary = read_level_summary(file->data(), file->size(), format, entry.summary);
+
+    //JSON levels need parsing for their palette, which only rendering does, so they're looked up there
+    if(entry.has_summary) {
+        entry.hash = ThumbnailCache::key_for(entry.hash, entry.summary.palette, directory_of(entry.path));
+        if(cache_.load(entry.hash, entry.thumbnail)) {
+            entry.from_cache = true;
+            entry.state = LEVEL_ENTRY_READY;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void LevelBrowser::render(uint32_t idx) {
+    LevelEntry& entry = entries_[idx];
+
+    MappedFile::ptr file;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        file = files_[idx];
+    }
+
+    try {
+        Level::ptr level = read_level(file->data(), file->size(), level_format_for_path(entry.path));
+
+        //Levels with a summary were already keyed and looked up by lookup()
+        bool looked_up = entry.has_summary;
+
+        entry.has_summary = true;
+        entry.summary.name = level->name();
+        entry.summary.width = level->horizontal_tile_count();
+        entry.summary.height = level->vertical_tile_count();
+        entry.summary.palette_size = level->palette().size();
+        entry.summary.layer_count = level->layer_count();
+        entry.summary.palette.clear();
+        for(uint32_t id = 0; id < level->palette().size(); ++id) {
+            entry.summary.palette.push_back(level->palette().path_for_id(id));
+        }
+
+        if(!looked_up) {
+            entry.hash = ThumbnailCache::key_for(entry.hash, entry.summary.palette, directory_of(entry.path));
+            entry.from_cache = cache_.load(entry.hash, entry.thumbnail);
+        }
+
+        if(!entry.from_cache) {
+            //Levels are already spread over the cores
+            RenderOptions options;
+            options.base_directory = directory_of(entry.path);
+            options.threads = 1;
+
+            render_thumbnail(*level, cache_.size(), options, entry.thumbnail);
+            cache_.store(entry.hash, entry.thumbnail);
+        }
+
+        entry.state = LEVEL_ENTRY_READY;
+    } catch(std::exception& e) {
+        entry.state = LEVEL_ENTRY_FAILED;
+        entry.error = e.what();
+        L_WARN("Unable to thumbnail " + entry.path + ": " + entry.error);
+    }
+}
+
+void LevelBrowser::run() {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uint8_t> missed(entries_.size(), false);
+    parallel_for(entries_.size(), threads_, [&](uint32_t i) {
+        if(cancel_) {
+            return;
+        }
+
+        if(lookup(i)) {
+            publish(i);
+        } else {
+            missed[i] = true;
+        }
+    });
+
+    std::vector<uint32_t> to_render;
+    for(uint32_t i = 0; i < missed.size(); ++i) {
+        if(missed[i]) {
+            to_render.push_back(i);
+        }
+    }
+
+    parallel_for(to_render.size(), threads_, [&](uint32_t i) {
+        if(cancel_) {
+            return;
+        }
+
+        render(to_render[i]);
+        publish(to_render[i]);
+    });
+
+    std::lock_guard<std::mutex> guard(lock_);
+    elapsed_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    done_ = true;
+}
+
+}
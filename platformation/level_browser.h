@@ -0,0 +1,100 @@
+#ifndef LEVEL_BROWSER_H
+#define LEVEL_BROWSER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <tr1/memory>
+
+#include "level.h"
+#include "level_file.h"
+#include "compositor.h"
+#include "thumbnail_cache.h"
+#include "mapped_file.h"
+
+namespace pn {
+
+enum LevelEntryState {
+    LEVEL_ENTRY_PENDING,
+    LEVEL_ENTRY_READY,
+    LEVEL_ENTRY_FAILED
+};
+
+struct LevelEntry {
+    LevelEntry():
+        has_summary(false),
+        hash(0),
+        from_cache(false),
+        state(LEVEL_ENTRY_PENDING) {}
+
+    std::string path;
+    bool has_summary; //JSON levels only get one once they've been rendered
+    LevelSummary summary;
+    uint64_t hash;
+    Image thumbnail;
+    bool from_cache;
+    LevelEntryState state;
+    std::string error;
+};
+
+/*
+    Every level file under a project directory, with thumbnails produced on
+    a background thread. Each file is mapped and hashed, and thumbnails
+    found in the cache are handed out first. Only once every cached one is
+    out are the rest rendered, so a warm cache fills the whole list before
+    any rendering starts.
+
+    Entries are filled in by the worker threads. The main thread should only
+    look at an entry's thumbnail, summary and state once take_finished()
+    has returned its index.
+*/
+class LevelBrowser {
+public:
+    typedef std::tr1::shared_ptr<LevelBrowser> ptr;
+
+    LevelBrowser(ThumbnailCache& cache, const std::string& directory, uint32_t threads=0);
+    ~LevelBrowser(); //Cancels thumbnails still to do
+
+    const std::string& directory() const { return directory_; }
+
+    uint32_t entry_count() const { return entries_.size(); }
+    const LevelEntry& entry(uint32_t idx) const { return entries_.at(idx); }
+
+    //Indices of the entries finished since the last call, returns false once everything is done and taken
+    bool take_finished(std::vector<uint32_t>& indices);
+
+    //Parsed from the mapping made when the entry was hashed if the file hasn't changed since. Throws LevelFileError
+    Level::ptr open(uint32_t idx) const;
+
+    //Level files (.pnl and .json) under directory, sorted by path
+    static std::vector<std::string> find_levels(const std::string& directory);
+
+    //Time from starting to the last thumbnail, only meaningful once take_finished() has returned false
+    double elapsed_ms() const { return elapsed_ms_; }
+
+private:
+    ThumbnailCache& cache_;
+    std::string directory_;
+    uint32_t threads_;
+    std::vector<LevelEntry> entries_;
+    std::vector<MappedFile::ptr> files_; //Kept from hashing through rendering to opening, so each file is only read once
+
+    std::thread thread_;
+    std::atomic<bool> cancel_;
+    mutable std::mutex lock_; //Guards files_ and finished_
+    std::vector<uint32_t> finished_;
+    bool done_;
+    double elapsed_ms_;
+
+    void run();
+    bool lookup(uint32_t idx);
+    void render(uint32_t idx);
+    void publish(uint32_t idx);
+};
+
+}
+
+#endif // LEVEL_BROWSER_H
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+
+#include "level_diff.h"
+#include "layer.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+/*
+    Reads one layer (or the metadata) of a level a CHUNK_SIZE block at a
+    time in layer cells, with tile ids translated into the diff's palette
+    when a remap is given. After seek() everything is worked out on
+    demand, so a block whose identity matches the other side's is never
+    read at all.
+
+    Blocks line up with chunks unless the layer was extended to the left
+    or bottom, in which case they're gathered cell by cell. Metadata is
+    compared as its flag bitsets and tiles as their values, so both ways
+    of reading a block compare the same.
+*/
+class BlockReader {
+public:
+    BlockReader(Level& level, uint32_t layer_index, const std::vector<int32_t>* remap):
+        layer_(nullptr),
+        metadata_(nullptr),
+        remap_(remap),
+        block_x_(0),
+        block_y_(0) {
+
+        if(layer_index == METADATA_LAYER_INDEX) {
+            metadata_ = &level.metadata();
+        } else if(layer_index < level.layer_count()) {
+            layer_ = &level.layer_at(layer_index);
+        }
+    }
+
+    Layer* layer() const { return layer_; }
+    MetadataLayer* metadata() const { return metadata_; }
+
+    void seek(uint32_t block_x, uint32_t block_y) {
+        block_x_ = block_x;
+        block_y_ = block_y;
+        identity_ = nullptr;
+        tiles_ = nullptr;
+        flags_ = nullptr;
+        values_ = nullptr;
+
+        if(layer_ && lines_up(layer_->origin_x(), layer_->origin_y(), layer_->width(), layer_->height())) {
+            const ChunkCells::ptr& cells = layer_->chunk(block_x, block_y).cells;
+            tiles_ = cells->tiles;
+            identity_ = remap_ ? nullptr : cells.get();
+        } else if(metadata_ && lines_up(metadata_->origin_x(), metadata_->origin_y(), metadata_->width(), metadata_->height())) {
+            const MetadataChunk::ptr& chunk = metadata_->chunk(block_x, block_y);
+            flags_ = chunk->flags;
+            identity_ = chunk.get();
+        }
+    }
+
+    //The block's chunk data if it's exactly that, blocks with the same identity are the same
+    const void* identity() const { return identity_; }
+
+    //Same cells as the other side's current block, by identity if they share a chunk and by value if not
+    bool same_as(BlockReader& other) {
+        if(identity_ && identity_ == other.identity_) {
+            return true;
+        }
+
+        if(metadata_) {
+            const std::bitset<CHUNK_AREA>* flags = this->flags();
+            const std::bitset<CHUNK_AREA>* other_flags = other.flags();
+            for(uint32_t flag = 0; flag < MAX_METADATA_FLAGS; ++flag) {
+                if(flags[flag] != other_flags[flag]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        return memcmp(values(), other.values(), CHUNK_AREA * sizeof(int32_t)) == 0;
+    }
+
+    //Tile ids, or flags for the metadata. Empty cells and missing layers read as -1 (0 for flags)
+    const int32_t* values() {
+        if(values_) {
+            return values_;
+        }
+
+        if(metadata_) {
+            const std::bitset<CHUNK_AREA>* flags = this->flags();
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                value_scratch_[i] = 0;
+            }
+
+            for(uint32_t flag = 0; flag < MAX_METADATA_FLAGS; ++flag) {
+                if(flags[flag].none()) {
+                    continue;
+                }
+
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    if(flags[flag].test(i)) {
+                        value_scratch_[i] |= (1 << flag);
+                    }
+                }
+            }
+        } else if(!layer_) {
+            std::fill(value_scratch_, value_scratch_ + CHUNK_AREA, -1);
+        } else {
+            const int32_t* tiles = tiles_;
+            if(!tiles) {
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    uint32_t x = (block_x_ * CHUNK_SIZE) + (i % CHUNK_SIZE);
+                    uint32_t y = (block_y_ * CHUNK_SIZE) + (i / CHUNK_SIZE);
+                    value_scratch_[i] = (x < layer_->width() && y < layer_->height()) ? layer_->tile_image_at(x, y) : -1;
+                }
+                tiles = value_scratch_;
+            }
+
+            if(!remap_) {
+                values_ = tiles;
+                return values_;
+            }
+
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                int32_t tile = tiles[i];
+                value_scratch_[i] = (tile >= 0 && uint32_t(tile) < remap_->size()) ? (*remap_)[tile] : -1;
+            }
+        }
+
+        values_ = value_scratch_;
+        return values_;
+    }
+
+private:
+    Layer* layer_;
+    MetadataLayer* metadata_;
+    const std::vector<int32_t>* remap_;
+
+    uint32_t block_x_;
+    uint32_t block_y_;
+    const void* identity_;
+    const int32_t* tiles_; //Straight into the chunk when the block lines up with one
+    const std::bitset<CHUNK_AREA>* flags_;
+    const int32_t* values_;
+
+    int32_t value_scratch_[CHUNK_AREA];
+    std::bitset<CHUNK_AREA> flag_scratch_[MAX_METADATA_FLAGS];
+
+    bool lines_up(uint32_t origin_x, uint32_t origin_y, uint32_t width, uint32_t height) const {
+        return !origin_x && !origin_y && (block_x_ + 1) * CHUNK_SIZE <= width && (block_y_ + 1) * CHUNK_SIZE <= height;
+    }
+
+    const std::bitset<CHUNK_AREA>* flags() {
+        if(flags_) {
+            return flags_;
+        }
+
+        for(uint32_t flag = 0; flag < MAX_METADATA_FLAGS; ++flag) {
+            flag_scratch_[flag].reset();
+        }
+
+        for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+            uint32_t x = (block_x_ * CHUNK_SIZE) + (i % CHUNK_SIZE);
+            uint32_t y = (block_y_ * CHUNK_SIZE) + (i / CHUNK_SIZE);
+            MetadataFlags cell = (x < metadata_->width() && y < metadata_->height()) ? metadata_->flags_at(x, y) : 0;
+            for(uint32_t flag = 0; flag < MAX_METADATA_FLAGS; ++flag) {
+                flag_scratch_[flag].set(i, (cell & (1 << flag)) != 0);
+            }
+        }
+
+        flags_ = flag_scratch_;
+        return flags_;
+    }
+};
+
+/*
+    Adds other's paths to palette, returning the id translation for other
+    or an empty vector if its ids are already the same in palette.
+*/
+std::vector<int32_t> merge_palette(Palette& palette, Palette& other) {
+    std::vector<int32_t> remap(other.size());
+
+    bool identity = true;
+    for(uint32_t i = 0; i < other.size(); ++i) {
+        remap[i] = palette.id_for_path(other.path_for_id(i));
+        identity = identity && remap[i] == int32_t(i);
+    }
+
+    if(identity) {
+        remap.clear();
+    }
+    return remap;
+}
+
+}
+
+LevelDiff diff_levels(Level& before, Level& after) {
+    PN_PROFILE_SCOPE("diff_levels");
+
+    LevelDiff diff;
+
+    //Ids in before stay as they are, after's are translated if its palette differs
+    Palette palette;
+    merge_palette(palette, before.palette());
+    std::vector<int32_t> after_remap = merge_palette(palette, after.palette());
+    for(uint32_t i = 0; i < palette.size(); ++i) {
+        diff.palette.push_back(palette.path_for_id(i));
+    }
+
+    uint32_t width = std::max(before.horizontal_tile_count(), after.horizontal_tile_count());
+    uint32_t height = std::max(before.vertical_tile_count(), after.vertical_tile_count());
+    uint32_t blocks_across = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t blocks_down = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    std::vector<uint32_t> layers;
+    for(uint32_t l = 0; l < std::max(before.layer_count(), after.layer_count()); ++l) {
+        layers.push_back(l);
+    }
+    layers.push_back(METADATA_LAYER_INDEX);
+
+    for(uint32_t layer: layers) {
+        BlockReader before_block(before, layer, nullptr);
+        BlockReader after_block(after, layer, after_remap.empty() ? nullptr : &after_remap);
+
+        for(uint32_t by = 0; by < blocks_down; ++by) {
+            for(uint32_t bx = 0; bx < blocks_across; ++bx) {
+                before_block.seek(bx, by);
+                after_block.seek(bx, by);
+
+                if(before_block.same_as(after_block)) {
+                    diff.blocks_skipped++;
+                    continue;
+                }
+
+                diff.blocks_compared++;
+                const int32_t* before_values = before_block.values();
+                const int32_t* after_values = after_block.values();
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    if(before_values[i] != after_values[i]) {
+                        CellDifference difference = {
+                            layer, (bx * CHUNK_SIZE) + (i % CHUNK_SIZE), (by * CHUNK_SIZE) + (i / CHUNK_SIZE),
+                            before_values[i], after_values[i]
+                        };
+                        diff.differences.push_back(difference);
+                    }
+                }
+            }
+        }
+    }
+
+    return diff;
+}
+
+namespace {
+
+//Copies a whole block from one side into the merged level, sharing chunks where the grids line up
+void take_block(BlockReader& source, Level& merged, uint32_t layer, uint32_t bx, uint32_t by, const std::vector<int32_t>* remap) {
+    uint32_t x = bx * CHUNK_SIZE;
+    uint32_t y = by * CHUNK_SIZE;
+    uint32_t width = std::min(CHUNK_SIZE, merged.horizontal_tile_count() - x);
+    uint32_t height = std::min(CHUNK_SIZE, merged.vertical_tile_count() - y);
+
+    if(source.metadata()) {
+        merged.metadata().paste_block(x, y, width, height, source.metadata()->copy_block(x, y));
+    } else if(source.layer()) {
+        merged.layer_at(layer).paste_block(x, y, width, height, source.layer()->copy_block(x, y), remap);
+    }
+    //A side without this layer has nothing to copy, and the merged level starts out empty
+}
+
+}
+
+LevelMerge merge_levels(Level& base, Level& ours, Level& theirs, ConflictResolution resolution) {
+    PN_PROFILE_SCOPE("merge_levels");
+
+    uint32_t base_width = base.horizontal_tile_count(), base_height = base.vertical_tile_count();
+    uint32_t ours_width = ours.horizontal_tile_count(), ours_height = ours.vertical_tile_count();
+    uint32_t theirs_width = theirs.horizontal_tile_count(), theirs_height = theirs.vertical_tile_count();
+
+    bool ours_resized = ours_width != base_width || ours_height != base_height;
+    bool theirs_resized = theirs_width != base_width || theirs_height != base_height;
+    if(ours_resized && theirs_resized && (ours_width != theirs_width || ours_height != theirs_height)) {
+        throw LevelMergeError("Both sides resized the level differently");
+    }
+
+    uint32_t width = ours_resized ? ours_width : theirs_width;
+    uint32_t height = ours_resized ? ours_height : theirs_height;
+
+    LevelMerge result;
+    result.level.reset(new Level(width, height));
+    Level& merged = *result.level;
+    merged.set_name((ours.name() != base.name()) ? ours.name() : theirs.name());
+
+    //Our ids carry over unchanged, so our blocks can always be shared
+    std::vector<int32_t> ours_remap = merge_palette(merged.palette(), ours.palette());
+    std::vector<int32_t> theirs_remap = merge_palette(merged.palette(), theirs.palette());
+    std::vector<int32_t> base_remap = merge_palette(merged.palette(), base.palette());
+
+    uint32_t layer_count = std::max(ours.layer_count(), theirs.layer_count());
+    while(merged.layer_count() < layer_count) {
+        merged.add_layer();
+    }
+
+    std::vector<uint32_t> layers;
+    for(uint32_t l = 0; l < layer_count; ++l) {
+        bool ours_renamed = l < ours.layer_count() && (l >= base.layer_count() || ours.layer_at(l).name() != base.layer_at(l).name());
+        bool use_ours = l < ours.layer_count() && (ours_renamed || l >= theirs.layer_count());
+        merged.layer_at(l).set_name(use_ours ? ours.layer_at(l).name() : theirs.layer_at(l).name());
+        layers.push_back(l);
+    }
+    layers.push_back(METADATA_LAYER_INDEX);
+
+    uint32_t blocks_across = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t blocks_down = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    for(uint32_t layer: layers) {
+        const std::vector<int32_t>* theirs_map = theirs_remap.empty() ? nullptr : &theirs_remap;
+
+        BlockReader base_block(base, layer, base_remap.empty() ? nullptr : &base_remap);
+        BlockReader ours_block(ours, layer, ours_remap.empty() ? nullptr : &ours_remap);
+        BlockReader theirs_block(theirs, layer, theirs_map);
+
+        for(uint32_t by = 0; by < blocks_down; ++by) {
+            for(uint32_t bx = 0; bx < blocks_across; ++bx) {
+                base_block.seek(bx, by);
+                ours_block.seek(bx, by);
+                theirs_block.seek(bx, by);
+
+                //Only one side (or neither) touched this block
+                if(ours_block.same_as(theirs_block) || theirs_block.same_as(base_block)) {
+                    take_block(ours_block, merged, layer, bx, by, nullptr);
+                    result.blocks_skipped++;
+                    continue;
+                } else if(ours_block.same_as(base_block)) {
+                    take_block(theirs_block, merged, layer, bx, by, theirs_map);
+                    result.blocks_skipped++;
+                    continue;
+                }
+
+                result.blocks_merged++;
+                const int32_t* base_values = base_block.values();
+                const int32_t* ours_values = ours_block.values();
+                const int32_t* theirs_values = theirs_block.values();
+                for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                    uint32_t x = (bx * CHUNK_SIZE) + (i % CHUNK_SIZE);
+                    uint32_t y = (by * CHUNK_SIZE) + (i / CHUNK_SIZE);
+                    if(x >= width || y >= height) {
+                        continue;
+                    }
+
+                    int32_t value = ours_values[i];
+                    if(layer == METADATA_LAYER_INDEX) {
+                        //Flags merge bit by bit, a bit changed on both sides was changed the same way so never conflicts
+                        value = base_values[i] ^ ((ours_values[i] ^ base_values[i]) | (theirs_values[i] ^ base_values[i]));
+                    } else if(ours_values[i] == base_values[i]) {
+                        value = theirs_values[i];
+                    } else if(theirs_values[i] != base_values[i] && theirs_values[i] != ours_values[i]) {
+                        MergeConflict conflict = { layer, x, y, base_values[i], ours_values[i], theirs_values[i] };
+                        result.conflicts.push_back(conflict);
+                        value = (resolution == RESOLVE_OURS) ? ours_values[i] : theirs_values[i];
+                    }
+
+                    if(layer == METADATA_LAYER_INDEX) {
+                        merged.metadata().set_flags(x, y, MetadataFlags(value));
+                    } else {
+                        merged.layer_at(layer).set_tile(x, y, value);
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+}
@@ -0,0 +1,103 @@
+#ifndef LEVEL_DIFF_H
+#define LEVEL_DIFF_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "level.h"
+
+namespace pn {
+
+//Stands in for a layer index when a difference or conflict is in the metadata flags
+const uint32_t METADATA_LAYER_INDEX = 0xFFFFFFFF;
+
+/*
+    Tile values are ids into the palette of the diff or merge they came
+    from, or -1 for an empty cell. Metadata values are the cell's flags.
+*/
+struct CellDifference {
+    uint32_t layer;
+    uint32_t x;
+    uint32_t y;
+    int32_t before;
+    int32_t after;
+};
+
+struct LevelDiff {
+    LevelDiff():
+        blocks_compared(0),
+        blocks_skipped(0) {}
+
+    bool identical() const { return differences.empty(); }
+
+    std::vector<std::string> palette; //Both levels' tiles
+    std::vector<CellDifference> differences; //In layer order, metadata last, then block by block
+
+    uint32_t blocks_compared; //Blocks that differed and were compared cell by cell
+    uint32_t blocks_skipped;
+};
+
+/*
+    Compares two levels layer by layer, with layers matched by index. A
+    layer or area that only exists in one of them compares as empty cells.
+
+    Both levels are cut into CHUNK_SIZE blocks. Blocks still sharing a
+    chunk are skipped without being read, the rest are compared whole
+    with memcmp and only those that differ are gone through cell by cell.
+    Blocks are read straight out of the chunks without copying whenever
+    the layer's grid lines up with them, which it does for any level that
+    hasn't been extended to the left or bottom.
+*/
+LevelDiff diff_levels(Level& before, Level& after);
+
+enum ConflictResolution {
+    RESOLVE_OURS,
+    RESOLVE_THEIRS
+};
+
+//Only ever for tiles
+struct MergeConflict {
+    uint32_t layer;
+    uint32_t x;
+    uint32_t y;
+    int32_t base;
+    int32_t ours;
+    int32_t theirs;
+};
+
+struct LevelMerge {
+    LevelMerge():
+        blocks_merged(0),
+        blocks_skipped(0) {}
+
+    Level::ptr level; //Its palette is the one conflict values index
+    std::vector<MergeConflict> conflicts; //Cells changed differently on each side, resolved as asked
+
+    uint32_t blocks_merged; //Blocks changed on both sides, merged cell by cell
+    uint32_t blocks_skipped;
+};
+
+class LevelMergeError : public std::runtime_error {
+public:
+    LevelMergeError(const std::string& what):
+        std::runtime_error(what) {}
+};
+
+/*
+    Three way merge of two levels descended from base. Each cell takes
+    whichever side changed it, and cells that both sides changed to
+    different tiles are conflicts, settled by resolution. Metadata flags
+    are merged bit by bit, so they never conflict. Blocks that
+    only one side touched are taken whole from that side (sharing its
+    chunks where possible) without looking at their cells.
+
+    The merged level takes its size from whichever side resized the level,
+    and throws LevelMergeError if both did and disagree.
+*/
+LevelMerge merge_levels(Level& base, Level& ours, Level& theirs, ConflictResolution resolution=RESOLVE_OURS);
+
+}
+
+#endif // LEVEL_DIFF_H
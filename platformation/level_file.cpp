@@ -0,0 +1,445 @@
+#include <cstdio>
+#include <sstream>
+#include <cstdlib>
+#include <iterator>
+#include <algorithm>
+#include <cctype>
+
+#include "kazbase/json/json.h"
+#include "kazbase/string.h"
+
+#include "level_file.h"
+#include "layer.h"
+#include "binary_io.h"
+#include "mapped_file.h"
+#include "atomic_file.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+const char* JSON_FORMAT_NAME = "platformation-level";
+
+/*
+    Upper bound on width x height, anything larger is a corrupt header
+    rather than a level. It's the area that costs memory, a long thin level
+    is fine, so the sides aren't capped on their own. This is 256MB of tile
+    ids per fully painted layer.
+*/
+const uint64_t MAX_LEVEL_CELLS = uint64_t(1) << 26;
+
+template<typename T>
+struct Run {
+    uint32_t length;
+    T value;
+};
+
+template<typename T, typename CellValue>
+void encode_runs(uint32_t width, uint32_t height, CellValue cell_value, std::vector<Run<T> >& out) {
+    for(uint32_t y = 0; y < height; ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            T value = cell_value(x, y);
+            if(!out.empty() && out.back().value == value) {
+                out.back().length++;
+            } else {
+                Run<T> run = { 1, value };
+                out.push_back(run);
+            }
+        }
+    }
+}
+
+//Calls store(x, y, value) for every cell, checking the runs cover the level exactly
+template<typename T, typename Store>
+void decode_runs(const std::vector<Run<T> >& runs, uint32_t width, uint32_t height, Store store) {
+    uint64_t expected = uint64_t(width) * uint64_t(height);
+    uint64_t cell = 0;
+
+    for(const Run<T>& run: runs) {
+        if(cell + run.length > expected) {
+            throw LevelFileError("Cell data runs past the end of the level");
+        }
+
+        for(uint32_t i = 0; i < run.length; ++i, ++cell) {
+            store(uint32_t(cell % width), uint32_t(cell / width), run.value);
+        }
+    }
+
+    if(cell != expected) {
+        throw LevelFileError("Cell data doesn't cover the whole level");
+    }
+}
+
+template<typename T>
+std::string runs_to_text(const std::vector<Run<T> >& runs) {
+    std::ostringstream out;
+    for(uint32_t i = 0; i < runs.size(); ++i) {
+        if(i) {
+            out << ' ';
+        }
+
+        out << int64_t(runs[i].value);
+        if(runs[i].length > 1) {
+            out << '*' << runs[i].length;
+        }
+    }
+    return out.str();
+}
+
+template<typename T>
+void text_to_runs(const std::string& text, std::vector<Run<T> >& runs) {
+    const char* c = text.c_str();
+    while(*c) {
+        if(*c == ' ') {
+            ++c;
+            continue;
+        }
+
+        char* end;
+        long value = strtol(c, &end, 10);
+        if(end == c) {
+            throw LevelFileError("Malformed cell data");
+        }
+        c = end;
+
+        Run<T> run = { 1, T(value) };
+        if(*c == '*') {
+            run.length = strtoul(c + 1, &end, 10);
+            if(end == c + 1 || !run.length) {
+                throw LevelFileError("Malformed run length in cell data");
+            }
+            c = end;
+        }
+        runs.push_back(run);
+    }
+}
+
+void write_json_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for(char c: text) {
+        switch(c) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\t': out << "\\t"; break;
+            default: out << c;
+        }
+    }
+    out << '"';
+}
+
+void check_dimensions(uint32_t width, uint32_t height) {
+    if(!width || !height || uint64_t(width) * height > MAX_LEVEL_CELLS) {
+        throw LevelFileError("Level dimensions are out of range");
+    }
+}
+
+void write_binary(Level& level, std::vector<uint8_t>& out) {
+    BinaryWriter writer(out);
+    uint32_t width = level.horizontal_tile_count();
+    uint32_t height = level.vertical_tile_count();
+
+    writer.magic("PNLV");
+    writer.u32(LEVEL_FILE_VERSION);
+    writer.string(level.name());
+    writer.u32(width);
+    writer.u32(height);
+
+    writer.u32(level.palette().size());
+    for(uint32_t i = 0; i < level.palette().size(); ++i) {
+        writer.string(level.palette().path_for_id(i));
+    }
+
+    writer.u32(level.layer_count());
+    for(uint32_t l = 0; l < level.layer_count(); ++l) {
+        Layer& layer = level.layer_at(l);
+        writer.string(layer.name());
+
+        std::vector<Run<int32_t> > runs;
+        encode_runs<int32_t>(width, height, [&](uint32_t x, uint32_t y) { return layer.tile_image_at(x, y); }, runs);
+
+        writer.u32(runs.size());
+        for(const Run<int32_t>& run: runs) {
+            writer.u32(run.length);
+            writer.i32(run.value);
+        }
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    std::vector<Run<uint8_t> > flag_runs;
+    encode_runs<uint8_t>(width, height, [&](uint32_t x, uint32_t y) { return metadata.flags_at(x, y); }, flag_runs);
+
+    writer.u32(flag_runs.size());
+    for(const Run<uint8_t>& run: flag_runs) {
+        writer.u32(run.length);
+        writer.u8(run.value);
+    }
+}
+
+Level::ptr read_binary(const uint8_t* data, size_t length) {
+    BinaryReader reader(data, length);
+
+    try {
+        if(!reader.magic("PNLV")) {
+            throw LevelFileError("Not a Platformation level file");
+        }
+
+        uint32_t version = reader.u32();
+        if(version > LEVEL_FILE_VERSION) {
+            throw LevelFileError("Level file is from a newer version of Platformation");
+        }
+
+        std::string name = reader.string();
+        uint32_t width = reader.u32();
+        uint32_t height = reader.u32();
+        check_dimensions(width, height);
+
+        Level::ptr level(new Level(width, height));
+        level->set_name(name);
+
+        uint32_t palette_count = reader.u32();
+        for(uint32_t i = 0; i < palette_count; ++i) {
+            level->palette().id_for_path(reader.string());
+        }
+
+        uint32_t layer_count = reader.u32();
+        for(uint32_t l = 0; l < layer_count; ++l) {
+            if(l >= level->layer_count()) {
+                level->add_layer();
+            }
+
+            Layer& layer = level->layer_at(l);
+            layer.set_name(reader.string());
+
+            std::vector<Run<int32_t> > runs(reader.u32());
+            if(runs.size() > reader.remaining() / 8) {
+                throw LevelFileError("Layer data is truncated");
+            }
+
+            for(Run<int32_t>& run: runs) {
+                run.length = reader.u32();
+                run.value = reader.i32();
+            }
+
+            decode_runs(runs, width, height, [&](uint32_t x, uint32_t y, int32_t tile) { layer.set_tile(x, y, tile); });
+        }
+
+        std::vector<Run<uint8_t> > flag_runs(reader.u32());
+        if(flag_runs.size() > reader.remaining() / 5) {
+            throw LevelFileError("Metadata is truncated");
+        }
+
+        for(Run<uint8_t>& run: flag_runs) {
+            run.length = reader.u32();
+            run.value = reader.u8();
+        }
+
+        MetadataLayer& metadata = level->metadata();
+        decode_runs(flag_runs, width, height, [&](uint32_t x, uint32_t y, uint8_t flags) {
+            if(flags) {
+                metadata.set_flags(x, y, flags);
+            }
+        });
+
+        return level;
+    } catch(std::out_of_range& e) {
+        throw LevelFileError("Level file is truncated");
+    }
+}
+
+void write_json(Level& level, std::vector<uint8_t>& out) {
+    uint32_t width = level.horizontal_tile_count();
+    uint32_t height = level.vertical_tile_count();
+
+    std::ostringstream json;
+    json << "{\n    \"format\": ";
+    write_json_string(json, JSON_FORMAT_NAME);
+    json << ",\n    \"version\": " << LEVEL_FILE_VERSION;
+    json << ",\n    \"name\": ";
+    write_json_string(json, level.name());
+    json << ",\n    \"width\": " << width;
+    json << ",\n    \"height\": " << height;
+
+    json << ",\n    \"palette\": [";
+    for(uint32_t i = 0; i < level.palette().size(); ++i) {
+        json << (i ? ",\n        " : "\n        ");
+        write_json_string(json, level.palette().path_for_id(i));
+    }
+    json << "\n    ],\n    \"layers\": [";
+
+    for(uint32_t l = 0; l < level.layer_count(); ++l) {
+        Layer& layer = level.layer_at(l);
+
+        std::vector<Run<int32_t> > runs;
+        encode_runs<int32_t>(width, height, [&](uint32_t x, uint32_t y) { return layer.tile_image_at(x, y); }, runs);
+
+        json << (l ? ",\n        " : "\n        ") << "{\"name\": ";
+        write_json_string(json, layer.name());
+        json << ", \"tiles\": ";
+        write_json_string(json, runs_to_text(runs));
+        json << "}";
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    std::vector<Run<uint8_t> > flag_runs;
+    encode_runs<uint8_t>(width, height, [&](uint32_t x, uint32_t y) { return metadata.flags_at(x, y); }, flag_runs);
+
+    json << "\n    ],\n    \"metadata\": ";
+    write_json_string(json, runs_to_text(flag_runs));
+    json << "\n}\n";
+
+    std::string text = json.str();
+    out.assign(text.begin(), text.end());
+}
+
+//Damaged files are far more likely to be missing keys than to have the wrong ones
+json::Node& required(json::Node& node, const std::string& key) {
+    if(!node.has_key(key)) {
+        throw LevelFileError("Level file has no \"" + key + "\"");
+    }
+    return node[key];
+}
+
+Level::ptr parse_json(const uint8_t* data, size_t length) {
+    json::JSON j = json::loads(std::string(reinterpret_cast<const char*>(data), length));
+
+    if(!j.has_key("format") || j["format"].get() != JSON_FORMAT_NAME) {
+        throw LevelFileError("Not a Platformation level file");
+    }
+
+    if(uint32_t(atoi(required(j, "version").get().c_str())) > LEVEL_FILE_VERSION) {
+        throw LevelFileError("Level file is from a newer version of Platformation");
+    }
+
+    uint32_t width = atoi(required(j, "width").get().c_str());
+    uint32_t height = atoi(required(j, "height").get().c_str());
+    check_dimensions(width, height);
+
+    Level::ptr level(new Level(width, height));
+    level->set_name(required(j, "name").get());
+
+    json::Node& palette = required(j, "palette");
+    for(uint32_t i = 0; i < palette.length(); ++i) {
+        level->palette().id_for_path(palette[i].get());
+    }
+
+    json::Node& layers = required(j, "layers");
+    for(uint32_t l = 0; l < layers.length(); ++l) {
+        if(l >= level->layer_count()) {
+            level->add_layer();
+        }
+
+        json::Node& node = layers[l];
+        Layer& layer = level->layer_at(l);
+        layer.set_name(required(node, "name").get());
+
+        std::vector<Run<int32_t> > runs;
+        text_to_runs(required(node, "tiles").get(), runs);
+        decode_runs(runs, width, height, [&](uint32_t x, uint32_t y, int32_t tile) { layer.set_tile(x, y, tile); });
+    }
+
+    if(j.has_key("metadata")) {
+        std::vector<Run<uint8_t> > flag_runs;
+        text_to_runs(j["metadata"].get(), flag_runs);
+
+        MetadataLayer& metadata = level->metadata();
+        decode_runs(flag_runs, width, height, [&](uint32_t x, uint32_t y, uint8_t flags) {
+            if(flags) {
+                metadata.set_flags(x, y, flags);
+            }
+        });
+    }
+
+    return level;
+}
+
+//Whatever the JSON parser throws for a truncated or mangled document is reported like any other damage
+Level::ptr read_json(const uint8_t* data, size_t length) {
+    try {
+        return parse_json(data, length);
+    } catch(LevelFileError& e) {
+        throw;
+    } catch(std::exception& e) {
+        throw LevelFileError(std::string("Level file isn't valid JSON: ") + e.what());
+    }
+}
+
+}
+
+LevelFormat level_format_for_path(const std::string& path) {
+    std::string lowered(path);
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+    return str::ends_with(lowered, ".json") ? LEVEL_FORMAT_JSON : LEVEL_FORMAT_BINARY;
+}
+
+Level::ptr read_level(const std::vector<uint8_t>& data, LevelFormat format) {
+    return read_level(data.data(), data.size(), format);
+}
+
+Level::ptr read_level(const uint8_t* data, size_t length, LevelFormat format) {
+    PN_PROFILE_SCOPE("level_file::read_level");
+    return (format == LEVEL_FORMAT_JSON) ? read_json(data, length) : read_binary(data, length);
+}
+
+bool read_level_summary(const uint8_t* data, size_t length, LevelFormat format, LevelSummary& out) {
+    if(format == LEVEL_FORMAT_JSON) {
+        return false;
+    }
+
+    BinaryReader reader(data, length);
+    try {
+        if(!reader.magic("PNLV") || reader.u32() > LEVEL_FILE_VERSION) {
+            return false;
+        }
+
+        out.name = reader.string();
+        out.width = reader.u32();
+        out.height = reader.u32();
+
+        out.palette_size = reader.u32();
+        out.palette.clear();
+        for(uint32_t i = 0; i < out.palette_size; ++i) {
+            out.palette.push_back(reader.string());
+        }
+
+        out.layer_count = reader.u32();
+    } catch(std::out_of_range& e) {
+        return false;
+    }
+
+    return true;
+}
+
+void write_level(Level& level, LevelFormat format, std::vector<uint8_t>& out) {
+    PN_PROFILE_SCOPE("level_file::write_level");
+
+    out.clear();
+    if(format == LEVEL_FORMAT_JSON) {
+        write_json(level, out);
+    } else {
+        write_binary(level, out);
+    }
+}
+
+Level::ptr load_level(const std::string& path) {
+    //Mapped rather than read, parsing straight from the page cache saves copying the file
+    MappedFile::ptr file = MappedFile::open(path);
+    if(!file) {
+        throw LevelFileError("Unable to open " + path);
+    }
+
+    return read_level(file->data(), file->size(), level_format_for_path(path));
+}
+
+void save_level(Level& level, const std::string& path) {
+    std::vector<uint8_t> data;
+    write_level(level, level_format_for_path(path), data);
+
+    //Written alongside and renamed over the old file, which also leaves anything mapping the old one unharmed
+    if(!write_file_atomically(path, data)) {
+        throw LevelFileError("Unable to write " + path);
+    }
+}
+
+}
@@ -0,0 +1,78 @@
+#ifndef LEVEL_FILE_H
+#define LEVEL_FILE_H
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "level.h"
+
+namespace pn {
+
+const uint32_t LEVEL_FILE_VERSION = 1;
+
+enum LevelFormat {
+    LEVEL_FORMAT_BINARY, //.pnl
+    LEVEL_FORMAT_JSON //.json
+};
+
+class LevelFileError : public std::runtime_error {
+public:
+    LevelFileError(const std::string& what):
+        std::runtime_error(what) {}
+};
+
+/*
+    Levels are stored either as JSON for diffing and hand editing, or as a
+    compact binary file. Both hold the same things: name, size, palette,
+    every layer's tiles and the metadata flags, with cells run length
+    encoded in row major order from cell (0, 0).
+
+    Binary layout (little endian): "PNLV", u32 version, string name,
+    u32 width, u32 height, u32 palette count + strings, u32 layer count,
+    per layer string name + u32 run count + runs of (u32 length, i32 tile),
+    then u32 run count + runs of (u32 length, u8 flags) for the metadata.
+    Strings are a u32 length followed by the bytes.
+
+    JSON layout: {"format": "platformation-level", "version": 1, "name",
+    "width", "height", "palette": [paths], "layers": [{"name", "tiles"}],
+    "metadata"}, where "tiles" and "metadata" are space separated values
+    with "value*count" for runs.
+*/
+
+LevelFormat level_format_for_path(const std::string& path);
+
+//What a level file's header says, without reading any cells
+struct LevelSummary {
+    LevelSummary():
+        width(0),
+        height(0),
+        palette_size(0),
+        layer_count(0) {}
+
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+    uint32_t palette_size;
+    uint32_t layer_count;
+    std::vector<std::string> palette; //Tile image paths as stored, relative ones are to the level's directory
+};
+
+//Both throw LevelFileError if the file can't be read or written
+Level::ptr load_level(const std::string& path);
+void save_level(Level& level, const std::string& path);
+
+Level::ptr read_level(const std::vector<uint8_t>& data, LevelFormat format);
+Level::ptr read_level(const uint8_t* data, size_t length, LevelFormat format);
+void write_level(Level& level, LevelFormat format, std::vector<uint8_t>& out);
+
+/*
+    Reads just the header of a binary level, which is cheap enough to do
+    for every file in a project. Returns false for JSON levels (the whole
+    document has to be parsed to get at it) or if the header is damaged.
+*/
+bool read_level_summary(const uint8_t* data, size_t length, LevelFormat format, LevelSummary& out);
+
+}
+
+#endif // LEVEL_FILE_H
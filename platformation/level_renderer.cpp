@@ -0,0 +1,487 @@
+#include "level_renderer.h"
+#include "level.h"
+#include "entity_registry.h"
+#include "profiler.h"
+#include "memory_accounting.h"
+
+namespace pn {
+
+ChunkRender::ChunkRender():
+    mesh_container(0),
+    entity_handle(0) {
+
+    memory::allocated(memory::SUBSYSTEM_RENDER_MESHES, sizeof(ChunkRender));
+}
+
+ChunkRender::~ChunkRender() {
+    memory::released(memory::SUBSYSTEM_RENDER_MESHES, sizeof(ChunkRender));
+}
+
+LayerRenderer::LayerRenderer(LevelRenderer& parent, Layer& layer):
+    parent_(parent),
+    layer_(layer),
+    mesh_container_(0),
+    offset_x_(0),
+    offset_y_(0) {
+
+}
+
+LayerRenderer::~LayerRenderer() {
+    remove_from_scene();
+}
+
+void LayerRenderer::add_to_scene() {
+    PN_PROFILE_SCOPE("LayerRenderer::add_to_scene");
+
+    mesh_container_ = parent_.mesh_pool().acquire(MESH_SHAPE_EMPTY);
+    layer_.set_view(this);
+    layer_geometry_changed();
+
+    for(uint32_t cy = 0; cy < layer_.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer_.chunks_across(); ++cx) {
+            chunk_changed(layer_.chunk(cx, cy));
+        }
+    }
+}
+
+void LayerRenderer::remove_from_scene() {
+    PN_PROFILE_SCOPE("LayerRenderer::remove_from_scene");
+
+    if(!mesh_container_) {
+        return;
+    }
+
+    layer_.set_view(nullptr);
+
+    //Hide the whole layer in one go, then hand everything back to the pool
+    parent_.mesh_pool().scene().mesh(mesh_container_).set_visible(false);
+
+    for(uint32_t cy = 0; cy < layer_.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer_.chunks_across(); ++cx) {
+            release_chunk_meshes(layer_.chunk(cx, cy));
+        }
+    }
+    release_animations();
+
+    parent_.mesh_pool().release(MESH_SHAPE_EMPTY, mesh_container_);
+    mesh_container_ = 0;
+}
+
+void LayerRenderer::layer_geometry_changed() {
+    kglt::Scene& scene = parent_.mesh_pool().scene();
+
+    //Keeps cell (x, y) at (x - width / 2, y - height / 2) in world space
+    scene.mesh(mesh_container_).move_to(
+        -(float(layer_.width()) / 2.0f) - float(layer_.origin_x()) + offset_x_,
+        -(float(layer_.height()) / 2.0f) - float(layer_.origin_y()) + offset_y_,
+        -1.0 - (0.1 * (float) layer_.zindex())
+    );
+}
+
+void LayerRenderer::set_offset(float x, float y) {
+    if(x == offset_x_ && y == offset_y_) {
+        return;
+    }
+
+    offset_x_ = x;
+    offset_y_ = y;
+    if(mesh_container_) {
+        layer_geometry_changed();
+    }
+}
+
+void LayerRenderer::chunk_moved(Chunk& chunk) {
+    if(!chunk.render) {
+        return;
+    }
+
+    kglt::Scene& scene = parent_.mesh_pool().scene();
+    scene.mesh(chunk.render->mesh_container).move_to(float(chunk.grid_x * CHUNK_SIZE), float(chunk.grid_y * CHUNK_SIZE), 0.0f);
+
+    //Frame meshes hang off the layer's frame groups rather than the chunk, so they move themselves
+    std::map<const Chunk*, AnimatedCells>::iterator it = animated_cells_.find(&chunk);
+    if(it == animated_cells_.end()) {
+        return;
+    }
+
+    for(AnimatedCells::value_type& pair: it->second) {
+        for(kglt::MeshID frame_mesh: pair.second.frame_meshes) {
+            scene.mesh(frame_mesh).move_to(
+                float((chunk.grid_x * CHUNK_SIZE) + (pair.first % CHUNK_SIZE)),
+                float((chunk.grid_y * CHUNK_SIZE) + (pair.first / CHUNK_SIZE)),
+                0.0f
+            );
+        }
+    }
+}
+
+void LayerRenderer::chunk_changed(Chunk& chunk) {
+    MeshPool& pool = parent_.mesh_pool();
+    kglt::Scene& scene = pool.scene();
+
+    EntityRegistry& entities = parent_.entities();
+
+    if(!chunk.render) {
+        chunk.render.reset(new ChunkRender());
+        chunk.render->mesh_container = pool.acquire(MESH_SHAPE_EMPTY);
+        chunk.render->entity_handle = entities.register_chunk(&layer_, &chunk);
+        scene.mesh(chunk.render->mesh_container).set_parent(&scene.mesh(mesh_container_));
+    }
+    chunk_moved(chunk);
+
+    ChunkRender& render = *chunk.render;
+
+    for(uint32_t ly = 0; ly < CHUNK_SIZE; ++ly) {
+        for(uint32_t lx = 0; lx < CHUNK_SIZE; ++lx) {
+            TileInstance& instance = render.tile(lx, ly);
+            bool inside = layer_.in_bounds((chunk.grid_x * CHUNK_SIZE) + lx, (chunk.grid_y * CHUNK_SIZE) + ly);
+
+            if(!inside) {
+                release_animated_cell(chunk, (ly * CHUNK_SIZE) + lx);
+                if(instance.mesh_id) {
+                    entities.clear(instance.border_mesh_id);
+                    entities.clear(instance.mesh_id);
+                    pool.release(MESH_SHAPE_TILE_OUTLINE, instance.border_mesh_id);
+                    pool.release(MESH_SHAPE_TILE, instance.mesh_id);
+                    instance.border_mesh_id = 0;
+                    instance.mesh_id = 0;
+                }
+                continue;
+            }
+
+            if(instance.mesh_id) {
+                continue;
+            }
+
+            instance.mesh_id = pool.acquire(MESH_SHAPE_TILE);
+            instance.border_mesh_id = pool.acquire(MESH_SHAPE_TILE_OUTLINE);
+
+            //Clicking either the tile or its border resolves back to this cell
+            uint32_t tile_index = EntityRegistry::tile_index(render.entity_handle, (ly * CHUNK_SIZE) + lx);
+            entities.set(instance.mesh_id, USER_DATA_TYPE_TILE_INSTANCE, tile_index);
+            entities.set(instance.border_mesh_id, USER_DATA_TYPE_TILE_INSTANCE, tile_index);
+
+            kglt::Mesh& mesh = scene.mesh(instance.mesh_id);
+            apply_tile_texture(chunk, (ly * CHUNK_SIZE) + lx, chunk.tile_image((ly * CHUNK_SIZE) + lx));
+
+            kglt::Mesh& border_mesh = scene.mesh(instance.border_mesh_id);
+            border_mesh.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, 1.0));
+            border_mesh.set_parent(&mesh);
+
+            mesh.set_parent(&scene.mesh(render.mesh_container));
+            mesh.move_to(float(lx), float(ly), 0.0f);
+            border_mesh.move_to(0, 0, 0.01); //Move the border mesh slightly forward
+        }
+    }
+}
+
+void LayerRenderer::chunk_dropped(Chunk& chunk) {
+    release_chunk_meshes(chunk);
+}
+
+void LayerRenderer::chunk_tiles_changed(Chunk& chunk) {
+    if(!chunk.render) {
+        return;
+    }
+
+    for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+        TileInstance& instance = chunk.render->tiles[i];
+        if(instance.mesh_id && instance.rendered_image_id != chunk.tile_image(i)) {
+            apply_tile_texture(chunk, i, chunk.tile_image(i));
+        }
+    }
+}
+
+void LayerRenderer::refresh_textures() {
+    //The animations may have changed too, so animated cells are rebuilt from scratch
+    release_animations();
+
+    for(uint32_t cy = 0; cy < layer_.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer_.chunks_across(); ++cx) {
+            Chunk& chunk = layer_.chunk(cx, cy);
+            if(!chunk.render) {
+                continue;
+            }
+
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                if(chunk.render->tiles[i].mesh_id) {
+                    apply_tile_texture(chunk, i, chunk.tile_image(i));
+                }
+            }
+        }
+    }
+}
+
+void LayerRenderer::apply_tile_texture(Chunk& chunk, uint32_t cell, int32_t tile_image_id) {
+    TileInstance& instance = chunk.render->tiles[cell];
+    kglt::Scene& scene = parent_.mesh_pool().scene();
+    kglt::Mesh& mesh = scene.mesh(instance.mesh_id);
+
+    release_animated_cell(chunk, cell);
+
+    int32_t animation = parent_.animation_of(tile_image_id);
+    if(animation >= 0) {
+        //The frame meshes do the drawing
+        mesh.set_diffuse_colour(kglt::Colour(0, 0, 0, 0));
+
+        AnimatedCell& animated = animated_cells_[&chunk][cell];
+        animated.animation = animation;
+
+        const TileAnimation& definition = parent_.animation(animation);
+        for(uint32_t f = 0; f < definition.frames.size(); ++f) {
+            kglt::MeshID frame_mesh_id = parent_.mesh_pool().acquire(MESH_SHAPE_TILE);
+            animated.frame_meshes.push_back(frame_mesh_id);
+
+            kglt::Mesh& frame_mesh = scene.mesh(frame_mesh_id);
+            kglt::TextureID texture = parent_.texture_for_tile(definition.frames[f]);
+            if(texture) {
+                frame_mesh.apply_texture(texture);
+                frame_mesh.set_diffuse_colour(kglt::Colour(1, 1, 1, 1));
+            } else {
+                frame_mesh.set_diffuse_colour(kglt::Colour(0, 0, 0, 0));
+            }
+
+            frame_mesh.set_parent(&scene.mesh(frame_group(animation, f)));
+            frame_mesh.move_to(
+                float((chunk.grid_x * CHUNK_SIZE) + (cell % CHUNK_SIZE)),
+                float((chunk.grid_y * CHUNK_SIZE) + (cell / CHUNK_SIZE)),
+                0.0f
+            );
+        }
+
+        instance.rendered_image_id = tile_image_id;
+        return;
+    }
+
+    kglt::TextureID texture = (tile_image_id >= 0) ? parent_.texture_for_tile(tile_image_id) : 0;
+
+    if(texture) {
+        mesh.apply_texture(texture);
+        mesh.set_diffuse_colour(kglt::Colour(1, 1, 1, 1));
+    } else {
+        mesh.set_diffuse_colour(kglt::Colour(0, 0, 0, 0));
+    }
+
+    instance.rendered_image_id = tile_image_id;
+}
+
+kglt::MeshID LayerRenderer::frame_group(uint32_t animation, uint32_t frame) {
+    if(animation >= frame_groups_.size()) {
+        frame_groups_.resize(animation + 1);
+    }
+
+    std::vector<kglt::MeshID>& groups = frame_groups_[animation];
+    if(frame >= groups.size()) {
+        groups.resize(frame + 1, 0);
+    }
+
+    if(!groups[frame]) {
+        MeshPool& pool = parent_.mesh_pool();
+        groups[frame] = pool.acquire(MESH_SHAPE_EMPTY);
+
+        //Just in front of the cells, so the clear tiles underneath don't hide the frames
+        kglt::Mesh& group = pool.scene().mesh(groups[frame]);
+        group.set_parent(&pool.scene().mesh(mesh_container_));
+        group.move_to(0.0f, 0.0f, 0.005f);
+        group.set_visible(frame == parent_.current_frame(animation));
+    }
+
+    return groups[frame];
+}
+
+void LayerRenderer::animation_frame_changed(uint32_t animation, uint32_t old_frame, uint32_t new_frame) {
+    if(animation >= frame_groups_.size()) {
+        return;
+    }
+
+    kglt::Scene& scene = parent_.mesh_pool().scene();
+    const std::vector<kglt::MeshID>& groups = frame_groups_[animation];
+
+    if(old_frame < groups.size() && groups[old_frame]) {
+        scene.mesh(groups[old_frame]).set_visible(false);
+    }
+    if(new_frame < groups.size() && groups[new_frame]) {
+        scene.mesh(groups[new_frame]).set_visible(true);
+    }
+}
+
+void LayerRenderer::release_animated_cell(AnimatedCell& cell) {
+    for(kglt::MeshID frame_mesh: cell.frame_meshes) {
+        parent_.mesh_pool().release(MESH_SHAPE_TILE, frame_mesh);
+    }
+    cell.frame_meshes.clear();
+}
+
+void LayerRenderer::release_animated_cell(Chunk& chunk, uint32_t cell) {
+    std::map<const Chunk*, AnimatedCells>::iterator it = animated_cells_.find(&chunk);
+    if(it == animated_cells_.end()) {
+        return;
+    }
+
+    AnimatedCells::iterator animated = it->second.find(cell);
+    if(animated == it->second.end()) {
+        return;
+    }
+
+    release_animated_cell(animated->second);
+    it->second.erase(animated);
+
+    if(it->second.empty()) {
+        animated_cells_.erase(it);
+    }
+}
+
+void LayerRenderer::release_animations() {
+    for(std::map<const Chunk*, AnimatedCells>::value_type& chunk: animated_cells_) {
+        for(AnimatedCells::value_type& cell: chunk.second) {
+            release_animated_cell(cell.second);
+        }
+    }
+    animated_cells_.clear();
+
+    //Frame meshes went first, the groups are their parents
+    for(std::vector<kglt::MeshID>& groups: frame_groups_) {
+        for(kglt::MeshID group: groups) {
+            if(group) {
+                parent_.mesh_pool().release(MESH_SHAPE_EMPTY, group);
+            }
+        }
+    }
+    frame_groups_.clear();
+}
+
+void LayerRenderer::release_chunk_meshes(Chunk& chunk) {
+    MeshPool& pool = parent_.mesh_pool();
+    EntityRegistry& entities = parent_.entities();
+
+    std::map<const Chunk*, AnimatedCells>::iterator animated = animated_cells_.find(&chunk);
+    if(animated != animated_cells_.end()) {
+        for(AnimatedCells::value_type& cell: animated->second) {
+            release_animated_cell(cell.second);
+        }
+        animated_cells_.erase(animated);
+    }
+
+    if(!chunk.render) {
+        return;
+    }
+
+    for(TileInstance& instance: chunk.render->tiles) {
+        if(!instance.mesh_id) {
+            continue;
+        }
+
+        entities.clear(instance.border_mesh_id);
+        entities.clear(instance.mesh_id);
+
+        //Borders are children of the tile, so they go first
+        pool.release(MESH_SHAPE_TILE_OUTLINE, instance.border_mesh_id);
+        pool.release(MESH_SHAPE_TILE, instance.mesh_id);
+        instance.border_mesh_id = 0;
+        instance.mesh_id = 0;
+    }
+
+    pool.release(MESH_SHAPE_EMPTY, chunk.render->mesh_container);
+    entities.unregister_chunk(chunk.render->entity_handle);
+    chunk.render.reset();
+}
+
+LevelRenderer::LevelRenderer(Level& level, kglt::Scene& scene, EntityRegistry& entities):
+    level_(level),
+    entities_(entities),
+    mesh_pool_(scene),
+    animator_(nullptr) {
+
+    for(uint32_t i = 0; i < level_.layer_count(); ++i) {
+        layer_added(level_.layer_at(i));
+    }
+
+    layer_added_connection_ = level_.signal_layer_added().connect(
+        sigc::mem_fun(this, &LevelRenderer::layer_added)
+    );
+    layer_removing_connection_ = level_.signal_layer_removing().connect(
+        sigc::mem_fun(this, &LevelRenderer::layer_removing)
+    );
+}
+
+LevelRenderer::~LevelRenderer() {
+    layer_added_connection_.disconnect();
+    layer_removing_connection_.disconnect();
+
+    //Layer renderers hand their meshes back to the pool, so they must go first
+    layers_.clear();
+}
+
+kglt::TextureID LevelRenderer::texture_for_tile(int32_t tile_image_id) {
+    if(!texture_lookup_ || tile_image_id < 0 || uint32_t(tile_image_id) >= level_.palette().size()) {
+        return 0;
+    }
+    return texture_lookup_(level_.palette().path_for_id(tile_image_id));
+}
+
+void LevelRenderer::refresh_textures() {
+    for(LayerRenderer::ptr& renderer: layers_) {
+        renderer->refresh_textures();
+    }
+}
+
+void LevelRenderer::set_animator(const TileAnimator* animator) {
+    animator_ = animator;
+    current_frames_.clear();
+}
+
+int32_t LevelRenderer::animation_of(int32_t tile_image_id) const {
+    return animator_ ? animator_->animation_of(tile_image_id) : -1;
+}
+
+uint32_t LevelRenderer::current_frame(uint32_t animation) const {
+    return (animation < current_frames_.size()) ? current_frames_[animation] : 0;
+}
+
+void LevelRenderer::update_animations(uint64_t time_ms) {
+    if(!animator_) {
+        return;
+    }
+
+    if(current_frames_.size() != animator_->animation_count()) {
+        current_frames_.resize(animator_->animation_count(), 0);
+    }
+
+    for(uint32_t a = 0; a < current_frames_.size(); ++a) {
+        uint32_t frame = animator_->frame_at(a, time_ms);
+        if(frame == current_frames_[a]) {
+            continue;
+        }
+
+        for(LayerRenderer::ptr& renderer: layers_) {
+            renderer->animation_frame_changed(a, current_frames_[a], frame);
+        }
+        current_frames_[a] = frame;
+    }
+}
+
+void LevelRenderer::set_layer_offset(Layer& layer, float x, float y) {
+    for(LayerRenderer::ptr& renderer: layers_) {
+        if(&renderer->layer() == &layer) {
+            renderer->set_offset(x, y);
+            return;
+        }
+    }
+}
+
+void LevelRenderer::layer_added(Layer& layer) {
+    LayerRenderer::ptr renderer(new LayerRenderer(*this, layer));
+    renderer->add_to_scene();
+    layers_.push_back(renderer);
+}
+
+void LevelRenderer::layer_removing(Layer& layer) {
+    for(std::vector<LayerRenderer::ptr>::iterator it = layers_.begin(); it != layers_.end(); ++it) {
+        if(&(*it)->layer() == &layer) {
+            layers_.erase(it);
+            return;
+        }
+    }
+}
+
+}
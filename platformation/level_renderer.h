@@ -0,0 +1,175 @@
+#ifndef LEVEL_RENDERER_H
+#define LEVEL_RENDERER_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <tr1/memory>
+#include <tr1/functional>
+#include <sigc++/sigc++.h>
+
+#include <kglt/kglt.h>
+
+#include "layer.h"
+#include "mesh_pool.h"
+#include "tile_animation.h"
+
+namespace pn {
+
+class Level;
+class LevelRenderer;
+class EntityRegistry;
+
+//Render state for one cell
+struct TileInstance {
+    TileInstance():
+        rendered_image_id(-1),
+        mesh_id(0),
+        border_mesh_id(0) {
+
+    }
+
+    int32_t rendered_image_id; //What the mesh currently shows, may lag behind the cell until a flush
+    uint32_t mesh_id;
+    uint32_t border_mesh_id;
+};
+
+//Hangs off Chunk::render from the first time a LayerRenderer builds the chunk until it releases it
+struct ChunkRender {
+    ChunkRender();
+    ~ChunkRender();
+
+    TileInstance& tile(uint32_t local_x, uint32_t local_y) {
+        return tiles[(local_y * CHUNK_SIZE) + local_x];
+    }
+
+    TileInstance tiles[CHUNK_AREA];
+    kglt::MeshID mesh_container;
+    uint32_t entity_handle; //Registered with the EntityRegistry while in the scene
+
+private:
+    ChunkRender(const ChunkRender&);
+    ChunkRender& operator=(const ChunkRender&);
+};
+
+/*
+    Builds and maintains the meshes for one layer: a container mesh for the
+    layer, one per chunk, and a tile plus outline per cell.
+
+    An animated cell's own tile is left clear (it still takes clicks and
+    shows the outline), and it gets a mesh per frame instead. Those live in
+    one group per animation frame for the whole layer, and only the groups
+    of the current frames are visible. Stepping an animation is then two
+    visibility flips, however many of its tiles are in the layer.
+*/
+class LayerRenderer : public LayerView {
+public:
+    typedef std::tr1::shared_ptr<LayerRenderer> ptr;
+
+    LayerRenderer(LevelRenderer& parent, Layer& layer);
+    ~LayerRenderer();
+
+    Layer& layer() { return layer_; }
+
+    void add_to_scene();
+    void remove_from_scene();
+
+    //Re-applies every tile's texture, for when the texture lookup changes
+    void refresh_textures();
+
+    //Shifts the whole layer, for the parallax preview
+    void set_offset(float x, float y);
+
+    void layer_geometry_changed();
+    void chunk_changed(Chunk& chunk);
+    void chunk_moved(Chunk& chunk);
+    void chunk_dropped(Chunk& chunk);
+    void chunk_tiles_changed(Chunk& chunk);
+
+    void animation_frame_changed(uint32_t animation, uint32_t old_frame, uint32_t new_frame);
+
+private:
+    struct AnimatedCell {
+        int32_t animation;
+        std::vector<kglt::MeshID> frame_meshes;
+    };
+
+    typedef std::map<uint32_t, AnimatedCell> AnimatedCells; //By cell index in the chunk
+
+    LevelRenderer& parent_;
+    Layer& layer_;
+
+    kglt::MeshID mesh_container_;
+    float offset_x_;
+    float offset_y_;
+
+    std::map<const Chunk*, AnimatedCells> animated_cells_;
+    std::vector<std::vector<kglt::MeshID> > frame_groups_; //[animation][frame], 0 until first needed
+
+    void apply_tile_texture(Chunk& chunk, uint32_t cell, int32_t tile_image_id);
+    void release_chunk_meshes(Chunk& chunk);
+
+    kglt::MeshID frame_group(uint32_t animation, uint32_t frame);
+    void release_animated_cell(AnimatedCell& cell);
+    void release_animated_cell(Chunk& chunk, uint32_t cell);
+    void release_animations();
+};
+
+class LevelRenderer {
+public:
+    typedef std::tr1::shared_ptr<LevelRenderer> ptr;
+    typedef std::tr1::function<kglt::TextureID (const std::string&)> TextureLookup;
+
+    LevelRenderer(Level& level, kglt::Scene& scene, EntityRegistry& entities);
+    ~LevelRenderer();
+
+    Level& level() { return level_; }
+    MeshPool& mesh_pool() { return mesh_pool_; }
+    EntityRegistry& entities() { return entities_; }
+
+    /*
+        The level only stores palette ids, the editor tells the renderer how
+        to find the texture for a palette entry. Call refresh_textures() when
+        the answer might have changed.
+    */
+    void set_texture_lookup(TextureLookup lookup) { texture_lookup_ = lookup; }
+    kglt::TextureID texture_for_tile(int32_t tile_image_id);
+    void refresh_textures();
+
+    /*
+        Animations are looked up by the tile a cell shows. The animator
+        must outlive the renderer or be replaced first, and
+        refresh_textures() picks up changes to it.
+    */
+    void set_animator(const TileAnimator* animator);
+    int32_t animation_of(int32_t tile_image_id) const;
+    const TileAnimation& animation(uint32_t idx) const { return animator_->animation(idx); }
+    uint32_t current_frame(uint32_t animation) const;
+
+    //Called once per frame with the shared animation clock
+    void update_animations(uint64_t time_ms);
+
+    //Moves one layer's container, the chunks and tiles inside it aren't touched
+    void set_layer_offset(Layer& layer, float x, float y);
+
+private:
+    Level& level_;
+    EntityRegistry& entities_;
+    MeshPool mesh_pool_;
+    TextureLookup texture_lookup_;
+
+    const TileAnimator* animator_;
+    std::vector<uint32_t> current_frames_;
+
+    std::vector<LayerRenderer::ptr> layers_;
+
+    sigc::connection layer_added_connection_;
+    sigc::connection layer_removing_connection_;
+
+    void layer_added(Layer& layer);
+    void layer_removing(Layer& layer);
+};
+
+}
+
+#endif // LEVEL_RENDERER_H
@@ -0,0 +1,526 @@
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <sstream>
+
+#include "kazbase/os/path.h"
+
+#include "level_validation.h"
+#include "level.h"
+#include "layer.h"
+#include "metadata_layer.h"
+#include "thread_pool.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+//Flags that only make sense somewhere the player can get to
+const MetadataFlags REACHABLE_CONTENT = METADATA_FLAG_TRIGGER | METADATA_FLAG_LADDER | METADATA_FLAG_WATER;
+
+struct FlagConflict {
+    MetadataFlags flag;
+    ValidationSeverity severity;
+    const char* message;
+};
+
+//Flags that mean nothing, or break the game, when the cell is also solid
+const FlagConflict FLAG_CONFLICTS[] = {
+    { METADATA_FLAG_TRIGGER, VALIDATION_ERROR, "Trigger inside solid cells can never fire" },
+    { METADATA_FLAG_ONE_WAY, VALIDATION_WARNING, "One way platform overlaps solid cells" },
+    { METADATA_FLAG_LADDER, VALIDATION_WARNING, "Ladder runs through solid cells" },
+    { METADATA_FLAG_WATER, VALIDATION_WARNING, "Water overlaps solid cells" }
+};
+
+const uint32_t FLAG_CONFLICT_COUNT = sizeof(FLAG_CONFLICTS) / sizeof(FlagConflict);
+
+//A connected open (non solid) area, first within one block and then across the level
+struct Region {
+    uint32_t size;
+    MetadataFlags content;
+    uint32_t first_x; //Topmost, then leftmost cell
+    uint32_t first_y;
+};
+
+/*
+    Open areas within one CHUNK_SIZE block of the metadata. Labels are
+    1 based indices into regions, 0 is a solid cell or one past the edge.
+*/
+struct BlockRegions {
+    uint16_t labels[CHUNK_AREA];
+    std::vector<Region> regions;
+};
+
+//Counts cells with the same problem so one issue can cover all of them
+struct CellTally {
+    CellTally():
+        count(0),
+        first_x(0),
+        first_y(0) {}
+
+    void add(int32_t x, int32_t y) {
+        if(!count++) {
+            first_x = x;
+            first_y = y;
+        }
+    }
+
+    uint32_t count;
+    int32_t first_x;
+    int32_t first_y;
+};
+
+std::string cell_count(uint32_t count) {
+    std::ostringstream text;
+    text << count << ((count == 1) ? " cell" : " cells");
+    return text.str();
+}
+
+class Validator {
+public:
+    Validator(Level& level, const ValidationOptions& options, IssueCallback callback):
+        level_(level),
+        metadata_(level.metadata()),
+        options_(options),
+        callback_(callback),
+        pool_(options.pool ? *options.pool : ThreadPool::shared()),
+        blocks_across_((level.metadata().width() + CHUNK_SIZE - 1) / CHUNK_SIZE),
+        blocks_down_((level.metadata().height() + CHUNK_SIZE - 1) / CHUNK_SIZE),
+        chunks_checked_(0) {}
+
+    ValidationSummary run();
+
+private:
+    Level& level_;
+    MetadataLayer& metadata_;
+    const ValidationOptions& options_;
+    IssueCallback callback_;
+    ThreadPool& pool_;
+
+    uint32_t blocks_across_;
+    uint32_t blocks_down_;
+    std::vector<BlockRegions> blocks_;
+
+    std::vector<bool> tile_available_;
+    std::vector<std::atomic<bool> > tile_used_;
+    std::atomic<uint32_t> chunks_checked_;
+
+    std::mutex report_lock_;
+    ValidationSummary summary_;
+
+    bool cancelled() const {
+        return options_.cancel && options_.cancel->load();
+    }
+
+    void report(ValidationSeverity severity, ValidationCheck check, const std::string& message, int32_t layer=-1, int32_t x=-1, int32_t y=-1);
+
+    void check_sizes();
+    void check_layer_chunk(uint32_t layer_index, uint32_t chunk_x, uint32_t chunk_y);
+    void check_metadata_block(uint32_t block_x, uint32_t block_y);
+    void check_palette();
+    void check_reachability();
+};
+
+void Validator::report(ValidationSeverity severity, ValidationCheck check, const std::string& message, int32_t layer, int32_t x, int32_t y) {
+    ValidationIssue issue;
+    issue.severity = severity;
+    issue.check = check;
+    issue.message = message;
+    issue.layer = layer;
+    issue.x = x;
+    issue.y = y;
+
+    std::lock_guard<std::mutex> lock(report_lock_);
+    if(severity == VALIDATION_ERROR) {
+        summary_.errors++;
+    } else {
+        summary_.warnings++;
+    }
+    callback_(issue);
+}
+
+void Validator::check_sizes() {
+    uint32_t width = level_.horizontal_tile_count();
+    uint32_t height = level_.vertical_tile_count();
+
+    for(uint32_t l = 0; l < level_.layer_count(); ++l) {
+        Layer& layer = level_.layer_at(l);
+        if(layer.width() != width || layer.height() != height) {
+            report(VALIDATION_ERROR, VALIDATION_CHECK_OUT_OF_BOUNDS, "Layer size doesn't match the level", l);
+        }
+    }
+
+    if(metadata_.width() != width || metadata_.height() != height) {
+        report(VALIDATION_ERROR, VALIDATION_CHECK_OUT_OF_BOUNDS, "Metadata size doesn't match the level");
+    }
+}
+
+void Validator::check_layer_chunk(uint32_t layer_index, uint32_t chunk_x, uint32_t chunk_y) {
+    if(cancelled()) {
+        return;
+    }
+
+    PN_PROFILE_SCOPE("validation::check_layer_chunk");
+
+    Layer& layer = level_.layer_at(layer_index);
+    Chunk& chunk = layer.chunk(chunk_x, chunk_y);
+    uint32_t palette_size = tile_used_.size();
+
+    std::map<int32_t, CellTally> unknown_tiles;
+    CellTally outside;
+    int32_t last_used = -1;
+
+    for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+        int32_t tile = chunk.tile_image(i);
+        if(tile < 0) {
+            continue;
+        }
+
+        uint32_t grid_x = (chunk_x * CHUNK_SIZE) + (i % CHUNK_SIZE);
+        uint32_t grid_y = (chunk_y * CHUNK_SIZE) + (i / CHUNK_SIZE);
+
+        //Relative to cell (0, 0), so cells off the top or left edge come out negative
+        int32_t x = int32_t(grid_x) - int32_t(layer.origin_x());
+        int32_t y = int32_t(grid_y) - int32_t(layer.origin_y());
+
+        if(!layer.in_bounds(grid_x, grid_y)) {
+            outside.add(x, y);
+        } else if(uint32_t(tile) >= palette_size) {
+            unknown_tiles[tile].add(x, y);
+        } else if(tile != last_used) {
+            tile_used_[tile].store(true, std::memory_order_relaxed);
+            last_used = tile;
+        }
+    }
+
+    for(auto& unknown: unknown_tiles) {
+        std::ostringstream message;
+        message << "Tile " << unknown.first << " isn't in the palette (" << cell_count(unknown.second.count) << ")";
+        report(VALIDATION_ERROR, VALIDATION_CHECK_MISSING_TILES, message.str(), layer_index, unknown.second.first_x, unknown.second.first_y);
+    }
+
+    if(outside.count) {
+        report(
+            VALIDATION_ERROR, VALIDATION_CHECK_OUT_OF_BOUNDS,
+            "Tile data outside the level (" + cell_count(outside.count) + ")",
+            layer_index, outside.first_x, outside.first_y
+        );
+    }
+
+    chunks_checked_++;
+}
+
+void Validator::check_metadata_block(uint32_t block_x, uint32_t block_y) {
+    if(cancelled()) {
+        return;
+    }
+
+    PN_PROFILE_SCOPE("validation::check_metadata_block");
+
+    BlockRegions& block = blocks_[(block_y * blocks_across_) + block_x];
+    std::fill(block.labels, block.labels + CHUNK_AREA, 0);
+
+    uint32_t start_x = block_x * CHUNK_SIZE;
+    uint32_t start_y = block_y * CHUNK_SIZE;
+    uint32_t width = std::min(CHUNK_SIZE, metadata_.width() - start_x);
+    uint32_t height = std::min(CHUNK_SIZE, metadata_.height() - start_y);
+
+    MetadataFlags flags[CHUNK_AREA];
+    CellTally conflicts[FLAG_CONFLICT_COUNT];
+
+    for(uint32_t y = 0; y < height; ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            MetadataFlags cell = metadata_.flags_at(start_x + x, start_y + y);
+            flags[(y * CHUNK_SIZE) + x] = cell;
+
+            if(cell & METADATA_FLAG_SOLID) {
+                for(uint32_t c = 0; c < FLAG_CONFLICT_COUNT; ++c) {
+                    if(cell & FLAG_CONFLICTS[c].flag) {
+                        conflicts[c].add(start_x + x, start_y + y);
+                    }
+                }
+            }
+        }
+    }
+
+    for(uint32_t c = 0; c < FLAG_CONFLICT_COUNT; ++c) {
+        if(conflicts[c].count) {
+            report(
+                FLAG_CONFLICTS[c].severity, VALIDATION_CHECK_OVERLAPPING_FLAGS,
+                std::string(FLAG_CONFLICTS[c].message) + " (" + cell_count(conflicts[c].count) + ")",
+                -1, conflicts[c].first_x, conflicts[c].first_y
+            );
+        }
+    }
+
+    //Label the open areas, cells are visited in row order so a region's first cell is its topmost
+    uint16_t stack[CHUNK_AREA];
+    for(uint32_t y = 0; y < height; ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            uint32_t seed = (y * CHUNK_SIZE) + x;
+            if(block.labels[seed] || (flags[seed] & METADATA_FLAG_SOLID)) {
+                continue;
+            }
+
+            Region region = { 0, 0, start_x + x, start_y + y };
+            block.regions.push_back(region);
+            uint16_t label = block.regions.size();
+
+            uint32_t top = 0;
+            stack[top++] = seed;
+            block.labels[seed] = label;
+
+            while(top) {
+                uint32_t cell = stack[--top];
+                uint32_t cx = cell % CHUNK_SIZE;
+                uint32_t cy = cell / CHUNK_SIZE;
+
+                block.regions.back().size++;
+                block.regions.back().content |= flags[cell] & REACHABLE_CONTENT;
+
+                uint32_t neighbours[4];
+                uint32_t neighbour_count = 0;
+                if(cx > 0) neighbours[neighbour_count++] = cell - 1;
+                if(cx + 1 < width) neighbours[neighbour_count++] = cell + 1;
+                if(cy > 0) neighbours[neighbour_count++] = cell - CHUNK_SIZE;
+                if(cy + 1 < height) neighbours[neighbour_count++] = cell + CHUNK_SIZE;
+
+                for(uint32_t n = 0; n < neighbour_count; ++n) {
+                    uint32_t next = neighbours[n];
+                    if(!block.labels[next] && !(flags[next] & METADATA_FLAG_SOLID)) {
+                        block.labels[next] = label;
+                        stack[top++] = next;
+                    }
+                }
+            }
+        }
+    }
+
+    chunks_checked_++;
+}
+
+void Validator::check_palette() {
+    Palette& palette = level_.palette();
+
+    for(uint32_t i = 0; i < palette.size(); ++i) {
+        const std::string& path = palette.path_for_id(i);
+        bool used = tile_used_[i].load();
+
+        if(!tile_available_[i]) {
+            //Removing a tile location leaves its tiles in the palette, which is only a problem if they're painted somewhere
+            report(
+                used ? VALIDATION_ERROR : VALIDATION_WARNING, VALIDATION_CHECK_MISSING_TILES,
+                (used ? "Missing tile image " : "Missing tile image (unused) ") + path
+            );
+        } else if(!used) {
+            report(VALIDATION_WARNING, VALIDATION_CHECK_MISSING_TILES, "Unused tile image " + path);
+        }
+    }
+}
+
+uint32_t find_root(std::vector<uint32_t>& parents, uint32_t region) {
+    while(parents[region] != region) {
+        parents[region] = parents[parents[region]];
+        region = parents[region];
+    }
+    return region;
+}
+
+void join_regions(std::vector<uint32_t>& parents, uint32_t a, uint32_t b) {
+    a = find_root(parents, a);
+    b = find_root(parents, b);
+    if(a != b) {
+        parents[std::max(a, b)] = std::min(a, b);
+    }
+}
+
+void Validator::check_reachability() {
+    PN_PROFILE_SCOPE("validation::check_reachability");
+
+    //Give every block's regions a level wide index
+    std::vector<uint32_t> offsets(blocks_.size() + 1, 0);
+    for(uint32_t b = 0; b < blocks_.size(); ++b) {
+        offsets[b + 1] = offsets[b] + blocks_[b].regions.size();
+    }
+
+    std::vector<uint32_t> parents(offsets.back());
+    for(uint32_t i = 0; i < parents.size(); ++i) {
+        parents[i] = i;
+    }
+
+    //Stitch regions together across the right and bottom edges of every block
+    for(uint32_t by = 0; by < blocks_down_; ++by) {
+        for(uint32_t bx = 0; bx < blocks_across_; ++bx) {
+            uint32_t b = (by * blocks_across_) + bx;
+            const BlockRegions& block = blocks_[b];
+
+            if(bx + 1 < blocks_across_) {
+                const BlockRegions& right = blocks_[b + 1];
+                for(uint32_t y = 0; y < CHUNK_SIZE; ++y) {
+                    uint16_t a = block.labels[(y * CHUNK_SIZE) + CHUNK_SIZE - 1];
+                    uint16_t c = right.labels[y * CHUNK_SIZE];
+                    if(a && c) {
+                        join_regions(parents, offsets[b] + a - 1, offsets[b + 1] + c - 1);
+                    }
+                }
+            }
+
+            if(by + 1 < blocks_down_) {
+                uint32_t below_index = b + blocks_across_;
+                const BlockRegions& below = blocks_[below_index];
+                for(uint32_t x = 0; x < CHUNK_SIZE; ++x) {
+                    uint16_t a = block.labels[((CHUNK_SIZE - 1) * CHUNK_SIZE) + x];
+                    uint16_t c = below.labels[x];
+                    if(a && c) {
+                        join_regions(parents, offsets[b] + a - 1, offsets[below_index] + c - 1);
+                    }
+                }
+            }
+        }
+    }
+
+    //Roots are always the lowest index in their set, so they're met before the rest of it
+    std::vector<Region> merged(parents.size());
+    for(uint32_t b = 0; b < blocks_.size(); ++b) {
+        for(uint32_t r = 0; r < blocks_[b].regions.size(); ++r) {
+            const Region& region = blocks_[b].regions[r];
+            uint32_t index = offsets[b] + r;
+            uint32_t root = find_root(parents, index);
+
+            Region& total = merged[root];
+            if(root == index) {
+                total = region;
+                continue;
+            }
+
+            total.size += region.size;
+            total.content |= region.content;
+            if(region.first_y < total.first_y || (region.first_y == total.first_y && region.first_x < total.first_x)) {
+                total.first_x = region.first_x;
+                total.first_y = region.first_y;
+            }
+        }
+    }
+
+    //The biggest open area is taken to be where the player is
+    int32_t main_area = -1;
+    for(uint32_t i = 0; i < merged.size(); ++i) {
+        if(parents[i] == i && (main_area < 0 || merged[i].size > merged[main_area].size)) {
+            main_area = i;
+        }
+    }
+
+    for(uint32_t i = 0; i < merged.size(); ++i) {
+        if(parents[i] != i || int32_t(i) == main_area || !merged[i].content) {
+            continue;
+        }
+
+        std::ostringstream message;
+        message << "Area with";
+        for(uint32_t flag_bit = 0; flag_bit < MAX_METADATA_FLAGS; ++flag_bit) {
+            if(merged[i].content & (1 << flag_bit)) {
+                message << " " << metadata_flag_name(flag_bit);
+            }
+        }
+        message << " is walled off from the main area (" << cell_count(merged[i].size) << ")";
+
+        report(VALIDATION_WARNING, VALIDATION_CHECK_UNREACHABLE, message.str(), -1, merged[i].first_x, merged[i].first_y);
+    }
+}
+
+ValidationSummary Validator::run() {
+    PN_PROFILE_SCOPE("validation::run");
+
+    auto start = std::chrono::steady_clock::now();
+
+    Palette& palette = level_.palette();
+    for(uint32_t i = 0; i < palette.size(); ++i) {
+        std::string path = palette.path_for_id(i);
+        if(options_.tile_available) {
+            tile_available_.push_back(options_.tile_available(path));
+            continue;
+        }
+
+        if(!options_.base_directory.empty() && !path.empty() && path[0] != '/') {
+            path = os::path::join(options_.base_directory, path);
+        }
+        tile_available_.push_back(os::path::exists(path));
+    }
+
+    std::vector<std::atomic<bool> > tile_used(palette.size());
+    for(std::atomic<bool>& used: tile_used) {
+        used = false;
+    }
+    tile_used_.swap(tile_used);
+
+    check_sizes();
+
+    blocks_.resize(blocks_across_ * blocks_down_);
+
+    TaskGroup group;
+    for(uint32_t l = 0; l < level_.layer_count(); ++l) {
+        Layer& layer = level_.layer_at(l);
+        for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+            for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+                pool_.submit(group, [=]() { check_layer_chunk(l, cx, cy); });
+            }
+        }
+    }
+
+    for(uint32_t by = 0; by < blocks_down_; ++by) {
+        for(uint32_t bx = 0; bx < blocks_across_; ++bx) {
+            pool_.submit(group, [=]() { check_metadata_block(bx, by); });
+        }
+    }
+
+    group.wait(pool_);
+
+    //Both of these need every chunk to have been seen
+    if(!cancelled()) {
+        check_palette();
+        check_reachability();
+    }
+
+    summary_.chunks = chunks_checked_;
+    summary_.cancelled = cancelled();
+    summary_.elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return summary_;
+}
+
+}
+
+const char* validation_check_name(ValidationCheck check) {
+    switch(check) {
+        case VALIDATION_CHECK_MISSING_TILES: return "Missing tiles";
+        case VALIDATION_CHECK_UNREACHABLE: return "Unreachable";
+        case VALIDATION_CHECK_OVERLAPPING_FLAGS: return "Overlapping flags";
+        case VALIDATION_CHECK_OUT_OF_BOUNDS: return "Out of bounds";
+    }
+    return "Unknown";
+}
+
+ValidationSummary validate_level(Level& level, const ValidationOptions& options, IssueCallback callback) {
+    Validator validator(level, options, callback);
+    return validator.run();
+}
+
+std::vector<ValidationIssue> validate_level(Level& level, const std::string& base_directory) {
+    ValidationOptions options;
+    options.base_directory = base_directory;
+
+    std::vector<ValidationIssue> issues;
+    validate_level(level, options, [&](const ValidationIssue& issue) { issues.push_back(issue); });
+    return issues;
+}
+
+bool has_errors(const std::vector<ValidationIssue>& issues) {
+    for(const ValidationIssue& issue: issues) {
+        if(issue.severity == VALIDATION_ERROR) {
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,90 @@
+#ifndef LEVEL_VALIDATION_H
+#define LEVEL_VALIDATION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+
+namespace pn {
+
+class Level;
+class ThreadPool;
+
+enum ValidationSeverity {
+    VALIDATION_WARNING,
+    VALIDATION_ERROR
+};
+
+enum ValidationCheck {
+    VALIDATION_CHECK_MISSING_TILES, //Tiles that aren't in the palette, or whose image has gone
+    VALIDATION_CHECK_UNREACHABLE, //Triggers, ladders and water walled off from the main area
+    VALIDATION_CHECK_OVERLAPPING_FLAGS, //Triggers and other flags sharing cells with solid ones
+    VALIDATION_CHECK_OUT_OF_BOUNDS //Data outside the level, or layers that don't match its size
+};
+
+const char* validation_check_name(ValidationCheck check);
+
+struct ValidationIssue {
+    ValidationSeverity severity;
+    ValidationCheck check;
+    std::string message;
+
+    //Where the problem is (the first cell of it for areas), -1 for anything that isn't tied to a layer or cell
+    int32_t layer;
+    int32_t x;
+    int32_t y;
+};
+
+typedef std::function<void (const ValidationIssue&)> IssueCallback;
+
+struct ValidationOptions {
+    ValidationOptions():
+        cancel(nullptr),
+        pool(nullptr) {}
+
+    //Relative palette paths are looked up under here, normally the directory the level was loaded from
+    std::string base_directory;
+
+    /*
+        Decides whether a palette image still exists. Defaults to looking
+        for the file. Only ever called on the thread that calls
+        validate_level(), so it can safely look at editor state.
+    */
+    std::function<bool (const std::string&)> tile_available;
+
+    const std::atomic<bool>* cancel; //Checked before each chunk, may be null
+    ThreadPool* pool; //Null uses ThreadPool::shared()
+};
+
+struct ValidationSummary {
+    ValidationSummary():
+        errors(0),
+        warnings(0),
+        chunks(0),
+        cancelled(false),
+        elapsed_ms(0) {}
+
+    uint32_t errors;
+    uint32_t warnings;
+    uint32_t chunks;
+    bool cancelled;
+    double elapsed_ms;
+};
+
+/*
+    Runs every check, one task per chunk on the pool. Issues are passed to
+    callback as soon as they're found, one at a time but from whichever
+    thread found them. The level mustn't change until this returns.
+*/
+ValidationSummary validate_level(Level& level, const ValidationOptions& options, IssueCallback callback);
+
+//Collects the issues instead of streaming them
+std::vector<ValidationIssue> validate_level(Level& level, const std::string& base_directory="");
+
+bool has_errors(const std::vector<ValidationIssue>& issues);
+
+}
+
+#endif // LEVEL_VALIDATION_H
@@ -1,13 +1,52 @@
+#include <iostream>
 #include <gtkmm.h>
+#include <boost/lexical_cast.hpp>
 
 #include "kazbase/logging/logging.h"
 #include "kazbase/fdo/base_directory.h"
+#include "kazbase/string.h"
 #include "main_window.h"
+#include "trace.h"
+
+void print_usage() {
+    std::cerr << "Usage: platformation [--trace=PATH [--trace-seconds=N]] [GTK options]" << std::endl
+              << std::endl
+              << "Options:" << std::endl
+              << "  --trace=PATH        record a Chrome trace of startup and editing to PATH" << std::endl
+              << "  --trace-seconds=N   how long to record for (default 30)" << std::endl;
+}
 
 int main(int argc, char* argv[]) {
     logging::get_logger("/")->add_handler(logging::Handler::ptr(new logging::StdIOHandler()));
     logging::get_logger("/")->set_level(logging::LOG_LEVEL_DEBUG);
 
+    //Strip our own options before GTK gets to see them
+    std::string trace_path;
+    double trace_seconds = 30.0;
+    int kept = 1;
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if(str::starts_with(arg, "--trace=")) {
+            trace_path = arg.substr(std::string("--trace=").length());
+        } else if(str::starts_with(arg, "--trace-seconds=")) {
+            try {
+                trace_seconds = boost::lexical_cast<double>(arg.substr(std::string("--trace-seconds=").length()));
+            } catch(boost::bad_lexical_cast& e) {
+                std::cerr << "Expected a number in option value" << std::endl;
+                print_usage();
+                return 2;
+            }
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argc = kept;
+
+    if(!trace_path.empty()) {
+        //Start before the window exists so that startup shows up in the trace
+        pn::trace::start(trace_path, trace_seconds);
+    }
+
     Glib::RefPtr<Gtk::Application> app =
             Gtk::Application::create(argc, argv, "uk.co.kazade.platformation");
 
@@ -18,5 +57,8 @@ int main(int argc, char* argv[]) {
 
     pn::MainWindow* window = nullptr;
     ui->get_widget_derived("main_window", window);
-    return app->run(*window);
+    int result = app->run(*window);
+
+    pn::trace::stop();
+    return result;
 }
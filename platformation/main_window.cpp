@@ -1,10 +1,22 @@
 #include <glibmm/i18n.h>
 #include <cassert>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <algorithm>
+#include <chrono>
 
 #include "main_window.h"
 #include "level.h"
 #include "layer.h"
+#include "trace.h"
+#include "memory_accounting.h"
+#include "runtime_export.h"
+#include "level_file.h"
+#include "pixel_ops.h"
+#include "tileset_manager.h"
+#include "tile_pixel_cache.h"
 #include "kazbase/fdo/base_directory.h"
 #include "kazbase/json/json.h"
 #include "kazbase/os/core.h"
@@ -16,6 +28,19 @@ namespace pn {
 
 static std::string CONFIG_DIR = os::path::join(fdo::xdg::get_config_home(), "platformation");
 static std::string CONFIG_PATH = os::path::join(CONFIG_DIR, "platformation.json");
+static std::string AUTOSAVE_DIR = os::path::join(CONFIG_DIR, "autosaves");
+static std::string THUMBNAIL_DIR = os::path::join(CONFIG_DIR, "thumbnails");
+static std::string EDITOR_STATE_PATH = os::path::join(CONFIG_DIR, "editor_state.pnes");
+static std::string TILE_PIXEL_CACHE_PATH = os::path::join(CONFIG_DIR, "tile_pixels.pntc");
+
+const uint32_t AUTOSAVE_INTERVAL_SECONDS = 60;
+
+const uint32_t LEVEL_THUMBNAIL_SIZE = 128;
+const uint32_t LEVEL_BROWSER_REFRESH_MS = 50;
+
+const double PREVIEW_SWEEP_TILES_PER_SECOND = 6.0;
+const uint64_t PREVIEW_REPORT_INTERVAL_NS = 500000000ull;
+const float PREVIEW_PARALLAX_STEP = 0.1f;
 
 void MainWindow::_create_layer_list_model() {
     layer_list_model_ = Gtk::TreeStore::create(layer_list_columns_);
@@ -34,6 +59,14 @@ void MainWindow::_create_layer_list_model() {
     level_layers_changed_cb();
 }
 
+void MainWindow::_create_level_browser_model() {
+    level_browser_model_ = Gtk::ListStore::create(level_browser_columns_);
+    Gtk::IconView* view = ui<Gtk::IconView>("level_browser_view");
+    view->set_model(level_browser_model_);
+    view->set_text_column(level_browser_columns_.label);
+    view->set_pixbuf_column(level_browser_columns_.thumbnail);
+}
+
 void MainWindow::_create_tile_location_list_model() {
     tile_location_list_model_ = Gtk::TreeStore::create(tile_location_list_columns_);
     Gtk::TreeView* view = ui<Gtk::TreeView>("tile_location_list");
@@ -44,6 +77,72 @@ void MainWindow::_create_tile_location_list_model() {
     selection->set_mode(Gtk::SELECTION_SINGLE);
 }
 
+void MainWindow::_create_memory_usage_model() {
+    memory_usage_model_ = Gtk::ListStore::create(memory_usage_columns_);
+    Gtk::TreeView* view = ui<Gtk::TreeView>("memory_usage_list");
+    view->set_model(memory_usage_model_);
+    view->append_column(_("Subsystem"), memory_usage_columns_.subsystem);
+    view->append_column(_("Size"), memory_usage_columns_.bytes);
+    view->append_column(_("Objects"), memory_usage_columns_.count);
+    view->append_column(_("Peak Size"), memory_usage_columns_.peak_bytes);
+    view->append_column(_("Peak Objects"), memory_usage_columns_.peak_count);
+
+    for(uint32_t i = 0; i < memory::SUBSYSTEM_MAX; ++i) {
+        Gtk::TreeModel::Row row = *(memory_usage_model_->append());
+        row[memory_usage_columns_.subsystem] = memory::subsystem_name(memory::Subsystem(i));
+    }
+
+    Gtk::TreeModel::Row total_row = *(memory_usage_model_->append());
+    total_row[memory_usage_columns_.subsystem] = _("Total");
+}
+
+bool MainWindow::refresh_memory_usage() {
+    Gtk::TreeModel::Children rows = memory_usage_model_->children();
+
+    uint32_t i = 0;
+    for(Gtk::TreeModel::iterator it = rows.begin(); it != rows.end(); ++it, ++i) {
+        memory::Usage usage = (i < memory::SUBSYSTEM_MAX) ? memory::usage(memory::Subsystem(i)) : memory::total();
+
+        Gtk::TreeModel::Row row = *it;
+        row[memory_usage_columns_.bytes] = memory::format_bytes(usage.bytes);
+        row[memory_usage_columns_.count] = usage.count;
+        row[memory_usage_columns_.peak_bytes] = memory::format_bytes(usage.peak_bytes);
+        row[memory_usage_columns_.peak_count] = usage.peak_count;
+    }
+
+    return true; //Keep the timeout running
+}
+
+void MainWindow::memory_toolbutton_toggled_cb() {
+    if(ui<Gtk::ToggleToolButton>("memory_toolbutton")->get_active()) {
+        refresh_memory_usage();
+        memory_refresh_connection_ = Glib::signal_timeout().connect(
+            sigc::mem_fun(this, &MainWindow::refresh_memory_usage), 500
+        );
+        ui<Gtk::Window>("memory_window")->show();
+    } else {
+        memory_refresh_connection_.disconnect();
+        ui<Gtk::Window>("memory_window")->hide();
+    }
+}
+
+bool MainWindow::memory_window_delete_cb(GdkEventAny* event) {
+    //Closing the panel just untoggles the button, the window itself is reused
+    ui<Gtk::ToggleToolButton>("memory_toolbutton")->set_active(false);
+    return true;
+}
+
+void MainWindow::_create_validation_model() {
+    validation_model_ = Gtk::ListStore::create(validation_columns_);
+    Gtk::TreeView* view = ui<Gtk::TreeView>("validation_list");
+    view->set_model(validation_model_);
+    view->append_column(_("Severity"), validation_columns_.severity);
+    view->append_column(_("Check"), validation_columns_.check);
+    view->append_column(_("Layer"), validation_columns_.layer);
+    view->append_column(_("Cell"), validation_columns_.position);
+    view->append_column(_("Problem"), validation_columns_.message);
+}
+
 void MainWindow::layer_selection_changed_cb() {
     Gtk::TreeView* view = ui<Gtk::TreeView>("layer_list");
 
@@ -54,6 +153,7 @@ void MainWindow::layer_selection_changed_cb() {
         Gtk::TreeModel::Row row = *iter;
         uint32_t active_layer = row[layer_list_columns_.column_id_];
         level_->set_active_layer(active_layer);
+        save_editor_state();
     }
 
     /*
@@ -70,6 +170,45 @@ void MainWindow::layer_selection_changed_cb() {
     }
 }
 
+enum ResizeAnchor {
+    RESIZE_ANCHOR_RIGHT_TOP = 0,
+    RESIZE_ANCHOR_LEFT_BOTTOM,
+    RESIZE_ANCHOR_ALL_EDGES
+};
+
+void MainWindow::level_size_spin_changed_cb() {
+    if(!level_) {
+        return;
+    }
+
+    int32_t dw = ui<Gtk::SpinButton>("level_width_spin")->get_value_as_int() - int32_t(level_->horizontal_tile_count());
+    int32_t dh = ui<Gtk::SpinButton>("level_height_spin")->get_value_as_int() - int32_t(level_->vertical_tile_count());
+
+    if(!dw && !dh) {
+        return;
+    }
+
+    switch(ui<Gtk::ComboBoxText>("resize_anchor_combo")->get_active_row_number()) {
+        case RESIZE_ANCHOR_LEFT_BOTTOM:
+            level_->extend(dw, dh, 0, 0);
+        break;
+        case RESIZE_ANCHOR_ALL_EDGES:
+            level_->extend(dw / 2, dh / 2, dw - (dw / 2), dh - (dh / 2));
+        break;
+        default:
+            level_->extend(0, 0, dw, dh);
+    }
+}
+
+void MainWindow::level_size_changed_cb() {
+    //Selections are shaped to their layer, a resized layer leaves them meaning nothing
+    clear_selection();
+    metadata_changed();
+
+    ui<Gtk::SpinButton>("level_width_spin")->set_value(level_->horizontal_tile_count());
+    ui<Gtk::SpinButton>("level_height_spin")->set_value(level_->vertical_tile_count());
+}
+
 void MainWindow::level_layers_changed_cb() {
     layer_list_model_->clear();
 
@@ -95,55 +234,1188 @@ void MainWindow::level_layers_changed_cb() {
     }    
 }
 
-void MainWindow::save_tile_locations() {
-    json::JSON j;
-    json::Node& node = j.insert_array("locations");
-    for(std::string location: tile_chooser_->directories()) {
-        node.append_value(location);
+void MainWindow::trace_toolbutton_toggled_cb() {
+    bool active = ui<Gtk::ToggleToolButton>("trace_toolbutton")->get_active();
+    if(active == trace::recording()) {
+        //The button is just being synced up with a trace that started or stopped elsewhere
+        return;
     }
 
-    std::ofstream fileout(CONFIG_PATH);
-    fileout << json::dumps(j);
+    if(active) {
+        std::string trace_dir = os::path::join(Glib::get_user_cache_dir(), "platformation");
+        if(!os::path::exists(trace_dir)) {
+            os::make_dirs(trace_dir);
+        }
+
+        std::string filename = "trace-" + Glib::DateTime::create_now_local().format("%Y%m%d-%H%M%S") + ".json";
+        trace::start(os::path::join(trace_dir, filename));
+        ui<Gtk::Label>("status_label")->set_text(_("Recording trace..."));
+    } else {
+        trace_written_cb(trace::stop());
+    }
 }
 
-void MainWindow::load_tile_locations() {
-    std::string contents = file_utils::read_contents(CONFIG_PATH);
+void MainWindow::trace_written_cb(std::string path) {
+    ui<Gtk::ToggleToolButton>("trace_toolbutton")->set_active(false);
 
-    if(str::strip(contents).empty()) {
-        L_INFO("Not loading locations from config as the config is empty");
+    if(path.empty()) {
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to write the trace file"));
+    } else {
+        ui<Gtk::Label>("status_label")->set_text(_("Trace written to ") + path);
+    }
+}
+
+void MainWindow::session_toolbutton_toggled_cb() {
+    bool active = ui<Gtk::ToggleToolButton>("session_toolbutton")->get_active();
+    if(active == bool(session_)) {
         return;
     }
 
-    json::JSON j = json::loads(contents);
+    if(!active) {
+        stop_session();
+        ui<Gtk::Label>("status_label")->set_text(_("Stopped sharing the level"));
+        return;
+    }
+
+    if(!os::path::exists(CONFIG_DIR)) {
+        os::make_dirs(CONFIG_DIR);
+    }
+
+    try {
+        session_ = SessionSync::open(*level_, os::path::join(CONFIG_DIR, "session.sock"));
+    } catch(SessionError& e) {
+        L_ERROR(e.what());
+        ui<Gtk::ToggleToolButton>("session_toolbutton")->set_active(false);
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to share the level: ") + e.what());
+        return;
+    }
+
+    if(session_->hosting()) {
+        ui<Gtk::Label>("status_label")->set_text(_("Sharing the level, other editors can join with Share Session"));
+    } else {
+        ui<Gtk::Label>("status_label")->set_text(_("Joining the shared level..."));
+    }
+}
+
+void MainWindow::update_session() {
+    bool was_connected = session_->connected();
+    uint32_t peer_count = session_->peer_count();
+
+    session_->update();
+
+    if(!session_->error().empty()) {
+        std::string error = session_->error();
+        stop_session();
+        ui<Gtk::Label>("status_label")->set_text(_("Left the shared level: ") + error);
+    } else if(!was_connected && session_->connected()) {
+        ui<Gtk::Label>("status_label")->set_text(_("Joined the shared level"));
+    } else if(session_->hosting() && peer_count != session_->peer_count()) {
+        ui<Gtk::Label>("status_label")->set_text(
+            _("Sharing the level with ") + boost::lexical_cast<std::string>(session_->peer_count()) + _(" other editor(s)")
+        );
+    }
+}
+
+void MainWindow::stop_session() {
+    session_.reset();
+    ui<Gtk::ToggleToolButton>("session_toolbutton")->set_active(false);
+}
+
+void MainWindow::frame_started_cb(uint64_t time_ms) {
+    if(canvas_->view().last_changes() & VIEW_MOVED) {
+        sync_scrollbars();
+    }
+
+    //The preview's camera is put back when it stops, so isn't worth remembering
+    if((canvas_->view().last_changes() & (VIEW_MOVED | VIEW_ZOOMED)) && !preview_) {
+        save_editor_state();
+    }
+
+    if(level_renderer_) {
+        level_renderer_->update_animations(time_ms);
+    }
+
+    if(preview_) {
+        update_parallax_preview();
+    }
+
+    if(session_) {
+        update_session();
+    }
+}
+
+void MainWindow::toggle_parallax_preview() {
+    if(!level_renderer_) {
+        return;
+    }
+
+    if(preview_) {
+        L_INFO("Parallax preview: " + preview_->pacing().summary());
+        ui<Gtk::Label>("status_label")->set_text(_("Preview finished, ") + preview_->pacing().summary());
+        preview_.reset();
+
+        for(uint32_t i = 0; i < level_->layer_count(); ++i) {
+            level_renderer_->set_layer_offset(level_->layer_at(i), 0, 0);
+        }
+
+        //Back to wherever the scrollbars say
+        scrollbar_value_changed();
+        return;
+    }
+
+    double start_x = canvas_->view().camera_x();
+    double start_y = canvas_->view().camera_y();
+    double half_width = double(level_->horizontal_tile_count()) / 2.0;
+
+    preview_.reset(new ParallaxPreview(start_x, start_y));
+    preview_->set_path(CameraPath::sweep(start_x, -half_width, half_width, start_y, PREVIEW_SWEEP_TILES_PER_SECOND));
+    preview_input_x_ = preview_input_y_ = 0;
+    preview_reported_ns_ = profiler::now_ns();
+
+    ui<Gtk::Label>("status_label")->set_text(_("Previewing parallax, arrows scroll, [ and ] change the active layer's parallax, P stops"));
+}
+
+void MainWindow::update_parallax_preview() {
+    uint64_t now = profiler::now_ns();
+    if(!preview_->advance(now)) {
+        return;
+    }
+
+    //One transform for the camera and one per layer, the tiles never move
+    canvas_->scene().active_camera().move_to(preview_->camera_x(), preview_->camera_y(), 0.0);
+    for(uint32_t i = 0; i < level_->layer_count(); ++i) {
+        Layer& layer = level_->layer_at(i);
+
+        double x, y;
+        preview_->layer_offset(layer, x, y);
+        level_renderer_->set_layer_offset(layer, float(x), float(y));
+    }
+
+    if(now - preview_reported_ns_ > PREVIEW_REPORT_INTERVAL_NS) {
+        ui<Gtk::Label>("status_label")->set_text(preview_->pacing().summary());
+        preview_reported_ns_ = now;
+    }
+}
+
+bool MainWindow::preview_key_event(GdkEventKey* key, bool pressed) {
+    double amount = pressed ? 1.0 : 0.0;
+
+    switch(key->keyval) {
+        case GDK_KEY_Left: preview_input_x_ = -amount; break;
+        case GDK_KEY_Right: preview_input_x_ = amount; break;
+        case GDK_KEY_Up: preview_input_y_ = amount; break;
+        case GDK_KEY_Down: preview_input_y_ = -amount; break;
+        case GDK_KEY_bracketleft:
+        case GDK_KEY_bracketright: {
+            if(pressed && level_->layer_count()) {
+                Layer& layer = level_->layer_at(level_->active_layer());
+                float step = (key->keyval == GDK_KEY_bracketleft) ? -PREVIEW_PARALLAX_STEP : PREVIEW_PARALLAX_STEP;
+                layer.set_parallax(std::max(0.0f, layer.parallax() + step));
+
+                char text[128];
+                snprintf(text, sizeof(text), "%s parallax %.1f", layer.name().c_str(), layer.parallax());
+                ui<Gtk::Label>("status_label")->set_text(text);
+                preview_reported_ns_ = profiler::now_ns();
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+
+    preview_->set_input(preview_input_x_, preview_input_y_);
+    return true;
+}
+
+bool MainWindow::key_release_event_cb(GdkEventKey* key) {
+    if(preview_) {
+        preview_key_event(key, false);
+    }
+    return true;
+}
+
+void MainWindow::export_toolbutton_clicked_cb() {
+    Gtk::FileChooserDialog fd(_("Export runtime pack"), Gtk::FILE_CHOOSER_ACTION_SAVE);
+
+    fd.set_transient_for(*this);
+    fd.set_do_overwrite_confirmation(true);
+    fd.set_current_name(level_->name() + ".pnrt");
+    fd.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+    fd.add_button(Gtk::Stock::OK, Gtk::RESPONSE_OK);
+
+    if(fd.run() != Gtk::RESPONSE_OK) {
+        return;
+    }
+
+    ExportStats stats;
+    if(!export_runtime_pack(*level_, fd.get_filename(), ExportOptions(), &stats)) {
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to write the runtime pack"));
+        return;
+    }
+
+    char summary[256];
+    snprintf(summary, sizeof(summary), _("Exported %u chunks, %u quads and %u collision rects (%s) in %.1f ms"),
+        stats.chunk_count, stats.quad_count, stats.collision_rect_count,
+        memory::format_bytes(stats.byte_count).c_str(), stats.elapsed_ms
+    );
+    ui<Gtk::Label>("status_label")->set_text(summary);
+}
+
+void MainWindow::validate_toolbutton_clicked_cb() {
+    stop_validation();
+
+    validation_model_->clear();
+    validation_queue_.clear();
+    ui<Gtk::Label>("validation_status_label")->set_text(_("Validating..."));
+    ui<Gtk::Button>("validation_cancel_button")->set_sensitive(true);
+    ui<Gtk::Window>("validation_window")->show();
+
+    //A round trip through the level file format is the cheapest full copy, and it's what the game will load anyway
+    std::vector<uint8_t> data;
+    write_level(*level_, LEVEL_FORMAT_BINARY, data);
+    Level::ptr snapshot = read_level(data, LEVEL_FORMAT_BINARY);
+
+    //Tiles whose location was removed from the chooser are still in the palette, but can't be drawn
+    std::set<std::string> available;
+    for(uint32_t i = 0; i < level_->palette().size(); ++i) {
+        const std::string& path = level_->palette().path_for_id(i);
+        if(tile_chooser_->texture_for_path(path)) {
+            available.insert(path);
+        }
+    }
+
+    validation_cancel_ = false;
+    validation_finished_ = false;
+    validation_thread_ = std::thread([=]() {
+        ValidationOptions options;
+        options.cancel = &validation_cancel_;
+        options.tile_available = [&available](const std::string& path) {
+            return available.count(path) > 0;
+        };
+
+        ValidationSummary summary = validate_level(*snapshot, options, [this](const ValidationIssue& issue) {
+            std::lock_guard<std::mutex> lock(validation_lock_);
+            validation_queue_.push_back(issue);
+        });
+
+        std::lock_guard<std::mutex> lock(validation_lock_);
+        validation_summary_ = summary;
+        validation_finished_ = true;
+    });
+
+    validation_refresh_connection_ = Glib::signal_timeout().connect(
+        sigc::mem_fun(this, &MainWindow::refresh_validation_results), 100
+    );
+}
+
+bool MainWindow::refresh_validation_results() {
+    std::vector<ValidationIssue> issues;
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(validation_lock_);
+        issues.swap(validation_queue_);
+        finished = validation_finished_;
+    }
+
+    for(const ValidationIssue& issue: issues) {
+        Gtk::TreeModel::Row row = *(validation_model_->append());
+        row[validation_columns_.severity] = (issue.severity == VALIDATION_ERROR) ? _("Error") : _("Warning");
+        row[validation_columns_.check] = validation_check_name(issue.check);
+        row[validation_columns_.layer] = (issue.layer >= 0) ? boost::lexical_cast<std::string>(issue.layer) : "";
+        row[validation_columns_.position] = (issue.x >= 0 || issue.y >= 0) ?
+            boost::lexical_cast<std::string>(issue.x) + ", " + boost::lexical_cast<std::string>(issue.y) : "";
+        row[validation_columns_.message] = issue.message;
+    }
+
+    if(!finished) {
+        return true;
+    }
+
+    validation_thread_.join();
+    ui<Gtk::Button>("validation_cancel_button")->set_sensitive(false);
+
+    char summary[256];
+    if(validation_summary_.cancelled) {
+        snprintf(summary, sizeof(summary), _("Cancelled after %u chunks"), validation_summary_.chunks);
+    } else {
+        snprintf(summary, sizeof(summary), _("%u errors and %u warnings in %u chunks (%.1f ms)"),
+            validation_summary_.errors, validation_summary_.warnings, validation_summary_.chunks, validation_summary_.elapsed_ms
+        );
+    }
+    ui<Gtk::Label>("validation_status_label")->set_text(summary);
+    return false;
+}
+
+void MainWindow::validation_cancel_button_clicked_cb() {
+    validation_cancel_ = true;
+}
+
+bool MainWindow::validation_window_delete_cb(GdkEventAny* event) {
+    stop_validation();
+    ui<Gtk::Window>("validation_window")->hide();
+    return true;
+}
+
+void MainWindow::browse_toolbutton_clicked_cb() {
+    Gtk::FileChooserDialog fd(_("Choose a project folder"), Gtk::FILE_CHOOSER_ACTION_SELECT_FOLDER);
+
+    fd.set_transient_for(*this);
+    fd.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+    fd.add_button(Gtk::Stock::OK, Gtk::RESPONSE_OK);
+
+    if(fd.run() != Gtk::RESPONSE_OK) {
+        return;
+    }
+
+    //Dropping the old browser stops its thumbnailing
+    level_browser_refresh_connection_.disconnect();
+    level_browser_model_->clear();
+    level_browser_.reset();
+    level_browser_.reset(new LevelBrowser(level_thumbnails_, fd.get_filename()));
+
+    //Every level is listed straight away, thumbnails fill in as they arrive
+    for(uint32_t i = 0; i < level_browser_->entry_count(); ++i) {
+        std::string path = level_browser_->entry(i).path;
+        size_t slash = path.rfind('/');
+
+        Gtk::TreeModel::Row row = *(level_browser_model_->append());
+        row[level_browser_columns_.index] = i;
+        row[level_browser_columns_.label] = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    }
+
+    char status[256];
+    snprintf(status, sizeof(status), _("%u levels"), level_browser_->entry_count());
+    ui<Gtk::Label>("level_browser_status_label")->set_text(status);
+    ui<Gtk::Window>("level_browser_window")->show();
+
+    level_browser_refresh_connection_ = Glib::signal_timeout().connect(
+        sigc::mem_fun(this, &MainWindow::refresh_level_browser), LEVEL_BROWSER_REFRESH_MS
+    );
+}
+
+static Glib::RefPtr<Gdk::Pixbuf> pixbuf_from_image(const Image& image) {
+    Glib::RefPtr<Gdk::Pixbuf> pixbuf = Gdk::Pixbuf::create(Gdk::COLORSPACE_RGB, true, 8, image.width, image.height);
+
+    std::vector<uint32_t> row(image.width);
+    for(uint32_t y = 0; y < image.height; ++y) {
+        unpremultiply_row(image.row(y), row.data(), image.width);
+        memcpy(pixbuf->get_pixels() + (y * pixbuf->get_rowstride()), row.data(), image.width * 4);
+    }
+    return pixbuf;
+}
+
+bool MainWindow::refresh_level_browser() {
+    std::vector<uint32_t> finished;
+    bool running = level_browser_->take_finished(finished);
+
+    Gtk::TreeModel::Children rows = level_browser_model_->children();
+    for(uint32_t idx: finished) {
+        const LevelEntry& entry = level_browser_->entry(idx);
+        Gtk::TreeModel::Row row = rows[idx];
+
+        if(entry.state == LEVEL_ENTRY_FAILED) {
+            row[level_browser_columns_.label] = Glib::ustring(row[level_browser_columns_.label]) + _(" (unreadable)");
+            continue;
+        }
+
+        if(entry.thumbnail.width && entry.thumbnail.height) {
+            row[level_browser_columns_.thumbnail] = pixbuf_from_image(entry.thumbnail);
+        }
+
+        char size[64];
+        snprintf(size, sizeof(size), "\n%ux%u", entry.summary.width, entry.summary.height);
+        row[level_browser_columns_.label] = entry.summary.name + size;
+    }
+
+    if(running) {
+        return true;
+    }
+
+    uint32_t cached = 0;
+    uint32_t failed = 0;
+    for(uint32_t i = 0; i < level_browser_->entry_count(); ++i) {
+        cached += level_browser_->entry(i).from_cache ? 1 : 0;
+        failed += (level_browser_->entry(i).state == LEVEL_ENTRY_FAILED) ? 1 : 0;
+    }
+
+    char status[256];
+    snprintf(status, sizeof(status), _("%u levels, %u thumbnails from the cache, %u unreadable, in %.1f ms"),
+        level_browser_->entry_count(), cached, failed, level_browser_->elapsed_ms()
+    );
+    ui<Gtk::Label>("level_browser_status_label")->set_text(status);
+    return false;
+}
+
+void MainWindow::level_browser_item_activated_cb(const Gtk::TreeModel::Path& path) {
+    Gtk::TreeModel::iterator iter = level_browser_model_->get_iter(path);
+    if(!iter || !level_browser_) {
+        return;
+    }
+
+    uint32_t idx = (*iter)[level_browser_columns_.index];
+    try {
+        set_level(level_browser_->open(idx), level_browser_->entry(idx).path);
+        ui<Gtk::Label>("status_label")->set_text(_("Opened ") + level_browser_->entry(idx).path);
+    } catch(LevelFileError& e) {
+        L_ERROR(e.what());
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to open ") + level_browser_->entry(idx).path);
+    }
+}
+
+bool MainWindow::level_browser_window_delete_cb(GdkEventAny* event) {
+    //The browser is kept, so reopening the window shows the same project without any work
+    ui<Gtk::Window>("level_browser_window")->hide();
+    return true;
+}
+
+void MainWindow::stop_validation() {
+    if(!validation_thread_.joinable()) {
+        return;
+    }
+
+    validation_cancel_ = true;
+    validation_thread_.join();
+    validation_refresh_connection_.disconnect();
+    ui<Gtk::Button>("validation_cancel_button")->set_sensitive(false);
+}
+
+Level::ptr MainWindow::restore_level(std::string& path) {
+    if(!load_editor_state(EDITOR_STATE_PATH, restored_state_)) {
+        restored_state_ = EditorState();
+    }
+
+    //An autosave is of whatever was open last time, so it most likely still came from that file
+    Level::ptr level = recover_autosave();
+    if(level) {
+        path = restored_state_.level_path;
+        return level;
+    }
+
+    if(!restored_state_.level_path.empty() && os::path::exists(restored_state_.level_path)) {
+        try {
+            path = restored_state_.level_path;
+            return load_level(path);
+        } catch(LevelFileError& e) {
+            L_ERROR(e.what());
+            ui<Gtk::Label>("status_label")->set_text(_("Unable to open ") + restored_state_.level_path);
+        }
+    }
+
+    path.clear();
+    return Level::ptr(new Level());
+}
+
+void MainWindow::restore_view() {
+    canvas_->view().jump_to(restored_state_.camera_x, restored_state_.camera_y);
+    canvas_->view().set_ortho_height(restored_state_.ortho_height);
+
+    if(restored_state_.active_layer < level_->layer_count()) {
+        level_->set_active_layer(restored_state_.active_layer);
+        level_layers_changed_cb();
+    }
+}
+
+void MainWindow::restore_tiles() {
+    PN_PROFILE_SCOPE("MainWindow::restore_tiles");
+
+    auto start = std::chrono::steady_clock::now();
+
+    //Tiles seen last time come out of the pixel cache rather than being decoded again
+    TilesetManager& manager = TilesetManager::instance();
+    manager.set_pixel_cache(TilePixelCache::open(TILE_PIXEL_CACHE_PATH));
+    uint64_t decodes = manager.decode_count();
+    uint64_t cache_hits = manager.cache_hit_count();
+
+    std::vector<std::string> directories = restored_state_.tile_directories;
+    if(!os::path::exists(EDITOR_STATE_PATH)) {
+        directories = legacy_tile_locations();
+    }
 
     ui<Gtk::ProgressBar>("progress_bar")->show();
+    for(std::string directory: directories) {
+        if(!os::path::is_dir(directory)) {
+            L_WARN("Skipping tile directory that no longer exists: " + directory);
+            continue;
+        }
+        tile_chooser_->add_directory(directory);
+    }
+    ui<Gtk::ProgressBar>("progress_bar")->hide();
+
+    if(!restored_state_.selected_tile.empty()) {
+        tile_chooser_->set_selected_path(restored_state_.selected_tile);
+    }
+    restoring_editor_state_ = false;
+
+    //Everything's uploaded, the mapping isn't needed again until the next start
+    manager.set_pixel_cache(TilePixelCache::ptr());
+
+    L_INFO(
+        "Restored " + boost::lexical_cast<std::string>(directories.size()) + " tile directories in " +
+        boost::lexical_cast<std::string>(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()) +
+        "ms, " + boost::lexical_cast<std::string>(manager.cache_hit_count() - cache_hits) + " of " +
+        boost::lexical_cast<std::string>(manager.decode_count() - decodes) + " tiles from the pixel cache"
+    );
+
+    save_editor_state();
+    editor_state_writer_.cache_tiles(tile_chooser_->tile_paths());
+}
+
+std::vector<std::string> MainWindow::legacy_tile_locations() {
+    //Older versions kept the tile directories in a JSON config, which is only read now
+    std::vector<std::string> locations;
+    if(!os::path::exists(CONFIG_PATH)) {
+        return locations;
+    }
+
+    std::string contents = file_utils::read_contents(CONFIG_PATH);
+    if(str::strip(contents).empty()) {
+        return locations;
+    }
+
+    json::JSON j = json::loads(contents);
     if(j.has_key("locations")) {
         for(uint32_t i = 0; i < j["locations"].length(); ++i) {
-            json::Node& n = j["locations"][i];
-            tile_chooser_->add_directory(n.get());
+            locations.push_back(j["locations"][i].get());
         }
     }
-    ui<Gtk::ProgressBar>("progress_bar")->hide();
+    return locations;
+}
+
+void MainWindow::save_editor_state() {
+    //Half restored state would overwrite the good one, restoring saves once it's done
+    if(restoring_editor_state_ || !tile_chooser_ || !level_) {
+        return;
+    }
+
+    EditorState state;
+    for(std::string directory: tile_chooser_->directories()) {
+        state.tile_directories.push_back(directory);
+    }
+    if(const TileChooserEntry* entry = tile_chooser_->selected_entry()) {
+        state.selected_tile = entry->abs_path;
+    }
+    state.camera_x = canvas_->view().camera_x();
+    state.camera_y = canvas_->view().camera_y();
+    state.ortho_height = canvas_->view().ortho_height();
+    state.active_layer = level_->active_layer();
+    state.level_path = level_path_;
+
+    editor_state_writer_.save(state);
+}
+
+void MainWindow::reload_autotile_rules() {
+    if(!level_) {
+        return;
+    }
+
+    autotiler_.clear();
+    tile_animator_.clear();
+    for(std::string directory: tile_chooser_->directories()) {
+        autotiler_.load_rules(os::path::join(directory, "autotile.json"), level_->palette(), directory);
+        tile_animator_.load_definitions(os::path::join(directory, "animations.json"), level_->palette(), directory);
+    }
+
+    if(active_terrain_ >= int32_t(autotiler_.terrain_count())) {
+        active_terrain_ = -1;
+    }
+
+    //Tiles from a removed directory lose their textures and animations, new ones may gain them
+    level_renderer_->refresh_textures();
+}
+
+void MainWindow::set_level(Level::ptr level, const std::string& path) {
+    if(preview_) {
+        toggle_parallax_preview();
+    }
+
+    //Sessions are tied to the level they were opened on
+    if(session_) {
+        stop_session();
+    }
+
+    //The renderer holds on to the old level, so it goes first
+    level_renderer_.reset();
+    level_ = level;
+    level_renderer_.reset(new LevelRenderer(*level_, canvas_->scene(), canvas_->entities()));
+
+    active_tile_mesh_ = 0;
+    selection_marked_ = false;
+    clear_selection();
+
+    //Watch for layer changes on the level
+    level_->signal_layers_changed().connect(
+        sigc::mem_fun(this, &MainWindow::level_layers_changed_cb)
+    );
+
+    level_->signal_size_changed().connect(
+        sigc::mem_fun(this, &MainWindow::level_size_changed_cb)
+    );
+
+    level_->signal_layer_removing().connect(
+        sigc::mem_fun(this, &MainWindow::layer_removing_cb)
+    );
+
+    level_renderer_->set_texture_lookup([=](const std::string& path) -> kglt::TextureID {
+        return tile_chooser_->texture_for_path(path);
+    });
+    level_renderer_->set_animator(&tile_animator_);
+
+    ui<Gtk::Entry>("level_name_box")->set_text(level_->name());
+    level_size_changed_cb();
+    level_layers_changed_cb();
+
+    //Terrains and animations are looked up in the palette, which is the new level's now
+    reload_autotile_rules();
+
+    level_path_ = path;
+    save_editor_state();
+}
+
+void MainWindow::cycle_active_terrain() {
+    if(!autotiler_.terrain_count()) {
+        ui<Gtk::Label>("status_label")->set_text(_("No autotile terrains loaded"));
+        return;
+    }
+
+    //Steps through each terrain and then back to plain tile painting
+    active_terrain_++;
+    if(active_terrain_ >= int32_t(autotiler_.terrain_count())) {
+        active_terrain_ = -1;
+        ui<Gtk::Label>("status_label")->set_text(_("Painting tiles"));
+    } else {
+        ui<Gtk::Label>("status_label")->set_text(_("Painting terrain: ") + autotiler_.terrain(active_terrain_).name);
+    }
+}
+
+void MainWindow::paint_active_tile_terrain() {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!active_tile_position(layer, x, y)) {
+        return;
+    }
+
+    AutotileBatch batch(autotiler_, *layer);
+    batch.paint(x, y, active_terrain_);
+    batch.commit();
+}
+
+void MainWindow::fill_active_layer_with_terrain() {
+    if(active_terrain_ < 0 || !level_->layer_count()) {
+        return;
+    }
+
+    Layer& layer = level_->layer_at(level_->active_layer());
+
+    AutotileBatch batch(autotiler_, layer);
+    batch.fill(0, 0, layer.width(), layer.height(), active_terrain_);
+    uint32_t evaluated = batch.commit();
+
+    L_DEBUG("Autotile fill evaluated " + boost::lexical_cast<std::string>(evaluated) + " cells");
+}
+
+void MainWindow::cycle_active_flag() {
+    //Steps through each flag and then back to painting tiles
+    active_flag_++;
+    if(active_flag_ >= int32_t(MAX_METADATA_FLAGS)) {
+        active_flag_ = -1;
+        ui<Gtk::Label>("status_label")->set_text(_("Painting tiles"));
+    } else {
+        ui<Gtk::Label>("status_label")->set_text(_("Painting flag: ") + std::string(metadata_flag_name(active_flag_)));
+    }
+    metadata_changed();
+}
+
+void MainWindow::paint_active_tile_flag() {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(active_flag_ < 0 || !active_tile_position(layer, x, y)) {
+        return;
+    }
+
+    //Clicking toggles, so the same brush takes a flag away again
+    MetadataLayer& metadata = level_->metadata();
+    MetadataFlags mask = MetadataFlags(1 << active_flag_);
+    if(metadata.flags_at(x, y) & mask) {
+        metadata.remove_flags(x, y, mask);
+    } else {
+        metadata.add_flags(x, y, mask);
+    }
+    metadata_changed();
+}
+
+void MainWindow::fill_active_flag(bool value) {
+    if(active_flag_ < 0) {
+        ui<Gtk::Label>("status_label")->set_text(_("Press K to pick a flag first"));
+        return;
+    }
+
+    MetadataLayer& metadata = level_->metadata();
+    MetadataFlags mask = MetadataFlags(1 << active_flag_);
+
+    CellRect bounds;
+    if(selection_ && selection_->bounds(bounds)) {
+        //Merged first, so each fill rebuilds a chunk's rectangles once rather than once a cell
+        std::vector<CellRect> rects;
+        greedy_merge(bounds.width, bounds.height, [&](uint32_t x, uint32_t y) {
+            return selection_->contains(bounds.x + x, bounds.y + y);
+        }, rects);
+
+        for(const CellRect& rect: rects) {
+            metadata.fill(CellRect(bounds.x + rect.x, bounds.y + rect.y, rect.width, rect.height), mask, value);
+        }
+    } else if(selected_area(bounds)) {
+        metadata.fill(bounds, mask, value);
+        selection_marked_ = false;
+    } else {
+        return;
+    }
+    metadata_changed();
+}
+
+void MainWindow::metadata_changed() {
+    if(!metadata_overlay_) {
+        return;
+    }
+
+    if(active_flag_ < 0) {
+        metadata_overlay_->hide();
+        return;
+    }
+
+    metadata_overlay_->show(level_->metadata(), MetadataFlags(1 << active_flag_));
+}
+
+void MainWindow::mark_selection_corner() {
+    Layer* layer = nullptr;
+    if(!active_tile_position(layer, selection_x_, selection_y_)) {
+        return;
+    }
+
+    selection_marked_ = true;
+    ui<Gtk::Label>("status_label")->set_text(_("Selection corner marked"));
+}
+
+bool MainWindow::selected_area(CellRect& area) {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!active_tile_position(layer, x, y)) {
+        return false;
+    }
+
+    //Without a marked corner the selection is just the active tile
+    uint32_t corner_x = selection_marked_ ? selection_x_ : x;
+    uint32_t corner_y = selection_marked_ ? selection_y_ : y;
+
+    area.x = std::min(x, corner_x);
+    area.y = std::min(y, corner_y);
+    area.width = std::max(x, corner_x) - area.x + 1;
+    area.height = std::max(y, corner_y) - area.y + 1;
+    return true;
+}
+
+void MainWindow::copy_selection(bool active_layer_only, bool cut) {
+    CellRect area;
+    if(!selected_area(area) || !level_->layer_count()) {
+        return;
+    }
+
+    uint32_t first_layer = active_layer_only ? level_->active_layer() : 0;
+    uint32_t layer_count = active_layer_only ? 1 : level_->layer_count();
+
+    Region::ptr region = cut ?
+        Region::cut(*level_, area, first_layer, layer_count) :
+        Region::copy(*level_, area, first_layer, layer_count);
+
+    if(region) {
+        clipboard_ = region;
+        selection_marked_ = false;
+        if(cut) {
+            metadata_changed();
+        }
+        ui<Gtk::Label>("status_label")->set_text(
+            (cut ? _("Cut ") : _("Copied ")) + boost::lexical_cast<std::string>(region->width()) + "x" +
+            boost::lexical_cast<std::string>(region->height())
+        );
+    }
+}
+
+SelectionCombine MainWindow::selection_combine(GdkEventKey* key) const {
+    bool shift = (key->state & GDK_SHIFT_MASK) != 0;
+    bool alt = (key->state & GDK_MOD1_MASK) != 0;
+
+    if(shift && alt) {
+        return SELECTION_INTERSECT;
+    } else if(shift) {
+        return SELECTION_ADD;
+    } else if(alt) {
+        return SELECTION_SUBTRACT;
+    }
+    return SELECTION_REPLACE;
+}
+
+void MainWindow::combine_selection(Layer& layer, const Selection& shape, SelectionCombine how) {
+    //Selecting on another layer starts again there
+    if(!selection_ || selection_layer_ != &layer || !selection_->fits(layer)) {
+        selection_.reset(new Selection(layer));
+        selection_layer_ = &layer;
+    }
+
+    selection_->combine(shape, how);
+    selection_changed();
+}
+
+void MainWindow::select_area(SelectionCombine how) {
+    CellRect area;
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!active_tile_position(layer, x, y) || !selected_area(area)) {
+        return;
+    }
+
+    Selection shape(*layer);
+    shape.add_rect(area);
+    selection_marked_ = false;
+    combine_selection(*layer, shape, how);
+}
+
+void MainWindow::select_all_of_active_tile(SelectionCombine how) {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!active_tile_position(layer, x, y)) {
+        return;
+    }
+
+    Selection shape(*layer);
+    shape.add_tile(*layer, layer->tile_image_at(x, y));
+    combine_selection(*layer, shape, how);
+}
+
+void MainWindow::add_lasso_point() {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!active_tile_position(layer, x, y)) {
+        return;
+    }
+
+    if(layer != lasso_layer_) {
+        lasso_.clear();
+        lasso_layer_ = layer;
+    }
+
+    //Through the middle of each cell picked
+    lasso_.push_back(SelectionPoint(double(x) + 0.5, double(y) + 0.5));
+    ui<Gtk::Label>("status_label")->set_text(
+        _("Lasso point ") + boost::lexical_cast<std::string>(lasso_.size()) + _(", Enter to close")
+    );
+}
+
+void MainWindow::close_lasso(SelectionCombine how) {
+    if(!lasso_layer_ || lasso_.size() < 3) {
+        ui<Gtk::Label>("status_label")->set_text(_("A lasso needs at least three points"));
+        return;
+    }
+
+    Selection shape(*lasso_layer_);
+    shape.add_lasso(lasso_);
+    combine_selection(*lasso_layer_, shape, how);
+
+    lasso_.clear();
+    lasso_layer_ = nullptr;
+}
+
+void MainWindow::clear_selection() {
+    selection_.reset();
+    selection_layer_ = nullptr;
+    lasso_.clear();
+    lasso_layer_ = nullptr;
+
+    if(selection_overlay_) {
+        selection_overlay_->hide();
+    }
+}
+
+void MainWindow::selection_changed() {
+    uint64_t count = selection_->count();
+    if(!count) {
+        clear_selection();
+        ui<Gtk::Label>("status_label")->set_text(_("Nothing selected"));
+        return;
+    }
+
+    selection_overlay_->show(*selection_);
+    ui<Gtk::Label>("status_label")->set_text(boost::lexical_cast<std::string>(count) + _(" cells selected"));
+}
+
+void MainWindow::layer_removing_cb(Layer& layer) {
+    if(&layer == selection_layer_ || &layer == lasso_layer_) {
+        clear_selection();
+    }
+}
+
+void MainWindow::fill_selection(bool with_chooser_tile) {
+    if(!selection_) {
+        return;
+    }
+
+    int32_t tile_image_id = -1;
+    if(with_chooser_tile) {
+        const TileChooserEntry* entry = tile_chooser_->selected_entry();
+        if(!entry) {
+            return;
+        }
+        tile_image_id = level_->palette().id_for_path(entry->abs_path);
+    }
+
+    selection_layer_->fill(*selection_, tile_image_id);
+    selection_layer_->flush_render();
+}
+
+void MainWindow::move_selection(int32_t dx, int32_t dy) {
+    if(!selection_) {
+        return;
+    }
+
+    //The selection moves along with its tiles, anything pushed off the edge is lost
+    selection_ = Selection::move_tiles(*selection_, *selection_layer_, dx, dy);
+    selection_layer_->flush_render();
+    selection_changed();
+}
+
+void MainWindow::copy_selection_to_active_layer() {
+    if(!selection_ || !level_->layer_count()) {
+        return;
+    }
+
+    Layer& dest = level_->layer_at(level_->active_layer());
+    if(&dest == selection_layer_) {
+        ui<Gtk::Label>("status_label")->set_text(_("Make another layer active to copy the selection to it"));
+        return;
+    }
+
+    Selection::copy_tiles(*selection_, *selection_layer_, dest);
+    dest.flush_render();
+    ui<Gtk::Label>("status_label")->set_text(_("Copied the selection to ") + dest.name());
+}
+
+void MainWindow::paste_clipboard(PasteMode mode) {
+    Layer* layer = nullptr;
+    uint32_t x, y;
+    if(!clipboard_ || !active_tile_position(layer, x, y)) {
+        return;
+    }
+
+    //A single layer goes onto the active layer, a full copy lines up with the level's layers
+    uint32_t first_layer = (clipboard_->layer_count() == 1) ? level_->active_layer() : 0;
+    clipboard_->paste(*level_, x, y, first_layer, mode);
+    metadata_changed();
+}
+
+void MainWindow::save_clipboard_as_stamp() {
+    if(!clipboard_) {
+        ui<Gtk::Label>("status_label")->set_text(_("Copy something before saving a stamp"));
+        return;
+    }
+
+    Gtk::Dialog dialog(_("Save stamp"), *this, true);
+    dialog.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+    dialog.add_button(Gtk::Stock::SAVE, Gtk::RESPONSE_OK);
+    dialog.set_default_response(Gtk::RESPONSE_OK);
+
+    Gtk::Entry name_entry;
+    name_entry.set_activates_default(true);
+    dialog.get_vbox()->pack_start(name_entry);
+    dialog.show_all_children();
+
+    if(dialog.run() != Gtk::RESPONSE_OK || name_entry.get_text().empty()) {
+        return;
+    }
+
+    try {
+        stamps_.save(name_entry.get_text(), *clipboard_);
+        ui<Gtk::Label>("status_label")->set_text(_("Saved stamp ") + name_entry.get_text());
+    } catch(LevelFileError& e) {
+        L_ERROR(e.what());
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to save the stamp"));
+    }
+}
+
+void MainWindow::choose_stamp() {
+    std::vector<std::string> names = stamps_.names();
+    if(names.empty()) {
+        ui<Gtk::Label>("status_label")->set_text(_("No stamps saved"));
+        return;
+    }
+
+    Gtk::Dialog dialog(_("Choose stamp"), *this, true);
+    dialog.add_button(Gtk::Stock::CANCEL, Gtk::RESPONSE_CANCEL);
+    dialog.add_button(Gtk::Stock::OK, Gtk::RESPONSE_OK);
+
+    Gtk::ComboBoxText name_combo;
+    for(std::string name: names) {
+        name_combo.append(name);
+    }
+    name_combo.set_active(0);
+    dialog.get_vbox()->pack_start(name_combo);
+    dialog.show_all_children();
+
+    if(dialog.run() != Gtk::RESPONSE_OK) {
+        return;
+    }
+
+    std::string name = name_combo.get_active_text();
+    try {
+        //The stamp goes on the clipboard, ready to be pasted with Ctrl+V
+        clipboard_ = stamps_.load(name);
+        ui<Gtk::Label>("status_label")->set_text(_("Stamp ") + name + _(" ready to paste"));
+    } catch(LevelFileError& e) {
+        L_ERROR(e.what());
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to load the stamp"));
+    }
+}
+
+Level::ptr MainWindow::recover_autosave() {
+    if(!os::path::exists(AUTOSAVE_DIR)) {
+        os::make_dirs(AUTOSAVE_DIR);
+    }
+
+    //Only autosaves from editors that have gone away, the ones still running are looking after theirs
+    std::string path = claim_orphaned_autosave(AUTOSAVE_DIR);
+    if(path.empty()) {
+        return Level::ptr();
+    }
+
+    Gtk::MessageDialog dialog(*this, _("Recover the autosaved level?"), false, Gtk::MESSAGE_QUESTION, Gtk::BUTTONS_YES_NO, true);
+    dialog.set_secondary_text(_("Choosing No starts a new level, and the autosave will be replaced."));
+    if(dialog.run() != Gtk::RESPONSE_YES) {
+        return Level::ptr();
+    }
+
+    try {
+        return load_autosave(path);
+    } catch(LevelFileError& e) {
+        L_ERROR(e.what());
+        ui<Gtk::Label>("status_label")->set_text(_("Unable to recover the autosaved level"));
+        return Level::ptr();
+    }
+}
+
+bool MainWindow::autosave_cb() {
+    //Results come back from the autosave thread, so the last save is reported when the next one starts
+    AutosaveResult result = autosaver_.last_result();
+    if(result.saves != autosave_results_seen_) {
+        autosave_results_seen_ = result.saves;
+        if(!result.ok) {
+            L_ERROR("Autosave failed: " + result.error);
+            ui<Gtk::Label>("status_label")->set_text(_("Autosave failed: ") + result.error);
+        } else {
+            L_DEBUG(
+                "Autosave compressed " + boost::lexical_cast<std::string>(result.chunks_encoded) + " chunks and reused " +
+                boost::lexical_cast<std::string>(result.chunks_reused) + " in " +
+                boost::lexical_cast<std::string>(result.elapsed_ms) + "ms"
+            );
+        }
+    }
+
+    if(level_) {
+        autosaver_.save(*level_);
+    }
+
+    return true; //Keep the timeout running
 }
 
 void MainWindow::_generate_blank_config() {
     if(!os::path::exists(CONFIG_DIR)) {
         os::make_dirs(CONFIG_DIR);
     }
-
-    if(!os::path::exists(CONFIG_PATH)) {
-        os::touch(CONFIG_PATH);
-    }
 }
 
 bool MainWindow::key_press_event_cb(GdkEventKey* key) {
     L_DEBUG("Key press event received");
-    if(key->keyval == GDK_KEY_a) {
+
+    bool control = (key->state & GDK_CONTROL_MASK) != 0;
+    bool shift = (key->state & GDK_SHIFT_MASK) != 0;
+    guint keyval = gdk_keyval_to_lower(key->keyval);
+
+    if(control) {
+        if(keyval == GDK_KEY_c) {
+            copy_selection(shift, false);
+        } else if(keyval == GDK_KEY_x) {
+            copy_selection(shift, true);
+        } else if(keyval == GDK_KEY_v) {
+            //Shift pastes as a stamp, leaving the level showing through empty cells
+            paste_clipboard(shift ? PASTE_OVERLAY : PASTE_REPLACE);
+        } else if(keyval == GDK_KEY_s && shift) {
+            save_clipboard_as_stamp();
+        } else if(keyval == GDK_KEY_o && shift) {
+            choose_stamp();
+        } else if(keyval == GDK_KEY_f) {
+            fill_selection(true);
+        } else if(keyval == GDK_KEY_l) {
+            copy_selection_to_active_layer();
+        } else if(keyval == GDK_KEY_k) {
+            //Shift clears the active flag instead
+            fill_active_flag(!shift);
+        }
+        return true;
+    }
+
+    if(key->keyval == GDK_KEY_p) {
+        toggle_parallax_preview();
+        return true;
+    }
+
+    if(preview_ && preview_key_event(key, true)) {
+        return true;
+    }
+
+    //Shift adds to the selection, Alt takes away and both together intersect
+    if(keyval == GDK_KEY_r) {
+        select_area(selection_combine(key));
+        return true;
+    } else if(keyval == GDK_KEY_g) {
+        select_all_of_active_tile(selection_combine(key));
+        return true;
+    } else if(keyval == GDK_KEY_l) {
+        add_lasso_point();
+        return true;
+    } else if(key->keyval == GDK_KEY_Return) {
+        close_lasso(selection_combine(key));
+        return true;
+    } else if(key->keyval == GDK_KEY_Escape) {
+        clear_selection();
+        return true;
+    } else if(key->keyval == GDK_KEY_Delete) {
+        fill_selection(false);
+        return true;
+    }
+
+    //Alt and the arrows nudge the selected tiles
+    if(key->state & GDK_MOD1_MASK) {
+        switch(key->keyval) {
+            case GDK_KEY_Left: move_selection(-1, 0); return true;
+            case GDK_KEY_Right: move_selection(1, 0); return true;
+            case GDK_KEY_Up: move_selection(0, 1); return true;
+            case GDK_KEY_Down: move_selection(0, -1); return true;
+            default: break;
+        }
+    }
+
+    if(key->keyval == GDK_KEY_m) {
+        mark_selection_corner();
+    } else if(key->keyval == GDK_KEY_a) {
         L_DEBUG("Changing to previous tile selection");
         tile_chooser_->previous();
     } else if (key->keyval == GDK_KEY_d) {
         L_DEBUG("Changing to next tile selection");
         tile_chooser_->next();
+    } else if (key->keyval == GDK_KEY_F3) {
+        canvas_->set_profiler_overlay_visible(!canvas_->profiler_overlay_visible());
+    } else if (key->keyval == GDK_KEY_t) {
+        cycle_active_terrain();
+    } else if (key->keyval == GDK_KEY_k) {
+        cycle_active_flag();
+    } else if (key->keyval == GDK_KEY_F && (key->state & GDK_SHIFT_MASK)) {
+        fill_active_layer_with_terrain();
     }
     return true;
 }
@@ -151,16 +1423,42 @@ bool MainWindow::key_press_event_cb(GdkEventKey* key) {
 MainWindow::MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>& builder):
     Gtk::Window(cobject),
     builder_(builder),
-    active_instance_(nullptr) {
+    horizontal_scrollbar_(nullptr),
+    vertical_scrollbar_(nullptr),
+    syncing_scrollbars_(false),
+    active_tile_(0),
+    active_tile_mesh_(0),
+    active_terrain_(-1),
+    active_flag_(-1),
+    preview_input_x_(0),
+    preview_input_y_(0),
+    preview_reported_ns_(0),
+    selection_marked_(false),
+    selection_x_(0),
+    selection_y_(0),
+    selection_layer_(nullptr),
+    lasso_layer_(nullptr),
+    stamps_(os::path::join(CONFIG_DIR, "stamps")),
+    autosaver_(autosave_path(AUTOSAVE_DIR)),
+    autosave_results_seen_(0),
+    editor_state_writer_(EDITOR_STATE_PATH, TILE_PIXEL_CACHE_PATH),
+    restoring_editor_state_(true), //Until restore_tiles() has put back last session's tiles
+    validation_cancel_(false),
+    validation_finished_(false),
+    level_thumbnails_(THUMBNAIL_DIR, LEVEL_THUMBNAIL_SIZE) {
 
     add_events(Gdk::EXPOSURE_MASK);
     add_events(Gdk::KEY_PRESS_MASK);
+    add_events(Gdk::KEY_RELEASE_MASK);
     builder_->get_widget_derived("canvas", canvas_);
 
     canvas_->signal_init().connect(sigc::mem_fun(this, &MainWindow::post_canvas_realize));
 
     _create_layer_list_model();
     _create_tile_location_list_model();
+    _create_memory_usage_model();
+    _create_validation_model();
+    _create_level_browser_model();
     _generate_blank_config();
 
 
@@ -169,6 +1467,13 @@ MainWindow::MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>
         sigc::mem_fun(this, &MainWindow::level_name_box_changed_cb)
     );
 
+    ui<Gtk::SpinButton>("level_width_spin")->signal_value_changed().connect(
+        sigc::mem_fun(this, &MainWindow::level_size_spin_changed_cb)
+    );
+    ui<Gtk::SpinButton>("level_height_spin")->signal_value_changed().connect(
+        sigc::mem_fun(this, &MainWindow::level_size_spin_changed_cb)
+    );
+
     //Set up the signals for adding and removing layers
     ui<Gtk::Button>("add_layer_button")->signal_clicked().connect(
         sigc::mem_fun(this, &MainWindow::add_layer_button_clicked_cb)
@@ -187,10 +1492,12 @@ MainWindow::MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>
     );
 
     ui<Gtk::ProgressBar>("progress_bar")->hide();
-    ui<Gtk::Scrollbar>("main_vertical_scrollbar")->signal_value_changed().connect(
+    horizontal_scrollbar_ = ui<Gtk::Scrollbar>("main_horizontal_scrollbar");
+    vertical_scrollbar_ = ui<Gtk::Scrollbar>("main_vertical_scrollbar");
+    vertical_scrollbar_->signal_value_changed().connect(
         sigc::mem_fun(this, &MainWindow::scrollbar_value_changed)
     );
-    ui<Gtk::Scrollbar>("main_horizontal_scrollbar")->signal_value_changed().connect(
+    horizontal_scrollbar_->signal_value_changed().connect(
         sigc::mem_fun(this, &MainWindow::scrollbar_value_changed)
     );
 
@@ -202,15 +1509,73 @@ MainWindow::MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>
         sigc::mem_fun(this, &MainWindow::key_press_event_cb)
     );
 
+    //Only the parallax preview cares when keys come back up
+    signal_key_release_event().connect(
+        sigc::mem_fun(this, &MainWindow::key_release_event_cb)
+    );
+
     canvas_->signal_mesh_selected().connect(
         sigc::mem_fun(this, &MainWindow::mesh_selected_callback)
     );
 
-    canvas_->signal_scroll_event().connect(
-        sigc::mem_fun(this, &MainWindow::canvas_scroll_event)
+    //A trace may already be running if --trace was passed on the command line
+    ui<Gtk::ToggleToolButton>("trace_toolbutton")->set_active(trace::recording());
+    ui<Gtk::ToggleToolButton>("trace_toolbutton")->signal_toggled().connect(
+        sigc::mem_fun(this, &MainWindow::trace_toolbutton_toggled_cb)
+    );
+    ui<Gtk::ToggleToolButton>("memory_toolbutton")->signal_toggled().connect(
+        sigc::mem_fun(this, &MainWindow::memory_toolbutton_toggled_cb)
+    );
+    ui<Gtk::ToggleToolButton>("session_toolbutton")->signal_toggled().connect(
+        sigc::mem_fun(this, &MainWindow::session_toolbutton_toggled_cb)
+    );
+    ui<Gtk::Window>("memory_window")->signal_delete_event().connect(
+        sigc::mem_fun(this, &MainWindow::memory_window_delete_cb)
+    );
+
+    ui<Gtk::ToolButton>("export_toolbutton")->signal_clicked().connect(
+        sigc::mem_fun(this, &MainWindow::export_toolbutton_clicked_cb)
+    );
+
+    ui<Gtk::ToolButton>("validate_toolbutton")->signal_clicked().connect(
+        sigc::mem_fun(this, &MainWindow::validate_toolbutton_clicked_cb)
+    );
+    ui<Gtk::Button>("validation_cancel_button")->signal_clicked().connect(
+        sigc::mem_fun(this, &MainWindow::validation_cancel_button_clicked_cb)
+    );
+    ui<Gtk::Window>("validation_window")->signal_delete_event().connect(
+        sigc::mem_fun(this, &MainWindow::validation_window_delete_cb)
+    );
+
+    ui<Gtk::ToolButton>("browse_toolbutton")->signal_clicked().connect(
+        sigc::mem_fun(this, &MainWindow::browse_toolbutton_clicked_cb)
+    );
+    ui<Gtk::IconView>("level_browser_view")->signal_item_activated().connect(
+        sigc::mem_fun(this, &MainWindow::level_browser_item_activated_cb)
+    );
+    ui<Gtk::Window>("level_browser_window")->signal_delete_event().connect(
+        sigc::mem_fun(this, &MainWindow::level_browser_window_delete_cb)
+    );
+
+    canvas_->signal_trace_written().connect(
+        sigc::mem_fun(this, &MainWindow::trace_written_cb)
+    );
+
+    canvas_->signal_frame_started().connect(
+        sigc::mem_fun(this, &MainWindow::frame_started_cb)
+    );
+
+    autosave_connection_ = Glib::signal_timeout().connect_seconds(
+        sigc::mem_fun(this, &MainWindow::autosave_cb), AUTOSAVE_INTERVAL_SECONDS
     );
 
     maximize();    
 }
 
+MainWindow::~MainWindow() {
+    autosave_connection_.disconnect();
+    level_browser_refresh_connection_.disconnect();
+    stop_validation();
+}
+
 }
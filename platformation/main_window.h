@@ -2,13 +2,32 @@
 #define MAIN_WINDOW_H
 
 #include <gtkmm.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 #include "kazbase/logging/logging.h"
 #include "canvas.h"
 #include "level.h"
+#include "level_renderer.h"
 #include "tile_chooser.h"
 #include "layer.h"
+#include "autotile.h"
+#include "tile_animation.h"
+#include "parallax_preview.h"
 #include "user_data_types.h"
+#include "profiler.h"
+#include "level_validation.h"
+#include "region.h"
+#include "selection.h"
+#include "selection_overlay.h"
+#include "metadata_overlay.h"
+#include "session_sync.h"
+#include "stamp_library.h"
+#include "autosave.h"
+#include "editor_state.h"
+#include "thumbnail_cache.h"
+#include "level_browser.h"
 
 namespace pn {
 
@@ -25,10 +44,35 @@ struct TileLocationListColumns : public Gtk::TreeModel::ColumnRecord {
     Gtk::TreeModelColumn<Glib::ustring> folder;
 };
 
+struct MemoryUsageColumns : public Gtk::TreeModel::ColumnRecord {
+    MemoryUsageColumns() { add(subsystem); add(bytes); add(count); add(peak_bytes); add(peak_count); }
+    Gtk::TreeModelColumn<Glib::ustring> subsystem;
+    Gtk::TreeModelColumn<Glib::ustring> bytes;
+    Gtk::TreeModelColumn<long> count;
+    Gtk::TreeModelColumn<Glib::ustring> peak_bytes;
+    Gtk::TreeModelColumn<long> peak_count;
+};
+
+struct ValidationColumns : public Gtk::TreeModel::ColumnRecord {
+    ValidationColumns() { add(severity); add(check); add(layer); add(position); add(message); }
+    Gtk::TreeModelColumn<Glib::ustring> severity;
+    Gtk::TreeModelColumn<Glib::ustring> check;
+    Gtk::TreeModelColumn<Glib::ustring> layer;
+    Gtk::TreeModelColumn<Glib::ustring> position;
+    Gtk::TreeModelColumn<Glib::ustring> message;
+};
+
+struct LevelBrowserColumns : public Gtk::TreeModel::ColumnRecord {
+    LevelBrowserColumns() { add(index); add(label); add(thumbnail); }
+    Gtk::TreeModelColumn<int> index;
+    Gtk::TreeModelColumn<Glib::ustring> label;
+    Gtk::TreeModelColumn<Glib::RefPtr<Gdk::Pixbuf> > thumbnail;
+};
 
 class MainWindow : public Gtk::Window {
 public:
     MainWindow(BaseObjectType* cobject, const Glib::RefPtr<Gtk::Builder>& builder);
+    ~MainWindow();
 
 
     //Signals
@@ -36,38 +80,32 @@ public:
         level_->set_name(ui<Gtk::Entry>("level_name_box")->get_text());
     }
 
+    void level_size_spin_changed_cb();
+    void level_size_changed_cb();
+
     void level_layers_changed_cb();
     void layer_selection_changed_cb();
 
     void scrollbar_value_changed() {
-        double x_pos = ui<Gtk::Scrollbar>("main_horizontal_scrollbar")->get_value();
-        double y_pos = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_value();
-        canvas_->scene().active_camera().move_to(x_pos, -y_pos, 0.0);
-    }
-
-    bool canvas_scroll_event(GdkEventScroll* scroll_event) {
-        GdkModifierType modifiers = gtk_accelerator_get_default_mod_mask();
-        if((scroll_event->state & modifiers) == GDK_CONTROL_MASK) {
-            //Ignore if CTRL is pressed
-            return false;
+        if(syncing_scrollbars_) {
+            return;
         }
 
-        if(scroll_event->direction == GDK_SCROLL_UP) {
-            double value = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_value();
-            double step = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_adjustment()->get_step_increment();
-            ui<Gtk::Scrollbar>("main_vertical_scrollbar")->set_value(value - step);
-            return true;
-        }
-        if (scroll_event->direction == GDK_SCROLL_DOWN) {
-            double value = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_value();
-            double step = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_adjustment()->get_step_increment();
-            ui<Gtk::Scrollbar>("main_vertical_scrollbar")->set_value(value + step);
-            return true;
-        }
-        return false;
+        //Dragged, the camera goes there on the next frame
+        canvas_->view().jump_to(horizontal_scrollbar_->get_value(), -vertical_scrollbar_->get_value());
+    }
+
+    //The canvas moves the camera, the scrollbars follow it once a frame
+    void sync_scrollbars() {
+        syncing_scrollbars_ = true;
+        horizontal_scrollbar_->set_value(canvas_->view().camera_x());
+        vertical_scrollbar_->set_value(-canvas_->view().camera_y());
+        syncing_scrollbars_ = false;
     }
 
     void recalculate_scrollbars(kglt::Pass& pass) {
+        PN_PROFILE_SCOPE("MainWindow::recalculate_scrollbars");
+
         if(!canvas_->scene().active_camera().frustum().initialized()) return;
 
         double frustum_height = canvas_->scene().active_camera().frustum().near_height();
@@ -75,17 +113,19 @@ public:
         double level_height = (double) level_->vertical_tile_count();
         double level_width = (double) level_->horizontal_tile_count();
 
-        Glib::RefPtr<Gtk::Adjustment> vadj = ui<Gtk::Scrollbar>("main_vertical_scrollbar")->get_adjustment();
-        if(vadj->get_page_size() != frustum_height) {
+        canvas_->view().set_bounds(-level_width / 2.0, level_width / 2.0, -level_height / 2.0, level_height / 2.0);
+
+        Glib::RefPtr<Gtk::Adjustment> vadj = vertical_scrollbar_->get_adjustment();
+        if(vadj->get_page_size() != frustum_height || vadj->get_lower() != -level_height / 2.0) {
             vadj->set_lower(-level_height / 2.0);
             vadj->set_upper(level_height / 2.0 + frustum_height);
             vadj->set_page_size(frustum_height);
             vadj->set_step_increment(1.0);
         }
 
-        Glib::RefPtr<Gtk::Adjustment> hadj = ui<Gtk::Scrollbar>("main_horizontal_scrollbar")->get_adjustment();
+        Glib::RefPtr<Gtk::Adjustment> hadj = horizontal_scrollbar_->get_adjustment();
         double hpage_size = hadj->get_page_size();
-        if(hpage_size != frustum_width) {
+        if(hpage_size != frustum_width || hadj->get_lower() != -level_width / 2.0) {
             hadj->set_lower(-level_width / 2.0);
             hadj->set_upper(level_width / 2.0 + frustum_width);
             hadj->set_page_size(frustum_width);
@@ -146,10 +186,17 @@ public:
             row[tile_location_list_columns_.folder] = directory;
         }
 
-        save_tile_locations();
+        //Restoring saves both once every directory is back
+        if(!restoring_editor_state_) {
+            save_editor_state();
+            editor_state_writer_.cache_tiles(tile_chooser_->tile_paths());
+        }
+        reload_autotile_rules();
     }
 
     void tile_loaded_cb(float percentage_done) {
+        PN_PROFILE_SCOPE("MainWindow::tile_loaded_cb");
+
         ui<Gtk::ProgressBar>("progress_bar")->set_fraction(percentage_done / 100.0);
 
         //Run a few events to keep things reponsive without slowing down too much (while events_pending() seems to just grind to a halt)
@@ -159,51 +206,149 @@ public:
         }
     }
 
-    void save_tile_locations();
-    void load_tile_locations();
+    void trace_toolbutton_toggled_cb();
+    void memory_toolbutton_toggled_cb();
+    void session_toolbutton_toggled_cb();
+    void update_session();
+    void stop_session();
+    bool refresh_memory_usage();
+    bool memory_window_delete_cb(GdkEventAny* event);
+    void trace_written_cb(std::string path);
+    void frame_started_cb(uint64_t time_ms);
+
+    void toggle_parallax_preview();
+    bool preview_key_event(GdkEventKey* key, bool pressed);
+    void update_parallax_preview();
+    void export_toolbutton_clicked_cb();
+    void validate_toolbutton_clicked_cb();
+    void validation_cancel_button_clicked_cb();
+    bool validation_window_delete_cb(GdkEventAny* event);
+    bool refresh_validation_results();
+    void browse_toolbutton_clicked_cb();
+    bool refresh_level_browser();
+    void level_browser_item_activated_cb(const Gtk::TreeModel::Path& path);
+    bool level_browser_window_delete_cb(GdkEventAny* event);
+
+    Level::ptr restore_level(std::string& path);
+    void restore_view();
+    void restore_tiles();
+    std::vector<std::string> legacy_tile_locations();
+    void save_editor_state();
+    void reload_autotile_rules();
 
     bool key_press_event_cb(GdkEventKey* key);
+    bool key_release_event_cb(GdkEventKey* key);
 
     void tile_selection_changed_callback(TileChooserEntry entry) {
-        if(active_instance_) {
-            kglt::Mesh& mesh = canvas_->scene().mesh(active_instance_->mesh_id);
-            mesh.apply_texture(entry.texture_id);
-            mesh.set_diffuse_colour(kglt::Colour(1, 1, 1, 1));
+        save_editor_state();
+
+        //Putting back last session's pick isn't an edit
+        if(restoring_editor_state_) {
+            return;
+        }
+
+        Layer* layer = nullptr;
+        uint32_t x, y;
+        if(active_tile_position(layer, x, y)) {
+            layer->set_tile(x, y, level_->palette().id_for_path(entry.abs_path));
+            layer->flush_render();
         }
     }
 
+    void paint_active_tile_terrain();
+    void fill_active_layer_with_terrain();
+    void cycle_active_terrain();
+
+    void cycle_active_flag();
+    void paint_active_tile_flag();
+    void fill_active_flag(bool value);
+    void metadata_changed();
+
+    void mark_selection_corner();
+    bool selected_area(CellRect& area);
+
+    SelectionCombine selection_combine(GdkEventKey* key) const;
+    void combine_selection(Layer& layer, const Selection& shape, SelectionCombine how);
+    void select_area(SelectionCombine how);
+    void select_all_of_active_tile(SelectionCombine how);
+    void add_lasso_point();
+    void close_lasso(SelectionCombine how);
+    void clear_selection();
+    void selection_changed();
+    void layer_removing_cb(Layer& layer);
+
+    void fill_selection(bool with_chooser_tile);
+    void move_selection(int32_t dx, int32_t dy);
+    void copy_selection_to_active_layer();
+    void copy_selection(bool active_layer_only, bool cut);
+    void paste_clipboard(PasteMode mode);
+    void save_clipboard_as_stamp();
+    void choose_stamp();
+
+    Level::ptr recover_autosave();
+    bool autosave_cb();
+
     void mesh_selected_callback(kglt::MeshID mesh_id) {
         L_DEBUG("Mesh selected: " + boost::lexical_cast<std::string>(mesh_id));
-        kglt::Mesh& m = canvas_->scene().mesh(mesh_id);
-        if(m.has_user_data()) {
-            try {
-                //Try and cast to a tile instance
-                TileInstance* tile_instance = m.user_data<TileInstance*>();
-                assert(tile_instance);
-
-                //If this mesh is part of a tile_instance
-                set_active_tile_instance(tile_instance);
-            } catch(boost::bad_any_cast& e) {
-                //If we can't then just do nothing for now
-                try {
-                    TileChooser* tile_chooser = m.user_data<TileChooser*>();
-                    tile_chooser->set_selected_by_mesh_id(mesh_id);
-                } catch (boost::bad_any_cast& e) {
-                    //pass
+
+        Entity entity = canvas_->entities().lookup(mesh_id);
+        switch(entity.type) {
+            case USER_DATA_TYPE_TILE_INSTANCE:
+                set_active_tile_instance(entity.index);
+                if(active_flag_ >= 0) {
+                    paint_active_tile_flag();
+                } else if(active_terrain_ >= 0) {
+                    paint_active_tile_terrain();
                 }
-            }
+            break;
+            case USER_DATA_TYPE_TILE_CHOOSER:
+                tile_chooser_->set_selected(entity.index);
+            break;
+            default:
+            break;
+        }
+    }
+
+    /*
+        The active tile is held as an entity index rather than a pointer so
+        that it survives chunks being moved or rebuilt. The mesh ID is kept
+        to spot the chunk handle having been recycled in the meantime.
+    */
+    TileInstance* active_tile_instance() {
+        TileInstance* instance = canvas_->entities().tile(active_tile_);
+        if(!instance || !instance->mesh_id || instance->mesh_id != active_tile_mesh_) {
+            return nullptr;
         }
+        return instance;
+    }
+
+    bool active_tile_position(Layer*& layer, uint32_t& x, uint32_t& y) {
+        if(!active_tile_instance()) {
+            return false;
+        }
+
+        ChunkRef ref = canvas_->entities().chunk(EntityRegistry::chunk_handle(active_tile_));
+        layer = ref.layer;
+        return layer && layer->cell_position(*ref.chunk, EntityRegistry::local_index(active_tile_), x, y);
     }
 
-    void set_active_tile_instance(TileInstance* instance) {
-        if(active_instance_) {
-            kglt::Mesh& old_border = canvas_->scene().mesh(active_instance_->border_mesh_id);
+    void set_active_tile_instance(uint32_t tile_index) {
+        if(TileInstance* old_instance = active_tile_instance()) {
+            kglt::Mesh& old_border = canvas_->scene().mesh(old_instance->border_mesh_id);
             old_border.move_to(0, 0, 0.1);
             old_border.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, 1.0));
         }
 
-        active_instance_ = instance;        
-        kglt::Mesh& border = canvas_->scene().mesh(active_instance_->border_mesh_id);
+        active_tile_ = tile_index;
+        active_tile_mesh_ = 0;
+
+        TileInstance* instance = canvas_->entities().tile(tile_index);
+        if(!instance || !instance->mesh_id) {
+            return;
+        }
+
+        active_tile_mesh_ = instance->mesh_id;
+        kglt::Mesh& border = canvas_->scene().mesh(instance->border_mesh_id);
         border.set_diffuse_colour(kglt::Colour(0.0, 0.0, 1.0, 1.0));
         border.move_to(0, 0, 0.2);
     }
@@ -211,7 +356,7 @@ public:
     void post_canvas_realize() {
         L_DEBUG("Initializing the tile chooser");
 
-        tile_chooser_.reset(new TileChooser(canvas_->scene()));
+        tile_chooser_.reset(new TileChooser(canvas_->scene(), canvas_->entities(), canvas_->tile_textures()));
         tile_chooser_->signal_locations_changed().connect(
             sigc::mem_fun(this, &MainWindow::tile_location_changed_cb)
         );
@@ -223,27 +368,80 @@ public:
             sigc::mem_fun(this, &MainWindow::tile_selection_changed_callback)
         );
 
-        //Must happen after the canvas as been created
-        level_.reset(new Level(canvas_->scene()));
+        selection_overlay_.reset(new SelectionOverlay(canvas_->scene()));
+        metadata_overlay_.reset(new MetadataOverlay(canvas_->scene()));
 
-        //Watch for layer changes on the level
-        level_->signal_layers_changed().connect(
-            sigc::mem_fun(this, &MainWindow::level_layers_changed_cb)
-        );
-
-        ui<Gtk::Entry>("level_name_box")->set_text(level_->name());
+        //Must happen after the canvas as been created
+        std::string level_path;
+        Level::ptr level = restore_level(level_path);
+        set_level(level, level_path);
+        restore_view();
 
         canvas_->scene().signal_render_pass_started().connect(sigc::mem_fun(this, &MainWindow::recalculate_scrollbars));
-        Glib::signal_idle().connect_once(sigc::mem_fun(this, &MainWindow::load_tile_locations));
+        Glib::signal_idle().connect_once(sigc::mem_fun(this, &MainWindow::restore_tiles));
     }
 
+    //Replaces the level being edited, the old one is dropped without saving. The path is where it was opened from, if anywhere
+    void set_level(Level::ptr level, const std::string& path=std::string());
+
 private:
     const Glib::RefPtr<Gtk::Builder>& builder_;
     Canvas* canvas_;
+    Gtk::Scrollbar* horizontal_scrollbar_; //Looked up once, they're touched every frame
+    Gtk::Scrollbar* vertical_scrollbar_;
+    bool syncing_scrollbars_;
     TileChooser::ptr tile_chooser_;
-    TileInstance* active_instance_;
+    uint32_t active_tile_;
+    kglt::MeshID active_tile_mesh_;
 
     Level::ptr level_;
+    LevelRenderer::ptr level_renderer_; //Declared after level_ so that it's destroyed first
+    SessionSync::ptr session_; //Null unless the level is shared with other editors
+
+    Autotiler autotiler_;
+    int32_t active_terrain_; //-1 when painting single tiles from the chooser
+
+    //Flag bit that clicks toggle and fills set, -1 when not editing metadata. The overlay is only up while editing
+    int32_t active_flag_;
+    MetadataOverlay::ptr metadata_overlay_;
+
+    TileAnimator tile_animator_;
+
+    ParallaxPreview::ptr preview_; //Null unless previewing
+    double preview_input_x_;
+    double preview_input_y_;
+    uint64_t preview_reported_ns_;
+
+    //The selection runs from the marked corner to the active tile
+    bool selection_marked_;
+    uint32_t selection_x_;
+    uint32_t selection_y_;
+    Region::ptr clipboard_;
+
+    /*
+        Cells picked out for bulk edits, on the layer they were picked on.
+        Dropped when that layer goes away or the level changes size.
+    */
+    Selection::ptr selection_;
+    Layer* selection_layer_;
+    std::vector<SelectionPoint> lasso_;
+    Layer* lasso_layer_;
+    SelectionOverlay::ptr selection_overlay_;
+    StampLibrary stamps_;
+
+    //Snapshots are taken on the main loop, compressing and writing happens on the autosave thread
+    Autosaver autosaver_;
+    sigc::connection autosave_connection_;
+    uint32_t autosave_results_seen_;
+
+    /*
+        Where the editor was left, read at startup and written (a while
+        after it last changes) on the writer's thread.
+    */
+    EditorStateWriter editor_state_writer_;
+    EditorState restored_state_;
+    bool restoring_editor_state_;
+    std::string level_path_;
 
     LayerListColumns layer_list_columns_;
     Glib::RefPtr<Gtk::TreeStore> layer_list_model_;
@@ -251,6 +449,34 @@ private:
     TileLocationListColumns tile_location_list_columns_;
     Glib::RefPtr<Gtk::TreeStore> tile_location_list_model_;
 
+    MemoryUsageColumns memory_usage_columns_;
+    Glib::RefPtr<Gtk::ListStore> memory_usage_model_;
+    sigc::connection memory_refresh_connection_;
+
+    /*
+        Validation runs on its own thread against a copy of the level, so
+        editing can carry on. Issues are queued by the worker threads and
+        moved into the results list by a timeout on the main loop.
+    */
+    ValidationColumns validation_columns_;
+    Glib::RefPtr<Gtk::ListStore> validation_model_;
+    sigc::connection validation_refresh_connection_;
+    std::thread validation_thread_;
+    std::atomic<bool> validation_cancel_;
+    std::atomic<bool> validation_finished_;
+    std::mutex validation_lock_;
+    std::vector<ValidationIssue> validation_queue_;
+    ValidationSummary validation_summary_;
+
+    void stop_validation();
+
+    //Declared in this order so the browser, which uses the cache, is destroyed first
+    ThumbnailCache level_thumbnails_;
+    LevelBrowser::ptr level_browser_;
+    LevelBrowserColumns level_browser_columns_;
+    Glib::RefPtr<Gtk::ListStore> level_browser_model_;
+    sigc::connection level_browser_refresh_connection_;
+
     template<typename T>
     T* ui(const std::string& name) {
         std::map<std::string, Gtk::Widget*>::iterator it = widget_cache_.find(name);
@@ -268,6 +494,9 @@ private:
 
     void _create_layer_list_model();
     void _create_tile_location_list_model();
+    void _create_memory_usage_model();
+    void _create_validation_model();
+    void _create_level_browser_model();
     void _generate_blank_config();
 };
 
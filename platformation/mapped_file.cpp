@@ -0,0 +1,71 @@
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "kazbase/logging/logging.h"
+
+#include "mapped_file.h"
+
+namespace pn {
+
+static uint64_t modified_ns(const struct stat& info) {
+    return (uint64_t(info.st_mtim.tv_sec) * 1000000000ULL) + uint64_t(info.st_mtim.tv_nsec);
+}
+
+bool file_signature(const std::string& path, uint64_t& size, uint64_t& modified) {
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0) {
+        return false;
+    }
+
+    size = uint64_t(info.st_size);
+    modified = modified_ns(info);
+    return true;
+}
+
+MappedFile::ptr MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        L_WARN("Unable to open " + path + ": " + strerror(errno));
+        return MappedFile::ptr();
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0) {
+        L_WARN("Unable to stat " + path + ": " + strerror(errno));
+        close(fd);
+        return MappedFile::ptr();
+    }
+
+    //mmap refuses zero lengths, an empty file has nothing to map anyway
+    const uint8_t* data = nullptr;
+    if(info.st_size > 0) {
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping == MAP_FAILED) {
+            L_WARN("Unable to map " + path + ": " + strerror(errno));
+            close(fd);
+            return MappedFile::ptr();
+        }
+        data = static_cast<const uint8_t*>(mapping);
+    }
+
+    //The mapping holds its own reference to the file
+    close(fd);
+    return MappedFile::ptr(new MappedFile(path, data, size_t(info.st_size), modified_ns(info)));
+}
+
+bool MappedFile::current() const {
+    uint64_t size, modified;
+    return file_signature(path_, size, modified) && size == size_ && modified == modified_;
+}
+
+MappedFile::~MappedFile() {
+    if(data_) {
+        munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+}
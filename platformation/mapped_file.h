@@ -0,0 +1,54 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <tr1/memory>
+
+namespace pn {
+
+/*
+    A whole file mapped read only. Nothing is read when it's opened, pages
+    come in from the page cache as they're touched, so mapping hundreds of
+    levels up front costs next to nothing. The mapping stays valid after
+    the file is replaced on disk (saves write a new file), but not if it's
+    truncated in place.
+*/
+class MappedFile {
+public:
+    typedef std::tr1::shared_ptr<MappedFile> ptr;
+
+    //Null (and logged) if the file can't be opened or mapped
+    static MappedFile::ptr open(const std::string& path);
+
+    ~MappedFile();
+
+    const std::string& path() const { return path_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    //The file on disk still has the size and modification time it had when it was mapped
+    bool current() const;
+
+private:
+    MappedFile(const std::string& path, const uint8_t* data, size_t size, uint64_t modified):
+        path_(path),
+        data_(data),
+        size_(size),
+        modified_(modified) {}
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string path_;
+    const uint8_t* data_;
+    size_t size_;
+    uint64_t modified_; //Nanoseconds
+};
+
+//Size and modification time (in nanoseconds), false if the file can't be found
+bool file_signature(const std::string& path, uint64_t& size, uint64_t& modified);
+
+}
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,116 @@
+#include <atomic>
+#include <cstdio>
+
+#include "memory_accounting.h"
+
+namespace pn {
+namespace memory {
+
+namespace {
+
+struct Counters {
+    std::atomic<int64_t> bytes;
+    std::atomic<int64_t> count;
+    std::atomic<int64_t> peak_bytes;
+    std::atomic<int64_t> peak_count;
+};
+
+Counters counters[SUBSYSTEM_MAX];
+
+const char* SUBSYSTEM_NAMES[SUBSYSTEM_MAX] = {
+    "Tile data",
+    "Render meshes",
+    "GPU textures (estimated)",
+    "Chooser entries",
+    "Decoded tile images"
+};
+
+void raise_peak(std::atomic<int64_t>& peak, int64_t value) {
+    int64_t current = peak.load(std::memory_order_relaxed);
+    while(value > current && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+}
+
+}
+
+void allocated(Subsystem subsystem, int64_t bytes, int64_t count) {
+    Counters& c = counters[subsystem];
+    raise_peak(c.peak_bytes, c.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    raise_peak(c.peak_count, c.count.fetch_add(count, std::memory_order_relaxed) + count);
+}
+
+void released(Subsystem subsystem, int64_t bytes, int64_t count) {
+    Counters& c = counters[subsystem];
+    c.bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    c.count.fetch_sub(count, std::memory_order_relaxed);
+}
+
+Usage usage(Subsystem subsystem) {
+    const Counters& c = counters[subsystem];
+
+    Usage result;
+    result.bytes = c.bytes.load(std::memory_order_relaxed);
+    result.count = c.count.load(std::memory_order_relaxed);
+    result.peak_bytes = c.peak_bytes.load(std::memory_order_relaxed);
+    result.peak_count = c.peak_count.load(std::memory_order_relaxed);
+    return result;
+}
+
+Usage total() {
+    Usage result;
+    for(uint32_t i = 0; i < SUBSYSTEM_MAX; ++i) {
+        Usage u = usage(Subsystem(i));
+        result.bytes += u.bytes;
+        result.count += u.count;
+        result.peak_bytes += u.peak_bytes; //Sum of the individual peaks, not a true peak
+        result.peak_count += u.peak_count;
+    }
+    return result;
+}
+
+void reset_peaks() {
+    for(uint32_t i = 0; i < SUBSYSTEM_MAX; ++i) {
+        counters[i].peak_bytes.store(counters[i].bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        counters[i].peak_count.store(counters[i].count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+}
+
+const char* subsystem_name(Subsystem subsystem) {
+    return SUBSYSTEM_NAMES[subsystem];
+}
+
+std::string format_bytes(int64_t bytes) {
+    char buffer[32];
+    if(bytes >= 1024 * 1024) {
+        snprintf(buffer, sizeof(buffer), "%.1f MiB", double(bytes) / (1024.0 * 1024.0));
+    } else if(bytes >= 1024) {
+        snprintf(buffer, sizeof(buffer), "%.1f KiB", double(bytes) / 1024.0);
+    } else {
+        snprintf(buffer, sizeof(buffer), "%lld B", (long long) bytes);
+    }
+    return buffer;
+}
+
+std::string report() {
+    std::string result;
+    char line[256];
+
+    for(uint32_t i = 0; i < SUBSYSTEM_MAX; ++i) {
+        Usage u = usage(Subsystem(i));
+        snprintf(line, sizeof(line), "%-26s %12s %10lld  (peak %s, %lld)\n",
+            subsystem_name(Subsystem(i)),
+            format_bytes(u.bytes).c_str(), (long long) u.count,
+            format_bytes(u.peak_bytes).c_str(), (long long) u.peak_count
+        );
+        result += line;
+    }
+
+    return result;
+}
+
+int64_t estimated_texture_bytes(uint32_t width, uint32_t height, uint32_t bpp) {
+    int64_t base = int64_t(width) * int64_t(height) * int64_t(bpp / 8);
+    return base + (base / 3);
+}
+
+}
+}
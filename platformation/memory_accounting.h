@@ -0,0 +1,55 @@
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <cstdint>
+#include <string>
+
+namespace pn {
+namespace memory {
+
+enum Subsystem {
+    SUBSYSTEM_TILE_DATA = 0,
+    SUBSYSTEM_RENDER_MESHES,
+    SUBSYSTEM_GPU_TEXTURES,
+    SUBSYSTEM_CHOOSER_ENTRIES,
+    SUBSYSTEM_TILE_IMAGES,
+    SUBSYSTEM_MAX
+};
+
+/*
+    kglt doesn't expose what a mesh costs, this is 4 vertices of position,
+    normal, texture coordinate and colour plus indices and the object
+    itself, rounded up.
+*/
+const int64_t ESTIMATED_RECTANGLE_MESH_BYTES = 512;
+
+struct Usage {
+    Usage(): bytes(0), count(0), peak_bytes(0), peak_count(0) {}
+
+    int64_t bytes;
+    int64_t count;
+    int64_t peak_bytes;
+    int64_t peak_count;
+};
+
+void allocated(Subsystem subsystem, int64_t bytes, int64_t count=1);
+void released(Subsystem subsystem, int64_t bytes, int64_t count=1);
+
+Usage usage(Subsystem subsystem);
+Usage total();
+void reset_peaks();
+
+const char* subsystem_name(Subsystem subsystem);
+std::string format_bytes(int64_t bytes);
+std::string report();
+
+/*
+    Texture memory is estimated from the uploaded size, including a full mip
+    chain, as the driver gives us no way to ask.
+*/
+int64_t estimated_texture_bytes(uint32_t width, uint32_t height, uint32_t bpp);
+
+}
+}
+
+#endif // MEMORY_ACCOUNTING_H
@@ -0,0 +1,82 @@
+#include "mesh_pool.h"
+#include "memory_accounting.h"
+
+namespace pn {
+
+MeshPool::MeshPool(kglt::Scene& scene, uint32_t max_pooled_per_shape):
+    scene_(scene),
+    max_pooled_per_shape_(max_pooled_per_shape) {
+
+    pool_root_ = scene_.new_mesh();
+    scene_.mesh(pool_root_).set_visible(false);
+    memory::allocated(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+}
+
+MeshPool::~MeshPool() {
+    clear();
+    scene_.delete_mesh(pool_root_);
+    memory::released(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+}
+
+void MeshPool::build_geometry(MeshShape shape, kglt::Mesh& mesh) {
+    switch(shape) {
+        case MESH_SHAPE_TILE:
+            kglt::procedural::mesh::rectangle(mesh, 1.0, 1.0, 0.5, 0.5);
+        break;
+        case MESH_SHAPE_TILE_OUTLINE:
+            kglt::procedural::mesh::rectangle_outline(mesh, 1.0, 1.0, 0.5, 0.5);
+        break;
+        default:
+        break;
+    }
+}
+
+kglt::MeshID MeshPool::acquire(MeshShape shape) {
+    std::vector<kglt::MeshID>& free_meshes = free_meshes_[shape];
+
+    if(free_meshes.empty()) {
+        kglt::MeshID new_mesh = scene_.new_mesh();
+        build_geometry(shape, scene_.mesh(new_mesh));
+        memory::allocated(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+        return new_mesh;
+    }
+
+    //Geometry is left intact on release, so a reused mesh only needs showing again
+    kglt::MeshID mesh_id = free_meshes.back();
+    free_meshes.pop_back();
+    scene_.mesh(mesh_id).set_visible(true);
+    return mesh_id;
+}
+
+void MeshPool::release(MeshShape shape, kglt::MeshID mesh_id) {
+    if(free_meshes_[shape].size() >= max_pooled_per_shape_) {
+        scene_.delete_mesh(mesh_id);
+        memory::released(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+        return;
+    }
+
+    kglt::Mesh& mesh = scene_.mesh(mesh_id);
+    mesh.set_visible(false);
+    mesh.set_parent(&scene_.mesh(pool_root_));
+    free_meshes_[shape].push_back(mesh_id);
+}
+
+uint32_t MeshPool::pooled_count() const {
+    uint32_t total = 0;
+    for(uint32_t i = 0; i < MESH_SHAPE_MAX; ++i) {
+        total += free_meshes_[i].size();
+    }
+    return total;
+}
+
+void MeshPool::clear() {
+    for(uint32_t i = 0; i < MESH_SHAPE_MAX; ++i) {
+        for(kglt::MeshID mesh_id: free_meshes_[i]) {
+            scene_.delete_mesh(mesh_id);
+        }
+        memory::released(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES * free_meshes_[i].size(), free_meshes_[i].size());
+        free_meshes_[i].clear();
+    }
+}
+
+}
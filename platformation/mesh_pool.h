@@ -0,0 +1,54 @@
+#ifndef MESH_POOL_H
+#define MESH_POOL_H
+
+#include <vector>
+#include <tr1/memory>
+
+#include <kglt/kglt.h>
+
+namespace pn {
+
+enum MeshShape {
+    MESH_SHAPE_EMPTY = 0, //Grouping meshes with no geometry of their own
+    MESH_SHAPE_TILE,
+    MESH_SHAPE_TILE_OUTLINE,
+    MESH_SHAPE_MAX
+};
+
+/*
+    Keeps released meshes (and their vertex data) around so that the next
+    layer to be built can reuse them rather than asking the scene for fresh
+    ones. Pooled meshes are hidden and detached from the level; whoever
+    releases a mesh is responsible for dropping its entity registration.
+*/
+class MeshPool {
+public:
+    typedef std::tr1::shared_ptr<MeshPool> ptr;
+
+    MeshPool(kglt::Scene& scene, uint32_t max_pooled_per_shape=200000);
+    ~MeshPool();
+
+    kglt::Scene& scene() { return scene_; }
+
+    kglt::MeshID acquire(MeshShape shape);
+    void release(MeshShape shape, kglt::MeshID mesh_id);
+
+    uint32_t pooled_count() const;
+    void clear();
+
+private:
+    MeshPool(const MeshPool&);
+    MeshPool& operator=(const MeshPool&);
+
+    kglt::Scene& scene_;
+    uint32_t max_pooled_per_shape_;
+
+    kglt::MeshID pool_root_;
+    std::vector<kglt::MeshID> free_meshes_[MESH_SHAPE_MAX];
+
+    void build_geometry(MeshShape shape, kglt::Mesh& mesh);
+};
+
+}
+
+#endif // MESH_POOL_H
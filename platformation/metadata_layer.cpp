@@ -0,0 +1,584 @@
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "metadata_layer.h"
+#include "memory_accounting.h"
+
+namespace pn {
+
+static const std::bitset<CHUNK_AREA> WORD_MASK(~0ULL);
+
+static int32_t floor_div(int32_t value, int32_t divisor) {
+    return (value >= 0) ? (value / divisor) : -((-value + divisor - 1) / divisor);
+}
+
+const char* metadata_flag_name(uint32_t flag_bit) {
+    static const char* names[MAX_METADATA_FLAGS] = {
+        "solid", "one_way", "hazard", "trigger", "ladder", "water", "user_0", "user_1"
+    };
+    return (flag_bit < MAX_METADATA_FLAGS) ? names[flag_bit] : "unknown";
+}
+
+MetadataChunk::MetadataChunk() {
+    memory::allocated(memory::SUBSYSTEM_TILE_DATA, sizeof(MetadataChunk));
+}
+
+MetadataChunk::MetadataChunk(const MetadataChunk& other) {
+    for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+        flags[i] = other.flags[i];
+        rects[i] = other.rects[i];
+    }
+
+    memory::allocated(memory::SUBSYSTEM_TILE_DATA, sizeof(MetadataChunk));
+}
+
+MetadataChunk::~MetadataChunk() {
+    memory::released(memory::SUBSYSTEM_TILE_DATA, sizeof(MetadataChunk));
+}
+
+MetadataFlags MetadataChunk::flags_at(uint32_t local_index) const {
+    MetadataFlags result = 0;
+    for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+        if(flags[i].test(local_index)) {
+            result |= (1 << i);
+        }
+    }
+    return result;
+}
+
+void MetadataChunk::merge_rects(MetadataFlags changed) {
+    for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+        if(!(changed & (1 << i))) {
+            continue;
+        }
+
+        std::vector<Rect>& merged = rects[i];
+        merged.clear();
+        if(flags[i].none()) {
+            continue;
+        }
+
+        //Unclaimed cells a row at a time, the same scan as greedy_merge() but with row masks
+        uint32_t rows[CHUNK_SIZE];
+        for(uint32_t w = 0; w < CHUNK_AREA / 64; ++w) {
+            uint64_t word = ((flags[i] >> (w * 64)) & WORD_MASK).to_ullong();
+            for(uint32_t r = 0; r < 64 / CHUNK_SIZE; ++r) {
+                rows[(w * (64 / CHUNK_SIZE)) + r] = (word >> (r * CHUNK_SIZE)) & ((1u << CHUNK_SIZE) - 1);
+            }
+        }
+
+        for(uint32_t y = 0; y < CHUNK_SIZE; ++y) {
+            while(rows[y]) {
+                uint32_t x = __builtin_ctz(rows[y]);
+                uint32_t width = __builtin_ctz(~(rows[y] >> x));
+                uint32_t span = ((1u << width) - 1) << x;
+
+                uint32_t height = 1;
+                while(y + height < CHUNK_SIZE && (rows[y + height] & span) == span) {
+                    ++height;
+                }
+
+                for(uint32_t j = y; j < y + height; ++j) {
+                    rows[j] &= ~span;
+                }
+
+                Rect rect = { uint8_t(x), uint8_t(y), uint8_t(width), uint8_t(height) };
+                merged.push_back(rect);
+            }
+        }
+    }
+}
+
+MetadataLayer::MetadataLayer(uint32_t width, uint32_t height):
+    width_(0),
+    height_(0),
+    origin_x_(0),
+    origin_y_(0),
+    chunks_across_(0),
+    chunks_down_(0) {
+
+    resize(width, height);
+}
+
+void MetadataLayer::locate(uint32_t x, uint32_t y, uint32_t& chunk_idx, uint32_t& local_index) const {
+    assert(x < width_ && y < height_);
+
+    uint32_t grid_x = x + origin_x_;
+    uint32_t grid_y = y + origin_y_;
+    chunk_idx = ((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE);
+    local_index = ((grid_y % CHUNK_SIZE) * CHUNK_SIZE) + (grid_x % CHUNK_SIZE);
+}
+
+MetadataFlags MetadataLayer::flags_at(uint32_t x, uint32_t y) const {
+    uint32_t chunk_idx, local_index;
+    locate(x, y, chunk_idx, local_index);
+
+    return chunks_[chunk_idx]->flags_at(local_index);
+}
+
+MetadataChunk& MetadataLayer::writable_chunk(uint32_t chunk_idx) {
+    flag_changes_.mark(chunk_idx);
+
+    //Shared with a clipboard region or a snapshot, take a private copy before writing
+    if(!chunks_[chunk_idx].unique()) {
+        chunks_[chunk_idx].reset(new MetadataChunk(*chunks_[chunk_idx]));
+    }
+    return *chunks_[chunk_idx];
+}
+
+std::bitset<CHUNK_AREA> MetadataLayer::cells_in(uint32_t chunk_x, uint32_t chunk_y, const CellRect& area) const {
+    std::bitset<CHUNK_AREA> result;
+
+    //Area in grid space, clipped to the layer
+    uint32_t min_x = origin_x_ + area.x;
+    uint32_t min_y = origin_y_ + area.y;
+    uint32_t max_x = origin_x_ + std::min(area.x + area.width, width_);
+    uint32_t max_y = origin_y_ + std::min(area.y + area.height, height_);
+
+    for(uint32_t ly = 0; ly < CHUNK_SIZE; ++ly) {
+        uint32_t grid_y = (chunk_y * CHUNK_SIZE) + ly;
+        if(grid_y < min_y || grid_y >= max_y) {
+            continue;
+        }
+
+        for(uint32_t lx = 0; lx < CHUNK_SIZE; ++lx) {
+            uint32_t grid_x = (chunk_x * CHUNK_SIZE) + lx;
+            if(grid_x >= min_x && grid_x < max_x) {
+                result.set((ly * CHUNK_SIZE) + lx);
+            }
+        }
+    }
+
+    return result;
+}
+
+void MetadataLayer::write(uint32_t x, uint32_t y, MetadataFlags mask, MetadataFlags values) {
+    uint32_t chunk_idx, local_index;
+    locate(x, y, chunk_idx, local_index);
+
+    MetadataFlags changed = (chunks_[chunk_idx]->flags_at(local_index) ^ values) & mask;
+    if(!changed) {
+        return;
+    }
+
+    MetadataChunk& chunk = writable_chunk(chunk_idx);
+    for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+        if(changed & (1 << i)) {
+            chunk.flags[i].flip(local_index);
+        }
+    }
+    chunk.merge_rects(changed);
+}
+
+void MetadataLayer::set_flags(uint32_t x, uint32_t y, MetadataFlags flags) {
+    write(x, y, 0xFF, flags);
+}
+
+void MetadataLayer::add_flags(uint32_t x, uint32_t y, MetadataFlags mask) {
+    write(x, y, mask, mask);
+}
+
+void MetadataLayer::remove_flags(uint32_t x, uint32_t y, MetadataFlags mask) {
+    write(x, y, mask, 0);
+}
+
+void MetadataLayer::fill(const CellRect& area, MetadataFlags mask, bool value) {
+    uint32_t end_x = std::min(area.x + area.width, width_);
+    uint32_t end_y = std::min(area.y + area.height, height_);
+    if(area.x >= end_x || area.y >= end_y) {
+        return;
+    }
+
+    //A chunk's worth of cells at a time with bitset operations
+    for(uint32_t cy = (area.y + origin_y_) / CHUNK_SIZE; cy <= (end_y - 1 + origin_y_) / CHUNK_SIZE; ++cy) {
+        for(uint32_t cx = (area.x + origin_x_) / CHUNK_SIZE; cx <= (end_x - 1 + origin_x_) / CHUNK_SIZE; ++cx) {
+            uint32_t chunk_idx = (cy * chunks_across_) + cx;
+            std::bitset<CHUNK_AREA> cells = cells_in(cx, cy, area);
+            MetadataFlags changed = 0;
+
+            for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+                if(!(mask & (1 << i))) {
+                    continue;
+                }
+
+                std::bitset<CHUNK_AREA> updated = value ? (chunks_[chunk_idx]->flags[i] | cells) : (chunks_[chunk_idx]->flags[i] & ~cells);
+                if(updated != chunks_[chunk_idx]->flags[i]) {
+                    writable_chunk(chunk_idx).flags[i] = updated;
+                    changed |= (1 << i);
+                }
+            }
+
+            if(changed) {
+                chunks_[chunk_idx]->merge_rects(changed);
+            }
+        }
+    }
+}
+
+MetadataChunk::ptr MetadataLayer::copy_block(int32_t x, int32_t y) const {
+    int32_t grid_x = x + int32_t(origin_x_);
+    int32_t grid_y = y + int32_t(origin_y_);
+
+    if(grid_x >= 0 && grid_y >= 0 && !(grid_x % CHUNK_SIZE) && !(grid_y % CHUNK_SIZE) &&
+       uint32_t(grid_x) < chunks_across_ * CHUNK_SIZE && uint32_t(grid_y) < chunks_down_ * CHUNK_SIZE) {
+        return chunks_[((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE)];
+    }
+
+    MetadataChunk::ptr block(new MetadataChunk());
+    for(uint32_t ly = 0; ly < CHUNK_SIZE; ++ly) {
+        for(uint32_t lx = 0; lx < CHUNK_SIZE; ++lx) {
+            int32_t cx = x + int32_t(lx);
+            int32_t cy = y + int32_t(ly);
+            if(cx < 0 || cy < 0 || uint32_t(cx) >= width_ || uint32_t(cy) >= height_) {
+                continue;
+            }
+
+            MetadataFlags cell = flags_at(cx, cy);
+            for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+                block->flags[i].set((ly * CHUNK_SIZE) + lx, (cell & (1 << i)) != 0);
+            }
+        }
+    }
+
+    block->merge_rects(0xFF);
+    return block;
+}
+
+void MetadataLayer::paste_block(int32_t x, int32_t y, uint32_t width, uint32_t height, const MetadataChunk::ptr& block, bool skip_empty) {
+    int32_t grid_x = x + int32_t(origin_x_);
+    int32_t grid_y = y + int32_t(origin_y_);
+
+    bool whole_chunk = width >= CHUNK_SIZE && height >= CHUNK_SIZE && x >= 0 && y >= 0 &&
+        !(grid_x % CHUNK_SIZE) && !(grid_y % CHUNK_SIZE) &&
+        uint32_t(x) + CHUNK_SIZE <= width_ && uint32_t(y) + CHUNK_SIZE <= height_;
+
+    if(whole_chunk && !skip_empty) {
+        uint32_t chunk_idx = ((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE);
+        if(chunks_[chunk_idx] != block) {
+            chunks_[chunk_idx] = block;
+            flag_changes_.mark(chunk_idx);
+        }
+        return;
+    }
+
+    for(uint32_t ly = 0; ly < std::min(height, CHUNK_SIZE); ++ly) {
+        for(uint32_t lx = 0; lx < std::min(width, CHUNK_SIZE); ++lx) {
+            int32_t cx = x + int32_t(lx);
+            int32_t cy = y + int32_t(ly);
+            if(cx < 0 || cy < 0 || uint32_t(cx) >= width_ || uint32_t(cy) >= height_) {
+                continue;
+            }
+
+            MetadataFlags cell = block->flags_at((ly * CHUNK_SIZE) + lx);
+            if(cell || !skip_empty) {
+                write(cx, cy, 0xFF, cell);
+            }
+        }
+    }
+}
+
+void MetadataLayer::resize(uint32_t new_width, uint32_t new_height) {
+    extend(0, 0, int32_t(new_width) - int32_t(width_), int32_t(new_height) - int32_t(height_));
+}
+
+void MetadataLayer::extend(int32_t left, int32_t bottom, int32_t right, int32_t top) {
+    int32_t new_width = int32_t(width_) + left + right;
+    int32_t new_height = int32_t(height_) + bottom + top;
+    assert(new_width > 0 && new_height > 0);
+
+    //Same scheme as Layer::extend, whole chunks move and only border chunks are touched
+    int32_t new_origin_x = int32_t(origin_x_) - left;
+    int32_t new_origin_y = int32_t(origin_y_) - bottom;
+
+    int32_t first_chunk_x = floor_div(new_origin_x, CHUNK_SIZE);
+    int32_t first_chunk_y = floor_div(new_origin_y, CHUNK_SIZE);
+    new_origin_x -= first_chunk_x * int32_t(CHUNK_SIZE);
+    new_origin_y -= first_chunk_y * int32_t(CHUNK_SIZE);
+
+    uint32_t new_across = (new_origin_x + new_width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t new_down = (new_origin_y + new_height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    std::vector<MetadataChunk::ptr> new_chunks(new_across * new_down);
+
+    for(uint32_t cy = 0; cy < new_down; ++cy) {
+        for(uint32_t cx = 0; cx < new_across; ++cx) {
+            int32_t old_cx = int32_t(cx) + first_chunk_x;
+            int32_t old_cy = int32_t(cy) + first_chunk_y;
+            uint32_t idx = (cy * new_across) + cx;
+
+            if(old_cx >= 0 && old_cy >= 0 && old_cx < int32_t(chunks_across_) && old_cy < int32_t(chunks_down_)) {
+                new_chunks[idx].swap(chunks_[(old_cy * chunks_across_) + old_cx]);
+            } else {
+                new_chunks[idx].reset(new MetadataChunk());
+            }
+        }
+    }
+
+    chunks_.swap(new_chunks);
+    chunks_across_ = new_across;
+    chunks_down_ = new_down;
+    origin_x_ = new_origin_x;
+    origin_y_ = new_origin_y;
+    width_ = new_width;
+    height_ = new_height;
+    flag_changes_.mark_all(chunks_.size());
+
+    //Cells that fell outside a shrunk layer must not reappear if it grows again
+    for(uint32_t cx = 0; cx < chunks_across_; ++cx) {
+        clip_to_layer(cx, 0);
+        clip_to_layer(cx, chunks_down_ - 1);
+    }
+
+    for(uint32_t cy = 0; cy < chunks_down_; ++cy) {
+        clip_to_layer(0, cy);
+        clip_to_layer(chunks_across_ - 1, cy);
+    }
+}
+
+void MetadataLayer::clip_to_layer(uint32_t chunk_x, uint32_t chunk_y) {
+    CellRect layer_area(0, 0, width_, height_);
+    std::bitset<CHUNK_AREA> inside = cells_in(chunk_x, chunk_y, layer_area);
+
+    uint32_t chunk_idx = (chunk_y * chunks_across_) + chunk_x;
+    MetadataFlags changed = 0;
+    for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+        std::bitset<CHUNK_AREA> clipped = chunks_[chunk_idx]->flags[i] & inside;
+        if(clipped != chunks_[chunk_idx]->flags[i]) {
+            writable_chunk(chunk_idx).flags[i] = clipped;
+            changed |= (1 << i);
+        }
+    }
+
+    if(changed) {
+        chunks_[chunk_idx]->merge_rects(changed);
+    }
+}
+
+template<typename Visitor>
+void MetadataLayer::visit_rects(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask, Visitor visitor) const {
+    //Into chunk grid space
+    float grid_min_x = std::max(min_x + float(origin_x_), 0.0f);
+    float grid_min_y = std::max(min_y + float(origin_y_), 0.0f);
+    float grid_max_x = max_x + float(origin_x_);
+    float grid_max_y = max_y + float(origin_y_);
+
+    if(grid_max_x <= grid_min_x || grid_max_y <= grid_min_y || grid_max_x <= 0.0f || grid_max_y <= 0.0f) {
+        return;
+    }
+
+    uint32_t first_cx = uint32_t(grid_min_x) / CHUNK_SIZE;
+    uint32_t first_cy = uint32_t(grid_min_y) / CHUNK_SIZE;
+    uint32_t last_cx = std::min(uint32_t(grid_max_x) / CHUNK_SIZE, chunks_across_ - 1);
+    uint32_t last_cy = std::min(uint32_t(grid_max_y) / CHUNK_SIZE, chunks_down_ - 1);
+
+    for(uint32_t cy = first_cy; cy <= last_cy; ++cy) {
+        for(uint32_t cx = first_cx; cx <= last_cx; ++cx) {
+            const MetadataChunk& chunk = *chunks_[(cy * chunks_across_) + cx];
+
+            for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+                if(!(mask & (1 << i))) {
+                    continue;
+                }
+
+                for(const MetadataChunk::Rect& r: chunk.rects[i]) {
+                    float rx = float((cx * CHUNK_SIZE) + r.x);
+                    float ry = float((cy * CHUNK_SIZE) + r.y);
+
+                    if(rx >= grid_max_x || ry >= grid_max_y || rx + r.width <= grid_min_x || ry + r.height <= grid_min_y) {
+                        continue;
+                    }
+
+                    CellRect result(
+                        (cx * CHUNK_SIZE) + r.x - origin_x_, (cy * CHUNK_SIZE) + r.y - origin_y_,
+                        r.width, r.height
+                    );
+
+                    if(!visitor(result)) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void MetadataLayer::query_aabb(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask, std::vector<CellRect>& out) const {
+    visit_rects(min_x, min_y, max_x, max_y, mask, [&](const CellRect& rect) {
+        out.push_back(rect);
+        return true;
+    });
+}
+
+bool MetadataLayer::any_in_aabb(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask) const {
+    bool found = false;
+    visit_rects(min_x, min_y, max_x, max_y, mask, [&](const CellRect&) {
+        found = true;
+        return false;
+    });
+    return found;
+}
+
+//Returns the entry and exit t of the ray through a box, false if it misses or only touches an edge
+static bool ray_box(float ox, float oy, float dx, float dy, float min_x, float min_y, float max_x, float max_y, float& t_near, float& t_far) {
+    t_near = -std::numeric_limits<float>::infinity();
+    t_far = std::numeric_limits<float>::infinity();
+
+    const float origin[2] = { ox, oy };
+    const float direction[2] = { dx, dy };
+    const float box_min[2] = { min_x, min_y };
+    const float box_max[2] = { max_x, max_y };
+
+    for(uint32_t axis = 0; axis < 2; ++axis) {
+        if(direction[axis] == 0.0f) {
+            if(origin[axis] < box_min[axis] || origin[axis] >= box_max[axis]) {
+                return false;
+            }
+            continue;
+        }
+
+        float t0 = (box_min[axis] - origin[axis]) / direction[axis];
+        float t1 = (box_max[axis] - origin[axis]) / direction[axis];
+        if(t0 > t1) {
+            std::swap(t0, t1);
+        }
+
+        t_near = std::max(t_near, t0);
+        t_far = std::min(t_far, t1);
+    }
+
+    return t_near < t_far;
+}
+
+bool MetadataLayer::raycast(float origin_x, float origin_y, float direction_x, float direction_y, float max_t, MetadataFlags mask, RayHit& hit) const {
+    float ox = origin_x + float(origin_x_);
+    float oy = origin_y + float(origin_y_);
+
+    float t_enter, t_exit;
+    if(!ray_box(ox, oy, direction_x, direction_y,
+            float(origin_x_), float(origin_y_), float(origin_x_ + width_), float(origin_y_ + height_),
+            t_enter, t_exit)) {
+        return false;
+    }
+
+    t_enter = std::max(t_enter, 0.0f);
+    t_exit = std::min(t_exit, max_t);
+    if(t_enter > t_exit) {
+        return false;
+    }
+
+    //Starting inside a flagged cell is a hit even if the ray leaves it straight away
+    float start_x = ox + direction_x * t_enter - float(origin_x_);
+    float start_y = oy + direction_y * t_enter - float(origin_y_);
+    uint32_t start_cell_x = std::min(uint32_t(std::max(std::floor(start_x), 0.0f)), width_ - 1);
+    uint32_t start_cell_y = std::min(uint32_t(std::max(std::floor(start_y), 0.0f)), height_ - 1);
+    if(flags_at(start_cell_x, start_cell_y) & mask) {
+        hit.distance = t_enter;
+        hit.x = start_cell_x;
+        hit.y = start_cell_y;
+        return true;
+    }
+
+    /*
+        Walk the chunks the ray passes through in order. A hit always lies
+        inside the chunk whose rectangle was hit, so the first chunk with
+        any hit holds the nearest one.
+    */
+    const float size = float(CHUNK_SIZE);
+    const float inf = std::numeric_limits<float>::infinity();
+
+    int32_t cx = std::min(int32_t((ox + direction_x * t_enter) / size), int32_t(chunks_across_) - 1);
+    int32_t cy = std::min(int32_t((oy + direction_y * t_enter) / size), int32_t(chunks_down_) - 1);
+    cx = std::max(cx, 0);
+    cy = std::max(cy, 0);
+
+    int32_t step_x = (direction_x > 0) ? 1 : -1;
+    int32_t step_y = (direction_y > 0) ? 1 : -1;
+    float next_x = (direction_x == 0.0f) ? inf : ((float(cx + (step_x > 0 ? 1 : 0)) * size) - ox) / direction_x;
+    float next_y = (direction_y == 0.0f) ? inf : ((float(cy + (step_y > 0 ? 1 : 0)) * size) - oy) / direction_y;
+    float delta_x = (direction_x == 0.0f) ? inf : size / std::fabs(direction_x);
+    float delta_y = (direction_y == 0.0f) ? inf : size / std::fabs(direction_y);
+
+    while(cx >= 0 && cy >= 0 && cx < int32_t(chunks_across_) && cy < int32_t(chunks_down_)) {
+        const MetadataChunk& chunk = *chunks_[(cy * chunks_across_) + cx];
+
+        float best_t = inf;
+        float best_min_x = 0, best_min_y = 0, best_max_x = 0, best_max_y = 0;
+
+        for(uint32_t i = 0; i < MAX_METADATA_FLAGS; ++i) {
+            if(!(mask & (1 << i))) {
+                continue;
+            }
+
+            for(const MetadataChunk::Rect& r: chunk.rects[i]) {
+                float min_x = float((cx * CHUNK_SIZE) + r.x);
+                float min_y = float((cy * CHUNK_SIZE) + r.y);
+                float max_x = min_x + r.width;
+                float max_y = min_y + r.height;
+
+                float t_near, t_far;
+                if(!ray_box(ox, oy, direction_x, direction_y, min_x, min_y, max_x, max_y, t_near, t_far)) {
+                    continue;
+                }
+
+                t_near = std::max(t_near, t_enter);
+                if(t_far <= t_near || t_near > t_exit || t_near >= best_t) {
+                    continue;
+                }
+
+                best_t = t_near;
+                best_min_x = min_x;
+                best_min_y = min_y;
+                best_max_x = max_x;
+                best_max_y = max_y;
+            }
+        }
+
+        if(best_t != inf) {
+            //Clamp the hit point into the rectangle, it may sit on its far edge
+            float px = ox + direction_x * best_t;
+            float py = oy + direction_y * best_t;
+            int32_t cell_x = std::min(std::max(int32_t(std::floor(px)), int32_t(best_min_x)), int32_t(best_max_x) - 1);
+            int32_t cell_y = std::min(std::max(int32_t(std::floor(py)), int32_t(best_min_y)), int32_t(best_max_y) - 1);
+
+            hit.distance = best_t;
+            hit.x = uint32_t(cell_x) - origin_x_;
+            hit.y = uint32_t(cell_y) - origin_y_;
+            return true;
+        }
+
+        if(next_x < next_y) {
+            if(next_x > t_exit) break;
+            cx += step_x;
+            next_x += delta_x;
+        } else {
+            if(next_y > t_exit) break;
+            cy += step_y;
+            next_y += delta_y;
+        }
+    }
+
+    return false;
+}
+
+void MetadataLayer::rectangles(uint32_t flag_bit, std::vector<CellRect>& out) const {
+    assert(flag_bit < MAX_METADATA_FLAGS);
+
+    visit_rects(-float(origin_x_), -float(origin_y_), float(width_), float(height_), 1 << flag_bit, [&](const CellRect& rect) {
+        out.push_back(rect);
+        return true;
+    });
+}
+
+uint32_t MetadataLayer::count(uint32_t flag_bit) const {
+    assert(flag_bit < MAX_METADATA_FLAGS);
+
+    uint32_t total = 0;
+    for(const MetadataChunk::ptr& chunk: chunks_) {
+        total += chunk->flags[flag_bit].count();
+    }
+    return total;
+}
+
+}
@@ -0,0 +1,154 @@
+#ifndef METADATA_LAYER_H
+#define METADATA_LAYER_H
+
+#include <cstdint>
+#include <vector>
+#include <bitset>
+#include <tr1/memory>
+
+#include "chunk.h"
+#include "rect_merge.h"
+
+namespace pn {
+
+enum MetadataFlag {
+    METADATA_FLAG_SOLID = 1 << 0,
+    METADATA_FLAG_ONE_WAY = 1 << 1,
+    METADATA_FLAG_HAZARD = 1 << 2,
+    METADATA_FLAG_TRIGGER = 1 << 3,
+    METADATA_FLAG_LADDER = 1 << 4,
+    METADATA_FLAG_WATER = 1 << 5,
+    METADATA_FLAG_USER_0 = 1 << 6,
+    METADATA_FLAG_USER_1 = 1 << 7
+};
+
+const uint32_t MAX_METADATA_FLAGS = 8;
+
+typedef uint8_t MetadataFlags;
+
+const char* metadata_flag_name(uint32_t flag_bit);
+
+/*
+    One bitset per flag, so a query for a single flag never has to look at
+    cells that only have other flags set. The merged rectangles covering
+    each flag are kept per chunk and rebuilt by whatever changed the flags,
+    while the chunk is still private to the layer, so a chunk shared with a
+    snapshot or another thread is never written by a read.
+*/
+struct MetadataChunk {
+    typedef std::tr1::shared_ptr<MetadataChunk> ptr;
+
+    struct Rect {
+        uint8_t x; //Chunk local
+        uint8_t y;
+        uint8_t width;
+        uint8_t height;
+    };
+
+    MetadataChunk();
+    MetadataChunk(const MetadataChunk& other);
+    ~MetadataChunk();
+
+    MetadataFlags flags_at(uint32_t local_index) const;
+
+    //Rebuilds rects for every flag in changed, same output as greedy_merge()
+    void merge_rects(MetadataFlags changed);
+
+    std::bitset<CHUNK_AREA> flags[MAX_METADATA_FLAGS];
+    std::vector<Rect> rects[MAX_METADATA_FLAGS];
+};
+
+struct RayHit {
+    float distance; //Along the ray direction, in units of its length
+    uint32_t x; //Cell that was hit
+    uint32_t y;
+};
+
+/*
+    Per cell collision and trigger flags that sit alongside the visual
+    layers. Cell (x, y) covers [x, x + 1) x [y, y + 1) in query space, which
+    is the same cell space that Layer uses.
+*/
+class MetadataLayer {
+public:
+    typedef std::tr1::shared_ptr<MetadataLayer> ptr;
+
+    MetadataLayer(uint32_t width, uint32_t height);
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    MetadataFlags flags_at(uint32_t x, uint32_t y) const;
+    void set_flags(uint32_t x, uint32_t y, MetadataFlags flags);
+    void add_flags(uint32_t x, uint32_t y, MetadataFlags mask);
+    void remove_flags(uint32_t x, uint32_t y, MetadataFlags mask);
+
+    //Sets or clears mask over a rectangle, clipped to the layer
+    void fill(const CellRect& area, MetadataFlags mask, bool value);
+
+    /*
+        Block copies for regions, the same as Layer::copy_block() and
+        Layer::paste_block(). Chunks are shared copy on write, so a chunk
+        aligned copy costs a pointer. skip_empty leaves cells alone where
+        the block has no flags set.
+    */
+    MetadataChunk::ptr copy_block(int32_t x, int32_t y) const;
+    void paste_block(int32_t x, int32_t y, uint32_t width, uint32_t height, const MetadataChunk::ptr& block, bool skip_empty=false);
+
+    void extend(int32_t left, int32_t bottom, int32_t right, int32_t top);
+    void resize(uint32_t new_width, uint32_t new_height);
+
+    /*
+        Appends the merged rectangles of every flag in mask that overlap the
+        box. Rectangles never cross a chunk boundary, and a cell with two of
+        the flags in mask is covered once for each. Only the chunks under
+        the box are looked at, and their rectangles are already merged, so
+        a query near the player costs a handful of rectangle tests.
+    */
+    void query_aabb(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask, std::vector<CellRect>& out) const;
+    bool any_in_aabb(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask) const;
+
+    //Finds the first cell with any flag in mask along origin + t * direction, 0 <= t <= max_t
+    bool raycast(float origin_x, float origin_y, float direction_x, float direction_y, float max_t, MetadataFlags mask, RayHit& hit) const;
+
+    //Every merged rectangle for a single flag, chunk by chunk, so none crosses a chunk boundary
+    void rectangles(uint32_t flag_bit, std::vector<CellRect>& out) const;
+
+    uint32_t count(uint32_t flag_bit) const;
+
+    //The chunk grid, laid out the same as Layer's
+    uint32_t origin_x() const { return origin_x_; }
+    uint32_t origin_y() const { return origin_y_; }
+    uint32_t chunks_across() const { return chunks_across_; }
+    uint32_t chunks_down() const { return chunks_down_; }
+    const MetadataChunk::ptr& chunk(uint32_t chunk_x, uint32_t chunk_y) const { return chunks_[(chunk_y * chunks_across_) + chunk_x]; }
+
+    //For snapshots, see ChunkChanges
+    bool take_flag_changes(std::vector<uint32_t>& chunk_indices) { return flag_changes_.take(chunk_indices); }
+
+private:
+    uint32_t width_;
+    uint32_t height_;
+
+    uint32_t origin_x_; //Offset of cell (0, 0) within the chunk grid
+    uint32_t origin_y_;
+
+    uint32_t chunks_across_;
+    uint32_t chunks_down_;
+    std::vector<MetadataChunk::ptr> chunks_;
+    ChunkChanges flag_changes_;
+
+    void locate(uint32_t x, uint32_t y, uint32_t& chunk_idx, uint32_t& local_index) const;
+    MetadataChunk& writable_chunk(uint32_t chunk_idx);
+    std::bitset<CHUNK_AREA> cells_in(uint32_t chunk_x, uint32_t chunk_y, const CellRect& area) const;
+    void write(uint32_t x, uint32_t y, MetadataFlags mask, MetadataFlags values);
+
+    void clip_to_layer(uint32_t chunk_x, uint32_t chunk_y);
+
+    template<typename Visitor>
+    void visit_rects(float min_x, float min_y, float max_x, float max_y, MetadataFlags mask, Visitor visitor) const;
+};
+
+}
+
+#endif // METADATA_LAYER_H
@@ -0,0 +1,134 @@
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "metadata_overlay.h"
+#include "memory_accounting.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+//Straight RGBA, little endian, one translucent colour per flag bit
+const uint32_t FLAG_TEXELS[MAX_METADATA_FLAGS] = {
+    0x60404040, //Solid, grey
+    0x6040C0C0, //One way, olive
+    0x602020FF, //Hazard, red
+    0x60FF40C0, //Trigger, purple
+    0x602090FF, //Ladder, orange
+    0x60FF8020, //Water, blue
+    0x6020FF20, //User 0, green
+    0x60FFFF20  //User 1, cyan
+};
+
+//In front of every layer, behind the selection
+const float METADATA_OVERLAY_Z = -0.6f;
+
+}
+
+MetadataOverlay::MetadataOverlay(kglt::Scene& scene):
+    scene_(scene),
+    mesh_id_(0),
+    texture_id_(0),
+    texture_width_(0),
+    texture_height_(0) {
+
+}
+
+MetadataOverlay::~MetadataOverlay() {
+    if(mesh_id_) {
+        scene_.delete_mesh(mesh_id_);
+    }
+    delete_texture();
+}
+
+void MetadataOverlay::delete_texture() {
+    if(!texture_id_) {
+        return;
+    }
+
+    scene_.delete_texture(texture_id_);
+    memory::released(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(texture_width_, texture_height_, 32));
+    texture_id_ = 0;
+}
+
+void MetadataOverlay::show(const MetadataLayer& metadata, MetadataFlags mask) {
+    PN_PROFILE_SCOPE("MetadataOverlay::show");
+
+    //Cells per texel, so huge levels stay within what GL will take
+    uint32_t step = std::max(
+        (metadata.width() + MAX_METADATA_TEXTURE_SIZE - 1) / MAX_METADATA_TEXTURE_SIZE,
+        (metadata.height() + MAX_METADATA_TEXTURE_SIZE - 1) / MAX_METADATA_TEXTURE_SIZE
+    );
+    step = std::max(step, 1u);
+    uint32_t width = (metadata.width() + step - 1) / step;
+    uint32_t height = (metadata.height() + step - 1) / step;
+
+    if(!width || !height) {
+        hide();
+        return;
+    }
+
+    //The quad is built to the level's size, so it's only rebuilt when that changes
+    if(width != texture_width_ || height != texture_height_) {
+        if(mesh_id_) {
+            scene_.delete_mesh(mesh_id_);
+        }
+        delete_texture();
+
+        texture_id_ = scene_.new_texture();
+        texture_width_ = width;
+        texture_height_ = height;
+        scene_.texture(texture_id_).set_bpp(32);
+        memory::allocated(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(width, height, 32));
+
+        float level_width = float(metadata.width());
+        float level_height = float(metadata.height());
+
+        mesh_id_ = scene_.new_mesh();
+        kglt::Mesh& mesh = scene_.mesh(mesh_id_);
+        kglt::procedural::mesh::rectangle(mesh, level_width, level_height, level_width / 2.0f, level_height / 2.0f);
+        mesh.apply_texture(texture_id_);
+
+        //Lines up with the layers, which keep cell (x, y) at (x - width / 2, y - height / 2)
+        mesh.move_to(-level_width / 2.0f, -level_height / 2.0f, METADATA_OVERLAY_Z);
+    }
+
+    //Rows go bottom first, the same way up as the layers
+    kglt::Texture& texture = scene_.texture(texture_id_);
+    texture.resize(width, height);
+    kglt::Texture::Data& data = texture.data();
+    memset(&data[0], 0, size_t(width) * height * 4);
+
+    std::vector<CellRect> rects;
+    for(uint32_t flag_bit = 0; flag_bit < MAX_METADATA_FLAGS; ++flag_bit) {
+        if(!(mask & (1 << flag_bit)) || !metadata.count(flag_bit)) {
+            continue;
+        }
+
+        rects.clear();
+        metadata.rectangles(flag_bit, rects);
+        for(const CellRect& rect: rects) {
+            uint32_t first_x = rect.x / step;
+            uint32_t last_x = (rect.x + rect.width - 1) / step;
+            for(uint32_t y = rect.y / step; y <= (rect.y + rect.height - 1) / step; ++y) {
+                uint8_t* row = &data[size_t(y) * width * 4];
+                for(uint32_t x = first_x; x <= last_x; ++x) {
+                    memcpy(row + (x * 4), &FLAG_TEXELS[flag_bit], 4);
+                }
+            }
+        }
+    }
+    texture.upload();
+
+    scene_.mesh(mesh_id_).set_visible(true);
+}
+
+void MetadataOverlay::hide() {
+    if(mesh_id_) {
+        scene_.mesh(mesh_id_).set_visible(false);
+    }
+}
+
+}
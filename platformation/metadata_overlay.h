@@ -0,0 +1,43 @@
+#ifndef METADATA_OVERLAY_H
+#define METADATA_OVERLAY_H
+
+#include <tr1/memory>
+
+#include "kglt/kglt.h"
+#include "metadata_layer.h"
+
+namespace pn {
+
+//Levels wider or taller than this share texels between neighbouring cells
+const uint32_t MAX_METADATA_TEXTURE_SIZE = 4096;
+
+/*
+    Shows which cells have which metadata flags, tinted a colour per flag,
+    with one quad over the whole level the same way SelectionOverlay does.
+    The texture is painted from the layer's merged rectangles, so a redraw
+    touches each rectangle once rather than asking every cell for its flags.
+*/
+class MetadataOverlay {
+public:
+    typedef std::tr1::shared_ptr<MetadataOverlay> ptr;
+
+    MetadataOverlay(kglt::Scene& scene);
+    ~MetadataOverlay();
+
+    //Only the flags in mask are drawn, later flags over earlier ones
+    void show(const MetadataLayer& metadata, MetadataFlags mask);
+    void hide();
+
+private:
+    kglt::Scene& scene_;
+    kglt::MeshID mesh_id_;
+    kglt::TextureID texture_id_;
+    uint32_t texture_width_;
+    uint32_t texture_height_;
+
+    void delete_texture();
+};
+
+}
+
+#endif // METADATA_OVERLAY_H
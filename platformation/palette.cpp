@@ -0,0 +1,27 @@
+#include "palette.h"
+
+namespace pn {
+
+int32_t Palette::id_for_path(const std::string& path) {
+    std::tr1::unordered_map<std::string, int32_t>::const_iterator it = ids_.find(path);
+    if(it != ids_.end()) {
+        return it->second;
+    }
+
+    int32_t new_id = paths_.size();
+    paths_.push_back(path);
+    ids_[path] = new_id;
+    return new_id;
+}
+
+int32_t Palette::find(const std::string& path) const {
+    std::tr1::unordered_map<std::string, int32_t>::const_iterator it = ids_.find(path);
+    return (it == ids_.end()) ? -1 : it->second;
+}
+
+void Palette::clear() {
+    paths_.clear();
+    ids_.clear();
+}
+
+}
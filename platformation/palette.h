@@ -0,0 +1,31 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <string>
+#include <vector>
+#include <tr1/unordered_map>
+
+namespace pn {
+
+/*
+    Maps the small integer tile IDs stored in layers to the tile images they
+    refer to. IDs are handed out in order and never reused, -1 means an
+    empty cell.
+*/
+class Palette {
+public:
+    int32_t id_for_path(const std::string& path);
+    int32_t find(const std::string& path) const;
+    const std::string& path_for_id(int32_t id) const { return paths_.at(id); }
+
+    uint32_t size() const { return paths_.size(); }
+    void clear();
+
+private:
+    std::vector<std::string> paths_;
+    std::tr1::unordered_map<std::string, int32_t> ids_;
+};
+
+}
+
+#endif // PALETTE_H
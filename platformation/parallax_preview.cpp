@@ -0,0 +1,175 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+
+#include "parallax_preview.h"
+#include "layer.h"
+
+namespace pn {
+
+void CameraPath::add_key(double time, double x, double y) {
+    CameraKey key = { time, x, y };
+    keys_.push_back(key);
+}
+
+void CameraPath::position_at(double time, double& x, double& y) const {
+    if(keys_.empty()) {
+        return;
+    }
+
+    if(duration() > 0.0) {
+        time = std::fmod(time, duration());
+    }
+
+    for(uint32_t i = 1; i < keys_.size(); ++i) {
+        const CameraKey& from = keys_[i - 1];
+        const CameraKey& to = keys_[i];
+        if(time <= to.time) {
+            double span = to.time - from.time;
+            double t = (span > 0.0) ? std::max(0.0, (time - from.time) / span) : 1.0;
+            x = from.x + ((to.x - from.x) * t);
+            y = from.y + ((to.y - from.y) * t);
+            return;
+        }
+    }
+
+    x = keys_.back().x;
+    y = keys_.back().y;
+}
+
+CameraPath CameraPath::sweep(double start_x, double min_x, double max_x, double y, double tiles_per_second) {
+    double speed = std::max(tiles_per_second, 0.001);
+
+    CameraPath path;
+    double time = 0.0;
+    path.add_key(time, start_x, y);
+    time += std::fabs(max_x - start_x) / speed;
+    path.add_key(time, max_x, y);
+    time += std::fabs(max_x - min_x) / speed;
+    path.add_key(time, min_x, y);
+    time += std::fabs(start_x - min_x) / speed;
+    path.add_key(time, start_x, y);
+    return path;
+}
+
+PacingStats::PacingStats(uint32_t window_size):
+    window_size_(window_size) {
+
+    clear();
+}
+
+void PacingStats::clear() {
+    intervals_.clear();
+    frame_count_ = 0;
+    repeated_frames_ = 0;
+    skipping_frames_ = 0;
+    dropped_steps_ = 0;
+}
+
+void PacingStats::add_frame(uint64_t interval_ns, uint32_t steps, uint32_t dropped_steps) {
+    intervals_.push_back(interval_ns);
+    if(intervals_.size() > window_size_) {
+        intervals_.pop_front();
+    }
+
+    frame_count_++;
+    repeated_frames_ += (steps == 0) ? 1 : 0;
+    skipping_frames_ += (steps > 1) ? 1 : 0;
+    dropped_steps_ += dropped_steps;
+}
+
+double PacingStats::interval_percentile(double percentile) const {
+    if(intervals_.empty()) {
+        return 0.0;
+    }
+
+    std::vector<uint64_t> sorted(intervals_.begin(), intervals_.end());
+    uint32_t idx = std::min(sorted.size() - 1, size_t(percentile / 100.0 * double(sorted.size())));
+    std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+    return double(sorted[idx]) / 1000000.0;
+}
+
+std::string PacingStats::summary() const {
+    double frames = double(std::max<uint64_t>(frame_count_, 1));
+
+    char line[256];
+    snprintf(line, sizeof(line),
+        "frame ms p50 %.2f p95 %.2f p99 %.2f max %.2f, %llu frames, %.1f%% repeated, %.1f%% skipped, %llu steps dropped",
+        interval_percentile(50), interval_percentile(95), interval_percentile(99), interval_percentile(100),
+        (unsigned long long) frame_count_,
+        100.0 * double(repeated_frames_) / frames, 100.0 * double(skipping_frames_) / frames,
+        (unsigned long long) dropped_steps_
+    );
+    return line;
+}
+
+ParallaxPreview::ParallaxPreview(double start_x, double start_y):
+    start_x_(start_x),
+    start_y_(start_y),
+    camera_x_(start_x),
+    camera_y_(start_y),
+    keyboard_(false),
+    input_x_(0),
+    input_y_(0),
+    scroll_speed_(8.0),
+    last_frame_ns_(0),
+    accumulated_ns_(0),
+    step_count_(0) {
+
+}
+
+void ParallaxPreview::set_input(double x, double y) {
+    input_x_ = x;
+    input_y_ = y;
+
+    if(x || y) {
+        keyboard_ = true;
+    }
+}
+
+uint32_t ParallaxPreview::advance(uint64_t now_ns) {
+    if(!last_frame_ns_) {
+        //The first frame just starts the clock
+        last_frame_ns_ = now_ns;
+        return 0;
+    }
+
+    uint64_t interval = now_ns - last_frame_ns_;
+    last_frame_ns_ = now_ns;
+    accumulated_ns_ += interval;
+
+    uint32_t steps = 0;
+    while(accumulated_ns_ >= PREVIEW_STEP_NS && steps < PREVIEW_MAX_STEPS_PER_FRAME) {
+        step();
+        accumulated_ns_ -= PREVIEW_STEP_NS;
+        ++steps;
+    }
+
+    uint32_t dropped = 0;
+    if(accumulated_ns_ >= PREVIEW_STEP_NS) {
+        dropped = uint32_t(accumulated_ns_ / PREVIEW_STEP_NS);
+        accumulated_ns_ %= PREVIEW_STEP_NS;
+    }
+
+    pacing_.add_frame(interval, steps, dropped);
+    return steps;
+}
+
+void ParallaxPreview::step() {
+    step_count_++;
+
+    if(keyboard_) {
+        camera_x_ += input_x_ * scroll_speed_ * PREVIEW_STEP_SECONDS;
+        camera_y_ += input_y_ * scroll_speed_ * PREVIEW_STEP_SECONDS;
+    } else if(!path_.empty()) {
+        path_.position_at(double(step_count_) * PREVIEW_STEP_SECONDS, camera_x_, camera_y_);
+    }
+}
+
+void ParallaxPreview::layer_offset(const Layer& layer, double& x, double& y) const {
+    double follow = 1.0 - double(layer.parallax());
+    x = (camera_x_ - start_x_) * follow;
+    y = (camera_y_ - start_y_) * follow;
+}
+
+}
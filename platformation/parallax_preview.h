@@ -0,0 +1,129 @@
+#ifndef PARALLAX_PREVIEW_H
+#define PARALLAX_PREVIEW_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <tr1/memory>
+
+namespace pn {
+
+class Layer;
+
+const uint32_t PREVIEW_STEPS_PER_SECOND = 60;
+const uint64_t PREVIEW_STEP_NS = 1000000000ull / PREVIEW_STEPS_PER_SECOND;
+const double PREVIEW_STEP_SECONDS = 1.0 / double(PREVIEW_STEPS_PER_SECOND);
+
+//After a stall the camera jumps ahead rather than running this many steps in one frame
+const uint32_t PREVIEW_MAX_STEPS_PER_FRAME = 5;
+
+struct CameraKey {
+    double time; //Seconds from the start of the path
+    double x;
+    double y;
+};
+
+//Straight lines between keys, looping back to the first key after the last
+class CameraPath {
+public:
+    void add_key(double time, double x, double y);
+    void clear() { keys_.clear(); }
+
+    bool empty() const { return keys_.empty(); }
+    double duration() const { return keys_.empty() ? 0.0 : keys_.back().time; }
+
+    void position_at(double time, double& x, double& y) const;
+
+    //From start_x to max_x, back to min_x and on to start_x again, at height y
+    static CameraPath sweep(double start_x, double min_x, double max_x, double y, double tiles_per_second);
+
+private:
+    std::vector<CameraKey> keys_;
+};
+
+/*
+    How evenly the preview's fixed steps landed on the frames drawn. At a
+    steady 60 fps every frame runs exactly one step, a frame that runs none
+    shows the same camera position twice and one that runs several jumps,
+    and both read as judder.
+*/
+class PacingStats {
+public:
+    PacingStats(uint32_t window_size=240);
+
+    void add_frame(uint64_t interval_ns, uint32_t steps, uint32_t dropped_steps);
+    void clear();
+
+    uint64_t frame_count() const { return frame_count_; }
+    double interval_percentile(double percentile) const;
+    std::string summary() const;
+
+private:
+    uint32_t window_size_;
+    std::deque<uint64_t> intervals_;
+
+    uint64_t frame_count_;
+    uint64_t repeated_frames_; //No step
+    uint64_t skipping_frames_; //More than one step
+    uint64_t dropped_steps_; //Thrown away after a stall
+};
+
+/*
+    Runs the preview camera at a locked PREVIEW_STEPS_PER_SECOND however
+    fast frames are drawn, either along a path or from keyboard input.
+    Parallax is applied by shifting each layer as a whole, see
+    layer_offset().
+*/
+class ParallaxPreview {
+public:
+    typedef std::tr1::shared_ptr<ParallaxPreview> ptr;
+
+    ParallaxPreview(double start_x, double start_y);
+
+    //Followed until keyboard input takes over
+    void set_path(const CameraPath& path) { path_ = path; }
+
+    //Direction in -1 to 1 on each axis, held until changed
+    void set_input(double x, double y);
+    void set_scroll_speed(double tiles_per_second) { scroll_speed_ = tiles_per_second; }
+
+    //Called once per frame drawn, returns the number of fixed steps run
+    uint32_t advance(uint64_t now_ns);
+
+    double camera_x() const { return camera_x_; }
+    double camera_y() const { return camera_y_; }
+
+    /*
+        The shift to give a layer (on top of its usual position) for the
+        camera's current position. Everything lines up where the preview
+        started, and a layer with parallax 1 never moves.
+    */
+    void layer_offset(const Layer& layer, double& x, double& y) const;
+
+    const PacingStats& pacing() const { return pacing_; }
+
+private:
+    double start_x_;
+    double start_y_;
+    double camera_x_;
+    double camera_y_;
+
+    CameraPath path_;
+    bool keyboard_;
+    double input_x_;
+    double input_y_;
+    double scroll_speed_;
+
+    uint64_t last_frame_ns_;
+    uint64_t accumulated_ns_;
+    uint64_t step_count_;
+
+    PacingStats pacing_;
+
+    void step();
+};
+
+}
+
+#endif // PARALLAX_PREVIEW_H
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstdint>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+namespace pn {
+
+/*
+    Calls function(i) for every i in [0, count) across the given number of
+    threads (0 uses every core), handing out indices one at a time so that
+    uneven jobs still balance. The calling thread does its share of the work.
+*/
+template<typename Function>
+void parallel_for(uint32_t count, uint32_t threads, Function function) {
+    if(!threads) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    threads = std::min(threads, count);
+
+    std::atomic<uint32_t> next(0);
+    auto worker = [&]() {
+        for(uint32_t i = next++; i < count; i = next++) {
+            function(i);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for(uint32_t i = 1; i < threads; ++i) {
+        pool.push_back(std::thread(worker));
+    }
+
+    worker();
+
+    for(std::thread& thread: pool) {
+        thread.join();
+    }
+}
+
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,623 @@
+#include <cstring>
+#include <atomic>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+//AVX2 functions are compiled for that target alone and only called if the CPU says it has it
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PN_PIXEL_OPS_AVX2 1
+#define PN_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#include "pixel_ops.h"
+
+namespace pn {
+
+namespace {
+
+const uint32_t ALPHA_MASK = 0xFF000000;
+
+//Hash constants, the usual 32 and 64 bit primes
+const uint64_t PRIME32_1 = 0x9E3779B1ULL;
+const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME64_3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+const size_t HASH_STRIPE_BYTES = 64;
+const size_t HASH_BLOCK_STRIPES = 16; //Accumulators are scrambled after each block
+
+const uint64_t HASH_KEYS[8] = {
+    0xBE4BA423396CFEB8ULL, 0x1CAD21F72C81017CULL, 0xDB979083E96DD4DEULL, 0x1F67B3B7A4A44072ULL,
+    0x78E5C0CC4EE679CBULL, 0x2172FFCC7DD05A82ULL, 0x8E2443F7744608B8ULL, 0x4C263A81E69035E0ULL
+};
+
+PixelPath best_path() {
+#ifdef PN_PIXEL_OPS_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return PIXEL_PATH_AVX2;
+    }
+#endif
+#ifdef __SSE2__
+    return PIXEL_PATH_SSE2;
+#else
+    return PIXEL_PATH_SCALAR;
+#endif
+}
+
+const PixelPath BEST_PATH = best_path();
+std::atomic<int> current_path(BEST_PATH);
+
+inline PixelPath active_path() {
+    return PixelPath(current_path.load(std::memory_order_relaxed));
+}
+
+inline uint32_t div255(uint32_t value) {
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+inline uint32_t premultiply(uint32_t pixel) {
+    uint32_t alpha = pixel >> 24;
+    if(alpha == 255) {
+        return pixel;
+    } else if(!alpha) {
+        return 0;
+    }
+
+    uint32_t result = pixel & ALPHA_MASK;
+    for(uint32_t shift = 0; shift < 24; shift += 8) {
+        result |= div255(((pixel >> shift) & 0xFF) * alpha) << shift;
+    }
+    return result;
+}
+
+inline uint32_t unpremultiply(uint32_t pixel) {
+    uint32_t alpha = pixel >> 24;
+    if(alpha == 255 || !alpha) {
+        return pixel;
+    }
+
+    uint32_t result = pixel & ALPHA_MASK;
+    for(uint32_t shift = 0; shift < 24; shift += 8) {
+        result |= std::min((((pixel >> shift) & 0xFF) * 255 + (alpha / 2)) / alpha, 255u) << shift;
+    }
+    return result;
+}
+
+inline uint32_t swap_red_blue(uint32_t pixel) {
+    return (pixel & 0xFF00FF00) | ((pixel >> 16) & 0xFF) | ((pixel & 0xFF) << 16);
+}
+
+inline uint32_t average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t result = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t total = ((a >> shift) & 0xFF) + ((b >> shift) & 0xFF) + ((c >> shift) & 0xFF) + ((d >> shift) & 0xFF);
+        result |= ((total + 2) >> 2) << shift;
+    }
+    return result;
+}
+
+inline uint64_t read_u64(const uint8_t* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, 8);
+    return value;
+}
+
+inline uint64_t rotl64(uint64_t value, uint32_t bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/*
+    Hashing runs eight 64 bit accumulators over 64 byte stripes. Each
+    stripe word adds its own value to the neighbouring accumulator and the
+    product of its halves (xored with a key) to its own, which is what
+    _mm_mul_epu32 does two or four words at a time. The accumulators are
+    scrambled every HASH_BLOCK_STRIPES stripes so the multiplies don't
+    lose high bits, and a last partial stripe is zero padded, the length
+    going into the final mix.
+*/
+void hash_stripe_scalar(uint64_t* acc, const uint8_t* stripe) {
+    for(uint32_t j = 0; j < 8; ++j) {
+        uint64_t word = read_u64(stripe + (j * 8));
+        uint64_t keyed = word ^ HASH_KEYS[j];
+        acc[j ^ 1] += word;
+        acc[j] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+}
+
+void hash_scramble_scalar(uint64_t* acc) {
+    for(uint32_t j = 0; j < 8; ++j) {
+        acc[j] = (acc[j] ^ (acc[j] >> 47) ^ HASH_KEYS[j]) * PRIME32_1;
+    }
+}
+
+void hash_stripes_scalar(uint64_t* acc, const uint8_t* data, size_t stripes) {
+    for(size_t s = 0; s < stripes; ++s) {
+        hash_stripe_scalar(acc, data + (s * HASH_STRIPE_BYTES));
+        if((s + 1) % HASH_BLOCK_STRIPES == 0) {
+            hash_scramble_scalar(acc);
+        }
+    }
+}
+
+//Scalar kernels, also used for the ends of rows the vector loops leave over
+
+void premultiply_scalar(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    for(uint32_t i = 0; i < count; ++i) {
+        destination[i] = premultiply(source[i]);
+    }
+}
+
+void unpremultiply_scalar(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    for(uint32_t i = 0; i < count; ++i) {
+        destination[i] = unpremultiply(source[i]);
+    }
+}
+
+void rgb_to_rgba_scalar(const uint8_t* source, uint32_t* destination, uint32_t count) {
+    for(uint32_t i = 0; i < count; ++i) {
+        const uint8_t* rgb = source + (i * 3);
+        destination[i] = ALPHA_MASK | (uint32_t(rgb[2]) << 16) | (uint32_t(rgb[1]) << 8) | rgb[0];
+    }
+}
+
+void swap_red_blue_scalar(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    for(uint32_t i = 0; i < count; ++i) {
+        destination[i] = swap_red_blue(source[i]);
+    }
+}
+
+//Output pixels [first, width2) of one row, from source rows top and bottom
+void downsample_scalar(const uint32_t* top, const uint32_t* bottom, uint32_t width, uint32_t first, uint32_t* out) {
+    uint32_t width2 = (width + 1) / 2;
+    for(uint32_t x = first; x < width2; ++x) {
+        uint32_t x0 = x * 2;
+        uint32_t x1 = std::min(x0 + 1, width - 1);
+        out[x] = average4(top[x0], top[x1], bottom[x0], bottom[x1]);
+    }
+}
+
+#ifdef __SSE2__
+
+void premultiply_sse2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb_lanes = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i alpha_lanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+    const __m128i half = _mm_set1_epi16(128);
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i halves[2] = { _mm_unpacklo_epi8(pixels, zero), _mm_unpackhi_epi8(pixels, zero) };
+
+        for(__m128i& value: halves) {
+            //Colour times alpha and alpha times 255, so the alpha comes out the same
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(value, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i factor = _mm_or_si128(_mm_and_si128(alpha, rgb_lanes), alpha_lanes);
+            __m128i product = _mm_add_epi16(_mm_mullo_epi16(value, factor), half);
+            value = _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_packus_epi16(halves[0], halves[1]));
+    }
+
+    premultiply_scalar(source + i, destination + i, count - i);
+}
+
+/*
+    (colour * 255 + alpha / 2) / alpha in floats. The numerator and alpha
+    are exact, the quotient is correctly rounded and can't be within 1/255
+    under a whole number without being it, so truncating gives the same
+    answer as the integer division. Pixels with alpha 0 or 255 are kept.
+*/
+inline __m128i unpremultiply_channels(__m128i channels) {
+    __m128i alpha = _mm_shuffle_epi32(channels, _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i numerator = _mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(channels, 8), channels), _mm_srli_epi32(alpha, 1));
+    return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(numerator), _mm_cvtepi32_ps(alpha)));
+}
+
+void unpremultiply_sse2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha_mask = _mm_set1_epi32(int32_t(ALPHA_MASK));
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i low = _mm_unpacklo_epi8(pixels, zero);
+        __m128i high = _mm_unpackhi_epi8(pixels, zero);
+
+        //Signed then unsigned saturation clamps to 255 like the scalar min()
+        __m128i result = _mm_packus_epi16(
+            _mm_packs_epi32(unpremultiply_channels(_mm_unpacklo_epi16(low, zero)), unpremultiply_channels(_mm_unpackhi_epi16(low, zero))),
+            _mm_packs_epi32(unpremultiply_channels(_mm_unpacklo_epi16(high, zero)), unpremultiply_channels(_mm_unpackhi_epi16(high, zero)))
+        );
+        __m128i alpha = _mm_and_si128(pixels, alpha_mask);
+        result = _mm_or_si128(_mm_andnot_si128(alpha_mask, result), alpha);
+
+        __m128i keep = _mm_or_si128(_mm_cmpeq_epi32(alpha, zero), _mm_cmpeq_epi32(alpha, alpha_mask));
+        result = _mm_or_si128(_mm_and_si128(keep, pixels), _mm_andnot_si128(keep, result));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), result);
+    }
+
+    unpremultiply_scalar(source + i, destination + i, count - i);
+}
+
+void swap_red_blue_sse2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m128i red_blue = _mm_set1_epi32(0x00FF00FF);
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        __m128i rb = _mm_and_si128(pixels, red_blue);
+        __m128i swapped = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_or_si128(_mm_andnot_si128(red_blue, pixels), swapped));
+    }
+
+    swap_red_blue_scalar(source + i, destination + i, count - i);
+}
+
+inline __m128i sum_pairs(__m128i a, __m128i b, __m128i c, __m128i d) {
+    return _mm_add_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, d));
+}
+
+void downsample_sse2(const uint32_t* top, const uint32_t* bottom, uint32_t width, uint32_t* out) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+
+    //Four output pixels from eight source pixels of each row, split into even and odd columns
+    uint32_t x = 0;
+    for(; (x + 4) * 2 <= width; x += 4) {
+        __m128 t0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + (x * 2))));
+        __m128 t1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(top + (x * 2) + 4)));
+        __m128 b0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + (x * 2))));
+        __m128 b1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + (x * 2) + 4)));
+
+        __m128i te = _mm_castps_si128(_mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i to = _mm_castps_si128(_mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1)));
+        __m128i be = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m128i bo = _mm_castps_si128(_mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m128i low = sum_pairs(_mm_unpacklo_epi8(te, zero), _mm_unpacklo_epi8(to, zero), _mm_unpacklo_epi8(be, zero), _mm_unpacklo_epi8(bo, zero));
+        __m128i high = sum_pairs(_mm_unpackhi_epi8(te, zero), _mm_unpackhi_epi8(to, zero), _mm_unpackhi_epi8(be, zero), _mm_unpackhi_epi8(bo, zero));
+        low = _mm_srli_epi16(_mm_add_epi16(low, two), 2);
+        high = _mm_srli_epi16(_mm_add_epi16(high, two), 2);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(low, high));
+    }
+
+    downsample_scalar(top, bottom, width, x, out);
+}
+
+void hash_stripes_sse2(uint64_t* acc_out, const uint8_t* data, size_t stripes) {
+    __m128i acc[4];
+    __m128i keys[4];
+    for(uint32_t j = 0; j < 4; ++j) {
+        acc[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc_out + (j * 2)));
+        keys[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(HASH_KEYS + (j * 2)));
+    }
+    const __m128i prime = _mm_set1_epi32(uint32_t(PRIME32_1));
+
+    for(size_t s = 0; s < stripes; ++s) {
+        const uint8_t* stripe = data + (s * HASH_STRIPE_BYTES);
+        for(uint32_t j = 0; j < 4; ++j) {
+            __m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(stripe + (j * 16)));
+            __m128i keyed = _mm_xor_si128(words, keys[j]);
+            __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+            acc[j] = _mm_add_epi64(acc[j], _mm_add_epi64(product, _mm_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+
+        if((s + 1) % HASH_BLOCK_STRIPES == 0) {
+            for(uint32_t j = 0; j < 4; ++j) {
+                __m128i mixed = _mm_xor_si128(_mm_xor_si128(acc[j], _mm_srli_epi64(acc[j], 47)), keys[j]);
+                __m128i low = _mm_mul_epu32(mixed, prime);
+                __m128i high = _mm_mul_epu32(_mm_srli_epi64(mixed, 32), prime);
+                acc[j] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+            }
+        }
+    }
+
+    for(uint32_t j = 0; j < 4; ++j) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc_out + (j * 2)), acc[j]);
+    }
+}
+
+#endif
+
+#ifdef PN_PIXEL_OPS_AVX2
+
+PN_TARGET_AVX2 void premultiply_avx2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb_lanes = _mm256_set_epi16(0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1);
+    const __m256i alpha_lanes = _mm256_set_epi16(255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0);
+    const __m256i half = _mm256_set1_epi16(128);
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        __m256i halves[2] = { _mm256_unpacklo_epi8(pixels, zero), _mm256_unpackhi_epi8(pixels, zero) };
+
+        for(__m256i& value: halves) {
+            __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(value, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m256i factor = _mm256_or_si256(_mm256_and_si256(alpha, rgb_lanes), alpha_lanes);
+            __m256i product = _mm256_add_epi16(_mm256_mullo_epi16(value, factor), half);
+            value = _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+        }
+
+        //Unpacking and packing both work within 128 bit lanes, so the pixels come back in order
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_packus_epi16(halves[0], halves[1]));
+    }
+
+    premultiply_scalar(source + i, destination + i, count - i);
+}
+
+PN_TARGET_AVX2 inline __m256i unpremultiply_channels_avx2(__m256i channels) {
+    __m256i alpha = _mm256_shuffle_epi32(channels, _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i numerator = _mm256_add_epi32(_mm256_sub_epi32(_mm256_slli_epi32(channels, 8), channels), _mm256_srli_epi32(alpha, 1));
+    return _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(numerator), _mm256_cvtepi32_ps(alpha)));
+}
+
+PN_TARGET_AVX2 void unpremultiply_avx2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha_mask = _mm256_set1_epi32(int32_t(ALPHA_MASK));
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        __m256i low = _mm256_unpacklo_epi8(pixels, zero);
+        __m256i high = _mm256_unpackhi_epi8(pixels, zero);
+
+        __m256i result = _mm256_packus_epi16(
+            _mm256_packs_epi32(unpremultiply_channels_avx2(_mm256_unpacklo_epi16(low, zero)), unpremultiply_channels_avx2(_mm256_unpackhi_epi16(low, zero))),
+            _mm256_packs_epi32(unpremultiply_channels_avx2(_mm256_unpacklo_epi16(high, zero)), unpremultiply_channels_avx2(_mm256_unpackhi_epi16(high, zero)))
+        );
+
+        __m256i alpha = _mm256_and_si256(pixels, alpha_mask);
+        result = _mm256_or_si256(_mm256_andnot_si256(alpha_mask, result), alpha);
+
+        __m256i keep = _mm256_or_si256(_mm256_cmpeq_epi32(alpha, zero), _mm256_cmpeq_epi32(alpha, alpha_mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_blendv_epi8(result, pixels, keep));
+    }
+
+    unpremultiply_scalar(source + i, destination + i, count - i);
+}
+
+PN_TARGET_AVX2 void rgb_to_rgba_avx2(const uint8_t* source, uint32_t* destination, uint32_t count) {
+    //pshufb spreads four packed pixels out to four words, 0x80 entries are zeroed and then filled with alpha
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -128, 3, 4, 5, -128, 6, 7, 8, -128, 9, 10, 11, -128);
+    const __m128i alpha = _mm_set1_epi32(int32_t(ALPHA_MASK));
+
+    //Each load reads 16 bytes for 12, so stop while there are still two pixels after the four
+    uint32_t i = 0;
+    for(; i + 6 <= count; i += 4) {
+        __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + (i * 3)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm_or_si128(_mm_shuffle_epi8(packed, spread), alpha));
+    }
+
+    rgb_to_rgba_scalar(source + (i * 3), destination + i, count - i);
+}
+
+PN_TARGET_AVX2 void swap_red_blue_avx2(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    const __m256i red_blue = _mm256_set1_epi32(0x00FF00FF);
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        __m256i rb = _mm256_and_si256(pixels, red_blue);
+        __m256i swapped = _mm256_or_si256(_mm256_slli_epi32(rb, 16), _mm256_srli_epi32(rb, 16));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_or_si256(_mm256_andnot_si256(red_blue, pixels), swapped));
+    }
+
+    swap_red_blue_scalar(source + i, destination + i, count - i);
+}
+
+PN_TARGET_AVX2 void downsample_avx2(const uint32_t* top, const uint32_t* bottom, uint32_t width, uint32_t* out) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i two = _mm256_set1_epi16(2);
+
+    uint32_t x = 0;
+    for(; (x + 8) * 2 <= width; x += 8) {
+        __m256 t0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + (x * 2))));
+        __m256 t1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(top + (x * 2) + 8)));
+        __m256 b0 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + (x * 2))));
+        __m256 b1 = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(bottom + (x * 2) + 8)));
+
+        __m256i te = _mm256_castps_si256(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256i to = _mm256_castps_si256(_mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1)));
+        __m256i be = _mm256_castps_si256(_mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256i bo = _mm256_castps_si256(_mm256_shuffle_ps(b0, b1, _MM_SHUFFLE(3, 1, 3, 1)));
+
+        __m256i low = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpacklo_epi8(te, zero), _mm256_unpacklo_epi8(to, zero)),
+                                       _mm256_add_epi16(_mm256_unpacklo_epi8(be, zero), _mm256_unpacklo_epi8(bo, zero)));
+        __m256i high = _mm256_add_epi16(_mm256_add_epi16(_mm256_unpackhi_epi8(te, zero), _mm256_unpackhi_epi8(to, zero)),
+                                        _mm256_add_epi16(_mm256_unpackhi_epi8(be, zero), _mm256_unpackhi_epi8(bo, zero)));
+        low = _mm256_srli_epi16(_mm256_add_epi16(low, two), 2);
+        high = _mm256_srli_epi16(_mm256_add_epi16(high, two), 2);
+
+        //The in-lane shuffles leave 64 bit pairs of output in the order 0 2 1 3
+        __m256i packed = _mm256_packus_epi16(low, high);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+
+    downsample_scalar(top, bottom, width, x, out);
+}
+
+PN_TARGET_AVX2 void hash_stripes_avx2(uint64_t* acc_out, const uint8_t* data, size_t stripes) {
+    __m256i acc[2];
+    __m256i keys[2];
+    for(uint32_t j = 0; j < 2; ++j) {
+        acc[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc_out + (j * 4)));
+        keys[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(HASH_KEYS + (j * 4)));
+    }
+    const __m256i prime = _mm256_set1_epi32(uint32_t(PRIME32_1));
+
+    for(size_t s = 0; s < stripes; ++s) {
+        const uint8_t* stripe = data + (s * HASH_STRIPE_BYTES);
+        for(uint32_t j = 0; j < 2; ++j) {
+            __m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(stripe + (j * 32)));
+            __m256i keyed = _mm256_xor_si256(words, keys[j]);
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+            acc[j] = _mm256_add_epi64(acc[j], _mm256_add_epi64(product, _mm256_shuffle_epi32(words, _MM_SHUFFLE(1, 0, 3, 2))));
+        }
+
+        if((s + 1) % HASH_BLOCK_STRIPES == 0) {
+            for(uint32_t j = 0; j < 2; ++j) {
+                __m256i mixed = _mm256_xor_si256(_mm256_xor_si256(acc[j], _mm256_srli_epi64(acc[j], 47)), keys[j]);
+                __m256i low = _mm256_mul_epu32(mixed, prime);
+                __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(mixed, 32), prime);
+                acc[j] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+            }
+        }
+    }
+
+    for(uint32_t j = 0; j < 2; ++j) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc_out + (j * 4)), acc[j]);
+    }
+}
+
+#endif
+
+}
+
+bool pixel_path_supported(PixelPath path) {
+    return path <= BEST_PATH;
+}
+
+const char* pixel_path_name(PixelPath path) {
+    switch(path) {
+        case PIXEL_PATH_SSE2: return "sse2";
+        case PIXEL_PATH_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+void set_pixel_path(PixelPath path) {
+    current_path = std::min(path, BEST_PATH);
+}
+
+PixelPath pixel_path() {
+    return active_path();
+}
+
+void premultiply_row(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    switch(active_path()) {
+#ifdef PN_PIXEL_OPS_AVX2
+        case PIXEL_PATH_AVX2: premultiply_avx2(source, destination, count); return;
+#endif
+#ifdef __SSE2__
+        case PIXEL_PATH_SSE2: premultiply_sse2(source, destination, count); return;
+#endif
+        default: premultiply_scalar(source, destination, count);
+    }
+}
+
+void unpremultiply_row(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    switch(active_path()) {
+#ifdef PN_PIXEL_OPS_AVX2
+        case PIXEL_PATH_AVX2: unpremultiply_avx2(source, destination, count); return;
+#endif
+#ifdef __SSE2__
+        case PIXEL_PATH_SSE2: unpremultiply_sse2(source, destination, count); return;
+#endif
+        default: unpremultiply_scalar(source, destination, count);
+    }
+}
+
+void rgb_to_rgba_row(const uint8_t* source, uint32_t* destination, uint32_t count) {
+    //Plain SSE2 has no byte shuffle, so only AVX2 machines (which all have SSSE3) get a vector version
+    switch(active_path()) {
+#ifdef PN_PIXEL_OPS_AVX2
+        case PIXEL_PATH_AVX2: rgb_to_rgba_avx2(source, destination, count); return;
+#endif
+        default: rgb_to_rgba_scalar(source, destination, count);
+    }
+}
+
+void swap_red_blue_row(const uint32_t* source, uint32_t* destination, uint32_t count) {
+    switch(active_path()) {
+#ifdef PN_PIXEL_OPS_AVX2
+        case PIXEL_PATH_AVX2: swap_red_blue_avx2(source, destination, count); return;
+#endif
+#ifdef __SSE2__
+        case PIXEL_PATH_SSE2: swap_red_blue_sse2(source, destination, count); return;
+#endif
+        default: swap_red_blue_scalar(source, destination, count);
+    }
+}
+
+void downsample(const uint32_t* source, uint32_t width, uint32_t height, uint32_t* destination) {
+    if(!width || !height) {
+        return;
+    }
+
+    PixelPath path = active_path();
+    uint32_t width2 = (width + 1) / 2;
+    uint32_t height2 = (height + 1) / 2;
+
+    for(uint32_t y = 0; y < height2; ++y) {
+        const uint32_t* top = source + (size_t(y * 2) * width);
+        const uint32_t* bottom = source + (size_t(std::min(y * 2 + 1, height - 1)) * width);
+        uint32_t* out = destination + (size_t(y) * width2);
+
+        switch(path) {
+#ifdef PN_PIXEL_OPS_AVX2
+            case PIXEL_PATH_AVX2: downsample_avx2(top, bottom, width, out); break;
+#endif
+#ifdef __SSE2__
+            case PIXEL_PATH_SSE2: downsample_sse2(top, bottom, width, out); break;
+#endif
+            default: downsample_scalar(top, bottom, width, 0, out);
+        }
+    }
+}
+
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+    uint64_t acc[8] = {
+        PRIME32_1 + seed, PRIME64_1, PRIME64_2, PRIME64_3,
+        PRIME64_4 - seed, PRIME32_1 ^ seed, PRIME64_5, PRIME32_1 * 3
+    };
+
+    //Whole blocks only, so every path scrambles at the same points
+    size_t stripes = length / HASH_STRIPE_BYTES;
+    size_t bulk = stripes - (stripes % HASH_BLOCK_STRIPES);
+
+    switch(active_path()) {
+#ifdef PN_PIXEL_OPS_AVX2
+        case PIXEL_PATH_AVX2: hash_stripes_avx2(acc, bytes, bulk); break;
+#endif
+#ifdef __SSE2__
+        case PIXEL_PATH_SSE2: hash_stripes_sse2(acc, bytes, bulk); break;
+#endif
+        default: hash_stripes_scalar(acc, bytes, bulk);
+    }
+    hash_stripes_scalar(acc, bytes + (bulk * HASH_STRIPE_BYTES), stripes - bulk);
+
+    size_t tail = length - (stripes * HASH_STRIPE_BYTES);
+    if(tail) {
+        uint8_t last[HASH_STRIPE_BYTES] = {};
+        memcpy(last, bytes + (stripes * HASH_STRIPE_BYTES), tail);
+        hash_stripe_scalar(acc, last);
+    }
+
+    uint64_t hash = (uint64_t(length) * PRIME64_1) ^ seed;
+    for(uint32_t j = 0; j < 8; ++j) {
+        hash = rotl64(hash ^ (rotl64(acc[j] * PRIME64_2, 31) * PRIME64_1), 27) * PRIME64_1 + PRIME64_4;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+}
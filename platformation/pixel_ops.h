@@ -0,0 +1,53 @@
+#ifndef PIXEL_OPS_H
+#define PIXEL_OPS_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace pn {
+
+/*
+    Row kernels for the tile loading pipeline. Pixels are RGBA, 8 bits a
+    channel in that byte order (little endian uint32s, R in the low byte).
+    Each kernel has a scalar version and SSE2 and AVX2 ones where the CPU
+    has them. The best path is picked at startup, and every path gives
+    bit-identical results, so the scalar one is the reference.
+*/
+enum PixelPath {
+    PIXEL_PATH_SCALAR,
+    PIXEL_PATH_SSE2,
+    PIXEL_PATH_AVX2
+};
+
+bool pixel_path_supported(PixelPath path);
+const char* pixel_path_name(PixelPath path);
+
+//Applies to every thread. Unsupported paths fall back to the best supported one below them
+void set_pixel_path(PixelPath path);
+PixelPath pixel_path();
+
+//Straight alpha to premultiplied, in place is fine
+void premultiply_row(const uint32_t* source, uint32_t* destination, uint32_t count);
+
+//Premultiplied back to straight alpha (PNG files, GL textures), in place is fine
+void unpremultiply_row(const uint32_t* source, uint32_t* destination, uint32_t count);
+
+//Packed 24 bit RGB to opaque RGBA, not in place
+void rgb_to_rgba_row(const uint8_t* source, uint32_t* destination, uint32_t count);
+
+//RGBA to BGRA or back, in place is fine
+void swap_red_blue_row(const uint32_t* source, uint32_t* destination, uint32_t count);
+
+/*
+    Halves a premultiplied image, each output pixel the rounded average of
+    a 2x2 block. Odd edges repeat their last row or column. destination
+    must hold ((width + 1) / 2) * ((height + 1) / 2) pixels.
+*/
+void downsample(const uint32_t* source, uint32_t width, uint32_t height, uint32_t* destination);
+
+//64 bit hash of any bytes, several GB/s. Not cryptographic
+uint64_t hash_bytes(const void* data, size_t length, uint64_t seed=0);
+
+}
+
+#endif // PIXEL_OPS_H
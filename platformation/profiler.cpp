@@ -0,0 +1,197 @@
+#include <mutex>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <cassert>
+
+#include "profiler.h"
+
+namespace pn {
+namespace profiler {
+
+std::atomic<int32_t> enable_count(0);
+
+namespace {
+
+const uint32_t RING_CAPACITY = 4096; //Must be a power of two
+const char* FRAME_SAMPLE_NAME = "frame";
+
+/*
+    Single producer (the owning thread), single consumer (whoever calls
+    drain()) ring buffer. Producers never block; if the consumer falls behind
+    samples are dropped and counted instead.
+*/
+class SampleRing {
+public:
+    SampleRing(uint32_t thread_id):
+        thread_id_(thread_id),
+        head_(0),
+        tail_(0) {}
+
+    bool push(const char* name, uint64_t start_ns, uint64_t duration_ns) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        uint32_t tail = tail_.load(std::memory_order_acquire);
+
+        if(head - tail == RING_CAPACITY) {
+            return false;
+        }
+
+        Sample& sample = samples_[head & (RING_CAPACITY - 1)];
+        sample.name = name;
+        sample.start_ns = start_ns;
+        sample.duration_ns = duration_ns;
+        sample.thread_id = thread_id_;
+
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void pop_all(std::vector<Sample>& out) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+
+        for(; tail != head; ++tail) {
+            out.push_back(samples_[tail & (RING_CAPACITY - 1)]);
+        }
+
+        tail_.store(tail, std::memory_order_release);
+    }
+
+private:
+    uint32_t thread_id_;
+    std::atomic<uint32_t> head_;
+    std::atomic<uint32_t> tail_;
+    Sample samples_[RING_CAPACITY];
+};
+
+std::mutex rings_mutex;
+std::vector<SampleRing*> rings; //Never freed, a thread's samples may be drained after it exits
+
+__thread SampleRing* thread_ring = nullptr;
+
+std::atomic<uint64_t> dropped(0);
+
+SampleRing* ring_for_this_thread() {
+    if(!thread_ring) {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        thread_ring = new SampleRing(rings.size());
+        rings.push_back(thread_ring);
+    }
+    return thread_ring;
+}
+
+}
+
+void acquire() {
+    enable_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void release() {
+    int32_t previous = enable_count.fetch_sub(1, std::memory_order_relaxed);
+    assert(previous > 0);
+}
+
+uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000ull + uint64_t(ts.tv_nsec);
+}
+
+void record(const char* name, uint64_t start_ns, uint64_t duration_ns) {
+    if(!ring_for_this_thread()->push(name, start_ns, duration_ns)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void drain(std::vector<Sample>& out) {
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for(SampleRing* ring: rings) {
+        ring->pop_all(out);
+    }
+}
+
+uint64_t dropped_sample_count() {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+FrameStats::FrameStats(uint32_t window_size):
+    window_size_(window_size),
+    frames_in_window_(0) {
+
+}
+
+void FrameStats::clear() {
+    frames_in_window_ = 0;
+    frame_times_.clear();
+    current_.clear();
+    previous_.clear();
+}
+
+void FrameStats::add_samples(const std::vector<Sample>& samples) {
+    for(const Sample& sample: samples) {
+        if(strcmp(sample.name, FRAME_SAMPLE_NAME) == 0) {
+            frame_times_.push_back(sample.duration_ns);
+            if(frame_times_.size() > window_size_) {
+                frame_times_.pop_front();
+            }
+
+            if(++frames_in_window_ == window_size_) {
+                //Roll the span totals over so the overlay shows a stable window
+                previous_.swap(current_);
+                current_.clear();
+                frames_in_window_ = 0;
+            }
+            continue;
+        }
+
+        SpanTotals& totals = current_[sample.name];
+        totals.count++;
+        totals.total_ns += sample.duration_ns;
+        totals.max_ns = std::max(totals.max_ns, sample.duration_ns);
+    }
+}
+
+double FrameStats::frame_time_percentile(double percentile) const {
+    if(frame_times_.empty()) {
+        return 0.0;
+    }
+
+    std::vector<uint64_t> sorted(frame_times_.begin(), frame_times_.end());
+    uint32_t idx = std::min(sorted.size() - 1, size_t(percentile / 100.0 * double(sorted.size())));
+    std::nth_element(sorted.begin(), sorted.begin() + idx, sorted.end());
+    return double(sorted[idx]) / 1000000.0;
+}
+
+std::string FrameStats::summary() const {
+    const std::map<std::string, SpanTotals>& spans = previous_.empty() ? current_ : previous_;
+    uint32_t frames = previous_.empty() ? std::max(frames_in_window_, 1u) : window_size_;
+
+    char line[256];
+    std::string result;
+
+    snprintf(line, sizeof(line), "frame ms  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f\n",
+        frame_time_percentile(50), frame_time_percentile(95),
+        frame_time_percentile(99), frame_time_percentile(100)
+    );
+    result += line;
+
+    for(const std::pair<const std::string, SpanTotals>& span: spans) {
+        snprintf(line, sizeof(line), "%-28s %7.3f ms/frame  max %.3f ms\n",
+            span.first.c_str(),
+            double(span.second.total_ns) / 1000000.0 / double(frames),
+            double(span.second.max_ns) / 1000000.0
+        );
+        result += line;
+    }
+
+    if(dropped_sample_count()) {
+        snprintf(line, sizeof(line), "dropped samples %llu\n", (unsigned long long) dropped_sample_count());
+        result += line;
+    }
+
+    return result;
+}
+
+}
+}
@@ -0,0 +1,110 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <atomic>
+
+namespace pn {
+namespace profiler {
+
+struct Sample {
+    const char* name; //Must point to a string literal, samples outlive the scope that recorded them
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    uint32_t thread_id;
+};
+
+extern std::atomic<int32_t> enable_count;
+
+/*
+    Checked by every ScopedTimer, so this is the only cost paid by
+    instrumented code while the profiler is switched off.
+*/
+inline bool enabled() {
+    return enable_count.load(std::memory_order_relaxed) > 0;
+}
+
+/*
+    The overlay and the trace recorder switch the profiler on independently,
+    it stays on while either of them holds a reference.
+*/
+void acquire();
+void release();
+
+uint64_t now_ns();
+
+void record(const char* name, uint64_t start_ns, uint64_t duration_ns);
+
+/*
+    Moves every sample recorded since the last call (on any thread) into
+    out. Only one thread should drain at a time, which in practice is the
+    GTK main loop.
+*/
+void drain(std::vector<Sample>& out);
+
+uint64_t dropped_sample_count();
+
+class ScopedTimer {
+public:
+    ScopedTimer(const char* name):
+        name_(name),
+        start_ns_(enabled() ? now_ns() : 0) {}
+
+    ~ScopedTimer() {
+        if(start_ns_) {
+            record(name_, start_ns_, now_ns() - start_ns_);
+        }
+    }
+
+private:
+    ScopedTimer(const ScopedTimer&);
+    ScopedTimer& operator=(const ScopedTimer&);
+
+    const char* name_;
+    uint64_t start_ns_;
+};
+
+/*
+    Aggregates drained samples into the numbers shown by the canvas overlay:
+    frame time percentiles over a rolling window and the mean cost of every
+    other named span over the same window.
+*/
+class FrameStats {
+public:
+    FrameStats(uint32_t window_size=240);
+
+    void add_samples(const std::vector<Sample>& samples);
+    void clear();
+
+    double frame_time_percentile(double percentile) const;
+    std::string summary() const;
+
+private:
+    struct SpanTotals {
+        SpanTotals(): count(0), total_ns(0), max_ns(0) {}
+
+        uint64_t count;
+        uint64_t total_ns;
+        uint64_t max_ns;
+    };
+
+    uint32_t window_size_;
+    uint32_t frames_in_window_;
+    std::deque<uint64_t> frame_times_;
+
+    std::map<std::string, SpanTotals> current_;
+    std::map<std::string, SpanTotals> previous_;
+};
+
+}
+}
+
+#define PN_PROFILE_CONCAT_(a, b) a##b
+#define PN_PROFILE_CONCAT(a, b) PN_PROFILE_CONCAT_(a, b)
+#define PN_PROFILE_SCOPE(name) pn::profiler::ScopedTimer PN_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+#endif // PROFILER_H
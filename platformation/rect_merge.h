@@ -0,0 +1,71 @@
+#ifndef RECT_MERGE_H
+#define RECT_MERGE_H
+
+#include <cstdint>
+#include <vector>
+
+namespace pn {
+
+struct CellRect {
+    CellRect():
+        x(0), y(0), width(0), height(0) {}
+
+    CellRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height):
+        x(x), y(y), width(width), height(height) {}
+
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+/*
+    Covers the occupied cells of a width x height grid with as few
+    rectangles as a greedy scan manages: each unclaimed cell (in row major
+    order) grows as far right as it can and then as far up as the whole row
+    allows. Not optimal, but output only depends on the input so it's safe
+    to cache.
+
+    occupied is anything callable as bool(uint32_t x, uint32_t y).
+*/
+template<typename Occupied>
+void greedy_merge(uint32_t width, uint32_t height, Occupied occupied, std::vector<CellRect>& out) {
+    std::vector<bool> claimed(width * height, false);
+
+    for(uint32_t y = 0; y < height; ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            if(claimed[(y * width) + x] || !occupied(x, y)) {
+                continue;
+            }
+
+            uint32_t w = 1;
+            while(x + w < width && !claimed[(y * width) + x + w] && occupied(x + w, y)) {
+                ++w;
+            }
+
+            uint32_t h = 1;
+            for(; y + h < height; ++h) {
+                bool row_full = true;
+                for(uint32_t i = x; i < x + w && row_full; ++i) {
+                    row_full = !claimed[((y + h) * width) + i] && occupied(i, y + h);
+                }
+
+                if(!row_full) {
+                    break;
+                }
+            }
+
+            for(uint32_t j = y; j < y + h; ++j) {
+                for(uint32_t i = x; i < x + w; ++i) {
+                    claimed[(j * width) + i] = true;
+                }
+            }
+
+            out.push_back(CellRect(x, y, w, h));
+        }
+    }
+}
+
+}
+
+#endif // RECT_MERGE_H
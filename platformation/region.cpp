@@ -0,0 +1,185 @@
+#include <algorithm>
+
+#include "region.h"
+#include "level.h"
+#include "layer.h"
+#include "profiler.h"
+
+namespace pn {
+
+Region::ptr Region::copy(Level& level, const CellRect& area, uint32_t first_layer, uint32_t layer_count) {
+    PN_PROFILE_SCOPE("Region::copy");
+
+    uint32_t end_x = std::min(area.x + area.width, level.horizontal_tile_count());
+    uint32_t end_y = std::min(area.y + area.height, level.vertical_tile_count());
+    if(area.x >= end_x || area.y >= end_y) {
+        return Region::ptr();
+    }
+
+    Region::ptr region(new Region());
+    region->width_ = end_x - area.x;
+    region->height_ = end_y - area.y;
+    region->blocks_across_ = (region->width_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    region->blocks_down_ = (region->height_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    Palette& palette = level.palette();
+    for(uint32_t i = 0; i < palette.size(); ++i) {
+        region->palette_.push_back(palette.path_for_id(i));
+    }
+
+    uint32_t last_layer = std::min(first_layer + layer_count, level.layer_count());
+    for(uint32_t l = first_layer; l < last_layer; ++l) {
+        Layer& layer = level.layer_at(l);
+
+        RegionLayer copied;
+        copied.name = layer.name();
+        copied.blocks.reserve(region->blocks_across_ * region->blocks_down_);
+
+        for(uint32_t by = 0; by < region->blocks_down_; ++by) {
+            for(uint32_t bx = 0; bx < region->blocks_across_; ++bx) {
+                copied.blocks.push_back(layer.copy_block(area.x + (bx * CHUNK_SIZE), area.y + (by * CHUNK_SIZE)));
+            }
+        }
+
+        region->layers_.push_back(copied);
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    for(uint32_t by = 0; by < region->blocks_down_; ++by) {
+        for(uint32_t bx = 0; bx < region->blocks_across_; ++bx) {
+            region->metadata_blocks_.push_back(metadata.copy_block(area.x + (bx * CHUNK_SIZE), area.y + (by * CHUNK_SIZE)));
+        }
+    }
+
+    return region;
+}
+
+Region::ptr Region::cut(Level& level, const CellRect& area, uint32_t first_layer, uint32_t layer_count) {
+    Region::ptr region = copy(level, area, first_layer, layer_count);
+    if(!region) {
+        return region;
+    }
+
+    uint32_t last_layer = std::min(first_layer + layer_count, level.layer_count());
+    for(uint32_t l = first_layer; l < last_layer; ++l) {
+        level.layer_at(l).fill(area, -1);
+    }
+
+    level.metadata().fill(area, 0xFF, false);
+    level.flush_render();
+    return region;
+}
+
+int32_t Region::tile_at(uint32_t layer, uint32_t x, uint32_t y) const {
+    const ChunkCells::ptr& block = layers_.at(layer).blocks[((y / CHUNK_SIZE) * blocks_across_) + (x / CHUNK_SIZE)];
+    return block->tiles[((y % CHUNK_SIZE) * CHUNK_SIZE) + (x % CHUNK_SIZE)];
+}
+
+MetadataFlags Region::flags_at(uint32_t x, uint32_t y) const {
+    const MetadataChunk::ptr& block = metadata_blocks_[((y / CHUNK_SIZE) * blocks_across_) + (x / CHUNK_SIZE)];
+    return block->flags_at(((y % CHUNK_SIZE) * CHUNK_SIZE) + (x % CHUNK_SIZE));
+}
+
+void Region::paste(Level& level, int32_t x, int32_t y, uint32_t first_layer, PasteMode mode) const {
+    PN_PROFILE_SCOPE("Region::paste");
+
+    //Within a level (or between levels whose palettes agree) ids carry over and blocks can be shared
+    Palette& palette = level.palette();
+    bool same_ids = palette.size() >= palette_.size();
+    for(uint32_t i = 0; same_ids && i < palette_.size(); ++i) {
+        same_ids = palette.path_for_id(i) == palette_[i];
+    }
+
+    std::vector<int32_t> remap;
+    if(!same_ids) {
+        //Only bring over the tiles that are actually used, not the whole source palette
+        remap.assign(palette_.size(), -1);
+        for(uint32_t l = 0; l < layers_.size(); ++l) {
+            for(uint32_t ry = 0; ry < height_; ++ry) {
+                for(uint32_t rx = 0; rx < width_; ++rx) {
+                    int32_t tile = tile_at(l, rx, ry);
+                    if(tile >= 0 && uint32_t(tile) < palette_.size() && remap[tile] < 0) {
+                        remap[tile] = palette.id_for_path(palette_[tile]);
+                    }
+                }
+            }
+        }
+    }
+
+    while(level.layer_count() < first_layer + layers_.size()) {
+        level.add_layer();
+    }
+
+    for(uint32_t l = 0; l < layers_.size(); ++l) {
+        Layer& layer = level.layer_at(first_layer + l);
+
+        for(uint32_t by = 0; by < blocks_down_; ++by) {
+            for(uint32_t bx = 0; bx < blocks_across_; ++bx) {
+                layer.paste_block(
+                    x + int32_t(bx * CHUNK_SIZE), y + int32_t(by * CHUNK_SIZE),
+                    std::min(CHUNK_SIZE, width_ - (bx * CHUNK_SIZE)), std::min(CHUNK_SIZE, height_ - (by * CHUNK_SIZE)),
+                    layers_[l].blocks[(by * blocks_across_) + bx],
+                    same_ids ? nullptr : &remap, mode == PASTE_OVERLAY
+                );
+            }
+        }
+    }
+
+    MetadataLayer& metadata = level.metadata();
+    for(uint32_t by = 0; by < blocks_down_; ++by) {
+        for(uint32_t bx = 0; bx < blocks_across_; ++bx) {
+            metadata.paste_block(
+                x + int32_t(bx * CHUNK_SIZE), y + int32_t(by * CHUNK_SIZE),
+                std::min(CHUNK_SIZE, width_ - (bx * CHUNK_SIZE)), std::min(CHUNK_SIZE, height_ - (by * CHUNK_SIZE)),
+                metadata_blocks_[(by * blocks_across_) + bx], mode == PASTE_OVERLAY
+            );
+        }
+    }
+
+    level.flush_render();
+}
+
+Level::ptr Region::to_level() const {
+    Level::ptr level(new Level(width_, height_));
+
+    while(level->layer_count() < layers_.size()) {
+        level->add_layer();
+    }
+
+    std::vector<int32_t> remap(palette_.size(), -1);
+    for(uint32_t l = 0; l < layers_.size(); ++l) {
+        Layer& layer = level->layer_at(l);
+        layer.set_name(layers_[l].name);
+
+        for(uint32_t y = 0; y < height_; ++y) {
+            for(uint32_t x = 0; x < width_; ++x) {
+                int32_t tile = tile_at(l, x, y);
+                if(tile < 0 || uint32_t(tile) >= palette_.size()) {
+                    continue;
+                }
+
+                if(remap[tile] < 0) {
+                    remap[tile] = level->palette().id_for_path(palette_[tile]);
+                }
+                layer.set_tile(x, y, remap[tile]);
+            }
+        }
+    }
+
+    for(uint32_t y = 0; y < height_; ++y) {
+        for(uint32_t x = 0; x < width_; ++x) {
+            if(MetadataFlags flags = flags_at(x, y)) {
+                level->metadata().set_flags(x, y, flags);
+            }
+        }
+    }
+
+    return level;
+}
+
+Region::ptr Region::from_level(Level& level) {
+    CellRect area(0, 0, level.horizontal_tile_count(), level.vertical_tile_count());
+    return copy(level, area, 0, level.layer_count());
+}
+
+}
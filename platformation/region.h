@@ -0,0 +1,85 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <tr1/memory>
+
+#include "chunk.h"
+#include "rect_merge.h"
+#include "metadata_layer.h"
+
+namespace pn {
+
+class Level;
+
+enum PasteMode {
+    PASTE_REPLACE, //Every cell in the region overwrites the level
+    PASTE_OVERLAY //Empty cells and cells without flags leave the level alone, for stamps
+};
+
+/*
+    A rectangular piece of one or more layers plus the metadata under it,
+    used for the clipboard and for stamps. Tiles and flags are held as
+    CHUNK_SIZE blocks shared copy on write with the layers they came from, so copying
+    an area that starts on a chunk boundary only copies pointers and costs
+    no memory until one side is edited.
+*/
+class Region {
+public:
+    typedef std::tr1::shared_ptr<Region> ptr;
+
+    /*
+        The area is clipped to the level, and null is returned if nothing
+        is left. Layers are first_layer up to first_layer + layer_count.
+    */
+    static Region::ptr copy(Level& level, const CellRect& area, uint32_t first_layer, uint32_t layer_count);
+
+    //Copy followed by clearing the area's tiles and flags
+    static Region::ptr cut(Level& level, const CellRect& area, uint32_t first_layer, uint32_t layer_count);
+
+    /*
+        Pastes with the top left cell at (x, y), anything outside the level
+        is dropped. Region layer i lands on level layer first_layer + i,
+        adding layers if needed. Tile ids are mapped through the level's
+        palette, and the views are flushed once per touched chunk.
+    */
+    void paste(Level& level, int32_t x, int32_t y, uint32_t first_layer, PasteMode mode=PASTE_REPLACE) const;
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+    uint32_t layer_count() const { return layers_.size(); }
+
+    int32_t tile_at(uint32_t layer, uint32_t x, uint32_t y) const;
+    MetadataFlags flags_at(uint32_t x, uint32_t y) const;
+
+    //The region as a level of its own (with only the tiles it uses in the palette), for saving stamps
+    std::tr1::shared_ptr<Level> to_level() const;
+    static Region::ptr from_level(Level& level);
+
+private:
+    Region():
+        width_(0),
+        height_(0),
+        blocks_across_(0),
+        blocks_down_(0) {}
+
+    struct RegionLayer {
+        std::string name;
+        std::vector<ChunkCells::ptr> blocks; //blocks_across_ x blocks_down_, starting at the region's top left
+    };
+
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t blocks_across_;
+    uint32_t blocks_down_;
+
+    std::vector<std::string> palette_; //The source level's palette when the copy was taken
+    std::vector<RegionLayer> layers_;
+    std::vector<MetadataChunk::ptr> metadata_blocks_; //Laid out the same as the layer blocks
+};
+
+}
+
+#endif // REGION_H
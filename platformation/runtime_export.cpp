@@ -0,0 +1,218 @@
+#include <algorithm>
+
+#include "kazbase/logging/logging.h"
+
+#include "runtime_export.h"
+#include "binary_io.h"
+#include "atomic_file.h"
+#include "level.h"
+#include "layer.h"
+#include "metadata_layer.h"
+#include "rect_merge.h"
+#include "profiler.h"
+#include "parallel.h"
+
+namespace pn {
+
+namespace {
+
+struct ChunkJob {
+    uint32_t layer;
+    uint32_t chunk_x;
+    uint32_t chunk_y;
+
+    uint32_t quad_count;
+    std::vector<uint8_t> vertices;
+};
+
+void bake_chunk(Layer& layer, uint32_t atlas_columns, uint32_t atlas_rows, ChunkJob& job) {
+    PN_PROFILE_SCOPE("export::bake_chunk");
+
+    BinaryWriter writer(job.vertices);
+    job.quad_count = 0;
+
+    uint32_t end_x = std::min((job.chunk_x + 1) * CHUNK_SIZE, layer.width());
+    uint32_t end_y = std::min((job.chunk_y + 1) * CHUNK_SIZE, layer.height());
+
+    float slot_width = 1.0f / float(atlas_columns);
+    float slot_height = 1.0f / float(atlas_rows);
+
+    for(uint32_t y = job.chunk_y * CHUNK_SIZE; y < end_y; ++y) {
+        for(uint32_t x = job.chunk_x * CHUNK_SIZE; x < end_x; ++x) {
+            int32_t id = layer.tile_image_at(x, y);
+            if(id < 0) {
+                continue;
+            }
+
+            //Atlas row 0 is at the top, so the bottom of a cell samples the bottom of its slot
+            float u0 = float(id % atlas_columns) * slot_width;
+            float v0 = float(id / atlas_columns) * slot_height;
+            float u1 = u0 + slot_width;
+            float v1 = v0 + slot_height;
+
+            float x0 = float(x), y0 = float(y);
+            float x1 = x0 + 1.0f, y1 = y0 + 1.0f;
+
+            writer.f32(x0); writer.f32(y0); writer.f32(u0); writer.f32(v1);
+            writer.f32(x1); writer.f32(y0); writer.f32(u1); writer.f32(v1);
+            writer.f32(x1); writer.f32(y1); writer.f32(u1); writer.f32(v0);
+            writer.f32(x0); writer.f32(y1); writer.f32(u0); writer.f32(v0);
+
+            ++job.quad_count;
+        }
+    }
+}
+
+}
+
+void build_runtime_pack(Level& level, const ExportOptions& options, std::vector<uint8_t>& out, ExportStats* stats) {
+    PN_PROFILE_SCOPE("export::build_runtime_pack");
+
+    uint64_t start_ns = profiler::now_ns();
+
+    uint32_t width = level.horizontal_tile_count();
+    uint32_t height = level.vertical_tile_count();
+    uint32_t atlas_columns = std::max(options.atlas_columns, 1u);
+    uint32_t atlas_rows = std::max((level.palette().size() + atlas_columns - 1) / atlas_columns, 1u);
+
+    uint32_t chunks_across = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    uint32_t chunks_down = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    std::vector<ChunkJob> jobs;
+    for(uint32_t l = 0; l < level.layer_count(); ++l) {
+        for(uint32_t cy = 0; cy < chunks_down; ++cy) {
+            for(uint32_t cx = 0; cx < chunks_across; ++cx) {
+                ChunkJob job;
+                job.layer = l;
+                job.chunk_x = cx;
+                job.chunk_y = cy;
+                job.quad_count = 0;
+                jobs.push_back(job);
+            }
+        }
+    }
+
+    //Collision is merged over the whole level, one job per flag alongside the chunks
+    MetadataLayer& metadata = level.metadata();
+    std::vector<std::vector<CellRect> > collision(MAX_METADATA_FLAGS);
+
+    parallel_for(jobs.size() + MAX_METADATA_FLAGS, options.threads, [&](uint32_t i) {
+        if(i < jobs.size()) {
+            bake_chunk(level.layer_at(jobs[i].layer), atlas_columns, atlas_rows, jobs[i]);
+            return;
+        }
+
+        uint32_t flag_bit = i - jobs.size();
+        if(!metadata.count(flag_bit)) {
+            return;
+        }
+
+        PN_PROFILE_SCOPE("export::merge_collision");
+        greedy_merge(width, height, [&](uint32_t x, uint32_t y) {
+            return (metadata.flags_at(x, y) & (1 << flag_bit)) != 0;
+        }, collision[flag_bit]);
+    });
+
+    PN_PROFILE_SCOPE("export::assemble");
+
+    out.clear();
+    BinaryWriter writer(out);
+
+    writer.magic("PNRT");
+    writer.u32(RUNTIME_PACK_VERSION);
+    writer.u32(width);
+    writer.u32(height);
+    writer.u32(CHUNK_SIZE);
+    writer.u32(level.layer_count());
+    writer.u32(atlas_columns);
+    writer.u32(atlas_rows);
+
+    size_t palette_offset = writer.reserve_u64();
+    size_t index_offset = writer.reserve_u64();
+    size_t collision_offset = writer.reserve_u64();
+    size_t vertex_offset = writer.reserve_u64();
+
+    writer.patch_u64(palette_offset, writer.position());
+    writer.u32(level.palette().size());
+    for(uint32_t i = 0; i < level.palette().size(); ++i) {
+        writer.string(level.palette().path_for_id(i));
+    }
+
+    uint32_t chunk_count = 0;
+    uint32_t quad_count = 0;
+    for(const ChunkJob& job: jobs) {
+        if(job.quad_count) {
+            ++chunk_count;
+            quad_count += job.quad_count;
+        }
+    }
+
+    writer.patch_u64(index_offset, writer.position());
+    writer.u32(chunk_count);
+
+    uint64_t vertex_bytes = 0;
+    for(const ChunkJob& job: jobs) {
+        if(!job.quad_count) {
+            continue;
+        }
+
+        writer.u32(job.layer);
+        writer.u32(job.chunk_x);
+        writer.u32(job.chunk_y);
+        writer.u32(job.quad_count);
+        writer.u64(vertex_bytes);
+        writer.u32(job.vertices.size());
+        vertex_bytes += job.vertices.size();
+    }
+
+    uint32_t rect_count = 0;
+    uint32_t flags_with_rects = 0;
+    for(const std::vector<CellRect>& rects: collision) {
+        flags_with_rects += rects.empty() ? 0 : 1;
+    }
+
+    writer.patch_u64(collision_offset, writer.position());
+    writer.u32(flags_with_rects);
+    for(uint32_t flag_bit = 0; flag_bit < MAX_METADATA_FLAGS; ++flag_bit) {
+        if(collision[flag_bit].empty()) {
+            continue;
+        }
+
+        writer.u32(flag_bit);
+        writer.u32(collision[flag_bit].size());
+        for(const CellRect& rect: collision[flag_bit]) {
+            writer.u32(rect.x);
+            writer.u32(rect.y);
+            writer.u32(rect.width);
+            writer.u32(rect.height);
+        }
+        rect_count += collision[flag_bit].size();
+    }
+
+    writer.patch_u64(vertex_offset, writer.position());
+    out.reserve(out.size() + vertex_bytes);
+    for(const ChunkJob& job: jobs) {
+        writer.bytes(job.vertices.data(), job.vertices.size());
+    }
+
+    if(stats) {
+        stats->chunk_count = chunk_count;
+        stats->quad_count = quad_count;
+        stats->collision_rect_count = rect_count;
+        stats->byte_count = out.size();
+        stats->elapsed_ms = double(profiler::now_ns() - start_ns) / 1000000.0;
+    }
+}
+
+bool export_runtime_pack(Level& level, const std::string& path, const ExportOptions& options, ExportStats* stats) {
+    std::vector<uint8_t> data;
+    build_runtime_pack(level, options, data, stats);
+
+    if(!write_file_atomically(path, data)) {
+        L_WARN("Unable to write " + path);
+        return false;
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef RUNTIME_EXPORT_H
+#define RUNTIME_EXPORT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pn {
+
+class Level;
+
+const uint32_t RUNTIME_PACK_VERSION = 1;
+
+/*
+    Runtime pack layout, all values little endian:
+
+    header      "PNRT", u32 version, u32 level width, u32 level height,
+                u32 chunk size, u32 layer count, u32 atlas columns,
+                u32 atlas rows, u64 offsets of the palette, chunk index,
+                collision and vertex sections (from the start of the file)
+
+    palette     u32 count, then per entry u32 length + path bytes. An
+                entry's atlas slot is its index, filled row by row from the
+                top left of the atlas.
+
+    chunk index u32 count, then per non-empty chunk u32 layer, u32 chunk x,
+                u32 chunk y, u32 quad count, u64 offset into the vertex
+                section, u32 byte length. Chunks are CHUNK_SIZE cells square
+                starting at cell (0, 0) of the level.
+
+    collision   u32 flag count, then per flag with any cells set u32 flag
+                bit, u32 rect count, rects as u32 x, y, width, height
+
+    vertices    per chunk, 4 vertices per quad as f32 x, f32 y, f32 u, f32 v
+                in cell units. Quads are drawn as (0, 1, 2) (0, 2, 3).
+
+    Output only depends on the level, never on thread timing, so packs can
+    be cached by hash.
+*/
+
+struct ExportOptions {
+    ExportOptions():
+        atlas_columns(16),
+        threads(0) {}
+
+    uint32_t atlas_columns;
+    uint32_t threads; //0 uses every core
+};
+
+struct ExportStats {
+    ExportStats():
+        chunk_count(0),
+        quad_count(0),
+        collision_rect_count(0),
+        byte_count(0),
+        elapsed_ms(0) {}
+
+    uint32_t chunk_count;
+    uint32_t quad_count;
+    uint32_t collision_rect_count;
+    uint64_t byte_count;
+    double elapsed_ms;
+};
+
+void build_runtime_pack(Level& level, const ExportOptions& options, std::vector<uint8_t>& out, ExportStats* stats=nullptr);
+bool export_runtime_pack(Level& level, const std::string& path, const ExportOptions& options=ExportOptions(), ExportStats* stats=nullptr);
+
+}
+
+#endif // RUNTIME_EXPORT_H
@@ -0,0 +1,370 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "selection.h"
+#include "layer.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+//Rows of a chunk are 16 bits each, 4 to a word
+const uint32_t ROWS_PER_WORD = 64 / CHUNK_SIZE;
+
+//Bit n set for each cell n of the chunk holding the tile
+void match_tiles(const int32_t* tiles, int32_t tile_image_id, uint64_t* words) {
+#ifdef __SSE2__
+    __m128i wanted = _mm_set1_epi32(tile_image_id);
+    for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+        const int32_t* cells = tiles + (w * 64);
+
+        uint64_t bits = 0;
+        for(uint32_t i = 0; i < 64; i += 16) {
+            __m128i a = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (cells + i)), wanted);
+            __m128i b = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (cells + i + 4)), wanted);
+            __m128i c = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (cells + i + 8)), wanted);
+            __m128i d = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (cells + i + 12)), wanted);
+
+            //Pack the 32 bit lanes down to bytes, one movemask gives the 16 cells
+            __m128i packed = _mm_packs_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+            bits |= uint64_t(uint32_t(_mm_movemask_epi8(packed))) << i;
+        }
+        words[w] |= bits;
+    }
+#else
+    for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+        uint64_t bits = 0;
+        for(uint32_t i = 0; i < 64; ++i) {
+            bits |= uint64_t(tiles[(w * 64) + i] == tile_image_id) << i;
+        }
+        words[w] |= bits;
+    }
+#endif
+}
+
+}
+
+Selection::Selection(const Layer& layer):
+    width_(layer.width()),
+    height_(layer.height()),
+    origin_x_(layer.origin_x()),
+    origin_y_(layer.origin_y()),
+    chunks_across_(layer.chunks_across()),
+    chunks_down_(layer.chunks_down()),
+    words_(chunk_count() * SELECTION_WORDS_PER_CHUNK, 0) {
+
+    for(uint32_t y = 0; y < height_; ++y) {
+        set_span(y, 0, width_, true);
+    }
+    bounds_mask_.swap(words_);
+    words_.assign(bounds_mask_.size(), 0);
+}
+
+bool Selection::fits(const Layer& layer) const {
+    return width_ == layer.width() && height_ == layer.height() &&
+           origin_x_ == layer.origin_x() && origin_y_ == layer.origin_y();
+}
+
+bool Selection::contains(uint32_t x, uint32_t y) const {
+    if(x >= width_ || y >= height_) {
+        return false;
+    }
+
+    uint32_t grid_x = x + origin_x_;
+    uint32_t grid_y = y + origin_y_;
+    uint32_t chunk_idx = ((grid_y / CHUNK_SIZE) * chunks_across_) + (grid_x / CHUNK_SIZE);
+    uint32_t local_index = ((grid_y % CHUNK_SIZE) * CHUNK_SIZE) + (grid_x % CHUNK_SIZE);
+    return (chunk_words(chunk_idx)[local_index / 64] >> (local_index % 64)) & 1;
+}
+
+void Selection::set(uint32_t x, uint32_t y, bool selected) {
+    assert(x < width_ && y < height_);
+    set_span(y, x, x + 1, selected);
+}
+
+void Selection::set_span(uint32_t y, uint32_t first_x, uint32_t end_x, bool selected) {
+    uint32_t grid_y = y + origin_y_;
+    uint32_t row = grid_y % CHUNK_SIZE;
+    uint32_t shift = (row % ROWS_PER_WORD) * CHUNK_SIZE;
+
+    uint64_t* row_words = &words_[(((grid_y / CHUNK_SIZE) * chunks_across_) * SELECTION_WORDS_PER_CHUNK) + (row / ROWS_PER_WORD)];
+
+    uint32_t grid_x = first_x + origin_x_;
+    uint32_t grid_end = end_x + origin_x_;
+    while(grid_x < grid_end) {
+        uint32_t cx = grid_x / CHUNK_SIZE;
+        uint32_t lx = grid_x % CHUNK_SIZE;
+        uint32_t run = std::min(CHUNK_SIZE - lx, grid_end - grid_x);
+
+        uint64_t mask = (((uint64_t(1) << run) - 1) << lx) << shift;
+        uint64_t& word = row_words[cx * SELECTION_WORDS_PER_CHUNK];
+        word = selected ? (word | mask) : (word & ~mask);
+
+        grid_x += run;
+    }
+}
+
+void Selection::clear() {
+    std::fill(words_.begin(), words_.end(), 0);
+}
+
+bool Selection::empty() const {
+    for(uint64_t word: words_) {
+        if(word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t Selection::count() const {
+    uint64_t total = 0;
+    for(uint64_t word: words_) {
+        total += __builtin_popcountll(word);
+    }
+    return total;
+}
+
+bool Selection::chunk_empty(uint32_t chunk_idx) const {
+    const uint64_t* words = chunk_words(chunk_idx);
+    for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+        if(words[w]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Selection::chunk_full(uint32_t chunk_idx) const {
+    const uint64_t* words = chunk_words(chunk_idx);
+    for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+        if(~words[w]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Selection::add_rect(const CellRect& area) {
+    uint32_t end_x = std::min(area.x + area.width, width_);
+    uint32_t end_y = std::min(area.y + area.height, height_);
+    for(uint32_t y = area.y; y < end_y && area.x < end_x; ++y) {
+        set_span(y, area.x, end_x, true);
+    }
+}
+
+void Selection::remove_rect(const CellRect& area) {
+    uint32_t end_x = std::min(area.x + area.width, width_);
+    uint32_t end_y = std::min(area.y + area.height, height_);
+    for(uint32_t y = area.y; y < end_y && area.x < end_x; ++y) {
+        set_span(y, area.x, end_x, false);
+    }
+}
+
+void Selection::add_lasso(const std::vector<SelectionPoint>& outline) {
+    PN_PROFILE_SCOPE("Selection::add_lasso");
+
+    if(outline.size() < 3) {
+        return;
+    }
+
+    double min_y = outline[0].y;
+    double max_y = outline[0].y;
+    for(const SelectionPoint& point: outline) {
+        min_y = std::min(min_y, point.y);
+        max_y = std::max(max_y, point.y);
+    }
+
+    int64_t first_row = std::max(int64_t(0), int64_t(std::floor(min_y)));
+    int64_t end_row = std::min(int64_t(height_), int64_t(std::ceil(max_y)));
+
+    std::vector<double> crossings;
+    for(int64_t y = first_row; y < end_row; ++y) {
+        //Where the outline crosses the line through this row's cell centres
+        double centre_y = double(y) + 0.5;
+        crossings.clear();
+        for(uint32_t i = 0; i < outline.size(); ++i) {
+            const SelectionPoint& a = outline[i];
+            const SelectionPoint& b = outline[(i + 1) % outline.size()];
+            if((a.y <= centre_y) != (b.y <= centre_y)) {
+                crossings.push_back(a.x + ((centre_y - a.y) / (b.y - a.y)) * (b.x - a.x));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+
+        for(uint32_t i = 0; i + 1 < crossings.size(); i += 2) {
+            //Cells whose centres fall between the pair
+            int64_t first_x = std::max(int64_t(0), int64_t(std::ceil(crossings[i] - 0.5)));
+            int64_t end_x = std::min(int64_t(width_), int64_t(std::ceil(crossings[i + 1] - 0.5)));
+            if(first_x < end_x) {
+                set_span(uint32_t(y), uint32_t(first_x), uint32_t(end_x), true);
+            }
+        }
+    }
+}
+
+void Selection::add_tile(const Layer& layer, int32_t tile_image_id) {
+    PN_PROFILE_SCOPE("Selection::add_tile");
+    assert(fits(layer));
+
+    for(uint32_t chunk_idx = 0; chunk_idx < chunk_count(); ++chunk_idx) {
+        const Chunk& chunk = layer.chunk(chunk_idx % chunks_across_, chunk_idx / chunks_across_);
+        uint64_t* words = writable_chunk_words(chunk_idx);
+        const uint64_t* mask = &bounds_mask_[chunk_idx * SELECTION_WORDS_PER_CHUNK];
+
+        //Chunks nobody has painted share the blank cells
+        if(chunk.cells == ChunkCells::blank()) {
+            if(tile_image_id < 0) {
+                for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+                    words[w] |= mask[w];
+                }
+            }
+            continue;
+        }
+
+        uint64_t matched[SELECTION_WORDS_PER_CHUNK] = {0};
+        match_tiles(chunk.cells->tiles, tile_image_id, matched);
+
+        //Cells outside the layer are empty, they mustn't be picked up when selecting empty cells
+        for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+            words[w] |= matched[w] & mask[w];
+        }
+    }
+}
+
+bool Selection::same_shape(const Selection& other) const {
+    return width_ == other.width_ && height_ == other.height_ &&
+           origin_x_ == other.origin_x_ && origin_y_ == other.origin_y_;
+}
+
+void Selection::unite(const Selection& other) {
+    assert(same_shape(other));
+    for(uint32_t i = 0; i < words_.size(); ++i) {
+        words_[i] |= other.words_[i];
+    }
+}
+
+void Selection::intersect(const Selection& other) {
+    assert(same_shape(other));
+    for(uint32_t i = 0; i < words_.size(); ++i) {
+        words_[i] &= other.words_[i];
+    }
+}
+
+void Selection::subtract(const Selection& other) {
+    assert(same_shape(other));
+    for(uint32_t i = 0; i < words_.size(); ++i) {
+        words_[i] &= ~other.words_[i];
+    }
+}
+
+void Selection::invert() {
+    for(uint32_t i = 0; i < words_.size(); ++i) {
+        words_[i] = ~words_[i] & bounds_mask_[i];
+    }
+}
+
+void Selection::combine(const Selection& other, SelectionCombine how) {
+    switch(how) {
+        case SELECTION_REPLACE: assert(same_shape(other)); words_ = other.words_; break;
+        case SELECTION_ADD: unite(other); break;
+        case SELECTION_SUBTRACT: subtract(other); break;
+        case SELECTION_INTERSECT: intersect(other); break;
+    }
+}
+
+bool Selection::bounds(CellRect& area) const {
+    uint32_t min_x = width_, min_y = height_, max_x = 0, max_y = 0;
+    for_each([&](uint32_t x, uint32_t y) {
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+    });
+
+    if(min_x > max_x) {
+        return false;
+    }
+
+    area = CellRect(min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+    return true;
+}
+
+void Selection::copy_tiles(const Selection& selection, const Layer& source, Layer& dest, int32_t dx, int32_t dy) {
+    PN_PROFILE_SCOPE("Selection::copy_tiles");
+    assert(selection.fits(source));
+
+    //Whole chunks straight across to the same chunk of a layer the same shape are shared
+    bool aligned = !dx && !dy && selection.fits(dest);
+
+    for(uint32_t chunk_idx = 0; chunk_idx < selection.chunk_count(); ++chunk_idx) {
+        if(selection.chunk_empty(chunk_idx)) {
+            continue;
+        }
+
+        uint32_t cx = chunk_idx % selection.chunks_across_;
+        uint32_t cy = chunk_idx / selection.chunks_across_;
+
+        if(aligned && selection.chunk_full(chunk_idx)) {
+            dest.paste_block(
+                int32_t(cx * CHUNK_SIZE) - int32_t(selection.origin_x_), int32_t(cy * CHUNK_SIZE) - int32_t(selection.origin_y_),
+                CHUNK_SIZE, CHUNK_SIZE, source.chunk(cx, cy).cells
+            );
+            continue;
+        }
+
+        const Chunk& chunk = source.chunk(cx, cy);
+        const uint64_t* words = selection.chunk_words(chunk_idx);
+        for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+            uint64_t bits = words[w];
+            while(bits) {
+                uint32_t local_index = (w * 64) + __builtin_ctzll(bits);
+                bits &= bits - 1;
+
+                int64_t x = int64_t(cx * CHUNK_SIZE + (local_index % CHUNK_SIZE)) - selection.origin_x_ + dx;
+                int64_t y = int64_t(cy * CHUNK_SIZE + (local_index / CHUNK_SIZE)) - selection.origin_y_ + dy;
+                if(x >= 0 && y >= 0 && x < int64_t(dest.width()) && y < int64_t(dest.height())) {
+                    dest.set_tile(uint32_t(x), uint32_t(y), chunk.tile_image(local_index));
+                }
+            }
+        }
+    }
+}
+
+Selection::ptr Selection::move_tiles(const Selection& selection, Layer& layer, int32_t dx, int32_t dy) {
+    PN_PROFILE_SCOPE("Selection::move_tiles");
+    assert(selection.fits(layer));
+
+    Selection::ptr moved(new Selection(layer));
+
+    //Read everything before clearing, the source and destination can overlap
+    std::vector<uint32_t> cells;
+    std::vector<int32_t> tiles;
+    selection.for_each([&](uint32_t x, uint32_t y) {
+        int64_t to_x = int64_t(x) + dx;
+        int64_t to_y = int64_t(y) + dy;
+        if(to_x >= 0 && to_y >= 0 && to_x < int64_t(layer.width()) && to_y < int64_t(layer.height())) {
+            cells.push_back((uint32_t(to_y) * layer.width()) + uint32_t(to_x));
+            tiles.push_back(layer.tile_image_at(x, y));
+        }
+    });
+
+    layer.fill(selection, -1);
+
+    for(uint32_t i = 0; i < cells.size(); ++i) {
+        uint32_t x = cells[i] % layer.width();
+        uint32_t y = cells[i] / layer.width();
+        layer.set_tile(x, y, tiles[i]);
+        moved->set(x, y);
+    }
+
+    return moved;
+}
+
+}
@@ -0,0 +1,149 @@
+#ifndef SELECTION_H
+#define SELECTION_H
+
+#include <cstdint>
+#include <vector>
+#include <tr1/memory>
+
+#include "chunk.h"
+#include "rect_merge.h"
+
+namespace pn {
+
+class Layer;
+
+const uint32_t SELECTION_WORDS_PER_CHUNK = CHUNK_AREA / 64;
+
+enum SelectionCombine {
+    SELECTION_REPLACE,
+    SELECTION_ADD,
+    SELECTION_SUBTRACT,
+    SELECTION_INTERSECT
+};
+
+//A point of a lasso, in cells. The outline runs through cell corners, (0, 0) being the bottom left of cell (0, 0)
+struct SelectionPoint {
+    SelectionPoint():
+        x(0), y(0) {}
+
+    SelectionPoint(double x, double y):
+        x(x), y(y) {}
+
+    double x;
+    double y;
+};
+
+/*
+    A set of cells of one layer, stored as a bitset for each of the layer's
+    chunks (bit ly * CHUNK_SIZE + lx, like the chunk's cells) so that
+    working through a selection goes chunk by chunk alongside the layer.
+    Combining selections is a word at a time, so even whole layer
+    selections are cheap to union, intersect and subtract.
+
+    A selection is shaped like the layer it was made for. If the layer is
+    resized it no longer lines up and should be thrown away, and only
+    selections of the same shape can be combined.
+*/
+class Selection {
+public:
+    typedef std::tr1::shared_ptr<Selection> ptr;
+
+    Selection(const Layer& layer);
+
+    uint32_t width() const { return width_; }
+    uint32_t height() const { return height_; }
+
+    //True if the selection was made for a layer of the layer's current shape
+    bool fits(const Layer& layer) const;
+
+    bool contains(uint32_t x, uint32_t y) const;
+    void set(uint32_t x, uint32_t y, bool selected=true);
+
+    void clear();
+    bool empty() const;
+    uint64_t count() const;
+
+    //Cells outside the layer are ignored
+    void add_rect(const CellRect& area);
+    void remove_rect(const CellRect& area);
+
+    //Adds the cells whose centres are inside the outline, by the even-odd rule
+    void add_lasso(const std::vector<SelectionPoint>& outline);
+
+    //Adds every cell of the layer holding the tile, -1 for empty cells
+    void add_tile(const Layer& layer, int32_t tile_image_id);
+
+    void unite(const Selection& other);
+    void intersect(const Selection& other);
+    void subtract(const Selection& other);
+    void invert();
+
+    void combine(const Selection& other, SelectionCombine how);
+
+    //The bounding box of the selected cells, false if there aren't any
+    bool bounds(CellRect& area) const;
+
+    //Calls visit(x, y) for each selected cell, chunk by chunk
+    template<typename Visitor>
+    void for_each(Visitor visit) const {
+        for(uint32_t chunk_idx = 0; chunk_idx < chunk_count(); ++chunk_idx) {
+            uint32_t base_x = (chunk_idx % chunks_across_) * CHUNK_SIZE;
+            uint32_t base_y = (chunk_idx / chunks_across_) * CHUNK_SIZE;
+
+            const uint64_t* words = chunk_words(chunk_idx);
+            for(uint32_t w = 0; w < SELECTION_WORDS_PER_CHUNK; ++w) {
+                uint64_t bits = words[w];
+                while(bits) {
+                    uint32_t local_index = (w * 64) + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    visit(base_x + (local_index % CHUNK_SIZE) - origin_x_, base_y + (local_index / CHUNK_SIZE) - origin_y_);
+                }
+            }
+        }
+    }
+
+    /*
+        The chunk grid, the same as the layer's. Bit n of the words for a
+        chunk is its cell n.
+    */
+    uint32_t origin_x() const { return origin_x_; }
+    uint32_t origin_y() const { return origin_y_; }
+    uint32_t chunks_across() const { return chunks_across_; }
+    uint32_t chunks_down() const { return chunks_down_; }
+    uint32_t chunk_count() const { return chunks_across_ * chunks_down_; }
+
+    const uint64_t* chunk_words(uint32_t chunk_idx) const { return &words_[chunk_idx * SELECTION_WORDS_PER_CHUNK]; }
+    bool chunk_empty(uint32_t chunk_idx) const;
+    bool chunk_full(uint32_t chunk_idx) const;
+
+    /*
+        Bulk operations. copy_tiles writes the selected cells of source to
+        the same cells of dest, offset by (dx, dy), clipped to dest.
+        move_tiles does the same within one layer, leaving the cells it
+        moved from empty, and returns where the selection ended up.
+    */
+    static void copy_tiles(const Selection& selection, const Layer& source, Layer& dest, int32_t dx=0, int32_t dy=0);
+    static ptr move_tiles(const Selection& selection, Layer& layer, int32_t dx, int32_t dy);
+
+private:
+    uint32_t width_;
+    uint32_t height_;
+    uint32_t origin_x_;
+    uint32_t origin_y_;
+    uint32_t chunks_across_;
+    uint32_t chunks_down_;
+
+    std::vector<uint64_t> words_;
+
+    //The in-layer cells of each chunk, selections never have bits outside them
+    std::vector<uint64_t> bounds_mask_;
+
+    uint64_t* writable_chunk_words(uint32_t chunk_idx) { return &words_[chunk_idx * SELECTION_WORDS_PER_CHUNK]; }
+    void set_span(uint32_t y, uint32_t first_x, uint32_t end_x, bool selected);
+    bool same_shape(const Selection& other) const;
+};
+
+}
+
+#endif // SELECTION_H
@@ -0,0 +1,101 @@
+#include <cstring>
+#include <algorithm>
+
+#include "selection_overlay.h"
+#include "memory_accounting.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+//Straight RGBA, little endian, a light blue wash
+const uint32_t SELECTED_TEXEL = 0x60FF8040;
+
+//In front of every layer but behind the active tile's border
+const float SELECTION_OVERLAY_Z = -0.5f;
+
+}
+
+SelectionOverlay::SelectionOverlay(kglt::Scene& scene):
+    scene_(scene),
+    mesh_id_(0),
+    texture_id_(0),
+    texture_width_(0),
+    texture_height_(0) {
+
+}
+
+SelectionOverlay::~SelectionOverlay() {
+    if(mesh_id_) {
+        scene_.delete_mesh(mesh_id_);
+    }
+    delete_texture();
+}
+
+void SelectionOverlay::delete_texture() {
+    if(!texture_id_) {
+        return;
+    }
+
+    scene_.delete_texture(texture_id_);
+    memory::released(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(texture_width_, texture_height_, 32));
+    texture_id_ = 0;
+}
+
+void SelectionOverlay::show(const Selection& selection) {
+    PN_PROFILE_SCOPE("SelectionOverlay::show");
+
+    //Cells per texel, so huge layers stay within what GL will take
+    uint32_t step = std::max(
+        (selection.width() + MAX_SELECTION_TEXTURE_SIZE - 1) / MAX_SELECTION_TEXTURE_SIZE,
+        (selection.height() + MAX_SELECTION_TEXTURE_SIZE - 1) / MAX_SELECTION_TEXTURE_SIZE
+    );
+    uint32_t width = (selection.width() + step - 1) / step;
+    uint32_t height = (selection.height() + step - 1) / step;
+
+    //The quad is built to the layer's size, so it's only rebuilt when that changes
+    if(width != texture_width_ || height != texture_height_) {
+        if(mesh_id_) {
+            scene_.delete_mesh(mesh_id_);
+        }
+        delete_texture();
+
+        texture_id_ = scene_.new_texture();
+        texture_width_ = width;
+        texture_height_ = height;
+        scene_.texture(texture_id_).set_bpp(32);
+        memory::allocated(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(width, height, 32));
+
+        float layer_width = float(selection.width());
+        float layer_height = float(selection.height());
+
+        mesh_id_ = scene_.new_mesh();
+        kglt::Mesh& mesh = scene_.mesh(mesh_id_);
+        kglt::procedural::mesh::rectangle(mesh, layer_width, layer_height, layer_width / 2.0f, layer_height / 2.0f);
+        mesh.apply_texture(texture_id_);
+
+        //Lines up with the layers, which keep cell (x, y) at (x - width / 2, y - height / 2)
+        mesh.move_to(-layer_width / 2.0f, -layer_height / 2.0f, SELECTION_OVERLAY_Z);
+    }
+
+    //Rows go bottom first, the same way up as the layer. Resizing gives fresh data to fill, uploads may let it go
+    kglt::Texture& texture = scene_.texture(texture_id_);
+    texture.resize(width, height);
+    kglt::Texture::Data& data = texture.data();
+    memset(&data[0], 0, size_t(width) * height * 4);
+    selection.for_each([&](uint32_t x, uint32_t y) {
+        memcpy(&data[((size_t(y / step) * width) + (x / step)) * 4], &SELECTED_TEXEL, 4);
+    });
+    texture.upload();
+
+    scene_.mesh(mesh_id_).set_visible(true);
+}
+
+void SelectionOverlay::hide() {
+    if(mesh_id_) {
+        scene_.mesh(mesh_id_).set_visible(false);
+    }
+}
+
+}
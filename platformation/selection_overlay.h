@@ -0,0 +1,41 @@
+#ifndef SELECTION_OVERLAY_H
+#define SELECTION_OVERLAY_H
+
+#include <tr1/memory>
+
+#include "kglt/kglt.h"
+#include "selection.h"
+
+namespace pn {
+
+//Selections wider or taller than this share texels between neighbouring cells
+const uint32_t MAX_SELECTION_TEXTURE_SIZE = 4096;
+
+/*
+    Highlights a selection with one quad over the whole layer, textured
+    with a texel per cell, so however many cells are selected it's a
+    single draw and a single upload when the selection changes.
+*/
+class SelectionOverlay {
+public:
+    typedef std::tr1::shared_ptr<SelectionOverlay> ptr;
+
+    SelectionOverlay(kglt::Scene& scene);
+    ~SelectionOverlay();
+
+    void show(const Selection& selection);
+    void hide();
+
+private:
+    kglt::Scene& scene_;
+    kglt::MeshID mesh_id_;
+    kglt::TextureID texture_id_;
+    uint32_t texture_width_;
+    uint32_t texture_height_;
+
+    void delete_texture();
+};
+
+}
+
+#endif // SELECTION_OVERLAY_H
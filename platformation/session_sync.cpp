@@ -0,0 +1,705 @@
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <boost/lexical_cast.hpp>
+
+#include "kazbase/logging/logging.h"
+
+#include "session_sync.h"
+#include "binary_io.h"
+#include "level.h"
+#include "layer.h"
+#include "profiler.h"
+
+namespace pn {
+
+namespace {
+
+enum SessionMessage {
+    SESSION_HELLO = 1,
+    SESSION_WELCOME,
+    SESSION_REJECT,
+    SESSION_SNAPSHOT,
+    SESSION_BATCH
+};
+
+enum ChunkRecord {
+    RECORD_UNIFORM = 0, //Every cell of the block in the layer has one tile
+    RECORD_MASKED //A mask of the cells that changed, then their tiles
+};
+
+const size_t GLOBAL_SEQUENCE_OFFSET = 12; //Sender id and sequence come first
+const uint32_t MAX_MESSAGE_BYTES = 256 * 1024 * 1024;
+const size_t READ_BYTES = 64 * 1024;
+const uint32_t NO_TILE = 0; //Tiles on the wire are 1 + their index in the batch's path table
+const uint32_t MASK_WORDS = CHUNK_AREA / 64;
+
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool set_non_blocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(address.sun_path)) {
+        throw SessionError("Session socket path is too long: " + path);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+}
+
+SessionSync::ptr SessionSync::open(Level& level, const std::string& socket_path) {
+    ptr session(new SessionSync(level, socket_path));
+    if(!session->join()) {
+        session->host();
+    }
+    return session;
+}
+
+SessionSync::SessionSync(Level& level, const std::string& socket_path):
+    level_(level),
+    socket_path_(socket_path),
+    hosting_(false),
+    listen_fd_(-1),
+    peer_id_(0),
+    next_peer_id_(1),
+    next_sequence_(1),
+    last_global_sequence_(0),
+    foreign_applied_(0) {
+
+    take_shadow();
+}
+
+SessionSync::~SessionSync() {
+    for(Connection& connection: connections_) {
+        if(connection.fd >= 0) {
+            ::close(connection.fd);
+        }
+    }
+
+    if(listen_fd_ >= 0) {
+        ::close(listen_fd_);
+        unlink(socket_path_.c_str());
+    }
+}
+
+bool SessionSync::join() {
+    sockaddr_un address = socket_address(socket_path_);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        throw SessionError(std::string("Unable to create a socket: ") + strerror(errno));
+    }
+
+    if(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        int error = errno;
+        ::close(fd);
+
+        //Left behind by a host that crashed, whoever hosts next takes the path over
+        if(error == ECONNREFUSED) {
+            unlink(socket_path_.c_str());
+        }
+
+        if(error == ECONNREFUSED || error == ENOENT) {
+            return false;
+        }
+        throw SessionError("Unable to join the session at " + socket_path_ + ": " + strerror(error));
+    }
+
+    if(!set_non_blocking(fd)) {
+        ::close(fd);
+        throw SessionError("Unable to make the session socket non-blocking");
+    }
+
+    Connection connection;
+    connection.fd = fd;
+    connections_.push_back(connection);
+
+    std::vector<uint8_t> hello;
+    BinaryWriter writer(hello);
+    writer.u32(SESSION_PROTOCOL_VERSION);
+    writer.u32(level_.layer_count());
+    writer.u32(level_.horizontal_tile_count());
+    writer.u32(level_.vertical_tile_count());
+    send(connections_.back(), SESSION_HELLO, hello);
+
+    L_INFO("Joining the editing session at " + socket_path_);
+    return true;
+}
+
+void SessionSync::host() {
+    sockaddr_un address = socket_address(socket_path_);
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd_ < 0) {
+        throw SessionError(std::string("Unable to create a socket: ") + strerror(errno));
+    }
+
+    if(bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+       listen(listen_fd_, 8) != 0 || !set_non_blocking(listen_fd_)) {
+        int error = errno;
+        ::close(listen_fd_);
+        listen_fd_ = -1;
+        throw SessionError("Unable to host a session at " + socket_path_ + ": " + strerror(error));
+    }
+
+    hosting_ = true;
+    L_INFO("Hosting an editing session at " + socket_path_);
+}
+
+bool SessionSync::connected() const {
+    return !hosting_ && !connections_.empty() && connections_[0].fd >= 0 && connections_[0].welcomed;
+}
+
+uint32_t SessionSync::peer_count() const {
+    uint32_t count = 0;
+    for(const Connection& connection: connections_) {
+        count += (connection.fd >= 0 && connection.welcomed);
+    }
+    return count;
+}
+
+bool SessionSync::idle() const {
+    for(const Connection& connection: connections_) {
+        if(connection.fd >= 0 && connection.out_offset < connection.out.size()) {
+            return false;
+        }
+    }
+    return unconfirmed_.empty();
+}
+
+uint32_t SessionSync::update() {
+    PN_PROFILE_SCOPE("SessionSync::update");
+
+    uint64_t start = now_ns();
+    uint64_t chunks_before = stats_.chunks_applied;
+    layer_touched_.assign(level_.layer_count(), false);
+
+    if(hosting_) {
+        accept_joiners();
+    }
+
+    for(Connection& connection: connections_) {
+        read(connection);
+    }
+
+    //Our own edits go first, so the host's order is the order it made and applied things in
+    if(hosting_ || connected()) {
+        std::vector<uint8_t> payload;
+        if(encode_changes(payload, false)) {
+            BinaryWriter writer(payload);
+            if(hosting_) {
+                writer.patch_u64(GLOBAL_SEQUENCE_OFFSET, ++last_global_sequence_);
+                for(Connection& connection: connections_) {
+                    if(connection.welcomed) {
+                        send(connection, SESSION_BATCH, payload);
+                    }
+                }
+            } else {
+                Sent sent;
+                sent.sequence = next_sequence_++;
+                sent.foreign_applied = foreign_applied_;
+                unconfirmed_.push_back(sent);
+
+                writer.patch_u64(4, sent.sequence);
+                send(connections_[0], SESSION_BATCH, payload);
+            }
+            stats_.batches_sent++;
+        }
+    } else {
+        //Nothing made before joining is kept, the host's tiles replace it
+        take_shadow();
+    }
+
+    for(Connection& connection: connections_) {
+        size_t offset = 0;
+        while(connection.fd >= 0 && connection.in.size() - offset >= 4) {
+            BinaryReader reader(&connection.in[offset], 4);
+            uint32_t length = reader.u32();
+            if(!length || length > MAX_MESSAGE_BYTES) {
+                close(connection, "Bad message from session peer");
+                break;
+            }
+
+            if(connection.in.size() - offset - 4 < length) {
+                break;
+            }
+
+            try {
+                handle_message(connection, connection.in[offset + 4], &connection.in[offset + 5], length - 1);
+            } catch(std::out_of_range& e) {
+                close(connection, "Truncated message from session peer");
+            }
+            offset += 4 + length;
+        }
+        connection.in.erase(connection.in.begin(), connection.in.begin() + std::min(offset, connection.in.size()));
+
+        if(connection.hung_up) {
+            close(connection, hosting_ ? "Hung up" : "The session host went away");
+        }
+    }
+
+    for(Connection& connection: connections_) {
+        write(connection);
+    }
+
+    connections_.erase(std::remove_if(connections_.begin(), connections_.end(),
+        [](const Connection& connection) { return connection.fd < 0; }), connections_.end()
+    );
+
+    //Peers' edits are in, remember them so they aren't sent back out as ours
+    for(uint32_t i = 0; i < layer_touched_.size(); ++i) {
+        if(layer_touched_[i]) {
+            level_.layer_at(i).flush_render();
+            take_shadow(i);
+        }
+    }
+
+    stats_.last_update_ms = double(now_ns() - start) / 1e6;
+    stats_.max_update_ms = std::max(stats_.max_update_ms, stats_.last_update_ms);
+    return stats_.chunks_applied - chunks_before;
+}
+
+void SessionSync::accept_joiners() {
+    while(true) {
+        int fd = accept(listen_fd_, nullptr, nullptr);
+        if(fd < 0) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                L_WARN(std::string("Session accept failed: ") + strerror(errno));
+            }
+            return;
+        }
+
+        if(!set_non_blocking(fd)) {
+            ::close(fd);
+            continue;
+        }
+
+        Connection connection;
+        connection.fd = fd;
+        connections_.push_back(connection);
+    }
+}
+
+void SessionSync::read(Connection& connection) {
+    while(connection.fd >= 0) {
+        size_t had = connection.in.size();
+        connection.in.resize(had + READ_BYTES);
+
+        ssize_t received = recv(connection.fd, &connection.in[had], READ_BYTES, 0);
+        connection.in.resize(had + std::max<ssize_t>(received, 0));
+
+        if(received > 0) {
+            stats_.bytes_received += received;
+        } else if(received == 0) {
+            connection.hung_up = true;
+            return;
+        } else if(errno != EINTR) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                close(connection, std::string("Session connection failed: ") + strerror(errno));
+            }
+            return;
+        }
+    }
+}
+
+void SessionSync::write(Connection& connection) {
+    while(connection.fd >= 0 && connection.out_offset < connection.out.size()) {
+        ssize_t sent = ::send(
+            connection.fd, &connection.out[connection.out_offset], connection.out.size() - connection.out_offset, MSG_NOSIGNAL
+        );
+
+        if(sent > 0) {
+            connection.out_offset += sent;
+            stats_.bytes_sent += sent;
+        } else if(errno != EINTR) {
+            if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                close(connection, std::string("Session connection failed: ") + strerror(errno));
+            }
+            return;
+        }
+    }
+
+    connection.out.clear();
+    connection.out_offset = 0;
+}
+
+void SessionSync::close(Connection& connection, const std::string& reason) {
+    if(connection.fd < 0) {
+        return;
+    }
+
+    ::close(connection.fd);
+    connection.fd = -1;
+
+    if(hosting_) {
+        L_INFO("Session peer " + boost::lexical_cast<std::string>(connection.peer_id) + " disconnected: " + reason);
+    } else {
+        L_WARN("Left the editing session: " + reason);
+        error_ = reason;
+        unconfirmed_.clear();
+    }
+}
+
+void SessionSync::send(Connection& connection, uint8_t type, const std::vector<uint8_t>& payload) {
+    if(connection.fd < 0) {
+        return;
+    }
+
+    BinaryWriter writer(connection.out);
+    writer.u32(payload.size() + 1);
+    writer.u8(type);
+    writer.bytes(payload.data(), payload.size());
+}
+
+void SessionSync::take_shadow() {
+    shadow_.resize(level_.layer_count());
+    shadow_width_.resize(level_.layer_count());
+    shadow_height_.resize(level_.layer_count());
+
+    for(uint32_t i = 0; i < level_.layer_count(); ++i) {
+        take_shadow(i);
+    }
+}
+
+void SessionSync::take_shadow(uint32_t layer_idx) {
+    Layer& layer = level_.layer_at(layer_idx);
+    std::vector<ChunkCells::ptr>& shadow = shadow_[layer_idx];
+
+    shadow.resize(layer.chunks_across() * layer.chunks_down());
+    for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+            shadow[(cy * layer.chunks_across()) + cx] = layer.chunk(cx, cy).cells;
+        }
+    }
+    shadow_width_[layer_idx] = layer.width();
+    shadow_height_[layer_idx] = layer.height();
+}
+
+bool SessionSync::encode_changes(std::vector<uint8_t>& payload, bool everything) {
+    PN_PROFILE_SCOPE("SessionSync::encode_changes");
+
+    if(shadow_.size() != level_.layer_count()) {
+        L_WARN("Layers were added or removed, they aren't shared with the session");
+        take_shadow();
+        return false;
+    }
+
+    std::vector<uint8_t> records;
+    BinaryWriter record_writer(records);
+    uint32_t record_count = 0;
+
+    std::vector<std::string> paths;
+    std::map<int32_t, uint32_t> wire_tiles;
+    auto wire_tile = [&](int32_t tile_image_id) -> uint32_t {
+        if(tile_image_id < 0) {
+            return NO_TILE;
+        }
+
+        std::map<int32_t, uint32_t>::iterator it = wire_tiles.find(tile_image_id);
+        if(it != wire_tiles.end()) {
+            return it->second;
+        }
+
+        //Levels don't get anywhere near this many different tiles
+        if(paths.size() >= 0xFFFE) {
+            L_ERROR("Too many different tiles in one session batch, sending empty cells");
+            return NO_TILE;
+        }
+
+        paths.push_back(level_.palette().path_for_id(tile_image_id));
+        wire_tiles[tile_image_id] = paths.size();
+        return paths.size();
+    };
+
+    for(uint32_t l = 0; l < level_.layer_count(); ++l) {
+        Layer& layer = level_.layer_at(l);
+        std::vector<ChunkCells::ptr>& shadow = shadow_[l];
+
+        if(shadow_width_[l] != layer.width() || shadow_height_[l] != layer.height() ||
+           shadow.size() != layer.chunks_across() * layer.chunks_down()) {
+            L_WARN("Layer " + layer.name() + " was resized, its size isn't shared with the session");
+            take_shadow(l);
+            continue;
+        }
+
+        for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+            for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+                ChunkCells::ptr& old_cells = shadow[(cy * layer.chunks_across()) + cx];
+                const ChunkCells::ptr& cells = layer.chunk(cx, cy).cells;
+                if(!everything && cells == old_cells) {
+                    continue;
+                }
+
+                //Cells outside the layer are always empty and never sent
+                int32_t x = int32_t(cx * CHUNK_SIZE) - int32_t(layer.origin_x());
+                int32_t y = int32_t(cy * CHUNK_SIZE) - int32_t(layer.origin_y());
+                uint32_t first_x = std::max(0, -x), end_x = std::min<int32_t>(CHUNK_SIZE, int32_t(layer.width()) - x);
+                uint32_t first_y = std::max(0, -y), end_y = std::min<int32_t>(CHUNK_SIZE, int32_t(layer.height()) - y);
+
+                uint64_t mask[MASK_WORDS] = {0};
+                bool uniform = true;
+                bool changed = false;
+                int32_t first_tile = cells->tiles[(first_y * CHUNK_SIZE) + first_x];
+
+                for(uint32_t ly = first_y; ly < end_y; ++ly) {
+                    for(uint32_t lx = first_x; lx < end_x; ++lx) {
+                        uint32_t i = (ly * CHUNK_SIZE) + lx;
+                        uniform = uniform && cells->tiles[i] == first_tile;
+                        if(everything || cells->tiles[i] != old_cells->tiles[i]) {
+                            mask[i / 64] |= uint64_t(1) << (i % 64);
+                            changed = true;
+                        }
+                    }
+                }
+                old_cells = cells;
+
+                if(!changed) {
+                    continue;
+                }
+
+                record_writer.u16(l);
+                record_writer.i32(x);
+                record_writer.i32(y);
+                if(uniform) {
+                    record_writer.u8(RECORD_UNIFORM);
+                    record_writer.u16(wire_tile(first_tile));
+                } else {
+                    record_writer.u8(RECORD_MASKED);
+                    for(uint32_t w = 0; w < MASK_WORDS; ++w) {
+                        record_writer.u64(mask[w]);
+                    }
+                    for(uint32_t w = 0; w < MASK_WORDS; ++w) {
+                        uint64_t bits = mask[w];
+                        while(bits) {
+                            uint32_t i = (w * 64) + __builtin_ctzll(bits);
+                            bits &= bits - 1;
+                            record_writer.u16(wire_tile(cells->tiles[i]));
+                        }
+                    }
+                }
+                record_count++;
+            }
+        }
+    }
+
+    if(!record_count && !everything) {
+        return false;
+    }
+
+    BinaryWriter writer(payload);
+    writer.u32(peer_id_);
+    writer.u64(0); //Sender's sequence, filled in by the caller
+    writer.u64(0); //The session's sequence, filled in by the host
+    writer.u64(now_ns());
+    writer.u32(paths.size());
+    for(const std::string& path: paths) {
+        writer.string(path);
+    }
+    writer.u32(record_count);
+    writer.bytes(records.data(), records.size());
+
+    stats_.chunks_sent += record_count;
+    return true;
+}
+
+void SessionSync::apply_batch(const uint8_t* data, size_t length, bool snapshot) {
+    PN_PROFILE_SCOPE("SessionSync::apply_batch");
+
+    BinaryReader reader(data, length);
+    uint32_t sender = reader.u32();
+    uint64_t sequence = reader.u64();
+    uint64_t global_sequence = reader.u64();
+    uint64_t sent_ns = reader.u64();
+
+    if(!hosting_ && !snapshot) {
+        if(global_sequence != last_global_sequence_ + 1) {
+            L_WARN(
+                "Session batches out of step, expected " + boost::lexical_cast<std::string>(last_global_sequence_ + 1) +
+                " and got " + boost::lexical_cast<std::string>(global_sequence)
+            );
+        }
+        last_global_sequence_ = global_sequence;
+
+        if(sender == peer_id_) {
+            //Our own batch, already applied unless someone else's got in first on the host
+            if(unconfirmed_.empty() || unconfirmed_.front().sequence != sequence) {
+                L_WARN("Session returned a batch that wasn't expected");
+                return;
+            }
+
+            bool overtaken = unconfirmed_.front().foreign_applied != foreign_applied_;
+            unconfirmed_.pop_front();
+            if(!overtaken) {
+                return;
+            }
+        } else {
+            foreign_applied_++;
+        }
+    }
+
+    std::vector<int32_t> tiles(1, -1);
+    uint32_t path_count = reader.u32();
+    for(uint32_t i = 0; i < path_count; ++i) {
+        tiles.push_back(level_.palette().id_for_path(reader.string()));
+    }
+
+    auto local_tile = [&](uint16_t wire_tile) -> int32_t {
+        return (wire_tile < tiles.size()) ? tiles[wire_tile] : -1;
+    };
+
+    uint32_t record_count = reader.u32();
+    for(uint32_t r = 0; r < record_count; ++r) {
+        uint32_t l = reader.u16();
+        int32_t x = reader.i32();
+        int32_t y = reader.i32();
+        uint8_t kind = reader.u8();
+
+        uint64_t mask[MASK_WORDS] = {0};
+        int32_t uniform_tile = -1;
+        if(kind == RECORD_UNIFORM) {
+            uniform_tile = local_tile(reader.u16());
+        } else {
+            for(uint32_t w = 0; w < MASK_WORDS; ++w) {
+                mask[w] = reader.u64();
+            }
+        }
+
+        Layer* layer = (l < level_.layer_count()) ? &level_.layer_at(l) : nullptr;
+        if(layer) {
+            layer_touched_[l] = true;
+        }
+
+        if(kind == RECORD_UNIFORM) {
+            if(!layer) {
+                continue;
+            }
+
+            int32_t first_x = std::max(x, 0), end_x = std::min(x + int32_t(CHUNK_SIZE), int32_t(layer->width()));
+            int32_t first_y = std::max(y, 0), end_y = std::min(y + int32_t(CHUNK_SIZE), int32_t(layer->height()));
+            if(first_x < end_x && first_y < end_y) {
+                //Lands on whole chunks when both sides' chunk grids line up, which they do unless a layer was extended
+                layer->fill(CellRect(first_x, first_y, end_x - first_x, end_y - first_y), uniform_tile);
+            }
+        } else {
+            //The tiles have to be read whether or not the layer is there
+            for(uint32_t w = 0; w < MASK_WORDS; ++w) {
+                uint64_t bits = mask[w];
+                while(bits) {
+                    uint32_t i = (w * 64) + __builtin_ctzll(bits);
+                    bits &= bits - 1;
+
+                    int32_t tile = local_tile(reader.u16());
+                    int64_t cell_x = int64_t(x) + (i % CHUNK_SIZE);
+                    int64_t cell_y = int64_t(y) + (i / CHUNK_SIZE);
+                    if(layer && cell_x >= 0 && cell_y >= 0 && cell_x < layer->width() && cell_y < layer->height()) {
+                        layer->set_tile(cell_x, cell_y, tile);
+                    }
+                }
+            }
+        }
+        stats_.chunks_applied++;
+    }
+
+    stats_.batches_applied++;
+    stats_.last_latency_ms = double(now_ns() - sent_ns) / 1e6;
+    if(!snapshot) {
+        stats_.max_latency_ms = std::max(stats_.max_latency_ms, stats_.last_latency_ms);
+    }
+}
+
+void SessionSync::handle_message(Connection& connection, uint8_t type, const uint8_t* data, size_t length) {
+    BinaryReader reader(data, length);
+
+    if(hosting_) {
+        if(type == SESSION_HELLO && !connection.welcomed) {
+            uint32_t version = reader.u32();
+            uint32_t layer_count = reader.u32();
+            uint32_t width = reader.u32();
+            uint32_t height = reader.u32();
+
+            std::string problem;
+            if(version != SESSION_PROTOCOL_VERSION) {
+                problem = "The host is running a different version";
+            } else if(layer_count != level_.layer_count() || width != level_.horizontal_tile_count() || height != level_.vertical_tile_count()) {
+                problem = "The host's level has different layers or a different size";
+            }
+
+            if(!problem.empty()) {
+                std::vector<uint8_t> reject;
+                BinaryWriter(reject).string(problem);
+                send(connection, SESSION_REJECT, reject);
+                write(connection);
+                close(connection, problem);
+                return;
+            }
+
+            connection.peer_id = next_peer_id_++;
+            connection.welcomed = true;
+
+            std::vector<uint8_t> welcome;
+            BinaryWriter writer(welcome);
+            writer.u32(connection.peer_id);
+            writer.u64(last_global_sequence_);
+            send(connection, SESSION_WELCOME, welcome);
+
+            //Everything the joiner needs to catch up, before any batch that comes after it
+            std::vector<uint8_t> snapshot;
+            encode_changes(snapshot, true);
+            send(connection, SESSION_SNAPSHOT, snapshot);
+
+            L_INFO("Session peer " + boost::lexical_cast<std::string>(connection.peer_id) + " joined");
+        } else if(type == SESSION_BATCH && connection.welcomed) {
+            apply_batch(data, length, false);
+
+            //Everyone gets it in the same order, the sender too
+            std::vector<uint8_t> batch(data, data + length);
+            BinaryWriter(batch).patch_u64(GLOBAL_SEQUENCE_OFFSET, ++last_global_sequence_);
+            for(Connection& peer: connections_) {
+                if(peer.welcomed) {
+                    send(peer, SESSION_BATCH, batch);
+                }
+            }
+        } else {
+            close(connection, "Unexpected message from session peer");
+        }
+        return;
+    }
+
+    switch(type) {
+        case SESSION_WELCOME:
+            peer_id_ = reader.u32();
+            last_global_sequence_ = reader.u64();
+            connection.welcomed = true;
+            L_INFO("Joined the editing session as peer " + boost::lexical_cast<std::string>(peer_id_));
+        break;
+        case SESSION_REJECT:
+            close(connection, reader.string());
+        break;
+        case SESSION_SNAPSHOT:
+            apply_batch(data, length, true);
+            layer_touched_.assign(level_.layer_count(), true);
+        break;
+        case SESSION_BATCH:
+            apply_batch(data, length, false);
+        break;
+        default:
+            close(connection, "Unexpected message from the session host");
+    }
+}
+
+}
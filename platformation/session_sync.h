@@ -0,0 +1,173 @@
+#ifndef SESSION_SYNC_H
+#define SESSION_SYNC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+#include <tr1/memory>
+
+#include "chunk.h"
+
+namespace pn {
+
+class Level;
+class Layer;
+
+const uint32_t SESSION_PROTOCOL_VERSION = 1;
+
+class SessionError : public std::runtime_error {
+public:
+    SessionError(const std::string& what):
+        std::runtime_error(what) {}
+};
+
+struct SessionStats {
+    SessionStats():
+        batches_sent(0),
+        batches_applied(0),
+        chunks_sent(0),
+        chunks_applied(0),
+        bytes_sent(0),
+        bytes_received(0),
+        last_latency_ms(0),
+        max_latency_ms(0),
+        last_update_ms(0),
+        max_update_ms(0) {}
+
+    uint64_t batches_sent;
+    uint64_t batches_applied;
+    uint64_t chunks_sent;
+    uint64_t chunks_applied;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+
+    double last_latency_ms; //From a peer's edit to it being applied here, both on the same machine's clock
+    double max_latency_ms;
+    double last_update_ms; //Time spent in update()
+    double max_update_ms;
+};
+
+/*
+    Live editing of one level by several editor instances on the same
+    machine, over a Unix domain socket. The first instance to open a
+    socket path hosts the session and the others join it; joining copies
+    the host's tiles over the local level, which must have the same
+    layers and size.
+
+    Edits aren't hooked as they happen. Each instance keeps its own
+    reference to every chunk's cells, and as cells are copied on write
+    any chunk whose cells pointer has changed since the last update has
+    been edited. Once a frame the changed chunks are diffed against the
+    old cells and sent as one batch, a record per chunk: either a single
+    tile for the whole chunk (fills) or a mask of the changed cells and
+    their new tiles. Tiles travel as paths, each instance has its own
+    palette.
+
+    The host puts every batch in order, stamping it with the next
+    sequence number and passing it to everyone, the sender included.
+    Everyone applies batches in that order, so concurrent edits to the
+    same cell end up the same everywhere. A sender skips its own batch
+    coming back unless someone else's arrived in the meantime, in which
+    case it's applied again to land on top like it did on the host.
+
+    Only tiles are shared. Adding or removing layers and resizing aren't,
+    and cells that don't exist on the receiving side are skipped.
+*/
+class SessionSync {
+public:
+    typedef std::tr1::shared_ptr<SessionSync> ptr;
+
+    //Hosts the session if nobody is listening at the path, joins it otherwise. Throws SessionError
+    static ptr open(Level& level, const std::string& socket_path);
+
+    ~SessionSync();
+
+    bool hosting() const { return hosting_; }
+
+    //Joiners are connected once the host has accepted them and sent its tiles
+    bool connected() const;
+    uint32_t peer_count() const;
+
+    /*
+        Once a frame on the main loop: sends the edits made since the last
+        update as one batch, applies whatever peers have sent and flushes
+        rendering for the layers that changed. Never blocks. Returns the
+        number of chunks changed by peers.
+    */
+    uint32_t update();
+
+    //Nothing waiting to be sent or to come back from the host
+    bool idle() const;
+
+    //Why a joiner stopped being connected, empty if it hasn't
+    const std::string& error() const { return error_; }
+
+    const SessionStats& stats() const { return stats_; }
+
+private:
+    struct Connection {
+        Connection():
+            fd(-1),
+            peer_id(0),
+            welcomed(false),
+            hung_up(false),
+            out_offset(0) {}
+
+        int fd;
+        uint32_t peer_id;
+        bool welcomed;
+        bool hung_up; //Closed once what it sent before hanging up has been handled
+        std::vector<uint8_t> in;
+        std::vector<uint8_t> out;
+        size_t out_offset;
+    };
+
+    struct Sent {
+        uint64_t sequence;
+        uint64_t foreign_applied; //foreign_applied_ when it was sent
+    };
+
+    SessionSync(Level& level, const std::string& socket_path);
+
+    Level& level_;
+    std::string socket_path_;
+    bool hosting_;
+    int listen_fd_;
+    std::vector<Connection> connections_; //The joiners when hosting, just the host otherwise
+
+    uint32_t peer_id_; //0 is the host
+    uint32_t next_peer_id_;
+    uint64_t next_sequence_; //Ours when joining, the session's when hosting
+    uint64_t last_global_sequence_;
+    std::deque<Sent> unconfirmed_;
+    uint64_t foreign_applied_;
+
+    //The cells each chunk had when last sent or received, by layer then chunk index
+    std::vector<std::vector<ChunkCells::ptr> > shadow_;
+    std::vector<uint32_t> shadow_width_;
+    std::vector<uint32_t> shadow_height_;
+    std::vector<bool> layer_touched_;
+
+    std::string error_;
+    SessionStats stats_;
+
+    void host();
+    bool join();
+    void accept_joiners();
+    void read(Connection& connection);
+    void write(Connection& connection);
+    void close(Connection& connection, const std::string& reason);
+    void send(Connection& connection, uint8_t type, const std::vector<uint8_t>& payload);
+
+    void take_shadow();
+    void take_shadow(uint32_t layer_idx);
+    bool encode_changes(std::vector<uint8_t>& payload, bool everything);
+    void apply_batch(const uint8_t* data, size_t length, bool snapshot);
+    void handle_message(Connection& connection, uint8_t type, const uint8_t* data, size_t length);
+};
+
+}
+
+#endif // SESSION_SYNC_H
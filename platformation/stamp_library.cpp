@@ -0,0 +1,64 @@
+#include <cstdio>
+#include <algorithm>
+
+#include "kazbase/os/core.h"
+#include "kazbase/os/path.h"
+#include "kazbase/string.h"
+
+#include "stamp_library.h"
+#include "level_file.h"
+
+namespace pn {
+
+const std::string STAMP_EXTENSION = ".pnl";
+
+StampLibrary::StampLibrary(const std::string& directory):
+    directory_(directory) {
+
+}
+
+std::string StampLibrary::path_for(const std::string& name) const {
+    if(name.empty() || name.find('/') != std::string::npos) {
+        throw LevelFileError("Invalid stamp name: " + name);
+    }
+    return os::path::join(directory_, name + STAMP_EXTENSION);
+}
+
+std::vector<std::string> StampLibrary::names() const {
+    std::vector<std::string> result;
+    if(!os::path::exists(directory_)) {
+        return result;
+    }
+
+    for(std::string file: os::path::list_dir(directory_)) {
+        if(str::ends_with(file, STAMP_EXTENSION)) {
+            result.push_back(file.substr(0, file.length() - STAMP_EXTENSION.length()));
+        }
+    }
+
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+void StampLibrary::save(const std::string& name, const Region& region) {
+    std::string path = path_for(name);
+
+    if(!os::path::exists(directory_)) {
+        os::make_dirs(directory_);
+    }
+
+    Level::ptr level = region.to_level();
+    level->set_name(name);
+    save_level(*level, path);
+}
+
+Region::ptr StampLibrary::load(const std::string& name) const {
+    Level::ptr level = load_level(path_for(name));
+    return Region::from_level(*level);
+}
+
+bool StampLibrary::remove(const std::string& name) {
+    return std::remove(path_for(name).c_str()) == 0;
+}
+
+}
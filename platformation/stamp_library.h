@@ -0,0 +1,36 @@
+#ifndef STAMP_LIBRARY_H
+#define STAMP_LIBRARY_H
+
+#include <string>
+#include <vector>
+
+#include "region.h"
+
+namespace pn {
+
+/*
+    Saved regions that can be pasted into any level. Each stamp is a small
+    level file named after the stamp, so stamps can also be opened and
+    edited like any other level.
+*/
+class StampLibrary {
+public:
+    StampLibrary(const std::string& directory);
+
+    std::vector<std::string> names() const;
+
+    //Names can't contain path separators. Both throw LevelFileError on failure
+    void save(const std::string& name, const Region& region);
+    Region::ptr load(const std::string& name) const;
+
+    bool remove(const std::string& name);
+
+private:
+    std::string directory_;
+
+    std::string path_for(const std::string& name) const;
+};
+
+}
+
+#endif // STAMP_LIBRARY_H
@@ -0,0 +1,155 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+namespace pn {
+
+namespace {
+
+//Which pool and queue the current thread works for, so submits from inside a task stay local
+thread_local ThreadPool* current_pool = nullptr;
+thread_local int32_t current_worker = -1;
+
+}
+
+void TaskGroup::task_finished() {
+    //Decremented under the lock, so a waiter can't see zero and free the group while it's still held here
+    std::lock_guard<std::mutex> lock(lock_);
+    if(--pending_ == 0) {
+        done_.notify_all();
+    }
+}
+
+void TaskGroup::wait(ThreadPool& pool) {
+    while(true) {
+        if(pending_.load() && pool.run_pending_task()) {
+            continue;
+        }
+
+        //Only finished once the last task has let go of the lock, the timeout covers tasks queued after this check
+        std::unique_lock<std::mutex> lock(lock_);
+        if(done_.wait_for(lock, std::chrono::milliseconds(1), [this]() { return pending_.load() == 0; })) {
+            return;
+        }
+    }
+}
+
+ThreadPool::ThreadPool(uint32_t threads):
+    next_queue_(0),
+    queued_(0),
+    stopping_(false) {
+
+    if(!threads) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    for(uint32_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::tr1::shared_ptr<Worker>(new Worker()));
+    }
+
+    //Started separately so no worker sees the vector while it's still growing
+    for(uint32_t i = 0; i < threads; ++i) {
+        workers_[i]->thread = std::thread(&ThreadPool::worker_main, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+
+    for(std::tr1::shared_ptr<Worker>& worker: workers_) {
+        worker->thread.join();
+    }
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::submit(TaskGroup& group, Task task) {
+    group.pending_++;
+
+    uint32_t index = (current_pool == this) ? current_worker : (next_queue_++ % workers_.size());
+
+    Worker& worker = *workers_[index];
+    {
+        std::lock_guard<std::mutex> lock(worker.lock);
+        QueuedTask queued = { task, &group };
+        worker.queue.push_back(queued);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_lock_);
+        queued_++;
+    }
+    wake_.notify_one();
+}
+
+bool ThreadPool::take_task(int32_t own_index, QueuedTask& out) {
+    if(own_index >= 0) {
+        Worker& own = *workers_[own_index];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if(!own.queue.empty()) {
+            out = own.queue.back();
+            own.queue.pop_back();
+            queued_--;
+            return true;
+        }
+    }
+
+    //Steal the oldest task, starting at the next queue along so thieves spread out
+    uint32_t count = workers_.size();
+    uint32_t start = (own_index >= 0) ? own_index + 1 : next_queue_.load();
+    for(uint32_t i = 0; i < count; ++i) {
+        Worker& victim = *workers_[(start + i) % count];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if(!victim.queue.empty()) {
+            out = victim.queue.front();
+            victim.queue.pop_front();
+            queued_--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::run(QueuedTask& queued) {
+    queued.task();
+    queued.group->task_finished();
+}
+
+bool ThreadPool::run_pending_task() {
+    QueuedTask queued;
+    if(!take_task((current_pool == this) ? current_worker : -1, queued)) {
+        return false;
+    }
+
+    run(queued);
+    return true;
+}
+
+void ThreadPool::worker_main(uint32_t index) {
+    current_pool = this;
+    current_worker = index;
+
+    while(true) {
+        QueuedTask queued;
+        if(take_task(index, queued)) {
+            run(queued);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        wake_.wait(lock, [this]() { return stopping_.load() || queued_.load() > 0; });
+        if(stopping_ && !queued_) {
+            return;
+        }
+    }
+}
+
+}
@@ -0,0 +1,91 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <tr1/memory>
+
+namespace pn {
+
+class ThreadPool;
+
+/*
+    Tracks a batch of tasks so the submitter can wait for all of them.
+    Waiting isn't idle, the waiting thread runs queued tasks until the
+    batch is done.
+*/
+class TaskGroup {
+public:
+    TaskGroup():
+        pending_(0) {}
+
+    void wait(ThreadPool& pool);
+
+private:
+    friend class ThreadPool;
+
+    std::atomic<uint32_t> pending_;
+    std::mutex lock_;
+    std::condition_variable done_;
+
+    void task_finished();
+};
+
+/*
+    Work stealing pool. Every worker has its own queue. Tasks submitted
+    from a worker go on that worker's queue and it takes the newest first,
+    which keeps related work on one core. Idle workers steal the oldest
+    task from someone else's queue.
+*/
+class ThreadPool {
+public:
+    typedef std::tr1::shared_ptr<ThreadPool> ptr;
+    typedef std::function<void ()> Task;
+
+    ThreadPool(uint32_t threads=0); //0 uses every core
+    ~ThreadPool();
+
+    uint32_t size() const { return workers_.size(); }
+
+    void submit(TaskGroup& group, Task task);
+
+    //Runs one queued task on the calling thread, returns false if there was nothing to do
+    bool run_pending_task();
+
+    //Shared by everything that doesn't need its own pool, created on first use
+    static ThreadPool& shared();
+
+private:
+    struct QueuedTask {
+        Task task;
+        TaskGroup* group;
+    };
+
+    struct Worker {
+        std::mutex lock;
+        std::deque<QueuedTask> queue;
+        std::thread thread;
+    };
+
+    std::vector<std::tr1::shared_ptr<Worker> > workers_;
+    std::atomic<uint32_t> next_queue_;
+    std::atomic<int32_t> queued_; //Can dip below zero briefly when a task is taken before its submit finishes
+    std::atomic<bool> stopping_;
+
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;
+
+    void worker_main(uint32_t index);
+    bool take_task(int32_t own_index, QueuedTask& out);
+    void run(QueuedTask& queued);
+};
+
+}
+
+#endif // THREAD_POOL_H
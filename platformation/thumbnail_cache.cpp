@@ -0,0 +1,75 @@
+#include <cstdio>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/os/core.h"
+#include "kazbase/os/path.h"
+#include "kazbase/string.h"
+
+#include "thumbnail_cache.h"
+#include "tileset_manager.h"
+#include "pixel_ops.h"
+
+namespace pn {
+
+ThumbnailCache::ThumbnailCache(const std::string& directory, uint32_t size):
+    directory_(directory),
+    size_(size) {
+
+}
+
+uint64_t ThumbnailCache::content_hash(const uint8_t* data, size_t length) {
+    return hash_bytes(data, length);
+}
+
+uint64_t ThumbnailCache::key_for(uint64_t level_hash, const std::vector<std::string>& palette, const std::string& base_directory) {
+    uint64_t key = level_hash;
+    for(std::string path: palette) {
+        if(!base_directory.empty() && !path.empty() && path[0] != '/') {
+            path = os::path::join(base_directory, path);
+        }
+
+        //Missing images hash as 0, so the thumbnail changes once they turn up
+        TileImage::ptr image = TilesetManager::instance().acquire(path);
+        uint64_t tile_hash = image->valid() ? image->content_hash() : 0;
+        key = hash_bytes(&tile_hash, sizeof(tile_hash), key);
+    }
+    return key;
+}
+
+std::string ThumbnailCache::path_for(uint64_t hash) const {
+    char name[64];
+    snprintf(name, sizeof(name), "%016llx-%u.png", (unsigned long long) hash, size_);
+    return os::path::join(directory_, name);
+}
+
+bool ThumbnailCache::load(uint64_t hash, Image& out) const {
+    std::string path = path_for(hash);
+    if(!os::path::exists(path)) {
+        return false;
+    }
+    return read_png(path, out);
+}
+
+bool ThumbnailCache::store(uint64_t hash, const Image& thumbnail) {
+    if(!os::path::exists(directory_)) {
+        os::make_dirs(directory_);
+    }
+
+    //write_png() goes through a temporary file of its own, so threads or editors sharing the directory can store the same thumbnail at once.
+    //Stores come from the level browser's workers, which are already spread over the cores
+    return write_png(thumbnail, path_for(hash), 1);
+}
+
+void ThumbnailCache::clear() {
+    if(!os::path::exists(directory_)) {
+        return;
+    }
+
+    for(std::string file: os::path::list_dir(directory_)) {
+        if(str::ends_with(file, ".png")) {
+            remove(os::path::join(directory_, file).c_str());
+        }
+    }
+}
+
+}
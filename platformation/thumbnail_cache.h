@@ -0,0 +1,52 @@
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "compositor.h"
+
+namespace pn {
+
+/*
+    Level thumbnails stored as PNGs named after a hash of the level file's
+    contents and the pixels of every tile image it uses, so a level that's
+    moved, copied or checked out again keeps its thumbnail, and an edited
+    level or redrawn tile gets a new one. Entries are never updated in
+    place, a changed level just stops using its old file.
+*/
+class ThumbnailCache {
+public:
+    ThumbnailCache(const std::string& directory, uint32_t size);
+
+    uint32_t size() const { return size_; }
+
+    //Fast rather than cryptographic, a few GB/s
+    static uint64_t content_hash(const uint8_t* data, size_t length);
+
+    /*
+        Folds each palette image's TileImage::content_hash() into the
+        level file's hash. The images come from the TilesetManager, so
+        they're decoded once and rendering the thumbnail reuses them.
+    */
+    static uint64_t key_for(uint64_t level_hash, const std::vector<std::string>& palette, const std::string& base_directory);
+
+    std::string path_for(uint64_t hash) const;
+
+    //False if there's no thumbnail for this hash yet
+    bool load(uint64_t hash, Image& out) const;
+
+    //Written to a temporary file and renamed, so readers never see half a PNG
+    bool store(uint64_t hash, const Image& thumbnail);
+
+    void clear();
+
+private:
+    std::string directory_;
+    uint32_t size_;
+};
+
+}
+
+#endif // THUMBNAIL_CACHE_H
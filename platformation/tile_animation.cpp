@@ -0,0 +1,108 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "kazbase/json/json.h"
+#include "kazbase/file_utils.h"
+#include "kazbase/os/path.h"
+#include "kazbase/logging/logging.h"
+
+#include "tile_animation.h"
+#include "palette.h"
+
+namespace pn {
+
+int32_t TileAnimator::add_animation(const TileAnimation& animation) {
+    int32_t idx = animations_.size();
+    animations_.push_back(animation);
+
+    TileAnimation& added = animations_.back();
+    added.frame_ms.resize(added.frames.size(), DEFAULT_FRAME_MS);
+
+    added.total_ms = 0;
+    for(uint32_t& ms: added.frame_ms) {
+        ms = std::max(ms, 1u);
+        added.total_ms += ms;
+    }
+
+    if(!added.frames.empty()) {
+        int32_t tile = added.frames[0];
+        if(uint32_t(tile) >= animation_for_tile_.size()) {
+            animation_for_tile_.resize(tile + 1, -1);
+        }
+        animation_for_tile_[tile] = idx;
+    }
+
+    return idx;
+}
+
+void TileAnimator::clear() {
+    animations_.clear();
+    animation_for_tile_.clear();
+}
+
+bool TileAnimator::load_definitions(const std::string& path, Palette& palette, const std::string& tile_directory) {
+    if(!os::path::exists(path)) {
+        return false;
+    }
+
+    json::JSON j = json::loads(file_utils::read_contents(path));
+    if(!j.has_key("animations")) {
+        L_INFO("No animations defined in " + path);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < j["animations"].length(); ++i) {
+        json::Node& node = j["animations"][i];
+        if(!node.has_key("frames") || !node["frames"].length()) {
+            L_INFO("Ignoring animation without frames in " + path);
+            continue;
+        }
+
+        TileAnimation animation;
+        animation.name = node["name"].get();
+
+        uint32_t frame_ms = DEFAULT_FRAME_MS;
+        if(node.has_key("frame_ms")) {
+            frame_ms = uint32_t(atoi(node["frame_ms"].get().c_str()));
+        }
+
+        for(uint32_t f = 0; f < node["frames"].length(); ++f) {
+            animation.frames.push_back(palette.id_for_path(os::path::join(tile_directory, node["frames"][f].get())));
+            animation.frame_ms.push_back(frame_ms);
+
+            if(node.has_key("durations") && f < node["durations"].length()) {
+                animation.frame_ms.back() = uint32_t(atoi(node["durations"][f].get().c_str()));
+            }
+        }
+
+        L_DEBUG("Loaded tile animation: " + animation.name);
+        add_animation(animation);
+    }
+
+    return true;
+}
+
+int32_t TileAnimator::animation_of(int32_t tile_image_id) const {
+    if(tile_image_id < 0 || uint32_t(tile_image_id) >= animation_for_tile_.size()) {
+        return -1;
+    }
+    return animation_for_tile_[tile_image_id];
+}
+
+uint32_t TileAnimator::frame_at(uint32_t animation, uint64_t time_ms) const {
+    const TileAnimation& a = animations_.at(animation);
+    if(!a.total_ms) {
+        return 0;
+    }
+
+    uint32_t t = uint32_t(time_ms % a.total_ms);
+    for(uint32_t f = 0; f < a.frame_ms.size(); ++f) {
+        if(t < a.frame_ms[f]) {
+            return f;
+        }
+        t -= a.frame_ms[f];
+    }
+    return 0;
+}
+
+}
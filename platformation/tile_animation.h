@@ -0,0 +1,63 @@
+#ifndef TILE_ANIMATION_H
+#define TILE_ANIMATION_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace pn {
+
+class Palette;
+
+const uint32_t DEFAULT_FRAME_MS = 100;
+
+/*
+    A strip of tile images shown in turn. Painting the first frame places
+    the animation, so levels store nothing extra and other editors just
+    see the first frame.
+*/
+struct TileAnimation {
+    TileAnimation():
+        total_ms(0) {}
+
+    std::string name;
+    std::vector<int32_t> frames; //Palette ids
+    std::vector<uint32_t> frame_ms;
+    uint32_t total_ms;
+};
+
+class TileAnimator {
+public:
+    int32_t add_animation(const TileAnimation& animation);
+
+    /*
+        Reads an animations.json from a tile directory, for example:
+
+            {"animations": [
+                {"name": "water", "frames": ["water1.png", "water2.png"], "frame_ms": 150},
+                {"name": "lava", "frames": ["lava1.png", "lava2.png"], "durations": [400, 100]}
+            ]}
+
+        Frame filenames are relative to that directory and are added to the
+        palette.
+    */
+    bool load_definitions(const std::string& path, Palette& palette, const std::string& tile_directory);
+    void clear();
+
+    uint32_t animation_count() const { return animations_.size(); }
+    const TileAnimation& animation(uint32_t idx) const { return animations_.at(idx); }
+
+    //Which animation a placed tile starts, or -1 if it's a still tile
+    int32_t animation_of(int32_t tile_image_id) const;
+
+    //Every animation loops from time 0, so all the tiles of one animation are always in step
+    uint32_t frame_at(uint32_t animation, uint64_t time_ms) const;
+
+private:
+    std::vector<TileAnimation> animations_;
+    std::vector<int32_t> animation_for_tile_; //Indexed by palette id
+};
+
+}
+
+#endif // TILE_ANIMATION_H
@@ -4,17 +4,26 @@
 #include "kazbase/string.h"
 #include "kazbase/logging/logging.h"
 #include "kglt/shortcuts.h"
+#include "profiler.h"
+#include "memory_accounting.h"
 
 namespace pn {
 
 const float TILE_CHOOSER_WIDTH = 2.0;
 const float TILE_CHOOSER_SPACING = 0.1;
 
-TileChooser::TileChooser(kglt::Scene& scene):
+static int64_t entry_bytes(const TileChooserEntry& entry) {
+    return sizeof(TileChooserEntry) + entry.directory.capacity() + entry.abs_path.capacity();
+}
+
+TileChooser::TileChooser(kglt::Scene& scene, EntityRegistry& entities, TileTextures& textures):
     scene_(scene),
-    current_selection_(0) {
+    entities_(entities),
+    textures_(textures),
+    cursor_(TILE_CHOOSER_VISIBLE_RADIUS) {
 
     group_mesh_ = scene.new_mesh();
+    memory::allocated(memory::SUBSYSTEM_RENDER_MESHES, 3 * memory::ESTIMATED_RECTANGLE_MESH_BYTES, 3); //Group, outline and slider
     kglt::Mesh& m = scene.mesh(group_mesh_);
     m.set_visible(false);
 
@@ -44,29 +53,45 @@ TileChooser::TileChooser(kglt::Scene& scene):
 }
 
 void TileChooser::next() {
-    if(current_selection_ >= entries_.size() - 1) {
-        return;
-    }
-    current_selection_++;
+    PN_PROFILE_SCOPE("TileChooser::next");
 
-    kglt::Mesh& slider = scene_.mesh(slider_group_mesh_);
-    slider.move_to(-(TILE_CHOOSER_WIDTH + TILE_CHOOSER_SPACING) * current_selection_, 0.0, 0.0);
-    update_hidden_tiles();
-    signal_selection_changed_(entries_[current_selection_]);
+    if(cursor_.next()) {
+        selection_moved();
+    }
 }
 
 void TileChooser::previous() {
-    if(current_selection_ < 1) {
-        return;
+    PN_PROFILE_SCOPE("TileChooser::previous");
+
+    if(cursor_.previous()) {
+        selection_moved();
     }
+}
+
+void TileChooser::set_selected(uint32_t index) {
+    assert(index < entries_.size());
 
-    current_selection_--;
+    //Even if it's already selected, fire a changed signal anyway
+    cursor_.set(index);
+    selection_moved();
+}
 
+bool TileChooser::set_selected_path(const std::string& abs_path) {
+    for(uint32_t i = 0; i < entries_.size(); ++i) {
+        if(entries_[i].abs_path == abs_path) {
+            set_selected(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TileChooser::selection_moved() {
     kglt::Mesh& slider = scene_.mesh(slider_group_mesh_);
-    slider.move_to(-(TILE_CHOOSER_WIDTH + TILE_CHOOSER_SPACING) * current_selection_, 0.0, 0.0);
+    slider.move_to(-(TILE_CHOOSER_WIDTH + TILE_CHOOSER_SPACING) * cursor_.current(), 0.0, 0.0);
     update_hidden_tiles();
 
-    signal_selection_changed_(entries_[current_selection_]);
+    signal_selection_changed_(entries_[cursor_.current()]);
 }
 
 void TileChooser::add_directory(const std::string& tile_directory) {
@@ -78,43 +103,67 @@ void TileChooser::add_directory(const std::string& tile_directory) {
 
     std::vector<std::string> to_load;
 
-    //FIXME: Should make recursive and store a relative path to the root
-    for(std::string file: os::path::list_dir(tile_directory)) {
-        if(str::ends_with(file, ".png")) {
-            std::string abs_path = os::path::join(tile_directory, file);
-            to_load.push_back(abs_path);
+    {
+        PN_PROFILE_SCOPE("TileChooser::scan_directory");
+
+        //FIXME: Should make recursive and store a relative path to the root
+        for(std::string file: os::path::list_dir(tile_directory)) {
+            if(str::ends_with(file, ".png")) {
+                std::string abs_path = os::path::join(tile_directory, file);
+                to_load.push_back(abs_path);
+            }
         }
     }
 
     int i = 0;
+    int32_t reported_percentage = -1;
 
     kglt::Mesh& slider = scene_.mesh(slider_group_mesh_);
 
     for(std::string abs_path: to_load) {
+        PN_PROFILE_SCOPE("TileChooser::load_tile");
+
         TileChooserEntry new_entry;
 
+        {
+            //Shared with any other window, render or thumbnail that already loaded this tile
+            PN_PROFILE_SCOPE("TileChooser::decode_and_upload");
+            new_entry.texture_id = textures_.acquire(abs_path);
+        }
+
+        ++i;
+        if(!new_entry.texture_id) {
+            continue;
+        }
+
         new_entry.mesh_id = scene_.new_mesh();
-        new_entry.texture_id = kglt::create_texture_from_file(scene_.window(), abs_path);
         new_entry.abs_path = abs_path;
+
         new_entry.directory = tile_directory;
 
+        memory::allocated(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+        memory::allocated(memory::SUBSYSTEM_CHOOSER_ENTRIES, entry_bytes(new_entry));
+
         kglt::Mesh& m = scene_.mesh(new_entry.mesh_id);
         kglt::procedural::mesh::rectangle(m, TILE_CHOOSER_WIDTH, TILE_CHOOSER_WIDTH);
         m.apply_texture(new_entry.texture_id);
-        m.set_user_data((TileChooser*)this);
+        entities_.set(new_entry.mesh_id, USER_DATA_TYPE_TILE_CHOOSER, entries_.size());
 
         //Set the parent of this mesh to the slider group mesh
         m.set_parent(&slider);
-        float xpos = i * (TILE_CHOOSER_WIDTH + TILE_CHOOSER_SPACING);
+        float xpos = entries_.size() * (TILE_CHOOSER_WIDTH + TILE_CHOOSER_SPACING);
         m.move_to(xpos, 0, 0);
 
         entries_.push_back(new_entry);
-        update_hidden_tiles(); //FIXME: This is slow as arse
-
-        ++i;
-        signal_tile_loaded_((100.0 / float(to_load.size())) * float(i));
-
-
+        cursor_.appended();
+        update_hidden_tiles(); //Only looks at the new entry
+
+        //Whole percents only, listeners run the main loop for each one and there can be thousands of tiles
+        float percentage = (100.0 / float(to_load.size())) * float(i);
+        if(int32_t(percentage) != reported_percentage) {
+            reported_percentage = int32_t(percentage);
+            signal_tile_loaded_(percentage);
+        }
     }
 
     update_hidden_tiles();
@@ -133,7 +182,11 @@ void TileChooser::remove_directory(const std::string& tile_directory) {
     //Delete the meshes relating to these entries
     for(TileChooserEntry& entry: entries_) {
         if(entry.directory == tile_directory) {
+            entities_.clear(entry.mesh_id);
             scene_.delete_mesh(entry.mesh_id);
+            textures_.release(entry.abs_path); //The texture goes unless something else in the window holds it
+            memory::released(memory::SUBSYSTEM_RENDER_MESHES, memory::ESTIMATED_RECTANGLE_MESH_BYTES);
+            memory::released(memory::SUBSYSTEM_CHOOSER_ENTRIES, entry_bytes(entry));
         }
     }
 
@@ -144,32 +197,56 @@ void TileChooser::remove_directory(const std::string& tile_directory) {
         ), entries_.end()
     );
 
+    //Entries after the removed ones have shifted down
+    for(uint32_t i = 0; i < entries_.size(); ++i) {
+        entities_.set(entries_[i].mesh_id, USER_DATA_TYPE_TILE_CHOOSER, i);
+    }
+
+    //Indices have shifted, so every entry's visibility is set again
+    cursor_.reset(entries_.size());
+    update_hidden_tiles();
+
     //Erase the directory itself
     directories_.erase(tile_directory);
     signal_locations_changed_(); //Fire off the locations changed signal
 }
 
+kglt::TextureID TileChooser::texture_for_path(const std::string& abs_path) const {
+    return textures_.texture_for_path(abs_path);
+}
+
+std::vector<std::string> TileChooser::tile_paths() const {
+    std::vector<std::string> paths;
+    paths.reserve(entries_.size());
+    for(const TileChooserEntry& entry: entries_) {
+        paths.push_back(entry.abs_path);
+    }
+    return paths;
+}
+
 void TileChooser::update_hidden_tiles() {
+    PN_PROFILE_SCOPE("TileChooser::update_hidden_tiles");
+
     /**
        Basically, we want to hide the tiles that are more than 5
        tiles away from the current selection, and show the ones that
-       are less or equal to that.
+       are less or equal to that. Only the entries the cursor says have
+       changed are touched.
     */
 
-    int32_t left = std::max((int32_t)0, int32_t(this->current_selection_) - 5);
-    int32_t right = std::min((int32_t)entries_.size(), int32_t(this->current_selection_) + 5);
+    std::vector<uint32_t> shown, hidden;
+    cursor_.take_changes(shown, hidden);
 
-    for(uint32_t i = 0; i < entries_.size(); ++i) {
+    for(uint32_t i: shown) {
         kglt::Mesh& m = scene_.mesh(entries_[i].mesh_id);
-        if(i >= left && i <= right) {
-            m.set_visible(true);
-
-            float a = 1.0; //1.0 - ((1.0 / 5.0) * (fabs(i - current_selection_)));
-            m.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, a));
-        } else {
-            m.set_visible(false);
-            m.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, 1.0));
-        }
+        m.set_visible(true);
+        m.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, 1.0));
+    }
+
+    for(uint32_t i: hidden) {
+        kglt::Mesh& m = scene_.mesh(entries_[i].mesh_id);
+        m.set_visible(false);
+        m.set_diffuse_colour(kglt::Colour(1.0, 1.0, 1.0, 1.0));
     }
 }
 
@@ -7,6 +7,9 @@
 #include <string>
 
 #include "kglt/kglt.h"
+#include "entity_registry.h"
+#include "chooser_cursor.h"
+#include "tile_textures.h"
 
 namespace pn {
 
@@ -21,7 +24,7 @@ class TileChooser {
 public:
     typedef std::tr1::shared_ptr<TileChooser> ptr;
 
-    TileChooser(kglt::Scene& scene);
+    TileChooser(kglt::Scene& scene, EntityRegistry& entities, TileTextures& textures);
     void add_directory(const std::string& tile_directory);
     void remove_directory(const std::string& tile_directory);
 
@@ -34,33 +37,26 @@ public:
     void next();
     void previous();
 
-    void set_selected_by_mesh_id(kglt::MeshID mesh_id) {
-        uint32_t i = 0;
-        for(TileChooserEntry entry: entries_) {
-            if(entry.mesh_id == mesh_id) {
-                break;
-            }
-            ++i;
-        }
-
-        assert(i != entries_.size());
-
-        if(current_selection_ < i) {
-            while(current_selection_ < i) {
-                next();
-            }
-        } else if (current_selection_ > i) {
-            while(current_selection_ > i) {
-                previous();
-            }
-        } else {
-            //It's already selected, but fire a changed signal anyway
-            signal_selection_changed_(entries_[i]);
-        }
+    void set_selected(uint32_t index);
+
+    //False if no loaded tile has this path
+    bool set_selected_path(const std::string& abs_path);
+
+    //Null while nothing is loaded
+    const TileChooserEntry* selected_entry() const {
+        return (cursor_.current() < entries_.size()) ? &entries_[cursor_.current()] : nullptr;
     }
 
+    //Returns 0 if no loaded tile has this path
+    kglt::TextureID texture_for_path(const std::string& abs_path) const;
+
+    //Every loaded tile, in chooser order
+    std::vector<std::string> tile_paths() const;
+
 private:
     kglt::Scene& scene_;
+    EntityRegistry& entities_;
+    TileTextures& textures_;
     kglt::MeshID group_mesh_;
     kglt::MeshID slider_group_mesh_;
 
@@ -71,9 +67,10 @@ private:
     sigc::signal<void, float> signal_tile_loaded_;
     sigc::signal<void, TileChooserEntry> signal_selection_changed_;
 
-    uint32_t current_selection_;
+    ChooserCursor cursor_;
 
     void update_hidden_tiles();
+    void selection_moved();
 };
 
 }
@@ -0,0 +1,155 @@
+#include <cstdio>
+#include <cstring>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/os/path.h"
+
+#include "tile_pixel_cache.h"
+#include "tileset_manager.h"
+#include "binary_io.h"
+#include "atomic_file.h"
+#include "profiler.h"
+
+namespace pn {
+
+TilePixelCache::ptr TilePixelCache::open(const std::string& path) {
+    PN_PROFILE_SCOPE("TilePixelCache::open");
+
+    if(!os::path::exists(path)) {
+        return TilePixelCache::ptr();
+    }
+
+    MappedFile::ptr file = MappedFile::open(path);
+    if(!file) {
+        return TilePixelCache::ptr();
+    }
+
+    TilePixelCache::ptr cache(new TilePixelCache(file));
+    try {
+        BinaryReader reader(file->data(), file->size());
+        if(!reader.magic("PNTC") || reader.u32() != TILE_PIXEL_CACHE_VERSION) {
+            L_WARN("Ignoring tile pixel cache from another version: " + path);
+            return TilePixelCache::ptr();
+        }
+
+        uint32_t count = reader.u32();
+        for(uint32_t i = 0; i < count; ++i) {
+            std::string tile_path = reader.string();
+
+            Entry entry;
+            entry.file_size = reader.u64();
+            entry.modified = reader.u64();
+            entry.width = reader.u32();
+            entry.height = reader.u32();
+            entry.offset = reader.u64();
+
+            uint64_t bytes = uint64_t(entry.width) * entry.height * 4;
+            if(entry.offset > file->size() || bytes > file->size() - entry.offset) {
+                L_WARN("Tile pixel cache is truncated: " + path);
+                return TilePixelCache::ptr();
+            }
+            cache->entries_[tile_path] = entry;
+        }
+    } catch(std::out_of_range& e) {
+        L_WARN("Tile pixel cache is truncated: " + path);
+        return TilePixelCache::ptr();
+    }
+
+    return cache;
+}
+
+bool TilePixelCache::write(const std::string& path, const std::vector<std::string>& tile_paths) {
+    PN_PROFILE_SCOPE("TilePixelCache::write");
+
+    //Held until the pixels are written, so nothing is freed underneath
+    std::vector<TileImage::ptr> images;
+    std::vector<uint8_t> header;
+    BinaryWriter writer(header);
+
+    //The header goes first, so its size has to be known before the offsets are
+    uint64_t header_size = 12;
+    for(const std::string& tile_path: tile_paths) {
+        header_size += 4 + tile_path.size() + 32;
+    }
+
+    writer.magic("PNTC");
+    writer.u32(TILE_PIXEL_CACHE_VERSION);
+    size_t count_at = writer.position();
+    writer.u32(0);
+
+    uint32_t count = 0;
+    uint64_t offset = header_size;
+    for(const std::string& tile_path: tile_paths) {
+        uint64_t file_size, modified;
+        if(!file_signature(tile_path, file_size, modified)) {
+            continue;
+        }
+
+        TileImage::ptr image = TilesetManager::instance().acquire(tile_path);
+        if(!image->valid()) {
+            continue;
+        }
+        images.push_back(image);
+
+        writer.string(tile_path);
+        writer.u64(file_size);
+        writer.u64(modified);
+        writer.u32(image->pixels().width);
+        writer.u32(image->pixels().height);
+        writer.u64(offset);
+
+        offset += image->pixels().pixels.size() * 4;
+        count++;
+    }
+
+    //Skipped tiles leave a gap between the header and the pixels, which is never read
+    for(uint32_t i = 0; i < 4; ++i) {
+        header[count_at + i] = (count >> (i * 8)) & 0xFF;
+    }
+    header.resize(header_size, 0);
+
+    //A cache that's only half there is ignored when it's opened, but it's still better not to leave one
+    bool written = write_file_atomically(path, [&](FILE* file) {
+        bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+        for(const TileImage::ptr& image: images) {
+            const std::vector<uint32_t>& pixels = image->pixels().pixels;
+            ok = ok && fwrite(pixels.data(), 4, pixels.size(), file) == pixels.size();
+        }
+        return ok;
+    });
+
+    if(!written) {
+        L_WARN("Unable to write the tile pixel cache: " + path);
+        return false;
+    }
+    return true;
+}
+
+bool TilePixelCache::current(const std::string& tile_path, const Entry& entry) const {
+    uint64_t file_size, modified;
+    return file_signature(tile_path, file_size, modified) && file_size == entry.file_size && modified == entry.modified;
+}
+
+bool TilePixelCache::load(const std::string& tile_path, Image& out) const {
+    std::map<std::string, Entry>::const_iterator it = entries_.find(tile_path);
+    if(it == entries_.end() || !current(tile_path, it->second)) {
+        return false;
+    }
+
+    const Entry& entry = it->second;
+    out.resize(entry.width, entry.height);
+    memcpy(out.pixels.data(), file_->data() + entry.offset, out.pixels.size() * 4);
+    return true;
+}
+
+bool TilePixelCache::covers(const std::vector<std::string>& tile_paths) const {
+    for(const std::string& tile_path: tile_paths) {
+        std::map<std::string, Entry>::const_iterator it = entries_.find(tile_path);
+        if(it == entries_.end() || !current(tile_path, it->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef TILE_PIXEL_CACHE_H
+#define TILE_PIXEL_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <tr1/memory>
+
+#include "compositor.h"
+#include "mapped_file.h"
+
+namespace pn {
+
+const uint32_t TILE_PIXEL_CACHE_VERSION = 1;
+
+/*
+    Decoded tile pixels from the last run in one file, so starting the
+    editor copies the tileset library out of the page cache instead of
+    inflating every PNG again. An entry is only used while its PNG has
+    the same size and modification time as when it was cached, so edited
+    tile art is decoded afresh.
+
+    Layout (little endian): "PNTC", u32 version, u32 entry count, per entry
+    string path + u64 file size, u64 modification time, u32 width, u32
+    height and u64 offset of the pixels, then the premultiplied pixels of
+    every entry.
+*/
+class TilePixelCache {
+public:
+    typedef std::tr1::shared_ptr<TilePixelCache> ptr;
+
+    //Null if there's no cache or it's unreadable (which is logged)
+    static TilePixelCache::ptr open(const std::string& path);
+
+    /*
+        Writes the pixels of these tiles, decoding any that aren't loaded
+        already. Written to a temporary file and renamed, so a cache that's
+        open elsewhere keeps its pixels. Safe on any thread.
+    */
+    static bool write(const std::string& path, const std::vector<std::string>& tile_paths);
+
+    //False if the tile isn't cached or its file changed since
+    bool load(const std::string& tile_path, Image& out) const;
+
+    //Every one of these tiles is cached and up to date
+    bool covers(const std::vector<std::string>& tile_paths) const;
+
+    uint32_t entry_count() const { return entries_.size(); }
+
+private:
+    struct Entry {
+        uint64_t file_size;
+        uint64_t modified;
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;
+    };
+
+    TilePixelCache(MappedFile::ptr file):
+        file_(file) {}
+
+    MappedFile::ptr file_;
+    std::map<std::string, Entry> entries_;
+
+    bool current(const std::string& tile_path, const Entry& entry) const;
+};
+
+}
+
+#endif // TILE_PIXEL_CACHE_H
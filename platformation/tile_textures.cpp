@@ -0,0 +1,105 @@
+#include <cstring>
+
+#include "kazbase/logging/logging.h"
+
+#include "tile_textures.h"
+#include "memory_accounting.h"
+#include "profiler.h"
+
+namespace pn {
+
+TileTextures::~TileTextures() {
+    for(auto& upload: uploads_) {
+        delete_texture(upload.second);
+    }
+}
+
+kglt::TextureID TileTextures::acquire(const std::string& path) {
+    std::map<std::string, Entry>::iterator it = textures_.find(path);
+    if(it != textures_.end()) {
+        it->second.references++;
+        return uploads_[it->second.image->content_hash()].texture;
+    }
+
+    TileImage::ptr image = TilesetManager::instance().acquire(path);
+    if(!image->valid()) {
+        L_WARN("Unable to load tile image " + path);
+        return 0;
+    }
+
+    std::map<uint64_t, Upload>::iterator existing = uploads_.find(image->content_hash());
+    if(existing != uploads_.end()) {
+        existing->second.paths++;
+    } else {
+        Upload upload;
+        upload.texture = this->upload(*image);
+        upload.width = image->pixels().width;
+        upload.height = image->pixels().height;
+        upload.paths = 1;
+        existing = uploads_.insert(std::make_pair(image->content_hash(), upload)).first;
+    }
+
+    Entry entry;
+    entry.image = image;
+    entry.references = 1;
+    textures_[path] = entry;
+    return existing->second.texture;
+}
+
+void TileTextures::release(const std::string& path) {
+    std::map<std::string, Entry>::iterator it = textures_.find(path);
+    if(it == textures_.end()) {
+        return;
+    }
+
+    if(!--it->second.references) {
+        std::map<uint64_t, Upload>::iterator upload = uploads_.find(it->second.image->content_hash());
+        if(!--upload->second.paths) {
+            delete_texture(upload->second);
+            uploads_.erase(upload);
+        }
+        textures_.erase(it);
+    }
+}
+
+kglt::TextureID TileTextures::texture_for_path(const std::string& path) const {
+    std::map<std::string, Entry>::const_iterator it = textures_.find(path);
+    if(it == textures_.end()) {
+        return 0;
+    }
+    return uploads_.find(it->second.image->content_hash())->second.texture;
+}
+
+kglt::TextureID TileTextures::upload(const TileImage& image) {
+    PN_PROFILE_SCOPE("TileTextures::upload");
+
+    const Image& pixels = image.pixels();
+
+    kglt::Scene& scene = window_.scene();
+    kglt::TextureID texture_id = scene.new_texture();
+    kglt::Texture& texture = scene.texture(texture_id);
+    texture.set_bpp(32);
+    texture.resize(pixels.width, pixels.height);
+
+    //GL wants straight alpha and the bottom row first, like kglt's own loader gives it
+    std::vector<uint32_t> straight;
+    image.straight_pixels(straight);
+
+    size_t row_bytes = size_t(pixels.width) * 4;
+    kglt::Texture::Data& data = texture.data();
+    for(uint32_t y = 0; y < pixels.height; ++y) {
+        memcpy(&data[y * row_bytes], &straight[size_t(pixels.height - 1 - y) * pixels.width], row_bytes);
+    }
+    texture.upload();
+
+    upload_count_++;
+    memory::allocated(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(pixels.width, pixels.height, 32));
+    return texture_id;
+}
+
+void TileTextures::delete_texture(const Upload& upload) {
+    window_.scene().delete_texture(upload.texture);
+    memory::released(memory::SUBSYSTEM_GPU_TEXTURES, memory::estimated_texture_bytes(upload.width, upload.height, 32));
+}
+
+}
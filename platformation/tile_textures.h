@@ -0,0 +1,65 @@
+#ifndef TILE_TEXTURES_H
+#define TILE_TEXTURES_H
+
+#include <map>
+#include <string>
+
+#include "kglt/kglt.h"
+#include "tileset_manager.h"
+
+namespace pn {
+
+/*
+    GPU textures for shared tile images in one window. The pixels come from
+    the TilesetManager, so a tile already decoded for another window, a
+    render or a thumbnail is uploaded without touching the file again, and
+    each tile is uploaded once however many users in the window ask for it.
+    Tiles with the same pixels under different paths (copied between
+    tilesets) share one texture too. A texture is deleted when its last
+    user releases it.
+
+    Only for the thread that owns the window's GL context.
+*/
+class TileTextures {
+public:
+    TileTextures(kglt::WindowBase& window):
+        window_(window),
+        upload_count_(0) {}
+
+    ~TileTextures();
+
+    //Adds a reference, returns 0 (with no reference taken) if the image can't be read
+    kglt::TextureID acquire(const std::string& path);
+    void release(const std::string& path);
+
+    //0 unless something holds a reference
+    kglt::TextureID texture_for_path(const std::string& path) const;
+
+    uint32_t texture_count() const { return uploads_.size(); }
+    uint32_t upload_count() const { return upload_count_; }
+
+private:
+    struct Entry {
+        TileImage::ptr image;
+        uint32_t references;
+    };
+
+    struct Upload {
+        kglt::TextureID texture;
+        uint32_t width;
+        uint32_t height;
+        uint32_t paths; //Entries using it
+    };
+
+    kglt::WindowBase& window_;
+    std::map<std::string, Entry> textures_;
+    std::map<uint64_t, Upload> uploads_; //By content hash
+    uint32_t upload_count_;
+
+    kglt::TextureID upload(const TileImage& image);
+    void delete_texture(const Upload& upload);
+};
+
+}
+
+#endif // TILE_TEXTURES_H
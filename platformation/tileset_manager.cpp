@@ -0,0 +1,181 @@
+#include <algorithm>
+#include <utility>
+
+#include "tileset_manager.h"
+#include "memory_accounting.h"
+#include "pixel_ops.h"
+#include "profiler.h"
+
+namespace pn {
+
+static int64_t image_bytes(const Image& image) {
+    return int64_t(image.pixels.capacity()) * 4;
+}
+
+TileImage::~TileImage() {
+    int64_t bytes = image_bytes(pixels_);
+    for(const Image& mip: mips_) {
+        bytes += image_bytes(mip);
+    }
+    for(auto& scaled: scaled_) {
+        bytes += int64_t(scaled.second.capacity()) * 4;
+    }
+    memory::released(memory::SUBSYSTEM_TILE_IMAGES, bytes);
+}
+
+bool TileImage::decode(const TilePixelCache* cache) {
+    PN_PROFILE_SCOPE("TileImage::decode");
+
+    //The mips and hash are quick to redo, it's inflating the PNG that the cache saves
+    bool cached = cache && cache->load(path_, pixels_);
+    valid_ = (cached || read_png(path_, pixels_)) && pixels_.width && pixels_.height;
+    if(!valid_) {
+        pixels_ = Image();
+        memory::allocated(memory::SUBSYSTEM_TILE_IMAGES, 0);
+        return false;
+    }
+
+    int64_t bytes = image_bytes(pixels_);
+
+    while(true) {
+        const Image& previous = mips_.empty() ? pixels_ : mips_.back();
+        if(previous.width == 1 && previous.height == 1) {
+            break;
+        }
+
+        Image mip;
+        mip.resize((previous.width + 1) / 2, (previous.height + 1) / 2);
+        downsample(previous.pixels.data(), previous.width, previous.height, mip.pixels.data());
+
+        bytes += image_bytes(mip);
+        mips_.push_back(std::move(mip));
+    }
+
+    content_hash_ = hash_bytes(pixels_.pixels.data(), pixels_.pixels.size() * 4, (uint64_t(pixels_.width) << 32) | pixels_.height);
+    memory::allocated(memory::SUBSYSTEM_TILE_IMAGES, bytes);
+    return cached;
+}
+
+const std::vector<uint32_t>& TileImage::scaled(uint32_t tile_pixels) {
+    std::lock_guard<std::mutex> guard(scaled_lock_);
+
+    //Map entries don't move, so the reference stays good after the lock is dropped
+    std::map<uint32_t, std::vector<uint32_t> >::iterator it = scaled_.find(tile_pixels);
+    if(it != scaled_.end()) {
+        return it->second;
+    }
+
+    std::vector<uint32_t>& out = scaled_[tile_pixels];
+    out.assign(size_t(tile_pixels) * tile_pixels, 0);
+    if(valid_) {
+        //Scaled from the smallest mip still at least as big, so shrinking a large tile reads a fraction of it
+        const Image* source = &pixels_;
+        for(const Image& mip: mips_) {
+            if(mip.width < tile_pixels || mip.height < tile_pixels) {
+                break;
+            }
+            source = &mip;
+        }
+        TileImages::scale(*source, tile_pixels, out.data());
+    }
+    memory::allocated(memory::SUBSYSTEM_TILE_IMAGES, int64_t(out.capacity()) * 4, 0);
+    return out;
+}
+
+void TileImage::straight_pixels(std::vector<uint32_t>& out) const {
+    out.clear();
+    if(!valid_) {
+        return;
+    }
+
+    //Coarsest first, so each level's clear pixels can take the colour of the one below them
+    std::vector<uint32_t> coarser;
+    uint32_t coarser_width = 0;
+    for(int32_t level = mips_.size(); level >= 0; --level) {
+        const Image& image = level ? mips_[level - 1] : pixels_;
+        out.resize(image.pixels.size());
+        unpremultiply_row(image.pixels.data(), out.data(), out.size());
+
+        if(coarser_width) {
+            for(uint32_t y = 0; y < image.height; ++y) {
+                uint32_t* row = &out[size_t(y) * image.width];
+                const uint32_t* below = &coarser[size_t(y / 2) * coarser_width];
+                for(uint32_t x = 0; x < image.width; ++x) {
+                    if(!(row[x] >> 24)) {
+                        row[x] = below[x / 2] & 0x00FFFFFF;
+                    }
+                }
+            }
+        }
+
+        coarser.swap(out);
+        coarser_width = image.width;
+    }
+    out.swap(coarser);
+}
+
+TilesetManager& TilesetManager::instance() {
+    static TilesetManager manager;
+    return manager;
+}
+
+TileImage::ptr TilesetManager::acquire(const std::string& path) {
+    TileImage::ptr image;
+    TilePixelCache::ptr cache;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        cache = pixel_cache_;
+
+        std::tr1::weak_ptr<TileImage>& slot = images_[path];
+        image = slot.lock();
+        if(!image) {
+            image.reset(new TileImage(path));
+            slot = image;
+        }
+
+        std::deque<TileImage::ptr>::iterator it = std::find(recent_.begin(), recent_.end(), image);
+        if(it != recent_.end()) {
+            recent_.erase(it);
+        }
+        recent_.push_front(image);
+        if(recent_.size() > RECENT_TILE_IMAGES) {
+            recent_.pop_back();
+        }
+    }
+
+    //Decoded outside the lock so other images aren't held up, anyone else after this one waits here
+    std::call_once(image->decoded_, [&]() {
+        if(image->decode(cache.get())) {
+            cache_hit_count_++;
+        }
+        decode_count_++;
+    });
+    return image;
+}
+
+uint32_t TilesetManager::live_count() {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    uint32_t count = 0;
+    for(std::map<std::string, std::tr1::weak_ptr<TileImage> >::iterator it = images_.begin(); it != images_.end();) {
+        if(it->second.expired()) {
+            images_.erase(it++);
+        } else {
+            ++count;
+            ++it;
+        }
+    }
+    return count;
+}
+
+void TilesetManager::set_pixel_cache(TilePixelCache::ptr cache) {
+    std::lock_guard<std::mutex> guard(lock_);
+    pixel_cache_ = cache;
+}
+
+void TilesetManager::trim() {
+    std::lock_guard<std::mutex> guard(lock_);
+    recent_.clear();
+}
+
+}
@@ -0,0 +1,126 @@
+#ifndef TILESET_MANAGER_H
+#define TILESET_MANAGER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <tr1/memory>
+
+#include "compositor.h"
+#include "tile_pixel_cache.h"
+
+namespace pn {
+
+const uint32_t RECENT_TILE_IMAGES = 256;
+
+/*
+    A tile image's pixels, decoded once for the whole process however many
+    levels, views and renders use it. Scaled copies are made the first time
+    a size is asked for and kept alongside, so rendering thumbnails for a
+    whole project scales each tile once rather than once per level.
+
+    Decoding also builds the halved mip chain and hashes the pixels, both
+    with the vector kernels in pixel_ops.
+*/
+class TileImage {
+public:
+    typedef std::tr1::shared_ptr<TileImage> ptr;
+
+    TileImage(const std::string& path):
+        path_(path),
+        valid_(false),
+        content_hash_(0) {}
+
+    ~TileImage();
+
+    const std::string& path() const { return path_; }
+
+    //False if the file couldn't be read, the pixels are then empty
+    bool valid() const { return valid_; }
+
+    //Premultiplied, top row first
+    const Image& pixels() const { return pixels_; }
+
+    //Each half the size of the one before, down to 1x1. Empty if not valid
+    const std::vector<Image>& mips() const { return mips_; }
+
+    //Of the size and pixels, so copies of a tile under different paths hash the same
+    uint64_t content_hash() const { return content_hash_; }
+
+    //Box filtered to a tile_pixels square
+    const std::vector<uint32_t>& scaled(uint32_t tile_pixels);
+
+    /*
+        Straight alpha for GL, top row first. Fully transparent pixels take
+        their colour from the nearest mip that has one, so linear filtering
+        at the edges of a sprite fades towards its own colours, not black.
+    */
+    void straight_pixels(std::vector<uint32_t>& out) const;
+
+private:
+    friend class TilesetManager;
+
+    std::string path_;
+    Image pixels_;
+    std::vector<Image> mips_;
+    bool valid_;
+    uint64_t content_hash_;
+    std::once_flag decoded_;
+
+    std::mutex scaled_lock_;
+    std::map<uint32_t, std::vector<uint32_t> > scaled_;
+
+    //True if the pixels came from the cache
+    bool decode(const TilePixelCache* cache);
+};
+
+/*
+    Hands out shared TileImages by path, so the second user of an image
+    gets the first one's pixels. An image is freed once nothing points to
+    it, apart from the last RECENT_TILE_IMAGES acquired, which are held on
+    to so a run of short lived users (rendering one level after another)
+    doesn't decode the same tiles over and over.
+
+    Safe to use from any thread. GPU textures are made from these per
+    window, see TileTextures.
+*/
+class TilesetManager {
+public:
+    static TilesetManager& instance();
+
+    //Decoded on first use, a failed decode still returns an image (check valid())
+    TileImage::ptr acquire(const std::string& path);
+
+    uint32_t live_count();
+    uint64_t decode_count() const { return decode_count_; }
+    uint64_t cache_hit_count() const { return cache_hit_count_; } //Decodes that came from the pixel cache
+
+    /*
+        Decodes take the pixels from here when it has them up to date,
+        rather than reading the PNG. Null stops using one.
+    */
+    void set_pixel_cache(TilePixelCache::ptr cache);
+
+    //Lets go of the recently used images, anything still pointed to stays loaded
+    void trim();
+
+private:
+    TilesetManager():
+        decode_count_(0),
+        cache_hit_count_(0) {}
+
+    std::mutex lock_;
+    TilePixelCache::ptr pixel_cache_;
+    std::map<std::string, std::tr1::weak_ptr<TileImage> > images_;
+    std::deque<TileImage::ptr> recent_;
+    std::atomic<uint64_t> decode_count_;
+    std::atomic<uint64_t> cache_hit_count_;
+};
+
+}
+
+#endif // TILESET_MANAGER_H
@@ -0,0 +1,155 @@
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+#include "kazbase/logging/logging.h"
+#include "trace.h"
+
+namespace pn {
+namespace trace {
+
+namespace {
+
+bool is_recording = false;
+std::string output_path;
+uint64_t origin_ns = 0;
+uint64_t deadline_ns = 0;
+uint32_t event_limit = 0;
+std::vector<profiler::Sample> events;
+
+void write_escaped(std::ostream& out, const char* text) {
+    out << '"';
+    for(const char* c = text; *c; ++c) {
+        if(*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+}
+
+void start(const std::string& path, double max_seconds, uint32_t max_events) {
+    if(is_recording) {
+        stop();
+    }
+
+    L_INFO("Recording trace to " + path);
+
+    output_path = path;
+    origin_ns = profiler::now_ns();
+    deadline_ns = origin_ns + uint64_t(max_seconds * 1000000000.0);
+    event_limit = max_events;
+    events.clear();
+    events.reserve(std::min(max_events, 65536u));
+
+    //Throw away anything recorded before the trace window opened
+    std::vector<profiler::Sample> stale;
+    profiler::drain(stale);
+
+    profiler::acquire();
+    is_recording = true;
+}
+
+std::string stop() {
+    if(!is_recording) {
+        return std::string();
+    }
+
+    std::vector<profiler::Sample> remaining;
+    profiler::drain(remaining);
+    add_samples(remaining);
+
+    is_recording = false;
+    profiler::release();
+
+    std::string path = output_path;
+    bool written = write_chrome_trace(path, events, origin_ns);
+
+    events.clear();
+    events.shrink_to_fit();
+
+    if(!written) {
+        L_ERROR("Unable to write trace to " + path);
+        return std::string();
+    }
+
+    L_INFO("Trace written to " + path);
+    return path;
+}
+
+bool recording() {
+    return is_recording;
+}
+
+bool expired() {
+    return is_recording && (events.size() >= event_limit || profiler::now_ns() >= deadline_ns);
+}
+
+void add_samples(const std::vector<profiler::Sample>& samples) {
+    if(!is_recording) {
+        return;
+    }
+
+    for(const profiler::Sample& sample: samples) {
+        if(events.size() >= event_limit) {
+            break;
+        }
+
+        if(sample.start_ns < origin_ns || sample.start_ns > deadline_ns) {
+            continue;
+        }
+
+        events.push_back(sample);
+    }
+}
+
+bool write_chrome_trace(const std::string& path, const std::vector<profiler::Sample>& samples, uint64_t origin) {
+    std::ofstream out(path.c_str());
+    if(!out) {
+        return false;
+    }
+
+    int pid = getpid();
+    uint32_t max_thread = 0;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    char numbers[128];
+    bool first = true;
+    for(const profiler::Sample& sample: samples) {
+        max_thread = std::max(max_thread, sample.thread_id);
+
+        if(!first) {
+            out << ",\n";
+        }
+        first = false;
+
+        out << "{\"name\":";
+        write_escaped(out, sample.name);
+
+        //Timestamps are in microseconds, keep the nanosecond precision as a fraction
+        snprintf(numbers, sizeof(numbers), ",\"cat\":\"pn\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u}",
+            double(sample.start_ns - origin) / 1000.0,
+            double(sample.duration_ns) / 1000.0,
+            pid, sample.thread_id
+        );
+        out << numbers;
+    }
+
+    for(uint32_t tid = 0; tid <= max_thread && !samples.empty(); ++tid) {
+        snprintf(numbers, sizeof(numbers),
+            ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+            pid, tid, tid
+        );
+        out << numbers;
+    }
+
+    out << "\n]}\n";
+    return out.good();
+}
+
+}
+}
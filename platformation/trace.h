@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <vector>
+
+#include "profiler.h"
+
+namespace pn {
+namespace trace {
+
+/*
+    Records every profiler span for at most max_seconds (or max_events,
+    whichever comes first) and writes them out as Chrome trace-event JSON
+    when stopped. The output loads in chrome://tracing, Perfetto and
+    speedscope.
+*/
+void start(const std::string& output_path, double max_seconds=30.0, uint32_t max_events=2000000);
+
+/*
+    Drains any outstanding samples, writes the trace file and returns its
+    path (or an empty string if nothing was recording or the write failed).
+*/
+std::string stop();
+
+bool recording();
+bool expired();
+
+void add_samples(const std::vector<profiler::Sample>& samples);
+
+bool write_chrome_trace(const std::string& path, const std::vector<profiler::Sample>& samples, uint64_t origin_ns);
+
+}
+}
+
+#endif // TRACE_H
@@ -5,8 +5,10 @@
 namespace pn {
 
 enum UserDataType {
-    USER_DATA_TYPE_TILE_CHOOSER = 0,
-    USER_DATA_TYPE_TILE_INSTANCE = 1
+    USER_DATA_TYPE_NONE = 0,
+    USER_DATA_TYPE_TILE_CHOOSER,
+    USER_DATA_TYPE_TILE_INSTANCE,
+    USER_DATA_TYPE_MAX
 };
 
 }
@@ -0,0 +1,145 @@
+#include <cmath>
+#include <algorithm>
+
+#include "view_input.h"
+
+namespace pn {
+
+ViewInput::ViewInput(double ortho_height):
+    last_changes_(VIEW_UNCHANGED),
+    forced_changes_(VIEW_UNCHANGED),
+    camera_x_(0),
+    camera_y_(0),
+    ortho_height_(ortho_height),
+    target_x_(0),
+    target_y_(0),
+    target_height_(ortho_height),
+    has_bounds_(false),
+    min_x_(0),
+    max_x_(0),
+    min_y_(0),
+    max_y_(0),
+    viewport_width_(0),
+    viewport_height_(0),
+    last_frame_ns_(0) {
+
+}
+
+void ViewInput::pointer_moved(double x, double y) {
+    pending_.pointer_x = x;
+    pending_.pointer_y = y;
+    pending_.has_pointer = true;
+    pending_.events++;
+}
+
+void ViewInput::scrolled(double steps_x, double steps_y) {
+    pending_.scroll_x += steps_x;
+    pending_.scroll_y += steps_y;
+    pending_.events++;
+}
+
+void ViewInput::zoomed(double steps) {
+    pending_.zoom_steps += steps;
+    pending_.events++;
+}
+
+void ViewInput::jump_to(double x, double y) {
+    target_x_ = camera_x_ = x;
+    target_y_ = camera_y_ = y;
+    forced_changes_ |= VIEW_MOVED;
+}
+
+void ViewInput::set_ortho_height(double height) {
+    target_height_ = ortho_height_ = std::min(std::max(height, MIN_ORTHO_HEIGHT), MAX_ORTHO_HEIGHT);
+    forced_changes_ |= VIEW_ZOOMED;
+}
+
+void ViewInput::set_viewport(uint32_t width, uint32_t height) {
+    viewport_width_ = width;
+    viewport_height_ = height;
+}
+
+void ViewInput::set_bounds(double min_x, double max_x, double min_y, double max_y) {
+    has_bounds_ = true;
+    min_x_ = min_x;
+    max_x_ = std::max(min_x, max_x);
+    min_y_ = min_y;
+    max_y_ = std::max(min_y, max_y);
+}
+
+void ViewInput::clamp_target() {
+    if(has_bounds_) {
+        target_x_ = std::min(std::max(target_x_, min_x_), max_x_);
+        target_y_ = std::min(std::max(target_y_, min_y_), max_y_);
+    }
+}
+
+uint32_t ViewInput::advance(uint64_t now_ns) {
+    double seconds = last_frame_ns_ ? std::min(double(now_ns - last_frame_ns_) / 1e9, VIEW_MAX_FRAME_SECONDS) : 0.0;
+    last_frame_ns_ = now_ns;
+
+    //The pointer position carries over, it's only the movement that's per frame
+    FrameInput input = pending_;
+    if(!input.has_pointer) {
+        input.pointer_x = last_input_.pointer_x;
+        input.pointer_y = last_input_.pointer_y;
+        input.has_pointer = last_input_.has_pointer;
+    }
+    last_input_ = input;
+    pending_ = FrameInput();
+
+    if(input.zoom_steps != 0) {
+        double height = std::min(std::max(target_height_ * std::pow(VIEW_ZOOM_PER_STEP, -input.zoom_steps), MIN_ORTHO_HEIGHT), MAX_ORTHO_HEIGHT);
+
+        /*
+            Move the target so the point under the pointer stays put. The
+            position and height ease at the same rate, so it stays put on
+            every frame on the way there too, not just at the end.
+        */
+        if(input.has_pointer && viewport_width_ && viewport_height_) {
+            double aspect = double(viewport_width_) / double(viewport_height_);
+            double from_centre_x = (input.pointer_x / viewport_width_) - 0.5;
+            double from_centre_y = 0.5 - (input.pointer_y / viewport_height_);
+            target_x_ += from_centre_x * (target_height_ - height) * aspect;
+            target_y_ += from_centre_y * (target_height_ - height);
+        }
+        target_height_ = height;
+    }
+
+    target_x_ += input.scroll_x * VIEW_SCROLL_TILES_PER_STEP;
+    target_y_ -= input.scroll_y * VIEW_SCROLL_TILES_PER_STEP;
+    clamp_target();
+
+    //Exponential easing, the same feel whatever the frame rate
+    double blend = 1.0 - std::exp(-seconds / VIEW_SMOOTHING_SECONDS);
+    auto ease = [=](double current, double target) -> double {
+        double value = current + ((target - current) * blend);
+        return (std::fabs(target - value) < VIEW_SNAP_DISTANCE) ? target : value;
+    };
+
+    double x = ease(camera_x_, target_x_);
+    double y = ease(camera_y_, target_y_);
+    double height = ease(ortho_height_, target_height_);
+
+    uint32_t changes = forced_changes_;
+    forced_changes_ = VIEW_UNCHANGED;
+
+    if(x != camera_x_ || y != camera_y_) {
+        changes |= VIEW_MOVED;
+    }
+    if(height != ortho_height_) {
+        changes |= VIEW_ZOOMED;
+    }
+
+    camera_x_ = x;
+    camera_y_ = y;
+    ortho_height_ = height;
+    last_changes_ = changes;
+    return changes;
+}
+
+bool ViewInput::settled() const {
+    return camera_x_ == target_x_ && camera_y_ == target_y_ && ortho_height_ == target_height_ && !pending_.events;
+}
+
+}
@@ -0,0 +1,113 @@
+#ifndef VIEW_INPUT_H
+#define VIEW_INPUT_H
+
+#include <cstdint>
+
+namespace pn {
+
+const double DEFAULT_ORTHO_HEIGHT = 15.0;
+const double MIN_ORTHO_HEIGHT = 2.0;
+const double MAX_ORTHO_HEIGHT = 500.0;
+
+const double VIEW_ZOOM_PER_STEP = 1.1; //Ortho height scale for each wheel step
+const double VIEW_SCROLL_TILES_PER_STEP = 1.0;
+const double VIEW_SMOOTHING_SECONDS = 0.05; //Time constant of the camera easing towards where it's headed
+const double VIEW_MAX_FRAME_SECONDS = 0.1; //Longer frames (stalls) ease as if they were this long
+const double VIEW_SNAP_DISTANCE = 0.001; //Closer than this to the target, in tiles, and the camera just gets there
+
+//Everything that arrived between two frames, folded together
+struct FrameInput {
+    FrameInput():
+        scroll_x(0),
+        scroll_y(0),
+        zoom_steps(0),
+        pointer_x(0),
+        pointer_y(0),
+        has_pointer(false),
+        events(0) {}
+
+    double scroll_x; //Wheel steps, positive is right
+    double scroll_y; //Positive is down
+    double zoom_steps; //Positive zooms in
+    double pointer_x; //The latest position in pixels from the top left of the view
+    double pointer_y;
+    bool has_pointer;
+    uint32_t events;
+};
+
+enum ViewChange {
+    VIEW_UNCHANGED = 0,
+    VIEW_MOVED = 1,
+    VIEW_ZOOMED = 2
+};
+
+/*
+    The editor camera, driven by input gathered over a frame rather than
+    moved for each event. Touchpads send scroll events far faster than
+    frames are drawn, so handlers only add to the pending input, and
+    advance() folds it all into where the camera is headed once a frame
+    and eases the camera there. Zooming keeps the point under the pointer
+    where it is.
+
+    Camera positions are in tiles, the centre of the view.
+*/
+class ViewInput {
+public:
+    ViewInput(double ortho_height=DEFAULT_ORTHO_HEIGHT);
+
+    void pointer_moved(double x, double y);
+    void scrolled(double steps_x, double steps_y);
+    void zoomed(double steps);
+
+    //Straight there with no easing, for the scrollbars and anything else that isn't a gesture
+    void jump_to(double x, double y);
+
+    //Straight to this zoom with no easing, within the zoom limits
+    void set_ortho_height(double height);
+
+    void set_viewport(uint32_t width, uint32_t height);
+    void set_bounds(double min_x, double max_x, double min_y, double max_y);
+
+    //Once per frame, returns ViewChange flags for what the camera needs
+    uint32_t advance(uint64_t now_ns);
+
+    double camera_x() const { return camera_x_; }
+    double camera_y() const { return camera_y_; }
+    double ortho_height() const { return ortho_height_; }
+
+    //True once the camera has caught up with the input
+    bool settled() const;
+
+    const FrameInput& last_input() const { return last_input_; }
+    uint32_t last_changes() const { return last_changes_; }
+
+private:
+    FrameInput pending_;
+    FrameInput last_input_;
+    uint32_t last_changes_;
+    uint32_t forced_changes_; //Applied on the next frame whatever the easing does
+
+    double camera_x_;
+    double camera_y_;
+    double ortho_height_;
+
+    double target_x_;
+    double target_y_;
+    double target_height_;
+
+    bool has_bounds_;
+    double min_x_;
+    double max_x_;
+    double min_y_;
+    double max_y_;
+
+    uint32_t viewport_width_;
+    uint32_t viewport_height_;
+    uint64_t last_frame_ns_;
+
+    void clamp_target();
+};
+
+}
+
+#endif // VIEW_INPUT_H
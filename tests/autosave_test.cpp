@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unistd.h>
+
+#include "level.h"
+#include "layer.h"
+#include "level_file.h"
+#include "autosave.h"
+
+/*
+    Behaviour checks for the autosaver, load_autosave() and recovering an
+    autosave left behind by an editor that died, run by ctest. Files go in
+    a fresh directory under the working directory, removed at the end.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t WIDTH = 70;
+const uint32_t HEIGHT = 40;
+
+//Nothing can have a pid this high, so its autosave always counts as orphaned
+const char* DEAD_PID_FILE = "999999999.pnas";
+
+uint32_t failures = 0;
+std::string directory;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::string path_in_directory(const std::string& file) {
+    return directory + "/" + file;
+}
+
+//Grown on the left and bottom, so the chunk grid has an origin to get wrong
+Level::ptr build_level() {
+    Level::ptr level(new Level(WIDTH, HEIGHT));
+    level->set_name("autosaved");
+    level->add_layer();
+    level->add_layer();
+
+    for(uint32_t i = 0; i < 6; ++i) {
+        level->palette().id_for_path("tiles/" + std::to_string(i) + ".png");
+    }
+
+    for(uint32_t l = 0; l < level->layer_count(); ++l) {
+        for(uint32_t i = 0; i < 900; ++i) {
+            level->layer_at(l).set_tile((i * 7 + l) % WIDTH, (i * 13) % HEIGHT, (i + l) % 6);
+        }
+    }
+    level->metadata().fill(CellRect(5, 5, 30, 3), METADATA_FLAG_SOLID, true);
+
+    level->extend(5, 3, 0, 0);
+    level->layer_at(1).set_tile(0, 0, 3);
+    level->metadata().set_flags(0, 0, METADATA_FLAG_HAZARD);
+    level->flush_render();
+    return level;
+}
+
+bool same_level(Level& a, Level& b) {
+    if(a.name() != b.name() || a.horizontal_tile_count() != b.horizontal_tile_count() ||
+       a.vertical_tile_count() != b.vertical_tile_count() || a.layer_count() != b.layer_count() ||
+       a.palette().size() != b.palette().size()) {
+        return false;
+    }
+
+    for(uint32_t l = 0; l < a.layer_count(); ++l) {
+        for(uint32_t y = 0; y < a.vertical_tile_count(); ++y) {
+            for(uint32_t x = 0; x < a.horizontal_tile_count(); ++x) {
+                if(a.layer_at(l).tile_image_at(x, y) != b.layer_at(l).tile_image_at(x, y)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    for(uint32_t y = 0; y < a.vertical_tile_count(); ++y) {
+        for(uint32_t x = 0; x < a.horizontal_tile_count(); ++x) {
+            if(a.metadata().flags_at(x, y) != b.metadata().flags_at(x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//False if the autosave couldn't be loaded or doesn't match
+bool loads_as(const std::string& path, Level& expected) {
+    try {
+        return same_level(*load_autosave(path), expected);
+    } catch(LevelFileError& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+}
+
+std::vector<uint8_t> read_file(const std::string& path) {
+    std::ifstream filein(path.c_str(), std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(filein)), std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string& path, const std::vector<uint8_t>& data) {
+    std::ofstream fileout(path.c_str(), std::ios::binary | std::ios::trunc);
+    fileout.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+bool rejected(const std::string& path) {
+    try {
+        load_autosave(path);
+    } catch(LevelFileError& e) {
+        return true;
+    }
+    return false;
+}
+
+void save_now(Autosaver& saver, Level& level) {
+    saver.save(level);
+    saver.wait();
+}
+
+void test_round_trip() {
+    Level::ptr level = build_level();
+    std::string path = path_in_directory("round_trip.pnas");
+
+    {
+        Autosaver saver(path);
+        save_now(saver, *level);
+        AutosaveResult result = saver.last_result();
+        check(result.ok, "the first save succeeds");
+        check(result.chunks_reused == 0, "the first save encodes every chunk");
+    }
+
+    check(loads_as(path, *level), "an autosave loads back cell for cell");
+    remove(path.c_str());
+}
+
+void test_incremental() {
+    Level::ptr level = build_level();
+    std::string path = path_in_directory("incremental.pnas");
+
+    Autosaver saver(path);
+    save_now(saver, *level);
+    uint32_t encoded_first = saver.last_result().chunks_encoded;
+
+    level->layer_at(2).set_tile(40, 20, 5);
+    level->metadata().set_flags(41, 21, METADATA_FLAG_LADDER);
+    save_now(saver, *level);
+    AutosaveResult result = saver.last_result();
+    check(result.ok, "an incremental save succeeds");
+    check(result.chunks_encoded == 2, "only the edited tile and metadata chunks are encoded again");
+    check(result.chunks_reused >= encoded_first - 2, "every other chunk is reused");
+    check(loads_as(path, *level), "an incremental autosave loads back cell for cell");
+
+    save_now(saver, *level);
+    check(saver.last_result().chunks_encoded == 0, "saving an unchanged level encodes nothing");
+
+    //Layers shifting down must not be matched with their old chunks
+    level->add_layer();
+    level->layer_at(3).set_tile(3, 3, 1);
+    level->remove_layer(1);
+    save_now(saver, *level);
+    check(saver.last_result().ok, "a save after adding and removing layers succeeds");
+    check(loads_as(path, *level), "layers come back in their new order");
+
+    level->extend(-5, 0, 17, 2);
+    save_now(saver, *level);
+    check(loads_as(path, *level), "a resized level comes back at its new size");
+
+    remove(path.c_str());
+}
+
+void test_damaged() {
+    Level::ptr level = build_level();
+    std::string path = path_in_directory("damaged.pnas");
+    std::string damaged_path = path_in_directory("damaged_copy.pnas");
+
+    {
+        Autosaver saver(path);
+        save_now(saver, *level);
+    }
+    std::vector<uint8_t> data = read_file(path);
+
+    check(rejected(path_in_directory("missing.pnas")), "a missing autosave is rejected");
+
+    bool all_rejected = true;
+    for(size_t length = 0; length < data.size(); ++length) {
+        write_file(damaged_path, std::vector<uint8_t>(data.begin(), data.begin() + length));
+        all_rejected = all_rejected && rejected(damaged_path);
+    }
+    check(all_rejected, "every truncation of an autosave is rejected");
+
+    std::vector<uint8_t> bad_magic(data);
+    bad_magic[0] = 'X';
+    write_file(damaged_path, bad_magic);
+    check(rejected(damaged_path), "files without the magic are rejected");
+
+    std::vector<uint8_t> newer(data);
+    newer[4] = AUTOSAVE_FILE_VERSION + 1;
+    write_file(damaged_path, newer);
+    check(rejected(damaged_path), "autosaves from a newer version are rejected");
+
+    //Mangles the compressed data near the end, which is the metadata's last blocks
+    std::vector<uint8_t> mangled(data);
+    for(size_t i = mangled.size() - 8; i < mangled.size(); ++i) {
+        mangled[i] ^= 0x5A;
+    }
+    write_file(damaged_path, mangled);
+    check(rejected(damaged_path), "corrupt chunk data is rejected");
+
+    remove(path.c_str());
+    remove(damaged_path.c_str());
+}
+
+void test_claim_orphaned() {
+    check(claim_orphaned_autosave(path_in_directory("missing")).empty(), "a missing directory has nothing to recover");
+    check(claim_orphaned_autosave(directory).empty(), "an empty directory has nothing to recover");
+
+    Level::ptr orphaned = build_level();
+    Level::ptr running = build_level();
+    running->set_name("still open");
+
+    //The parent is still running, so its autosave is left alone
+    std::string running_path = path_in_directory(std::to_string(getppid()) + ".pnas");
+    std::string orphan_path = path_in_directory(DEAD_PID_FILE);
+    {
+        Autosaver saver(orphan_path);
+        save_now(saver, *orphaned);
+    }
+    {
+        Autosaver saver(running_path);
+        save_now(saver, *running);
+    }
+    write_file(path_in_directory("notes.txt"), std::vector<uint8_t>(4, 'x'));
+
+    std::string claimed = claim_orphaned_autosave(directory);
+    check(claimed == autosave_path(directory), "the orphan is claimed under this editor's own autosave path");
+    check(loads_as(claimed, *orphaned), "the claimed autosave is the orphaned one");
+    check(rejected(orphan_path), "the orphan is moved rather than copied, so nothing else can claim it");
+    check(loads_as(running_path, *running), "a running editor's autosave is left where it is");
+
+    remove(claimed.c_str());
+    check(claim_orphaned_autosave(directory).empty(), "running editors' autosaves are never claimed");
+
+    remove(running_path.c_str());
+    remove(path_in_directory("notes.txt").c_str());
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    char pattern[] = "autosave_test.XXXXXX";
+    if(!mkdtemp(pattern)) {
+        std::cerr << "Unable to create a directory to autosave into" << std::endl;
+        return 1;
+    }
+    directory = pattern;
+
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "round_trip", test_round_trip },
+        { "incremental", test_incremental },
+        { "damaged", test_damaged },
+        { "claim_orphaned", test_claim_orphaned }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    rmdir(directory.c_str());
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+#include "autotile.h"
+
+/*
+    Behaviour checks for AutotileBatch, run by ctest. After any mix of
+    paints, fills and erases, a commit has to leave every cell as if the
+    whole layer had been autotiled from scratch, while only evaluating the
+    cells the edits could have changed.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 32;
+const uint32_t WIDTH = 70;
+const uint32_t HEIGHT = 40;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+/*
+    Grass has a tile for every edge mask plus an inner tile for cells with
+    all eight neighbours, so its diagonals matter. Water only has some of
+    the edge masks, so the rest fall back to its default tile.
+*/
+Autotiler build_autotiler(Level& level) {
+    Autotiler autotiler;
+
+    Terrain grass;
+    grass.name = "grass";
+    grass.neighbours = 8;
+    grass.default_tile = level.palette().id_for_path("grass/default.png");
+    for(uint32_t mask = 0; mask <= EDGE_NEIGHBOUR_MASK; ++mask) {
+        grass.tile_for_mask[mask] = level.palette().id_for_path("grass/" + std::to_string(mask) + ".png");
+    }
+    grass.tile_for_mask[NEIGHBOUR_MASK_COUNT - 1] = level.palette().id_for_path("grass/inner.png");
+    autotiler.add_terrain(grass);
+
+    Terrain water;
+    water.name = "water";
+    water.default_tile = level.palette().id_for_path("water/default.png");
+    for(uint32_t mask = 0; mask <= EDGE_NEIGHBOUR_MASK; mask += 3) {
+        water.tile_for_mask[mask] = level.palette().id_for_path("water/" + std::to_string(mask) + ".png");
+    }
+    autotiler.add_terrain(water);
+
+    return autotiler;
+}
+
+//The tile every cell should have, worked out from the terrain painted in each cell
+int32_t expected_tile(const Autotiler& autotiler, const std::vector<int32_t>& terrains, uint32_t x, uint32_t y) {
+    int32_t terrain = terrains[(y * WIDTH) + x];
+    if(terrain < 0) {
+        return -1;
+    }
+
+    const int32_t offsets[8][2] = {
+        {0, 1}, {1, 0}, {0, -1}, {-1, 0},
+        {1, 1}, {1, -1}, {-1, -1}, {-1, 1}
+    };
+
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < 8; ++i) {
+        int32_t nx = int32_t(x) + offsets[i][0];
+        int32_t ny = int32_t(y) + offsets[i][1];
+        if(nx >= 0 && ny >= 0 && nx < int32_t(WIDTH) && ny < int32_t(HEIGHT) && terrains[(ny * WIDTH) + nx] == terrain) {
+            mask |= (1 << i);
+        }
+    }
+
+    //A corner only counts with both of its edges
+    if((mask & (NEIGHBOUR_N | NEIGHBOUR_E)) != (NEIGHBOUR_N | NEIGHBOUR_E)) mask &= ~NEIGHBOUR_NE;
+    if((mask & (NEIGHBOUR_S | NEIGHBOUR_E)) != (NEIGHBOUR_S | NEIGHBOUR_E)) mask &= ~NEIGHBOUR_SE;
+    if((mask & (NEIGHBOUR_S | NEIGHBOUR_W)) != (NEIGHBOUR_S | NEIGHBOUR_W)) mask &= ~NEIGHBOUR_SW;
+    if((mask & (NEIGHBOUR_N | NEIGHBOUR_W)) != (NEIGHBOUR_N | NEIGHBOUR_W)) mask &= ~NEIGHBOUR_NW;
+
+    return autotiler.resolve(terrain, mask);
+}
+
+bool layer_matches(const Autotiler& autotiler, Layer& layer, const std::vector<int32_t>& terrains) {
+    for(uint32_t y = 0; y < HEIGHT; ++y) {
+        for(uint32_t x = 0; x < WIDTH; ++x) {
+            if(layer.tile_image_at(x, y) != expected_tile(autotiler, terrains, x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void test_matches_full_evaluation() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Autotiler autotiler = build_autotiler(level);
+    Layer& layer = level.layer_at(0);
+
+    std::vector<int32_t> terrains(WIDTH * HEIGHT, -1);
+
+    bool all_match = true;
+    for(uint32_t round = 0; round < 50; ++round) {
+        AutotileBatch batch(autotiler, layer);
+
+        for(uint32_t edit = 0; edit < 20; ++edit) {
+            int32_t terrain = int32_t(random() % 3) - 1;
+            uint32_t x = random() % WIDTH;
+            uint32_t y = random() % HEIGHT;
+
+            if(random() % 4) {
+                batch.paint(x, y, terrain);
+                terrains[(y * WIDTH) + x] = terrain;
+            } else {
+                //Fills may run off the layer, which clips them
+                uint32_t width = 1 + random() % 20;
+                uint32_t height = 1 + random() % 20;
+                batch.fill(x, y, width, height, terrain);
+                for(uint32_t fy = y; fy < std::min(y + height, HEIGHT); ++fy) {
+                    for(uint32_t fx = x; fx < std::min(x + width, WIDTH); ++fx) {
+                        terrains[(fy * WIDTH) + fx] = terrain;
+                    }
+                }
+            }
+        }
+
+        batch.commit();
+        all_match = all_match && layer_matches(autotiler, layer, terrains);
+    }
+
+    check(all_match, "every commit leaves the layer as a full autotile pass would");
+}
+
+void test_evaluated_cells() {
+    Level level(WIDTH, HEIGHT);
+    Autotiler autotiler = build_autotiler(level);
+    Layer& layer = level.layer_at(0);
+
+    AutotileBatch batch(autotiler, layer);
+    batch.fill(0, 0, WIDTH, HEIGHT, 0);
+    check(batch.commit() == WIDTH * HEIGHT, "filling the layer evaluates each cell once");
+    check(layer.tile_image_at(5, 5) == autotiler.terrain(0).tile_for_mask[NEIGHBOUR_MASK_COUNT - 1], "cells inside a solid block use the inner tile");
+    check(layer.tile_image_at(0, 0) == autotiler.terrain(0).tile_for_mask[NEIGHBOUR_N | NEIGHBOUR_E], "the corner cell falls back to its edges");
+
+    check(batch.commit() == 0, "committing again with no edits evaluates nothing");
+
+    batch.paint(20, 20, -1);
+    check(batch.commit() == 9, "a single paint evaluates the cell and its neighbours");
+    check(layer.tile_image_at(20, 21) == autotiler.terrain(0).tile_for_mask[EDGE_NEIGHBOUR_MASK & ~NEIGHBOUR_S], "the neighbours of an erased cell lose that edge");
+
+    batch.paint(30, 20, 1);
+    batch.paint(31, 20, 1);
+    check(batch.commit() == 12, "neighbouring paints share the cells they both touch");
+
+    batch.fill(10, 10, 5, 5, 1);
+    check(batch.commit() == 49, "a fill evaluates the area and the ring around it");
+
+    batch.paint(0, 0, 1);
+    check(batch.commit() == 4, "paints in a corner only evaluate cells inside the layer");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "matches_full_evaluation", test_matches_full_evaluation },
+        { "evaluated_cells", test_evaluated_cells }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,209 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+
+/*
+    Behaviour checks for growing and shrinking layers with Layer::extend(),
+    run by ctest. Every resize is checked against a plain grid of tile ids
+    resized the slow way.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 30;
+const uint32_t WIDTH = 70;
+const uint32_t HEIGHT = 40;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+//What the layer should hold, row major from cell (0, 0)
+struct Expected {
+    uint32_t width;
+    uint32_t height;
+    std::vector<int32_t> tiles;
+
+    void extend(int32_t left, int32_t bottom, int32_t right, int32_t top) {
+        uint32_t new_width = uint32_t(int32_t(width) + left + right);
+        uint32_t new_height = uint32_t(int32_t(height) + bottom + top);
+
+        std::vector<int32_t> moved(new_width * new_height, -1);
+        for(uint32_t y = 0; y < new_height; ++y) {
+            for(uint32_t x = 0; x < new_width; ++x) {
+                int32_t old_x = int32_t(x) - left;
+                int32_t old_y = int32_t(y) - bottom;
+                if(old_x >= 0 && old_y >= 0 && old_x < int32_t(width) && old_y < int32_t(height)) {
+                    moved[(y * new_width) + x] = tiles[(old_y * width) + old_x];
+                }
+            }
+        }
+
+        width = new_width;
+        height = new_height;
+        tiles.swap(moved);
+    }
+};
+
+Expected fill_randomly(Layer& layer, std::mt19937& random) {
+    Expected expected = { layer.width(), layer.height(), std::vector<int32_t>() };
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < layer.width(); ++x) {
+            int32_t tile = int32_t(random() % 5) - 1;
+            layer.set_tile(x, y, tile);
+            expected.tiles.push_back(tile);
+        }
+    }
+    layer.flush_render();
+    return expected;
+}
+
+bool matches(const Layer& layer, const Expected& expected) {
+    if(layer.width() != expected.width || layer.height() != expected.height) {
+        return false;
+    }
+
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < layer.width(); ++x) {
+            if(layer.tile_image_at(x, y) != expected.tiles[(y * expected.width) + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//Cells of the chunk grid outside the layer must be empty, or growing the layer again would bring old tiles back
+bool outside_is_empty(Layer& layer) {
+    for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+            for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                uint32_t grid_x = (cx * CHUNK_SIZE) + (i % CHUNK_SIZE);
+                uint32_t grid_y = (cy * CHUNK_SIZE) + (i / CHUNK_SIZE);
+                if(!layer.in_bounds(grid_x, grid_y) && layer.chunk(cx, cy).tile_image(i) != -1) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+bool grid_fits(Layer& layer) {
+    return layer.origin_x() < CHUNK_SIZE && layer.origin_y() < CHUNK_SIZE &&
+        layer.chunks_across() == (layer.origin_x() + layer.width() + CHUNK_SIZE - 1) / CHUNK_SIZE &&
+        layer.chunks_down() == (layer.origin_y() + layer.height() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+const ChunkCells* cells_holding(Layer& layer, uint32_t x, uint32_t y) {
+    return layer.chunk((x + layer.origin_x()) / CHUNK_SIZE, (y + layer.origin_y()) / CHUNK_SIZE).cells.get();
+}
+
+void test_each_edge() {
+    std::mt19937 random(SEED);
+
+    const int32_t edges[][4] = {
+        { 3, 0, 0, 0 }, { 0, 5, 0, 0 }, { 0, 0, 7, 0 }, { 0, 0, 0, 9 },
+        { -3, 0, 0, 0 }, { 0, -5, 0, 0 }, { 0, 0, -7, 0 }, { 0, 0, 0, -9 },
+        { 16, 16, 16, 16 }, { -16, -16, -16, -16 }, { 20, -1, -20, 1 }
+    };
+
+    for(const int32_t* edge: edges) {
+        Level level(WIDTH, HEIGHT);
+        Layer& layer = level.layer_at(0);
+        Expected expected = fill_randomly(layer, random);
+
+        layer.extend(edge[0], edge[1], edge[2], edge[3]);
+        expected.extend(edge[0], edge[1], edge[2], edge[3]);
+
+        std::string what = "extend(" + std::to_string(edge[0]) + ", " + std::to_string(edge[1]) + ", " +
+            std::to_string(edge[2]) + ", " + std::to_string(edge[3]) + ")";
+        check(matches(layer, expected), what + " keeps every tile where it was");
+        check(grid_fits(layer), what + " leaves a chunk grid just big enough for the layer");
+        check(outside_is_empty(layer), what + " empties cells that fall outside the layer");
+    }
+}
+
+void test_random_sequence() {
+    std::mt19937 random(SEED);
+
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = level.layer_at(0);
+    Expected expected = fill_randomly(layer, random);
+
+    bool all_match = true;
+    bool all_empty_outside = true;
+    for(uint32_t step = 0; step < 200; ++step) {
+        int32_t left = int32_t(random() % 41) - 20;
+        int32_t bottom = int32_t(random() % 41) - 20;
+        int32_t right = int32_t(random() % 41) - 20;
+        int32_t top = int32_t(random() % 41) - 20;
+
+        //Stay between one cell and a few hundred across
+        if(int32_t(layer.width()) + left + right < 1 || int32_t(layer.width()) + left + right > 300 ||
+           int32_t(layer.height()) + bottom + top < 1 || int32_t(layer.height()) + bottom + top > 300) {
+            continue;
+        }
+
+        layer.extend(left, bottom, right, top);
+        expected.extend(left, bottom, right, top);
+
+        //New cells get painted too, so later shrinks have something to drop
+        uint32_t x = random() % layer.width();
+        uint32_t y = random() % layer.height();
+        layer.set_tile(x, y, 2);
+        expected.tiles[(y * expected.width) + x] = 2;
+        layer.flush_render();
+
+        all_match = all_match && matches(layer, expected);
+        all_empty_outside = all_empty_outside && outside_is_empty(layer) && grid_fits(layer);
+    }
+
+    check(all_match, "a long run of random resizes keeps every tile where it was");
+    check(all_empty_outside, "a long run of random resizes never leaves tiles outside the layer");
+}
+
+void test_chunks_are_moved() {
+    std::mt19937 random(SEED);
+
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = level.layer_at(0);
+    fill_randomly(layer, random);
+
+    const ChunkCells* middle = cells_holding(layer, 35, 20);
+    layer.extend(CHUNK_SIZE * 2, 3, 1, CHUNK_SIZE);
+    check(cells_holding(layer, 35 + (CHUNK_SIZE * 2), 23) == middle, "growing moves chunks rather than copying their cells");
+
+    layer.extend(-int32_t(CHUNK_SIZE), -3, 0, 0);
+    check(cells_holding(layer, 35 + CHUNK_SIZE, 20) == middle, "shrinking moves chunks rather than copying their cells");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "each_edge", test_each_edge },
+        { "random_sequence", test_random_sequence },
+        { "chunks_are_moved", test_chunks_are_moved }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,231 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+#include "level_diff.h"
+
+/*
+    Behaviour checks for diff_levels() and merge_levels(), run by ctest.
+    Every level is built from scratch rather than copied, so blocks never
+    share chunks and each comparison has to go by the cells themselves.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t WIDTH = 70; //Not a multiple of CHUNK_SIZE, so the right and bottom blocks are partial
+const uint32_t HEIGHT = 40;
+const uint32_t TILE_KINDS = 6;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::string tile_path(uint32_t kind) {
+    return "tiles/" + std::to_string(kind) + ".png";
+}
+
+int32_t tile_at(Level& level, uint32_t x, uint32_t y) {
+    int32_t id = level.layer_at(0).tile_image_at(x, y);
+    return (id < 0) ? -1 : int32_t(std::stoi(level.palette().path_for_id(id).substr(6)));
+}
+
+/*
+    The same two layer level every time. reverse_palette registers the
+    tiles in the opposite order, so equal levels can have different ids.
+*/
+Level::ptr build_level(bool reverse_palette=false) {
+    Level::ptr level(new Level(WIDTH, HEIGHT));
+    level->add_layer();
+
+    for(uint32_t i = 0; i < TILE_KINDS; ++i) {
+        level->palette().id_for_path(tile_path(reverse_palette ? TILE_KINDS - 1 - i : i));
+    }
+
+    for(uint32_t l = 0; l < level->layer_count(); ++l) {
+        Layer& layer = level->layer_at(l);
+        for(uint32_t y = 0; y < HEIGHT; ++y) {
+            for(uint32_t x = 0; x < WIDTH; ++x) {
+                uint32_t kind = ((x * 7) + (y * 3) + l) % (TILE_KINDS + 2);
+                if(kind < TILE_KINDS) {
+                    layer.set_tile(x, y, level->palette().id_for_path(tile_path(kind)));
+                }
+            }
+        }
+    }
+
+    level->metadata().fill(CellRect(0, 0, WIDTH, 2), METADATA_FLAG_SOLID, true);
+    return level;
+}
+
+void set_tile(Level& level, uint32_t x, uint32_t y, uint32_t kind) {
+    level.layer_at(0).set_tile(x, y, level.palette().id_for_path(tile_path(kind)));
+}
+
+void test_identical() {
+    Level::ptr before = build_level();
+    Level::ptr after = build_level();
+
+    LevelDiff diff = diff_levels(*before, *after);
+    check(diff.identical(), "separately built equal levels have no differences");
+    check(diff.blocks_compared == 0, "equal blocks are never compared cell by cell");
+}
+
+void test_palette_order() {
+    Level::ptr before = build_level();
+    Level::ptr after = build_level(true);
+
+    LevelDiff diff = diff_levels(*before, *after);
+    check(diff.identical(), "a reordered palette alone isn't a difference");
+
+    set_tile(*after, 20, 20, 1);
+    diff = diff_levels(*before, *after);
+    check(diff.differences.size() == 1, "one edit under a reordered palette is one difference");
+    if(diff.differences.size() == 1) {
+        const CellDifference& difference = diff.differences[0];
+        check(difference.layer == 0 && difference.x == 20 && difference.y == 20, "the difference is where the edit was");
+        check(diff.palette[difference.after] == tile_path(1), "after is in the diff's palette");
+    }
+
+    //Theirs uses the reversed ids, the merge has to translate them
+    Level::ptr base = build_level();
+    Level::ptr ours = build_level();
+    Level::ptr theirs = build_level(true);
+    set_tile(*theirs, 3, 3, 5);
+
+    LevelMerge merge = merge_levels(*base, *ours, *theirs);
+    check(merge.conflicts.empty(), "an edit under a reordered palette doesn't conflict");
+    check(tile_at(*merge.level, 3, 3) == 5, "their edit keeps its tile through the palette translation");
+    check(tile_at(*merge.level, 4, 3) == tile_at(*base, 4, 3), "their untouched cells keep their tiles");
+}
+
+void test_single_cell_edits() {
+    Level::ptr before = build_level();
+    Level::ptr after = build_level();
+
+    //Every cell of a block, one at a time, so no change can hide inside an equal looking block
+    for(uint32_t y = 16; y < 32; ++y) {
+        for(uint32_t x = 16; x < 32; ++x) {
+            Layer& layer = after->layer_at(1);
+            int32_t original = layer.tile_image_at(x, y);
+            layer.set_tile(x, y, (original < 0) ? 0 : -1);
+
+            LevelDiff diff = diff_levels(*before, *after);
+            check(diff.differences.size() == 1, "a single changed cell is always found (" + std::to_string(x) + ", " + std::to_string(y) + ")");
+
+            layer.set_tile(x, y, original);
+        }
+    }
+}
+
+void test_one_sided_edits() {
+    Level::ptr base = build_level();
+    Level::ptr ours = build_level();
+    Level::ptr theirs = build_level();
+
+    //Different blocks, and different cells of the same block
+    set_tile(*ours, 1, 5, 2);
+    set_tile(*theirs, 40, 30, 3);
+    set_tile(*ours, 20, 20, 4);
+    set_tile(*theirs, 21, 20, 5);
+    ours->metadata().add_flags(10, 10, METADATA_FLAG_HAZARD);
+    theirs->metadata().add_flags(10, 10, METADATA_FLAG_LADDER);
+    theirs->metadata().remove_flags(30, 0, METADATA_FLAG_SOLID);
+
+    LevelMerge merge = merge_levels(*base, *ours, *theirs);
+    Level& merged = *merge.level;
+
+    check(merge.conflicts.empty(), "edits to different cells don't conflict");
+    check(tile_at(merged, 1, 5) == 2, "our edit is kept");
+    check(tile_at(merged, 40, 30) == 3, "their edit is kept");
+    check(tile_at(merged, 20, 20) == 4 && tile_at(merged, 21, 20) == 5, "both edits within one block are kept");
+    check(merged.metadata().flags_at(10, 10) == (METADATA_FLAG_HAZARD | METADATA_FLAG_LADDER), "flags from both sides are combined");
+    check(!(merged.metadata().flags_at(30, 0) & METADATA_FLAG_SOLID), "a flag cleared on one side stays cleared");
+    check(merged.metadata().flags_at(31, 0) == METADATA_FLAG_SOLID, "untouched flags are kept");
+
+    LevelDiff diff = diff_levels(*base, merged);
+    check(diff.differences.size() == 6, "the merge differs from the base by exactly the edits");
+}
+
+void test_conflicts() {
+    Level::ptr base = build_level();
+    Level::ptr ours = build_level();
+    Level::ptr theirs = build_level();
+
+    set_tile(*ours, 5, 5, 1);
+    set_tile(*theirs, 5, 5, 4);
+    set_tile(*ours, 6, 5, 3);
+    set_tile(*theirs, 6, 5, 3);
+
+    LevelMerge merge = merge_levels(*base, *ours, *theirs, RESOLVE_OURS);
+    check(merge.conflicts.size() == 1, "only the cell changed differently on each side conflicts");
+    if(merge.conflicts.size() == 1) {
+        const MergeConflict& conflict = merge.conflicts[0];
+        check(conflict.x == 5 && conflict.y == 5, "the conflict is at the contested cell");
+        check(merge.level->palette().path_for_id(conflict.ours) == tile_path(1), "the conflict records our tile");
+        check(merge.level->palette().path_for_id(conflict.theirs) == tile_path(4), "the conflict records their tile");
+    }
+    check(tile_at(*merge.level, 5, 5) == 1, "RESOLVE_OURS takes our tile");
+    check(tile_at(*merge.level, 6, 5) == 3, "the same edit on both sides is taken");
+
+    merge = merge_levels(*base, *ours, *theirs, RESOLVE_THEIRS);
+    check(tile_at(*merge.level, 5, 5) == 4, "RESOLVE_THEIRS takes their tile");
+}
+
+void test_resize() {
+    Level::ptr base = build_level();
+    Level::ptr ours = build_level();
+    Level::ptr theirs = build_level();
+
+    ours->resize(WIDTH + 20, HEIGHT);
+    set_tile(*ours, WIDTH + 5, 3, 1);
+    set_tile(*theirs, 2, 30, 4);
+
+    LevelMerge merge = merge_levels(*base, *ours, *theirs);
+    Level& merged = *merge.level;
+    check(merged.horizontal_tile_count() == WIDTH + 20 && merged.vertical_tile_count() == HEIGHT, "the merge takes the resized side's size");
+    check(tile_at(merged, WIDTH + 5, 3) == 1, "an edit in the grown area is kept");
+    check(tile_at(merged, 2, 30) == 4, "the other side's edit survives the resize");
+
+    LevelDiff diff = diff_levels(*base, *ours);
+    check(diff.differences.size() == 1, "growing a level only differs where the new cells were painted");
+
+    theirs->resize(WIDTH, HEIGHT + 10);
+    bool threw = false;
+    try {
+        merge_levels(*base, *ours, *theirs);
+    } catch(LevelMergeError& e) {
+        threw = true;
+    }
+    check(threw, "resizing differently on both sides is an error");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "identical", test_identical },
+        { "palette_order", test_palette_order },
+        { "single_cell_edits", test_single_cell_edits },
+        { "one_sided_edits", test_one_sided_edits },
+        { "conflicts", test_conflicts },
+        { "resize", test_resize }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
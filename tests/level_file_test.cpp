@@ -0,0 +1,228 @@
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+#include "level_file.h"
+
+/*
+    Behaviour checks for reading and writing levels in both formats, run by
+    ctest. A level has to come back cell for cell, and a damaged file has
+    to be turned down with a LevelFileError rather than crash the editor
+    or come back half read.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t WIDTH = 70; //Not a multiple of CHUNK_SIZE, so the last chunk of each row is partial
+const uint32_t HEIGHT = 33;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+//Two named layers, long runs and single cells, flags in a block and on their own
+Level::ptr build_level() {
+    Level::ptr level(new Level(WIDTH, HEIGHT));
+    level->set_name("test \"level\"");
+    level->add_layer();
+    level->layer_at(1).set_name("foreground");
+
+    level->palette().id_for_path("tiles/a.png");
+    level->palette().id_for_path("tiles/b.png");
+    level->palette().id_for_path("tiles/c.png");
+
+    for(uint32_t x = 0; x < WIDTH; ++x) {
+        level->layer_at(0).set_tile(x, 0, 0);
+    }
+    for(uint32_t i = 0; i < 500; ++i) {
+        level->layer_at(i % 2).set_tile((i * 7) % WIDTH, (i * 13) % HEIGHT, i % 3);
+    }
+
+    level->metadata().fill(CellRect(10, 10, 20, 5), METADATA_FLAG_SOLID, true);
+    level->metadata().set_flags(3, 4, METADATA_FLAG_SOLID | METADATA_FLAG_HAZARD);
+    return level;
+}
+
+bool same_level(Level& a, Level& b) {
+    if(a.name() != b.name() || a.horizontal_tile_count() != b.horizontal_tile_count() ||
+       a.vertical_tile_count() != b.vertical_tile_count() || a.layer_count() != b.layer_count() ||
+       a.palette().size() != b.palette().size()) {
+        return false;
+    }
+
+    for(uint32_t i = 0; i < a.palette().size(); ++i) {
+        if(a.palette().path_for_id(i) != b.palette().path_for_id(i)) {
+            return false;
+        }
+    }
+
+    for(uint32_t l = 0; l < a.layer_count(); ++l) {
+        if(a.layer_at(l).name() != b.layer_at(l).name()) {
+            return false;
+        }
+
+        for(uint32_t y = 0; y < a.vertical_tile_count(); ++y) {
+            for(uint32_t x = 0; x < a.horizontal_tile_count(); ++x) {
+                if(a.layer_at(l).tile_image_at(x, y) != b.layer_at(l).tile_image_at(x, y)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    for(uint32_t y = 0; y < a.vertical_tile_count(); ++y) {
+        for(uint32_t x = 0; x < a.horizontal_tile_count(); ++x) {
+            if(a.metadata().flags_at(x, y) != b.metadata().flags_at(x, y)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//True if reading the data is turned down the way the editor expects
+bool rejected(const std::vector<uint8_t>& data, LevelFormat format) {
+    try {
+        read_level(data, format);
+    } catch(LevelFileError& e) {
+        return true;
+    }
+    return false;
+}
+
+std::vector<uint8_t> replaced(const std::vector<uint8_t>& data, const std::string& from, const std::string& to) {
+    std::string text(data.begin(), data.end());
+    size_t at = text.find(from);
+    if(at != std::string::npos) {
+        text.replace(at, from.size(), to);
+    }
+    return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+void test_round_trip(LevelFormat format, const std::string& name) {
+    Level::ptr level = build_level();
+
+    std::vector<uint8_t> data;
+    write_level(*level, format, data);
+    Level::ptr back = read_level(data, format);
+    check(same_level(*level, *back), name + " levels come back cell for cell");
+
+    std::vector<uint8_t> again;
+    write_level(*back, format, again);
+    check(again == data, name + " levels are written the same after a round trip");
+}
+
+void test_binary_round_trip() {
+    test_round_trip(LEVEL_FORMAT_BINARY, ".pnl");
+}
+
+void test_json_round_trip() {
+    test_round_trip(LEVEL_FORMAT_JSON, "JSON");
+}
+
+void test_truncated() {
+    Level::ptr level = build_level();
+
+    for(LevelFormat format: { LEVEL_FORMAT_BINARY, LEVEL_FORMAT_JSON }) {
+        std::vector<uint8_t> data;
+        write_level(*level, format, data);
+
+        bool all_rejected = true;
+        for(size_t length = 0; length < data.size(); ++length) {
+            //Trailing whitespace is still a whole document
+            if(format == LEVEL_FORMAT_JSON && isspace(data[length])) {
+                continue;
+            }
+            all_rejected = all_rejected && rejected(std::vector<uint8_t>(data.begin(), data.begin() + length), format);
+        }
+        check(all_rejected, std::string("every truncation of a ") + (format == LEVEL_FORMAT_JSON ? "JSON" : ".pnl") + " level is rejected");
+    }
+}
+
+void test_corrupt_binary() {
+    Level::ptr level = build_level();
+    std::vector<uint8_t> data;
+    write_level(*level, LEVEL_FORMAT_BINARY, data);
+
+    std::vector<uint8_t> bad_magic(data);
+    bad_magic[0] = 'X';
+    check(rejected(bad_magic, LEVEL_FORMAT_BINARY), "files without the magic are rejected");
+
+    std::vector<uint8_t> newer(data);
+    newer[4] = LEVEL_FILE_VERSION + 1;
+    check(rejected(newer, LEVEL_FORMAT_BINARY), "files from a newer version are rejected");
+
+    //The name is a u32 length then the bytes, width and height follow
+    size_t size_at = 8 + 4 + level->name().size();
+
+    std::vector<uint8_t> huge(data);
+    huge[size_at + 3] = 0x7F;
+    huge[size_at + 7] = 0x7F;
+    check(rejected(huge, LEVEL_FORMAT_BINARY), "an absurd width and height is rejected before anything is allocated");
+
+    std::vector<uint8_t> zero(data);
+    for(size_t i = size_at; i < size_at + 4; ++i) {
+        zero[i] = 0;
+    }
+    check(rejected(zero, LEVEL_FORMAT_BINARY), "a zero width is rejected");
+
+    //A level one row shorter than its cells, so the runs overrun it
+    std::vector<uint8_t> shorter(data);
+    shorter[size_at + 4] = HEIGHT - 1;
+    check(rejected(shorter, LEVEL_FORMAT_BINARY), "cell runs past the end of the level are rejected");
+
+    std::vector<uint8_t> taller(data);
+    taller[size_at + 4] = HEIGHT + 1;
+    check(rejected(taller, LEVEL_FORMAT_BINARY), "cell runs that don't cover the level are rejected");
+
+    std::vector<uint8_t> name_too_long(data);
+    name_too_long[11] = 0x7F;
+    check(rejected(name_too_long, LEVEL_FORMAT_BINARY), "a string longer than the file is rejected");
+}
+
+void test_corrupt_json() {
+    Level::ptr level = build_level();
+    std::vector<uint8_t> data;
+    write_level(*level, LEVEL_FORMAT_JSON, data);
+
+    check(rejected(replaced(data, "platformation-level", "something-else"), LEVEL_FORMAT_JSON), "documents of another format are rejected");
+    check(rejected(replaced(data, "\"version\": 1", "\"version\": 99"), LEVEL_FORMAT_JSON), "documents from a newer version are rejected");
+    check(rejected(replaced(data, "\"width\": 70", "\"width\": 70000000"), LEVEL_FORMAT_JSON), "an absurd width is rejected");
+    check(rejected(replaced(data, "\"height\": 33", "\"height\": 32"), LEVEL_FORMAT_JSON), "cell runs past the end of the level are rejected");
+    check(rejected(replaced(data, "\"height\": 33", "\"height\": 34"), LEVEL_FORMAT_JSON), "cell runs that don't cover the level are rejected");
+    check(rejected(replaced(data, "\"layers\"", "\"levels\""), LEVEL_FORMAT_JSON), "a document without layers is rejected");
+    check(rejected(replaced(data, "\"tiles\"", "\"tile\""), LEVEL_FORMAT_JSON), "a layer without tiles is rejected");
+    check(rejected(replaced(data, "*", "*x"), LEVEL_FORMAT_JSON), "malformed run lengths are rejected");
+    check(rejected(replaced(data, "*", "*0 "), LEVEL_FORMAT_JSON), "zero length runs are rejected");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "binary_round_trip", test_binary_round_trip },
+        { "json_round_trip", test_json_round_trip },
+        { "truncated", test_truncated },
+        { "corrupt_binary", test_corrupt_binary },
+        { "corrupt_json", test_corrupt_json }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
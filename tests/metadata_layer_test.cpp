@@ -0,0 +1,233 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#include "metadata_layer.h"
+#include "rect_merge.h"
+
+/*
+    Behaviour checks for MetadataLayer's rectangle index and the queries
+    answered from it, run by ctest. Every answer is compared with a brute
+    force walk over flags_at().
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 33;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+//Scattered solid boxes, extended on every side afterwards so the grid has an origin
+MetadataLayer build_layer(std::mt19937& random) {
+    MetadataLayer layer(300, 200);
+    for(uint32_t i = 0; i < 4000; ++i) {
+        CellRect area(random() % 300, random() % 200, (random() % 6) + 1, (random() % 4) + 1);
+        layer.fill(area, METADATA_FLAG_SOLID, (random() % 4) != 0);
+    }
+    for(uint32_t i = 0; i < 300; ++i) {
+        layer.add_flags(random() % 300, random() % 200, METADATA_FLAG_HAZARD);
+    }
+
+    layer.extend(7, 3, -5, 9);
+    layer.extend(-2, -1, 4, 0);
+    return layer;
+}
+
+bool brute_any(const MetadataLayer& layer, float min_x, float min_y, float max_x, float max_y, MetadataFlags mask) {
+    for(uint32_t y = uint32_t(std::max(min_y, 0.0f)); y < layer.height() && float(y) < max_y; ++y) {
+        for(uint32_t x = uint32_t(std::max(min_x, 0.0f)); x < layer.width() && float(x) < max_x; ++x) {
+            if(layer.flags_at(x, y) & mask) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void test_rectangles_cover_flags() {
+    std::mt19937 random(SEED);
+    MetadataLayer layer = build_layer(random);
+
+    for(uint32_t flag_bit = 0; flag_bit < 3; ++flag_bit) {
+        std::vector<CellRect> rects;
+        layer.rectangles(flag_bit, rects);
+
+        std::vector<uint32_t> covered(layer.width() * layer.height(), 0);
+        for(const CellRect& rect: rects) {
+            for(uint32_t y = rect.y; y < rect.y + rect.height; ++y) {
+                for(uint32_t x = rect.x; x < rect.x + rect.width; ++x) {
+                    covered[(y * layer.width()) + x]++;
+                }
+            }
+        }
+
+        bool exact = true;
+        for(uint32_t y = 0; y < layer.height(); ++y) {
+            for(uint32_t x = 0; x < layer.width(); ++x) {
+                bool set = (layer.flags_at(x, y) & (1 << flag_bit)) != 0;
+                exact = exact && covered[(y * layer.width()) + x] == (set ? 1u : 0u);
+            }
+        }
+        check(exact, std::string("rectangles cover every ") + metadata_flag_name(flag_bit) + " cell exactly once");
+    }
+}
+
+void test_chunk_rects_match_greedy_merge() {
+    std::mt19937 random(SEED);
+    MetadataLayer layer = build_layer(random);
+
+    bool same = true;
+    for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+        for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+            const MetadataChunk& chunk = *layer.chunk(cx, cy);
+
+            std::vector<CellRect> expected;
+            greedy_merge(CHUNK_SIZE, CHUNK_SIZE, [&](uint32_t x, uint32_t y) {
+                return chunk.flags[0].test((y * CHUNK_SIZE) + x);
+            }, expected);
+
+            const std::vector<MetadataChunk::Rect>& rects = chunk.rects[0];
+            same = same && rects.size() == expected.size();
+            for(uint32_t i = 0; same && i < rects.size(); ++i) {
+                same = rects[i].x == expected[i].x && rects[i].y == expected[i].y &&
+                    rects[i].width == expected[i].width && rects[i].height == expected[i].height;
+            }
+        }
+    }
+    check(same, "each chunk's rectangles are what greedy_merge gives");
+}
+
+void test_copy_on_write() {
+    std::mt19937 random(SEED);
+    MetadataLayer layer = build_layer(random);
+
+    //Chunk aligned, so the block is the layer's own chunk
+    int32_t x = CHUNK_SIZE - int32_t(layer.origin_x());
+    int32_t y = CHUNK_SIZE - int32_t(layer.origin_y());
+    MetadataChunk::ptr block = layer.copy_block(x, y);
+    std::vector<MetadataChunk::Rect> before = block->rects[0];
+
+    layer.fill(CellRect(x, y, CHUNK_SIZE, CHUNK_SIZE), METADATA_FLAG_SOLID, true);
+
+    check(block->rects[0].size() == before.size(), "writing the layer leaves a copied block's rectangles alone");
+    check(layer.chunk(1, 1)->rects[0].size() == 1, "a filled chunk is one rectangle");
+}
+
+void test_query_aabb() {
+    std::mt19937 random(SEED);
+    MetadataLayer layer = build_layer(random);
+
+    bool agree = true;
+    double total_us = 0;
+    for(uint32_t i = 0; i < 5000; ++i) {
+        float min_x = float(random() % (layer.width() * 10)) / 10.0f - 2.0f;
+        float min_y = float(random() % (layer.height() * 10)) / 10.0f - 2.0f;
+        //Edges never land on a cell boundary, where float rounding would decide the answer
+        float max_x = min_x + float(random() % 60) / 10.0f + 0.15f;
+        float max_y = min_y + float(random() % 40) / 10.0f + 0.15f;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<CellRect> found;
+        layer.query_aabb(min_x, min_y, max_x, max_y, METADATA_FLAG_SOLID, found);
+        bool any = layer.any_in_aabb(min_x, min_y, max_x, max_y, METADATA_FLAG_SOLID);
+        total_us += elapsed_us(start);
+
+        bool expected = brute_any(layer, min_x, min_y, max_x, max_y, METADATA_FLAG_SOLID);
+        agree = agree && expected == !found.empty() && expected == any;
+
+        for(const CellRect& rect: found) {
+            bool overlaps = float(rect.x) < max_x && float(rect.x + rect.width) > min_x &&
+                float(rect.y) < max_y && float(rect.y + rect.height) > min_y;
+            agree = agree && overlaps;
+        }
+    }
+    check(agree, "box queries find flagged cells exactly when a brute force scan does");
+    std::cout << "        query_aabb + any_in_aabb " << (total_us / 5000.0) << " us" << std::endl;
+}
+
+void test_raycast() {
+    std::mt19937 random(SEED);
+    MetadataLayer layer = build_layer(random);
+
+    const float MAX_T = 60.0f;
+    const float STEP = 0.002f;
+
+    bool agree = true;
+    double total_us = 0;
+    for(uint32_t i = 0; i < 1000; ++i) {
+        float origin_x = float(random() % (layer.width() * 100)) / 100.0f - 10.0f;
+        float origin_y = float(random() % (layer.height() * 100)) / 100.0f - 10.0f;
+        float angle = float(random() % 3600) / 3600.0f * 6.2831853f;
+        float direction_x = std::cos(angle);
+        float direction_y = std::sin(angle);
+        if(i % 10 == 0) {
+            //Axis aligned rays take the zero direction paths
+            direction_x = (i % 20 == 0) ? 1.0f : 0.0f;
+            direction_y = (i % 20 == 0) ? 0.0f : -1.0f;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        RayHit hit;
+        bool got = layer.raycast(origin_x, origin_y, direction_x, direction_y, MAX_T, METADATA_FLAG_SOLID, hit);
+        total_us += elapsed_us(start);
+
+        float expected = -1.0f;
+        for(float t = 0; t <= MAX_T; t += STEP) {
+            float x = origin_x + (direction_x * t);
+            float y = origin_y + (direction_y * t);
+            if(x >= 0 && y >= 0 && x < float(layer.width()) && y < float(layer.height()) &&
+               (layer.flags_at(uint32_t(x), uint32_t(y)) & METADATA_FLAG_SOLID)) {
+                expected = t;
+                break;
+            }
+        }
+
+        //Hits right at the end of the ray can fall either side of the march's last step
+        bool near_end = (got && hit.distance > MAX_T - 0.01f) || expected > MAX_T - 0.01f;
+        if(got != (expected >= 0)) {
+            agree = agree && near_end;
+        } else if(got) {
+            agree = agree && std::fabs(hit.distance - expected) < 0.01f && (layer.flags_at(hit.x, hit.y) & METADATA_FLAG_SOLID);
+        }
+    }
+    check(agree, "rays stop at the same cell as a brute force march");
+    std::cout << "        raycast " << (total_us / 1000.0) << " us" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "rectangles_cover_flags", test_rectangles_cover_flags },
+        { "chunk_rects_match_greedy_merge", test_chunk_rects_match_greedy_merge },
+        { "copy_on_write", test_copy_on_write },
+        { "query_aabb", test_query_aabb },
+        { "raycast", test_raycast }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,520 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <algorithm>
+#include <map>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sched.h>
+#include <boost/lexical_cast.hpp>
+
+#include "kazbase/logging/logging.h"
+#include "kazbase/json/json.h"
+#include "kazbase/file_utils.h"
+#include "kazbase/string.h"
+
+#include "level.h"
+#include "layer.h"
+#include "palette.h"
+#include "chooser_cursor.h"
+#include "pixel_ops.h"
+
+/*
+    Microbenchmarks for the core structures that keep coming up in
+    profiles, for catching regressions the end to end timings hide:
+
+        pn-microbench [--filter=TEXT] [--samples=N] [--repetitions=N]
+                      [--cpu=N] [--save=PATH] [--baseline=PATH]
+                      [--threshold=PERCENT]
+
+    Every benchmark builds its data from a fixed seed, runs a few warm up
+    samples and then times each sample of a fixed number of operations.
+    That's repeated a few times and the lowest of the repetitions' medians
+    is reported, along with the 99th percentile time per operation over
+    every sample and the spread between the fastest and slowest median.
+    Noise from the rest of the machine only ever makes a repetition
+    slower, so the lowest median is the most repeatable number to compare.
+    The process is pinned to one CPU (the one it starts on unless --cpu
+    says otherwise) so it isn't migrated between cores mid sample.
+
+    --save writes the results as a baseline, spreads included, and
+    --baseline compares against one, exiting with 1 if any median is more
+    than its allowance slower. A benchmark's allowance is the threshold
+    (default 15%) or the spread it had when the baseline was saved,
+    whichever is larger, so one that was already noisy then doesn't fail
+    on its noise while the steady ones are held to the threshold. The
+    allowance is shown next to each change. Baselines are only meaningful
+    on the machine that made them.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t BENCH_SEED = 48;
+const uint32_t DEFAULT_SAMPLES = 100; //Per repetition
+const uint32_t DEFAULT_REPETITIONS = 5;
+const uint32_t WARMUP_SAMPLES = 10;
+const double DEFAULT_THRESHOLD_PERCENT = 15.0;
+
+//Written to so the compiler can't throw away the reads being timed
+volatile int64_t sink = 0;
+
+struct Benchmark {
+    std::string name;
+    uint32_t operations; //Per sample
+
+    //Builds the data and returns what runs one sample
+    std::function<std::function<void ()> (std::mt19937&)> prepare;
+};
+
+struct BaselineEntry {
+    double median_ns;
+    double spread_percent; //0 in baselines saved before spreads were
+};
+
+struct Result {
+    Result():
+        median_ns(0),
+        p99_ns(0),
+        spread_percent(0) {}
+
+    std::string name;
+    double median_ns; //Per operation, the lowest of the repetitions' medians
+    double p99_ns;
+    double spread_percent; //How much slower the slowest repetition's median was
+};
+
+Layer& filled_layer(Level& level, std::mt19937& random, uint32_t tile_kinds) {
+    Layer& layer = level.layer_at(0);
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < layer.width(); ++x) {
+            //About a third empty, like a typical level
+            int32_t tile = int32_t(random() % (tile_kinds + (tile_kinds / 2))) - int32_t(tile_kinds / 2);
+            layer.set_tile(x, y, std::max(tile, -1));
+        }
+    }
+    layer.flush_render();
+    return layer;
+}
+
+std::vector<uint32_t> random_cells(std::mt19937& random, uint32_t count, uint32_t width, uint32_t height) {
+    std::vector<uint32_t> cells(count);
+    for(uint32_t& cell: cells) {
+        cell = ((random() % height) * width) + (random() % width);
+    }
+    return cells;
+}
+
+const uint32_t LAYER_SIZE = 1024;
+const uint32_t CELL_BATCH = 4096;
+
+//Big enough to swamp the call overhead, small enough to stay in L2 like a tile sheet row band does
+const uint32_t PIXEL_BATCH_WIDTH = 256;
+const uint32_t PIXEL_BATCH_HEIGHT = 128;
+const uint32_t PIXEL_BATCH = PIXEL_BATCH_WIDTH * PIXEL_BATCH_HEIGHT;
+
+//Clear, opaque and translucent pixels in equal parts, the mix that decides which branches the kernels take
+std::vector<uint32_t> random_pixels(std::mt19937& random, uint32_t count) {
+    std::vector<uint32_t> pixels(count);
+    for(uint32_t& pixel: pixels) {
+        uint32_t kind = random() % 4;
+        uint32_t alpha = (kind == 0) ? 0 : (kind == 1) ? 255 : (random() & 0xFF);
+        pixel = (alpha << 24) | (random() & 0xFFFFFF);
+    }
+    return pixels;
+}
+
+/*
+    Every pixel kernel on every path the CPU supports, so a regression on
+    one instruction set can't hide behind the others. Times are per pixel.
+    Bit-exactness between the paths is checked by pixel_ops_test.
+*/
+void add_pixel_benchmarks(std::vector<Benchmark>& all) {
+    typedef std::function<void (const std::vector<uint32_t>&, std::vector<uint32_t>&)> Kernel;
+
+    struct PixelKernel {
+        const char* name;
+        bool premultiplied; //Takes premultiplied pixels, the way the pipeline hands them over
+        Kernel run;
+    };
+
+    const PixelKernel kernels[] = {
+        { "premultiply", false, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            premultiply_row(in.data(), out.data(), PIXEL_BATCH);
+        }},
+        { "unpremultiply", true, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            unpremultiply_row(in.data(), out.data(), PIXEL_BATCH);
+        }},
+        { "rgb_to_rgba", false, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            rgb_to_rgba_row(reinterpret_cast<const uint8_t*>(in.data()), out.data(), PIXEL_BATCH);
+        }},
+        { "swap_red_blue", false, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            swap_red_blue_row(in.data(), out.data(), PIXEL_BATCH);
+        }},
+        { "downsample", true, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            downsample(in.data(), PIXEL_BATCH_WIDTH, PIXEL_BATCH_HEIGHT, out.data());
+        }},
+        { "hash_bytes", false, [](const std::vector<uint32_t>& in, std::vector<uint32_t>& out) {
+            sink += int64_t(hash_bytes(in.data(), in.size() * 4));
+        }}
+    };
+
+    for(int path = PIXEL_PATH_SCALAR; path <= PIXEL_PATH_AVX2; ++path) {
+        if(!pixel_path_supported(PixelPath(path))) {
+            continue;
+        }
+
+        for(const PixelKernel& kernel: kernels) {
+            Kernel run = kernel.run;
+            bool premultiplied = kernel.premultiplied;
+            std::string name = std::string(kernel.name) + "_" + pixel_path_name(PixelPath(path));
+
+            all.push_back(Benchmark{ name, PIXEL_BATCH, [=](std::mt19937& random) -> std::function<void ()> {
+                std::tr1::shared_ptr<std::vector<uint32_t> > in(new std::vector<uint32_t>(random_pixels(random, PIXEL_BATCH)));
+                std::tr1::shared_ptr<std::vector<uint32_t> > out(new std::vector<uint32_t>(PIXEL_BATCH));
+                if(premultiplied) {
+                    premultiply_row(in->data(), in->data(), PIXEL_BATCH);
+                }
+
+                //The path is global, so it's set on every sample in case another benchmark changed it
+                return [=]() {
+                    set_pixel_path(PixelPath(path));
+                    run(*in, *out);
+                    sink += (*out)[0];
+                };
+            }});
+        }
+    }
+}
+
+std::vector<Benchmark> benchmarks() {
+    std::vector<Benchmark> all;
+
+    all.push_back(Benchmark{ "layer_get", CELL_BATCH, [](std::mt19937& random) -> std::function<void ()> {
+        std::tr1::shared_ptr<Level> level(new Level(LAYER_SIZE, LAYER_SIZE));
+        Layer& layer = filled_layer(*level, random, 64);
+        std::vector<uint32_t> cells = random_cells(random, CELL_BATCH, LAYER_SIZE, LAYER_SIZE);
+
+        return [=, &layer]() {
+            int64_t total = 0;
+            for(uint32_t cell: cells) {
+                total += layer.tile_image_at(cell % LAYER_SIZE, cell / LAYER_SIZE);
+            }
+            sink += total;
+            (void) level;
+        };
+    }});
+
+    all.push_back(Benchmark{ "layer_set", CELL_BATCH, [](std::mt19937& random) -> std::function<void ()> {
+        std::tr1::shared_ptr<Level> level(new Level(LAYER_SIZE, LAYER_SIZE));
+        Layer& layer = filled_layer(*level, random, 64);
+        std::vector<uint32_t> cells = random_cells(random, CELL_BATCH, LAYER_SIZE, LAYER_SIZE);
+        std::vector<int32_t> tiles(CELL_BATCH);
+        for(int32_t& tile: tiles) {
+            tile = int32_t(random() % 65) - 1;
+        }
+
+        return [=, &layer]() {
+            for(uint32_t i = 0; i < CELL_BATCH; ++i) {
+                layer.set_tile(cells[i] % LAYER_SIZE, cells[i] / LAYER_SIZE, tiles[i]);
+            }
+            layer.flush_render();
+            (void) level;
+        };
+    }});
+
+    all.push_back(Benchmark{ "chunk_iteration", LAYER_SIZE * LAYER_SIZE, [](std::mt19937& random) -> std::function<void ()> {
+        std::tr1::shared_ptr<Level> level(new Level(LAYER_SIZE, LAYER_SIZE));
+        Layer& layer = filled_layer(*level, random, 64);
+
+        //Per cell, whole chunks at a time the way exporters and validation walk a layer
+        return [=, &layer]() {
+            int64_t total = 0;
+            for(uint32_t cy = 0; cy < layer.chunks_down(); ++cy) {
+                for(uint32_t cx = 0; cx < layer.chunks_across(); ++cx) {
+                    const int32_t* tiles = layer.chunk(cx, cy).cells->tiles;
+                    for(uint32_t i = 0; i < CHUNK_AREA; ++i) {
+                        total += tiles[i];
+                    }
+                }
+            }
+            sink += total;
+            (void) level;
+        };
+    }});
+
+    all.push_back(Benchmark{ "level_add_remove_layer", 16, [](std::mt19937& random) -> std::function<void ()> {
+        std::tr1::shared_ptr<Level> level(new Level(256, 256));
+        for(uint32_t i = 0; i < 7; ++i) {
+            level->add_layer();
+        }
+        filled_layer(*level, random, 64);
+
+        std::vector<uint32_t> removals(16);
+        for(uint32_t& idx: removals) {
+            idx = random() % 8;
+        }
+
+        //Each operation adds a layer and removes one, so the count stays put
+        return [=]() {
+            for(uint32_t idx: removals) {
+                level->add_layer();
+                level->remove_layer(idx);
+            }
+        };
+    }});
+
+    all.push_back(Benchmark{ "chooser_next_previous", 4096, [](std::mt19937& random) -> std::function<void ()> {
+        const uint32_t ENTRIES = 100000;
+
+        std::tr1::shared_ptr<ChooserCursor> cursor(new ChooserCursor());
+        std::tr1::shared_ptr<std::vector<bool> > visible(new std::vector<bool>(ENTRIES, true));
+        cursor->appended(ENTRIES);
+        cursor->set(ENTRIES / 2);
+
+        std::vector<bool> forwards(4096);
+        for(uint32_t i = 0; i < forwards.size(); ++i) {
+            forwards[i] = random() % 2;
+        }
+
+        //The visibility flags stand in for the chooser's meshes
+        return [=]() {
+            std::vector<uint32_t> shown, hidden;
+            for(bool forward: forwards) {
+                if(forward) {
+                    cursor->next();
+                } else {
+                    cursor->previous();
+                }
+
+                cursor->take_changes(shown, hidden);
+                for(uint32_t i: shown) {
+                    (*visible)[i] = true;
+                }
+                for(uint32_t i: hidden) {
+                    (*visible)[i] = false;
+                }
+            }
+        };
+    }});
+
+    all.push_back(Benchmark{ "palette_lookup", CELL_BATCH, [](std::mt19937& random) -> std::function<void ()> {
+        std::tr1::shared_ptr<Palette> palette(new Palette());
+        std::vector<std::string> paths;
+        for(uint32_t set = 0; set < 32; ++set) {
+            for(uint32_t tile = 0; tile < 128; ++tile) {
+                paths.push_back(
+                    "/home/user/tilesets/set_" + boost::lexical_cast<std::string>(set) +
+                    "/tile_" + boost::lexical_cast<std::string>(tile) + ".png"
+                );
+                palette->id_for_path(paths.back());
+            }
+        }
+
+        std::vector<std::string> lookups(CELL_BATCH);
+        for(std::string& path: lookups) {
+            path = paths[random() % paths.size()];
+        }
+
+        return [=]() {
+            int64_t total = 0;
+            for(const std::string& path: lookups) {
+                total += palette->find(path);
+            }
+            sink += total;
+        };
+    }});
+
+    add_pixel_benchmarks(all);
+    return all;
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    uint32_t idx = uint32_t(std::ceil(fraction * sorted.size()));
+    return sorted[std::min<uint32_t>(idx ? idx - 1 : 0, sorted.size() - 1)];
+}
+
+Result run(const Benchmark& benchmark, uint32_t samples, uint32_t repetitions) {
+    std::mt19937 random(BENCH_SEED);
+    std::function<void ()> sample = benchmark.prepare(random);
+
+    for(uint32_t i = 0; i < WARMUP_SAMPLES; ++i) {
+        sample();
+    }
+
+    std::vector<double> medians;
+    std::vector<double> all;
+    for(uint32_t r = 0; r < repetitions; ++r) {
+        std::vector<double> per_operation;
+        for(uint32_t i = 0; i < samples; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            sample();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            per_operation.push_back(ns / benchmark.operations);
+        }
+        std::sort(per_operation.begin(), per_operation.end());
+
+        medians.push_back(percentile(per_operation, 0.5));
+        all.insert(all.end(), per_operation.begin(), per_operation.end());
+    }
+    std::sort(medians.begin(), medians.end());
+    std::sort(all.begin(), all.end());
+
+    Result result;
+    result.name = benchmark.name;
+    result.median_ns = medians.front();
+    result.p99_ns = percentile(all, 0.99);
+    result.spread_percent = (medians.front() > 0) ? ((medians.back() / medians.front()) - 1.0) * 100.0 : 0;
+    return result;
+}
+
+//Keeps the benchmarks on one core, so timings don't pick up migrations and cold caches
+void pin_to_cpu(int32_t cpu) {
+    if(cpu < 0) {
+        cpu = sched_getcpu();
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(cpu < 0 || sched_setaffinity(0, sizeof(set), &set) != 0) {
+        L_WARN("Unable to pin to a CPU, timings will be noisier");
+    }
+}
+
+bool save_results(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path.c_str());
+    if(!out) {
+        L_ERROR("Unable to write the baseline to " + path);
+        return false;
+    }
+
+    out << "{\n    \"benchmarks\": [\n";
+    for(uint32_t i = 0; i < results.size(); ++i) {
+        char line[256];
+        snprintf(line, sizeof(line), "        {\"name\": \"%s\", \"median_ns\": %.3f, \"p99_ns\": %.3f, \"spread_percent\": %.1f}%s\n",
+                 results[i].name.c_str(), results[i].median_ns, results[i].p99_ns, results[i].spread_percent,
+                 (i + 1 < results.size()) ? "," : "");
+        out << line;
+    }
+    out << "    ]\n}\n";
+    return bool(out);
+}
+
+//By benchmark name
+bool load_baseline(const std::string& path, std::map<std::string, BaselineEntry>& entries) {
+    std::string contents = file_utils::read_contents(path);
+    if(str::strip(contents).empty()) {
+        L_ERROR("Empty or missing baseline " + path);
+        return false;
+    }
+
+    json::JSON j = json::loads(contents);
+    if(!j.has_key("benchmarks")) {
+        L_ERROR("No benchmarks in baseline " + path);
+        return false;
+    }
+
+    for(uint32_t i = 0; i < j["benchmarks"].length(); ++i) {
+        json::Node& node = j["benchmarks"][i];
+        BaselineEntry& entry = entries[node["name"].get()];
+        entry.median_ns = atof(node["median_ns"].get().c_str());
+        entry.spread_percent = node.has_key("spread_percent") ? atof(node["spread_percent"].get().c_str()) : 0;
+    }
+    return true;
+}
+
+void print_usage() {
+    std::cerr << "Usage: pn-microbench [--filter=TEXT] [--samples=N] [--repetitions=N] [--cpu=N] [--save=PATH] [--baseline=PATH] [--threshold=PERCENT]" << std::endl;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    logging::get_logger("/")->add_handler(logging::Handler::ptr(new logging::StdIOHandler()));
+    logging::get_logger("/")->set_level(logging::LOG_LEVEL_WARN);
+
+    std::string filter;
+    std::string save_path;
+    std::string baseline_path;
+    uint32_t samples = DEFAULT_SAMPLES;
+    uint32_t repetitions = DEFAULT_REPETITIONS;
+    int32_t cpu = -1;
+    double threshold = DEFAULT_THRESHOLD_PERCENT;
+
+    try {
+        for(int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if(str::starts_with(arg, "--filter=")) {
+                filter = arg.substr(9);
+            } else if(str::starts_with(arg, "--samples=")) {
+                samples = std::max<uint32_t>(1, boost::lexical_cast<uint32_t>(arg.substr(10)));
+            } else if(str::starts_with(arg, "--repetitions=")) {
+                repetitions = std::max<uint32_t>(1, boost::lexical_cast<uint32_t>(arg.substr(14)));
+            } else if(str::starts_with(arg, "--cpu=")) {
+                cpu = boost::lexical_cast<int32_t>(arg.substr(6));
+            } else if(str::starts_with(arg, "--save=")) {
+                save_path = arg.substr(7);
+            } else if(str::starts_with(arg, "--baseline=")) {
+                baseline_path = arg.substr(11);
+            } else if(str::starts_with(arg, "--threshold=")) {
+                threshold = boost::lexical_cast<double>(arg.substr(12));
+            } else {
+                print_usage();
+                return 2;
+            }
+        }
+    } catch(boost::bad_lexical_cast& e) {
+        print_usage();
+        return 2;
+    }
+
+    std::map<std::string, BaselineEntry> baseline;
+    if(!baseline_path.empty() && !load_baseline(baseline_path, baseline)) {
+        return 2;
+    }
+
+    pin_to_cpu(cpu);
+
+    std::vector<Result> results;
+    uint32_t regressions = 0;
+
+    std::cout << "benchmark                  median ns    p99 ns   spread   baseline    change   allowed" << std::endl;
+    for(const Benchmark& benchmark: benchmarks()) {
+        if(!filter.empty() && std::string(benchmark.name).find(filter) == std::string::npos) {
+            continue;
+        }
+
+        Result result = run(benchmark, samples, repetitions);
+        results.push_back(result);
+
+        char line[256];
+        snprintf(line, sizeof(line), "%-24s %11.3f %9.3f %7.1f%%", result.name.c_str(), result.median_ns, result.p99_ns, result.spread_percent);
+        std::cout << line;
+
+        std::map<std::string, BaselineEntry>::iterator it = baseline.find(result.name);
+        if(it != baseline.end() && it->second.median_ns > 0) {
+            double change = ((result.median_ns / it->second.median_ns) - 1.0) * 100.0;
+            double allowed = std::max(threshold, it->second.spread_percent);
+            bool regressed = change > allowed;
+            regressions += regressed;
+
+            snprintf(line, sizeof(line), " %10.3f %+8.1f%% %8.1f%%%s", it->second.median_ns, change, allowed, regressed ? "  REGRESSION" : "");
+            std::cout << line;
+        }
+        std::cout << std::endl;
+    }
+
+    if(!save_path.empty() && !save_results(save_path, results)) {
+        return 2;
+    }
+
+    if(!baseline_path.empty()) {
+        std::cout << regressions << " of " << results.size() << " benchmarks regressed by more than they're allowed" << std::endl;
+    }
+    return regressions ? 1 : 0;
+}
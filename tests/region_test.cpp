@@ -0,0 +1,290 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+#include "region.h"
+
+/*
+    Behaviour checks for copying, cutting and pasting regions, run by
+    ctest. Regions share their blocks copy on write with the layers they
+    came from and went to, so besides checking cells against the level
+    they were copied from, these make sure an edit on one side never shows
+    up on the other.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 37;
+const uint32_t TILE_KINDS = 4;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::string tile_path(uint32_t kind) {
+    return "tiles/" + std::to_string(kind) + ".png";
+}
+
+//Compared by path, so levels with different palettes can be compared
+std::string path_at(Level& level, uint32_t layer, uint32_t x, uint32_t y) {
+    int32_t id = level.layer_at(layer).tile_image_at(x, y);
+    return (id < 0) ? std::string() : level.palette().path_for_id(id);
+}
+
+//Two layers of scattered tiles and flags, reverse_palette registers the tiles the other way round
+Level::ptr build_level(std::mt19937& random, uint32_t width, uint32_t height, bool reverse_palette=false) {
+    Level::ptr level(new Level(width, height));
+    level->add_layer();
+
+    for(uint32_t i = 0; i < TILE_KINDS; ++i) {
+        level->palette().id_for_path(tile_path(reverse_palette ? TILE_KINDS - 1 - i : i));
+    }
+
+    for(uint32_t l = 0; l < level->layer_count(); ++l) {
+        for(uint32_t y = 0; y < height; ++y) {
+            for(uint32_t x = 0; x < width; ++x) {
+                int32_t tile = (random() % 3) ? level->palette().id_for_path(tile_path(random() % TILE_KINDS)) : -1;
+                level->layer_at(l).set_tile(x, y, tile);
+            }
+        }
+    }
+
+    for(uint32_t y = 0; y < height; ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            level->metadata().set_flags(x, y, (random() % 4) ? 0 : MetadataFlags(random() % 256));
+        }
+    }
+    level->flush_render();
+    return level;
+}
+
+//A copy of every cell, for checking what a paste should have done
+struct Cells {
+    uint32_t width;
+    uint32_t height;
+    std::vector<std::string> paths[2];
+    std::vector<MetadataFlags> flags;
+};
+
+Cells cells_of(Level& level, const CellRect& area) {
+    Cells cells = { area.width, area.height };
+    for(uint32_t y = area.y; y < area.y + area.height; ++y) {
+        for(uint32_t x = area.x; x < area.x + area.width; ++x) {
+            for(uint32_t l = 0; l < 2; ++l) {
+                cells.paths[l].push_back(path_at(level, l, x, y));
+            }
+            cells.flags.push_back(level.metadata().flags_at(x, y));
+        }
+    }
+    return cells;
+}
+
+CellRect whole(Level& level) {
+    return CellRect(0, 0, level.horizontal_tile_count(), level.vertical_tile_count());
+}
+
+//Checks dest against before with source pasted over it at (px, py)
+bool pasted_correctly(Level& dest, const Cells& before, const Cells& source, int32_t px, int32_t py, PasteMode mode) {
+    for(uint32_t y = 0; y < before.height; ++y) {
+        for(uint32_t x = 0; x < before.width; ++x) {
+            int32_t sx = int32_t(x) - px;
+            int32_t sy = int32_t(y) - py;
+            bool inside = sx >= 0 && sy >= 0 && sx < int32_t(source.width) && sy < int32_t(source.height);
+            uint32_t from = inside ? (sy * source.width) + sx : 0;
+
+            for(uint32_t l = 0; l < 2; ++l) {
+                std::string expected = before.paths[l][(y * before.width) + x];
+                if(inside && !(mode == PASTE_OVERLAY && source.paths[l][from].empty())) {
+                    expected = source.paths[l][from];
+                }
+                if(path_at(dest, l, x, y) != expected) {
+                    return false;
+                }
+            }
+
+            MetadataFlags expected = before.flags[(y * before.width) + x];
+            if(inside && !(mode == PASTE_OVERLAY && !source.flags[from])) {
+                expected = source.flags[from];
+            }
+            if(dest.metadata().flags_at(x, y) != expected) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void test_copy_paste() {
+    std::mt19937 random(SEED);
+
+    bool copies_match = true;
+    bool pastes_match = true;
+    for(uint32_t trial = 0; trial < 100; ++trial) {
+        Level::ptr source = build_level(random, 20 + random() % 60, 20 + random() % 60);
+        Level::ptr dest = build_level(random, 20 + random() % 60, 20 + random() % 60, true);
+
+        CellRect area(random() % 30, random() % 30, 1 + random() % 50, 1 + random() % 50);
+        Region::ptr region = Region::copy(*source, area, 0, 2);
+        if(!region) {
+            continue;
+        }
+
+        CellRect clipped(area.x, area.y, region->width(), region->height());
+        Cells copied = cells_of(*source, clipped);
+        for(uint32_t y = 0; y < region->height(); ++y) {
+            for(uint32_t x = 0; x < region->width(); ++x) {
+                for(uint32_t l = 0; l < 2; ++l) {
+                    copies_match = copies_match && region->tile_at(l, x, y) == source->layer_at(l).tile_image_at(clipped.x + x, clipped.y + y);
+                }
+                copies_match = copies_match && region->flags_at(x, y) == source->metadata().flags_at(clipped.x + x, clipped.y + y);
+            }
+        }
+
+        Cells before = cells_of(*dest, whole(*dest));
+        int32_t px = int32_t(random() % 40) - 10;
+        int32_t py = int32_t(random() % 40) - 10;
+        PasteMode mode = (trial % 2) ? PASTE_OVERLAY : PASTE_REPLACE;
+        region->paste(*dest, px, py, 0, mode);
+        pastes_match = pastes_match && pasted_correctly(*dest, before, copied, px, py, mode);
+    }
+
+    check(copies_match, "regions hold the cells they were copied from");
+    check(pastes_match, "pastes land in the right place, through the destination's palette, clipped to the level");
+}
+
+//Checks the region still holds the cells it was copied with, ids going through the palette it was copied from
+bool region_holds(const Region& region, Level& source, const Cells& copied) {
+    for(uint32_t y = 0; y < copied.height; ++y) {
+        for(uint32_t x = 0; x < copied.width; ++x) {
+            for(uint32_t l = 0; l < 2; ++l) {
+                int32_t id = region.tile_at(l, x, y);
+                std::string path = (id < 0) ? std::string() : source.palette().path_for_id(id);
+                if(path != copied.paths[l][(y * copied.width) + x]) {
+                    return false;
+                }
+            }
+            if(region.flags_at(x, y) != copied.flags[(y * copied.width) + x]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void test_copy_on_write() {
+    std::mt19937 random(SEED);
+    Level::ptr source = build_level(random, 64, 48);
+
+    //Starts on a chunk boundary, so the region's blocks are the source's chunks
+    CellRect area(CHUNK_SIZE, 0, CHUNK_SIZE * 2, CHUNK_SIZE * 2);
+    Region::ptr region = Region::copy(*source, area, 0, 2);
+    Cells copied = cells_of(*source, area);
+    const ChunkCells* copied_cells = source->layer_at(0).chunk(1, 0).cells.get();
+
+    source->layer_at(0).fill(area, -1);
+    source->metadata().fill(area, MetadataFlags(~0), false);
+    source->flush_render();
+    check(source->layer_at(0).chunk(1, 0).cells.get() != copied_cells, "editing a copied chunk gives the layer its own cells");
+    check(region_holds(*region, *source, copied), "edits to the source after copying don't reach the region");
+
+    //The same palette, so the paste can share the region's blocks rather than remap them
+    Level::ptr same_palette = build_level(random, 64, 48);
+    Cells before = cells_of(*same_palette, whole(*same_palette));
+    region->paste(*same_palette, CHUNK_SIZE, 0, 0);
+    check(pasted_correctly(*same_palette, before, copied, CHUNK_SIZE, 0, PASTE_REPLACE), "an aligned paste writes every cell");
+    check(same_palette->layer_at(0).chunk(1, 0).cells.get() == copied_cells, "an aligned paste shares the region's blocks");
+
+    same_palette->layer_at(0).set_tile(CHUNK_SIZE, 0, 0);
+    same_palette->metadata().set_flags(CHUNK_SIZE, 0, METADATA_FLAG_WATER);
+    same_palette->flush_render();
+    check(same_palette->layer_at(0).chunk(1, 0).cells.get() != copied_cells, "editing a pasted chunk gives the layer its own cells");
+    check(region_holds(*region, *source, copied), "edits where a region was pasted don't reach the region");
+
+    //Another palette order, so the ids have to be remapped and nothing can be shared
+    Level::ptr other_palette = build_level(random, 64, 48, true);
+    before = cells_of(*other_palette, whole(*other_palette));
+    region->paste(*other_palette, CHUNK_SIZE, 0, 0);
+    check(pasted_correctly(*other_palette, before, copied, CHUNK_SIZE, 0, PASTE_REPLACE), "a paste through another palette writes every cell");
+    check(other_palette->layer_at(0).chunk(1, 0).cells.get() != copied_cells, "a paste through another palette doesn't share the region's blocks");
+
+    //And a second paste from the same region still has the original cells
+    Level::ptr again = build_level(random, 64, 48);
+    before = cells_of(*again, whole(*again));
+    region->paste(*again, 5, 3, 0);
+    check(pasted_correctly(*again, before, copied, 5, 3, PASTE_REPLACE), "a region can be pasted again after its pastes were edited");
+}
+
+void test_cut() {
+    std::mt19937 random(SEED);
+    Level::ptr level = build_level(random, 50, 40);
+
+    CellRect area(7, 5, 20, 30);
+    Cells before = cells_of(*level, area);
+    Region::ptr region = Region::cut(*level, area, 0, 2);
+
+    bool cleared = true;
+    for(uint32_t y = area.y; y < area.y + area.height; ++y) {
+        for(uint32_t x = area.x; x < area.x + area.width; ++x) {
+            cleared = cleared && level->layer_at(0).tile_image_at(x, y) == -1 && level->layer_at(1).tile_image_at(x, y) == -1;
+            cleared = cleared && level->metadata().flags_at(x, y) == 0;
+        }
+    }
+    check(cleared, "cutting empties the area");
+
+    Cells all = cells_of(*level, whole(*level));
+    region->paste(*level, area.x, area.y, 0);
+    check(pasted_correctly(*level, all, before, area.x, area.y, PASTE_REPLACE), "pasting a cut region back restores the area");
+}
+
+void test_level_round_trip() {
+    std::mt19937 random(SEED);
+    Level::ptr level = build_level(random, 50, 40);
+
+    CellRect area(3, 9, 25, 17);
+    Region::ptr region = Region::copy(*level, area, 0, 2);
+    Level::ptr stamp = region->to_level();
+    Region::ptr back = Region::from_level(*stamp);
+
+    bool same = back->width() == region->width() && back->height() == region->height();
+    for(uint32_t y = 0; same && y < area.height; ++y) {
+        for(uint32_t x = 0; x < area.width; ++x) {
+            for(uint32_t l = 0; l < 2; ++l) {
+                int32_t id = back->tile_at(l, x, y);
+                std::string path = (id < 0) ? std::string() : stamp->palette().path_for_id(id);
+                same = same && path == path_at(*level, l, area.x + x, area.y + y);
+            }
+            same = same && back->flags_at(x, y) == region->flags_at(x, y);
+        }
+    }
+    check(same, "a region saved as a stamp level comes back the same");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "copy_paste", test_copy_paste },
+        { "copy_on_write", test_copy_on_write },
+        { "cut", test_cut },
+        { "level_round_trip", test_level_round_trip }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
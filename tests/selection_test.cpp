@@ -0,0 +1,258 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <functional>
+
+#include "level.h"
+#include "layer.h"
+#include "selection.h"
+
+/*
+    Behaviour checks for selections and the bulk edits made through them,
+    run by ctest. Every answer is compared with a brute force walk over the
+    layer's cells. The layers are grown on the left and bottom first, so
+    the chunk grid has an origin and the chunks at its edges are partial.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 47;
+const uint32_t WIDTH = 37;
+const uint32_t HEIGHT = 29;
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+//Tiles 0 to 2 and empty cells, scattered
+Layer& build_layer(Level& level, std::mt19937& random) {
+    Layer& layer = level.layer_at(0);
+    layer.extend(3, 5, 0, 0);
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < layer.width(); ++x) {
+            layer.set_tile(x, y, int32_t(random() % 4) - 1);
+        }
+    }
+    layer.flush_render();
+    return layer;
+}
+
+std::vector<int32_t> tiles_of(const Layer& layer) {
+    std::vector<int32_t> tiles;
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < layer.width(); ++x) {
+            tiles.push_back(layer.tile_image_at(x, y));
+        }
+    }
+    return tiles;
+}
+
+//True if the selection holds exactly the cells for which selected(x, y) is true
+bool selects(const Selection& selection, std::function<bool (uint32_t, uint32_t)> selected) {
+    uint64_t count = 0;
+    for(uint32_t y = 0; y < selection.height(); ++y) {
+        for(uint32_t x = 0; x < selection.width(); ++x) {
+            bool expected = selected(x, y);
+            if(selection.contains(x, y) != expected) {
+                return false;
+            }
+            count += expected;
+        }
+    }
+    return selection.count() == count && selection.empty() == (count == 0);
+}
+
+bool in_rect(const CellRect& rect, uint32_t x, uint32_t y) {
+    return x >= rect.x && y >= rect.y && x < rect.x + rect.width && y < rect.y + rect.height;
+}
+
+void test_add_tile() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = build_layer(level, random);
+
+    for(int32_t tile = -1; tile < 3; ++tile) {
+        Selection selection(layer);
+        selection.add_tile(layer, tile);
+        check(selects(selection, [&](uint32_t x, uint32_t y) { return layer.tile_image_at(x, y) == tile; }),
+              "selecting tile " + std::to_string(tile) + " picks exactly the cells holding it");
+    }
+}
+
+void test_combine() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = build_layer(level, random);
+
+    CellRect first(2, 3, 20, 10);
+    CellRect second(10, 5, 100, 100); //Runs off the layer, which clips it
+
+    Selection a(layer);
+    Selection b(layer);
+    a.add_rect(first);
+    b.add_rect(second);
+    check(selects(a, [&](uint32_t x, uint32_t y) { return in_rect(first, x, y); }), "a rectangle selects the cells inside it");
+    check(selects(b, [&](uint32_t x, uint32_t y) { return in_rect(second, x, y); }), "a rectangle off the edge is clipped to the layer");
+
+    Selection united(a), intersected(a), subtracted(a), inverted(a);
+    united.unite(b);
+    intersected.intersect(b);
+    subtracted.subtract(b);
+    inverted.invert();
+    check(selects(united, [&](uint32_t x, uint32_t y) { return in_rect(first, x, y) || in_rect(second, x, y); }), "union");
+    check(selects(intersected, [&](uint32_t x, uint32_t y) { return in_rect(first, x, y) && in_rect(second, x, y); }), "intersection");
+    check(selects(subtracted, [&](uint32_t x, uint32_t y) { return in_rect(first, x, y) && !in_rect(second, x, y); }), "subtraction");
+    check(selects(inverted, [&](uint32_t x, uint32_t y) { return !in_rect(first, x, y); }), "inverting never selects cells outside the layer");
+
+    Selection combined(a);
+    combined.combine(b, SELECTION_INTERSECT);
+    check(selects(combined, [&](uint32_t x, uint32_t y) { return in_rect(first, x, y) && in_rect(second, x, y); }), "combine intersects");
+    combined.combine(b, SELECTION_REPLACE);
+    check(selects(combined, [&](uint32_t x, uint32_t y) { return in_rect(second, x, y); }), "combine replaces");
+
+    Selection removed(b);
+    removed.remove_rect(first);
+    check(selects(removed, [&](uint32_t x, uint32_t y) { return in_rect(second, x, y) && !in_rect(first, x, y); }), "removing a rectangle");
+
+    CellRect bounds;
+    check(a.bounds(bounds) && bounds.x == first.x && bounds.y == first.y && bounds.width == first.width && bounds.height == first.height,
+          "the bounds of a rectangle are the rectangle");
+    a.clear();
+    check(!a.bounds(bounds) && a.empty(), "a cleared selection has no bounds");
+
+    uint64_t visited = 0;
+    bool all_selected = true;
+    united.for_each([&](uint32_t x, uint32_t y) {
+        all_selected = all_selected && united.contains(x, y);
+        ++visited;
+    });
+    check(all_selected && visited == united.count(), "for_each visits each selected cell once");
+}
+
+void test_lasso() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = build_layer(level, random);
+
+    Selection triangle(layer);
+    std::vector<SelectionPoint> outline = { SelectionPoint(0, 0), SelectionPoint(20, 0), SelectionPoint(0, 20) };
+    triangle.add_lasso(outline);
+    check(selects(triangle, [](uint32_t x, uint32_t y) { return (x + 0.5) + (y + 0.5) < 20; }), "a lasso selects the cells whose centres are inside it");
+
+    //A square drawn round twice, the even-odd rule leaves nothing inside
+    Selection twice(layer);
+    std::vector<SelectionPoint> looped = {
+        SelectionPoint(2, 2), SelectionPoint(8, 2), SelectionPoint(8, 8), SelectionPoint(2, 8),
+        SelectionPoint(2, 2), SelectionPoint(8, 2), SelectionPoint(8, 8), SelectionPoint(2, 8)
+    };
+    twice.add_lasso(looped);
+    check(twice.empty(), "a lasso goes by the even-odd rule");
+}
+
+void test_bulk_edits() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = build_layer(level, random);
+
+    level.add_layer();
+    Layer& other = level.layer_at(1);
+    other.extend(3, 5, 0, 0);
+
+    CellRect area(4, 2, 15, 12);
+    Selection selection(layer);
+    selection.add_rect(area);
+    selection.add_tile(layer, 2);
+
+    std::vector<int32_t> before = tiles_of(layer);
+    uint32_t width = layer.width();
+
+    Selection::copy_tiles(selection, layer, other);
+    bool copied = true;
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            copied = copied && other.tile_image_at(x, y) == (selection.contains(x, y) ? before[(y * width) + x] : -1);
+        }
+    }
+    check(copied, "copying tiles copies the selected cells and nothing else");
+
+    int32_t dx = 3;
+    int32_t dy = -2;
+    Selection::ptr moved = Selection::move_tiles(selection, layer, dx, dy);
+    bool moved_tiles = true;
+    bool moved_selection = true;
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            int32_t from_x = int32_t(x) - dx;
+            int32_t from_y = int32_t(y) - dy;
+            bool arrived = from_x >= 0 && from_y >= 0 && from_x < int32_t(width) && from_y < int32_t(layer.height()) && selection.contains(from_x, from_y);
+
+            int32_t expected = selection.contains(x, y) ? -1 : before[(y * width) + x];
+            if(arrived) {
+                expected = before[(from_y * width) + from_x];
+            }
+            moved_tiles = moved_tiles && layer.tile_image_at(x, y) == expected;
+            moved_selection = moved_selection && moved->contains(x, y) == arrived;
+        }
+    }
+    check(moved_tiles, "moving tiles empties where they were and overwrites where they land");
+    check(moved_selection, "the selection moves with the tiles, clipped to the layer");
+
+    layer.fill(*moved, 1);
+    bool filled = true;
+    std::vector<int32_t> after_move = tiles_of(layer);
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            filled = filled && (!moved->contains(x, y) || layer.tile_image_at(x, y) == 1);
+        }
+    }
+    check(filled, "filling a selection sets every selected cell");
+
+    layer.fill(*moved, -1);
+    bool erased = true;
+    for(uint32_t y = 0; y < layer.height(); ++y) {
+        for(uint32_t x = 0; x < width; ++x) {
+            erased = erased && layer.tile_image_at(x, y) == (moved->contains(x, y) ? -1 : after_move[(y * width) + x]);
+        }
+    }
+    check(erased, "filling a selection with -1 erases only the selected cells");
+}
+
+void test_fits() {
+    std::mt19937 random(SEED);
+    Level level(WIDTH, HEIGHT);
+    Layer& layer = build_layer(level, random);
+
+    Selection selection(layer);
+    check(selection.fits(layer), "a selection fits the layer it was made for");
+
+    layer.extend(1, 0, 0, 0);
+    check(!selection.fits(layer), "a selection no longer fits once its layer is resized");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "add_tile", test_add_tile },
+        { "combine", test_combine },
+        { "lasso", test_lasso },
+        { "bulk_edits", test_bulk_edits },
+        { "fits", test_fits }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        test.second();
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}
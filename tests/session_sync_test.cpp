@@ -0,0 +1,175 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <unistd.h>
+
+#include "level.h"
+#include "layer.h"
+#include "session_sync.h"
+
+/*
+    Behaviour checks for live sessions, run by ctest. A session is hosted
+    and joined from a second level in the same process over a local
+    socket, then both sides scribble over the same cells while each makes
+    a fill across most of the level. Every frame updates the host then the
+    joiner, like two editors drawing a frame each. Once everything has
+    arrived the two levels have to match cell for cell.
+*/
+
+using namespace pn;
+
+namespace {
+
+const uint32_t SEED = 49;
+const uint32_t WIDTH = 512;
+const uint32_t HEIGHT = 512;
+const uint32_t TILES = 64;
+const uint32_t EDIT_FRAMES = 60;
+const uint32_t EDITS_PER_FRAME = 200;
+const uint32_t FILL_FRAME = 30;
+const uint32_t MAX_FRAMES = 1000; //Anything slower than this has stalled
+
+uint32_t failures = 0;
+
+void check(bool condition, const std::string& what) {
+    if(!condition) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+std::string path_of(Level& level, int32_t tile) {
+    return (tile < 0) ? std::string() : level.palette().path_for_id(tile);
+}
+
+//Compared by path, each side registers tiles in the order it first sees them
+uint32_t differences(Level& a, Level& b) {
+    uint32_t count = 0;
+    for(uint32_t y = 0; y < HEIGHT; ++y) {
+        for(uint32_t x = 0; x < WIDTH; ++x) {
+            count += path_of(a, a.layer_at(0).tile_image_at(x, y)) != path_of(b, b.layer_at(0).tile_image_at(x, y));
+        }
+    }
+    return count;
+}
+
+struct TwoEditors {
+    TwoEditors(const std::string& socket_path):
+        random(SEED),
+        host_level(WIDTH, HEIGHT),
+        joiner_level(WIDTH, HEIGHT),
+        frame(0) {
+
+        for(uint32_t i = 0; i < WIDTH * HEIGHT / 8; ++i) {
+            host_level.layer_at(0).set_tile(random() % WIDTH, random() % HEIGHT, random_tile(host_level));
+        }
+
+        host = SessionSync::open(host_level, socket_path);
+        joiner = SessionSync::open(joiner_level, socket_path);
+    }
+
+    int32_t random_tile(Level& level) {
+        uint32_t tile = random() % (TILES + 1);
+        return tile ? level.palette().id_for_path("tiles/" + std::to_string(tile) + ".png") : -1;
+    }
+
+    void run_frame() {
+        host->update();
+        joiner->update();
+        frame++;
+        if(!joiner->error().empty()) {
+            throw SessionError(joiner->error());
+        }
+    }
+
+    //Runs frames until both sides have nothing left to send, returns how many it took
+    uint32_t settle() {
+        uint32_t start = frame;
+        do {
+            run_frame();
+        } while((!joiner->connected() || !host->idle() || !joiner->idle()) && frame - start < MAX_FRAMES);
+        run_frame(); //Anything the last frame applied is on its way back out
+        return frame - start;
+    }
+
+    std::mt19937 random;
+    Level host_level;
+    Level joiner_level;
+    SessionSync::ptr host;
+    SessionSync::ptr joiner;
+    uint32_t frame;
+};
+
+std::string socket_path() {
+    return "/tmp/platformation-session-test-" + std::to_string(getpid()) + ".sock";
+}
+
+void test_join() {
+    TwoEditors editors(socket_path());
+    check(editors.host->hosting() && !editors.joiner->hosting(), "the first session hosts and the second joins");
+
+    check(editors.settle() < MAX_FRAMES, "joining finishes");
+    check(editors.joiner->connected(), "the joiner is connected");
+    check(differences(editors.host_level, editors.joiner_level) == 0, "the joiner gets the host's level");
+}
+
+void test_concurrent_edits() {
+    TwoEditors editors(socket_path());
+    Level& host = editors.host_level;
+    Level& joiner = editors.joiner_level;
+    editors.settle();
+
+    bool fill_arrived = false;
+    for(uint32_t f = 0; f < EDIT_FRAMES; ++f) {
+        for(uint32_t i = 0; i < EDITS_PER_FRAME; ++i) {
+            //The same corner on both sides, so plenty of cells are fought over
+            host.layer_at(0).set_tile(editors.random() % 64, editors.random() % 64, editors.random_tile(host));
+            joiner.layer_at(0).set_tile(editors.random() % 64, editors.random() % 64, editors.random_tile(joiner));
+        }
+
+        if(f != FILL_FRAME) {
+            editors.run_frame();
+            continue;
+        }
+
+        int32_t host_tile = editors.random_tile(host);
+        int32_t joiner_tile = editors.random_tile(joiner);
+        host.layer_at(0).fill(CellRect(8, 8, WIDTH - 16, HEIGHT / 2), host_tile);
+        joiner.layer_at(0).fill(CellRect(8, HEIGHT / 4, WIDTH - 16, HEIGHT / 2), joiner_tile);
+
+        //The middle of the host's fill, which the joiner's doesn't cover
+        std::string expected = path_of(host, host_tile);
+        for(uint32_t waited = 0; waited < MAX_FRAMES && !fill_arrived; ++waited) {
+            editors.run_frame();
+            fill_arrived = path_of(joiner, joiner.layer_at(0).tile_image_at(WIDTH / 2, 16)) == expected;
+        }
+    }
+    check(fill_arrived, "the host's fill reaches the joiner");
+
+    check(editors.settle() < MAX_FRAMES, "both sides settle once editing stops");
+    check(differences(host, joiner) == 0, "both sides end up with the same level");
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::pair<const char*, std::function<void ()> > > tests = {
+        { "join", test_join },
+        { "concurrent_edits", test_concurrent_edits }
+    };
+
+    for(auto& test: tests) {
+        uint32_t before = failures;
+        try {
+            test.second();
+        } catch(SessionError& e) {
+            check(false, std::string("session error: ") + e.what());
+        }
+        std::cout << ((failures == before) ? "ok      " : "FAILED  ") << test.first << std::endl;
+    }
+
+    return failures ? 1 : 0;
+}